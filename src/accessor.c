@@ -0,0 +1,265 @@
+/*
+ * Copyright (C) 2004-2005 Josh Triplett
+ *
+ * This package is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ *
+ * This package is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ */
+
+/*
+ * An accessor is a field path resolved once against the definitions.  If
+ * nothing before the value depends on the data, its offset is worked out
+ * when the accessor is made, and getting the value reads it straight from
+ * the packet.  Otherwise the accessor keeps the index of each field or
+ * element along the path, and steps a cursor through them.  A request sent
+ * as a big request has its fields after the header 4 bytes, and one field,
+ * further on.
+ */
+
+#include <stdlib.h>
+
+#include "utils.h"
+#include "xamine-private.h"
+
+/* The header a big request inserts its length after: the opcodes, or the
+ * major opcode and a field, and the 16-bit length. */
+#define BIG_REQUEST_HEADER 4
+#define BIG_REQUEST_FIELDS 3
+
+struct xamine_accessor {
+    struct xamine_context *ctx;
+    const struct xamine_definition *definition; /* Of the packet */
+    const struct xamine_definition *big;        /* Of it as a big request */
+    const struct xamine_definition *value;      /* Base type of the value */
+    bool is_static;
+    size_t offset;              /* Of the value, if is_static */
+    size_t nsteps;
+    size_t steps[];             /* Indices of fields and list elements */
+};
+
+/* Follow typedefs.  Returns NULL for corrupt chains. */
+static const struct xamine_definition *
+accessor_resolve(const struct xamine_definition *definition)
+{
+    for (int i = 0; definition && definition->type == XAMINE_TYPEDEF; i++) {
+        if (i == 64)
+            return NULL;
+        definition = definition->u.ref;
+    }
+    return definition;
+}
+
+/* Get the size of a field, if it does not depend on the data. */
+static bool
+accessor_field_size(const struct xamine_field_definition *field, size_t *size)
+{
+    if (!xamine_static_size(field->definition, size))
+        return false;
+    if (field->length) {
+        if (field->length->type != XAMINE_VALUE)
+            return false;
+        *size *= field->length->u.value;
+    }
+    return true;
+}
+
+/*
+ * Split a path component into a field name and an optional element index,
+ * as in "keys" or "keys[3]".  Returns false if it is malformed.
+ */
+static bool
+accessor_parse_component(char *component, bool *has_index, size_t *index)
+{
+    char *bracket = strchr(component, '['), *end;
+
+    *has_index = false;
+    if (!bracket)
+        return *component != '\0';
+    if (bracket == component || bracket[1] < '0' || bracket[1] > '9')
+        return false;
+    *index = strtoul(bracket + 1, &end, 10);
+    if (end[0] != ']' || end[1] != '\0')
+        return false;
+    *bracket = '\0';
+    *has_index = true;
+    return true;
+}
+
+static const struct xamine_definition *
+accessor_find_packet(const struct xamine_definition *definitions, const char *name)
+{
+    for (const struct xamine_definition *def = definitions; def; def = def->next) {
+        const struct xamine_definition *resolved;
+
+        if (!def->name || !streq(def->name, name))
+            continue;
+        resolved = accessor_resolve(def);
+        if (resolved && resolved->type == XAMINE_STRUCT)
+            return def;
+    }
+    return NULL;
+}
+
+const struct xamine_definition *
+xamine_find_packet(struct xamine_context *ctx, const char *name)
+{
+    const struct xamine_definition *def;
+
+    def = accessor_find_packet(xamine_context_definitions(ctx), name);
+    if (!def && xamine_load_packet_extensions(ctx, name))
+        def = accessor_find_packet(xamine_context_definitions(ctx), name);
+    return def;
+}
+
+XAMINE_EXPORT struct xamine_accessor *
+xamine_accessor_new(struct xamine_context *ctx, const char *path)
+{
+    struct xamine_accessor *accessor = NULL;
+    const struct xamine_definition *current;
+    char *copy, *component, *dot;
+    size_t ncomponents = 1;
+
+    copy = strdup(path);
+    if (!copy)
+        return NULL;
+    for (const char *p = path; *p; p++)
+        if (*p == '.')
+            ncomponents++;
+    if (ncomponents < 2)
+        goto out;
+
+    /* Each component is a field and maybe a list element. */
+    accessor = calloc(1, sizeof(*accessor) + 2 * (ncomponents - 1) * sizeof(size_t));
+    if (!accessor)
+        goto out;
+    dot = strchr(copy, '.');
+    *dot = '\0';
+    accessor->definition = xamine_find_packet(ctx, copy);
+    if (!accessor->definition)
+        goto fail;
+    accessor->big = xamine_big_request(ctx, accessor->definition);
+    accessor->is_static = true;
+
+    current = accessor_resolve(accessor->definition);
+    for (component = dot + 1; component; component = dot ? dot + 1 : NULL) {
+        const struct xamine_field_definition *field;
+        size_t field_index = 0, element_index = 0, size;
+        bool has_index;
+
+        dot = strchr(component, '.');
+        if (dot)
+            *dot = '\0';
+        if (!accessor_parse_component(component, &has_index, &element_index) ||
+            !current || (current->type != XAMINE_STRUCT && current->type != XAMINE_UNION))
+            goto fail;
+
+        for (field = current->u.fields; field; field = field->next, field_index++) {
+            if (field->name && streq(field->name, component))
+                break;
+            if (current->type == XAMINE_STRUCT) {
+                if (accessor->is_static && accessor_field_size(field, &size))
+                    accessor->offset += size;
+                else
+                    accessor->is_static = false;
+            }
+        }
+        if (!field || has_index != (field->length != NULL))
+            goto fail;
+        accessor->steps[accessor->nsteps++] = field_index;
+
+        if (has_index) {
+            /* The element is only known to be there if the length is. */
+            if (accessor->is_static && field->length->type == XAMINE_VALUE &&
+                element_index < field->length->u.value &&
+                xamine_static_size(field->definition, &size))
+                accessor->offset += element_index * size;
+            else
+                accessor->is_static = false;
+            accessor->steps[accessor->nsteps++] = element_index;
+        }
+
+        current = accessor_resolve(field->definition);
+    }
+
+    /* The value must be of a base type. */
+    if (!current || current->type == XAMINE_STRUCT || current->type == XAMINE_UNION ||
+        (current->u.size != 1 && current->u.size != 2 && current->u.size != 4))
+        goto fail;
+    accessor->value = current;
+    accessor->ctx = xamine_context_ref(ctx);
+    goto out;
+
+fail:
+    free(accessor);
+    accessor = NULL;
+out:
+    free(copy);
+    return accessor;
+}
+
+XAMINE_EXPORT void
+xamine_accessor_free(struct xamine_accessor *accessor)
+{
+    if (!accessor)
+        return;
+    xamine_context_unref(accessor->ctx);
+    free(accessor);
+}
+
+int
+xamine_accessor_read(const struct xamine_accessor *accessor,
+                     const struct xamine_conversation *conversation,
+                     const struct xamine_definition *definition,
+                     const unsigned char *data, size_t size, long *value)
+{
+    struct xamine_cursor cursor, child;
+    struct xamine_item item;
+    bool big = accessor->big && definition == accessor->big;
+
+    if (definition != accessor->definition && !big)
+        return -1;
+
+    if (accessor->is_static) {
+        size_t offset = accessor->offset;
+
+        if (big && offset >= BIG_REQUEST_HEADER)
+            offset += 4;
+        if (offset > size || size - offset < accessor->value->u.size)
+            return -1;
+        *value = xamine_decode_scalar(&item, accessor->value->type, accessor->value->u.size,
+                                      data + offset, conversation->is_le);
+        return 0;
+    }
+
+    xamine_cursor_start(&cursor, conversation, definition, data, size);
+    for (size_t i = 0; i < accessor->nsteps; i++) {
+        size_t step = accessor->steps[i];
+
+        if (big && i == 0 && step >= BIG_REQUEST_FIELDS)
+            step++;
+        if (xamine_cursor_child(&cursor, step, &child) < 0)
+            return -1;
+        cursor = child;
+    }
+    return xamine_cursor_value(&cursor, value);
+}
+
+XAMINE_EXPORT int
+xamine_accessor_get(const struct xamine_accessor *accessor,
+                    const struct xamine_conversation *conversation,
+                    enum xamine_direction direction,
+                    const void *data, size_t size, long *value)
+{
+    const struct xamine_definition *definition;
+
+    definition = xamine_packet_definition(conversation, direction, data, &size);
+    if (!definition)
+        return -1;
+    return xamine_accessor_read(accessor, conversation, definition, data, size, value);
+}
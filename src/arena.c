@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2004-2005 Josh Triplett
+ *
+ * This package is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ *
+ * This package is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "utils.h"
+
+/*
+ * Resetting the arena rewinds to the first block without freeing anything,
+ * so an arena that is reset after every packet or batch settles at its
+ * high-water mark and stops calling malloc altogether.
+ */
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+XAMINE_EXPORT struct xamine_arena *
+xamine_arena_new(void)
+{
+    return calloc(1, sizeof(struct xamine_arena));
+}
+
+XAMINE_EXPORT void
+xamine_arena_reset(struct xamine_arena *arena)
+{
+    arena->current = arena->first;
+    if (arena->current)
+        arena->current->used = 0;
+}
+
+XAMINE_EXPORT void
+xamine_arena_free(struct xamine_arena *arena)
+{
+    if (!arena)
+        return;
+
+    while (arena->first) {
+        struct arena_block *block = arena->first;
+        arena->first = block->next;
+        free(block);
+    }
+    free(arena);
+}
+
+void *
+arena_alloc_block(struct xamine_arena *arena, size_t size)
+{
+    struct arena_block *block = arena->current;
+    void *ptr;
+
+    /* Move on to the next block that fits, reusing blocks kept from before
+     * the last reset. */
+    while (!block || block->used + size > block->size) {
+        struct arena_block **next = block ? &block->next : &arena->first;
+
+        if (!*next || (*next)->size < size) {
+            size_t block_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+            struct arena_block *new_block = malloc(sizeof(*new_block) + block_size);
+
+            if (!new_block)
+                return NULL;
+            new_block->size = block_size;
+            new_block->next = *next;
+            *next = new_block;
+        }
+        block = *next;
+        block->used = 0;
+        arena->current = block;
+    }
+
+    ptr = block->data + block->used;
+    block->used += size;
+    return ptr;
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2004-2005 Josh Triplett
+ *
+ * This package is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ *
+ * This package is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ */
+
+#ifndef XAMINE_ARENA_H
+#define XAMINE_ARENA_H
+
+#include <stddef.h>
+#include <string.h>
+
+#include "xamine.h"
+
+/*
+ * A bump allocator over a chain of blocks.  Allocating from the current
+ * block is inline, as decoders allocate every item from the arena.
+ */
+
+#define ARENA_ALIGN 16
+
+struct arena_block {
+    struct arena_block *next;
+    size_t size;
+    size_t used;
+    _Alignas(ARENA_ALIGN) unsigned char data[];
+};
+
+struct xamine_arena {
+    struct arena_block *first;
+    struct arena_block *current;
+};
+
+/* Allocate an aligned size from a later block, adding one if needed. */
+void *
+arena_alloc_block(struct xamine_arena *arena, size_t size);
+
+/*
+ * Allocate size bytes from the arena, aligned for any type.  The memory is
+ * not initialized.  Returns NULL on failure.
+ */
+static inline void *
+arena_alloc(struct xamine_arena *arena, size_t size)
+{
+    struct arena_block *block = arena->current;
+
+    size = (size + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+    if (block && block->size - block->used >= size) {
+        void *ptr = block->data + block->used;
+        block->used += size;
+        return ptr;
+    }
+    return arena_alloc_block(arena, size);
+}
+
+/* Like arena_alloc, but the memory is zeroed. */
+static inline void *
+arena_zalloc(struct xamine_arena *arena, size_t size)
+{
+    void *ptr = arena_alloc(arena, size);
+
+    if (ptr)
+        memset(ptr, 0, size);
+    return ptr;
+}
+
+#endif /* XAMINE_ARENA_H */
@@ -0,0 +1,213 @@
+/*
+ * Copyright (C) 2004-2005 Josh Triplett
+ *
+ * This package is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ *
+ * This package is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "atom.h"
+
+/*
+ * Interned strings are stored back to back in large blocks, and found
+ * through an open-addressing hash table of atoms.  Atom 0 is reserved for
+ * XAMINE_ATOM_NONE.
+ */
+
+#define ATOM_BLOCK_SIZE 16384
+
+struct atom_block {
+    struct atom_block *next;
+    size_t used;
+    char data[];
+};
+
+struct atom_table {
+    const char **strings;       /* Text of each atom, indexed by atom */
+    uint32_t *hashes;           /* Hash of each atom, indexed by atom */
+    xamine_atom natoms;
+    xamine_atom alloc;
+
+    xamine_atom *index;         /* Hash table of atoms; 0 is an empty slot */
+    uint32_t index_mask;
+
+    struct atom_block *blocks;
+};
+
+static uint32_t
+atom_hash(const char *string, size_t len)
+{
+    uint32_t hash = 2166136261u;
+
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char) string[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+struct atom_table *
+atom_table_new(void)
+{
+    struct atom_table *table = calloc(1, sizeof(*table));
+
+    if (!table)
+        return NULL;
+
+    table->alloc = 1024;
+    table->strings = calloc(table->alloc, sizeof(*table->strings));
+    table->hashes = calloc(table->alloc, sizeof(*table->hashes));
+    table->index_mask = 2 * table->alloc - 1;
+    table->index = calloc(table->index_mask + 1, sizeof(*table->index));
+    if (!table->strings || !table->hashes || !table->index) {
+        atom_table_free(table);
+        return NULL;
+    }
+    table->natoms = 1;
+
+    return table;
+}
+
+void
+atom_table_free(struct atom_table *table)
+{
+    if (!table)
+        return;
+
+    while (table->blocks) {
+        struct atom_block *block = table->blocks;
+        table->blocks = block->next;
+        free(block);
+    }
+    free(table->strings);
+    free(table->hashes);
+    free(table->index);
+    free(table);
+}
+
+static char *
+atom_store(struct atom_table *table, const char *string, size_t len)
+{
+    struct atom_block *block = table->blocks;
+    char *text;
+
+    if (!block || block->used + len + 1 > ATOM_BLOCK_SIZE) {
+        size_t size = len + 1 > ATOM_BLOCK_SIZE ? len + 1 : ATOM_BLOCK_SIZE;
+
+        block = malloc(sizeof(*block) + size);
+        if (!block)
+            return NULL;
+        block->used = 0;
+        block->next = table->blocks;
+        table->blocks = block;
+    }
+
+    text = block->data + block->used;
+    memcpy(text, string, len);
+    text[len] = '\0';
+    block->used += len + 1;
+
+    return text;
+}
+
+static bool
+atom_grow(struct atom_table *table)
+{
+    xamine_atom alloc = table->alloc * 2;
+    uint32_t index_mask = 2 * alloc - 1;
+    const char **strings;
+    uint32_t *hashes;
+    xamine_atom *index;
+
+    strings = realloc(table->strings, alloc * sizeof(*strings));
+    if (!strings)
+        return false;
+    table->strings = strings;
+    hashes = realloc(table->hashes, alloc * sizeof(*hashes));
+    if (!hashes)
+        return false;
+    table->hashes = hashes;
+    index = calloc(index_mask + 1, sizeof(*index));
+    if (!index)
+        return false;
+
+    /* Rehash using the stored hashes. */
+    for (xamine_atom atom = 1; atom < table->natoms; atom++) {
+        uint32_t slot = hashes[atom] & index_mask;
+        while (index[slot])
+            slot = (slot + 1) & index_mask;
+        index[slot] = atom;
+    }
+
+    free(table->index);
+    table->index = index;
+    table->index_mask = index_mask;
+    table->alloc = alloc;
+    return true;
+}
+
+xamine_atom
+atom_intern(struct atom_table *table, const char *string, size_t len,
+            bool add)
+{
+    uint32_t hash = atom_hash(string, len);
+    uint32_t slot;
+    xamine_atom atom;
+    char *text;
+
+    for (slot = hash & table->index_mask; (atom = table->index[slot]);
+         slot = (slot + 1) & table->index_mask) {
+        const char *candidate = table->strings[atom];
+        if (table->hashes[atom] == hash &&
+            strncmp(candidate, string, len) == 0 && candidate[len] == '\0')
+            return atom;
+    }
+
+    if (!add)
+        return XAMINE_ATOM_NONE;
+
+    if (table->natoms == table->alloc) {
+        if (!atom_grow(table))
+            return XAMINE_ATOM_NONE;
+        /* The empty slot moved. */
+        for (slot = hash & table->index_mask; table->index[slot];
+             slot = (slot + 1) & table->index_mask)
+            ;
+    }
+
+    text = atom_store(table, string, len);
+    if (!text)
+        return XAMINE_ATOM_NONE;
+
+    atom = table->natoms++;
+    table->strings[atom] = text;
+    table->hashes[atom] = hash;
+    table->index[slot] = atom;
+
+    return atom;
+}
+
+const char *
+atom_text(const struct atom_table *table, xamine_atom atom)
+{
+    if (atom == XAMINE_ATOM_NONE || atom >= table->natoms)
+        return NULL;
+    return table->strings[atom];
+}
+
+const char *
+atom_strdup(struct atom_table *table, const char *string)
+{
+    if (!string)
+        return NULL;
+    return atom_text(table, atom_intern(table, string, strlen(string), true));
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2004-2005 Josh Triplett
+ *
+ * This package is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ *
+ * This package is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ */
+
+#ifndef XAMINE_ATOM_H
+#define XAMINE_ATOM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * An atom is a small integer standing for an interned string.  Two strings
+ * are equal iff their atoms are equal, and the text of an atom stays valid
+ * until the table is freed.
+ */
+typedef uint32_t xamine_atom;
+
+#define XAMINE_ATOM_NONE 0
+
+struct atom_table;
+
+struct atom_table *
+atom_table_new(void);
+
+void
+atom_table_free(struct atom_table *table);
+
+/*
+ * Get the atom of the first len bytes of string.  If the string is not
+ * interned yet, it is added if add is true; otherwise XAMINE_ATOM_NONE is
+ * returned.
+ */
+xamine_atom
+atom_intern(struct atom_table *table, const char *string, size_t len,
+            bool add);
+
+/* Get the text of an atom, or NULL for XAMINE_ATOM_NONE. */
+const char *
+atom_text(const struct atom_table *table, xamine_atom atom);
+
+/* Intern a NUL-terminated string and return its interned text. */
+const char *
+atom_strdup(struct atom_table *table, const char *string);
+
+#endif /* XAMINE_ATOM_H */
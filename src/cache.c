@@ -0,0 +1,938 @@
+/*
+ * Copyright (C) 2004-2005 Josh Triplett
+ *
+ * This package is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ *
+ * This package is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ */
+
+/*
+ * The definition cache is a snapshot of the fully resolved definition graph
+ * of a context, so that a context can be created without parsing any XML.
+ *
+ * The file is written in host byte order and contains no pointers: every
+ * reference is an index into one of the tables below, or an offset into the
+ * string table, so the file can be mapped at any address.  Strings are used
+ * in place from the read-only mapping; the structures of xamine.h are rebuilt
+ * with one allocation per table.
+ *
+ * References between definitions always point towards the end of the
+ * definition table (a type is defined before it is used, and definitions are
+ * prepended to ctx->definitions), and operands of an expression always
+ * precede it.  The loader checks this, so a corrupt file cannot create
+ * cycles.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "utils.h"
+#include "xamine-private.h"
+
+#define CACHE_MAGIC "XAMINE\0C"
+#define CACHE_VERSION 4
+#define CACHE_BYTE_ORDER 0x01020304
+#define CACHE_NONE UINT32_MAX
+
+enum cache_section {
+    CACHE_STRINGS,
+    CACHE_DEFINITIONS,
+    CACHE_FIELDS,
+    CACHE_EXPRESSIONS,
+    CACHE_EXTENSIONS,
+    CACHE_NUMBERS,          /* Extension events, errors, requests and replies */
+    CACHE_CORE_EVENTS,
+    CACHE_CORE_ERRORS,
+    CACHE_CORE_REQUESTS,
+    CACHE_CORE_REPLIES,
+    CACHE_NUM_SECTIONS
+};
+
+struct cache_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;    /* CACHE_BYTE_ORDER in the writer's byte order */
+    uint64_t key;
+    uint64_t size;          /* Size of the whole file */
+    struct {
+        uint32_t offset;
+        uint32_t count;
+    } sections[CACHE_NUM_SECTIONS];
+};
+
+struct cache_definition {
+    uint32_t name;
+    uint32_t type;
+    uint32_t value;         /* Size, first field, or referenced definition */
+    uint32_t nfields;
+};
+
+struct cache_field {
+    uint32_t name;
+    uint32_t definition;
+    uint32_t length;        /* Expression, or CACHE_NONE for non-list */
+};
+
+struct cache_expression {
+    uint32_t type;
+    uint32_t op;
+    uint32_t left;
+    uint32_t right;
+    uint64_t value;         /* Value, or field name for XAMINE_FIELDREF */
+};
+
+struct cache_extension {
+    uint32_t name;
+    uint32_t xname;
+    uint32_t first_event;
+    uint32_t nevents;
+    uint32_t first_generic_event;
+    uint32_t ngeneric_events;
+    uint32_t first_error;
+    uint32_t nerrors;
+    uint32_t first_request;
+    uint32_t nrequests;
+    uint32_t first_reply;
+    uint32_t nreplies;
+};
+
+struct cache_number {
+    uint32_t number;
+    uint32_t definition;
+};
+
+static const size_t cache_record_size[CACHE_NUM_SECTIONS] = {
+    [CACHE_STRINGS]     = 1,
+    [CACHE_DEFINITIONS] = sizeof(struct cache_definition),
+    [CACHE_FIELDS]      = sizeof(struct cache_field),
+    [CACHE_EXPRESSIONS] = sizeof(struct cache_expression),
+    [CACHE_EXTENSIONS]  = sizeof(struct cache_extension),
+    [CACHE_NUMBERS]     = sizeof(struct cache_number),
+    [CACHE_CORE_EVENTS] = sizeof(uint32_t),
+    [CACHE_CORE_ERRORS] = sizeof(uint32_t),
+    [CACHE_CORE_REQUESTS] = sizeof(uint32_t),
+    [CACHE_CORE_REPLIES] = sizeof(uint32_t),
+};
+
+/* Storage behind a context loaded from a cache file. */
+struct xamine_cache {
+    void *map;
+    size_t map_size;
+    struct xamine_definition *definitions;
+    struct xamine_field_definition *fields;
+    struct xamine_expression *expressions;
+    struct xamine_extension *extensions;
+    struct xamine_event *events;
+    struct xamine_error *errors;
+};
+
+/********** Key **********/
+
+static uint64_t
+fnv1a(uint64_t hash, const void *data, size_t size)
+{
+    const unsigned char *p = data;
+
+    for (size_t i = 0; i < size; i++) {
+        hash ^= p[i];
+        hash *= UINT64_C(0x100000001b3);
+    }
+    return hash;
+}
+
+uint64_t
+xamine_cache_key(char **files)
+{
+    uint64_t hash = UINT64_C(0xcbf29ce484222325);
+
+    for (char **iter = files; iter && *iter; iter++) {
+        struct stat st;
+        int64_t stamp[3] = { -1, -1, -1 };
+
+        if (stat(*iter, &st) == 0) {
+            stamp[0] = st.st_size;
+            stamp[1] = st.st_mtim.tv_sec;
+            stamp[2] = st.st_mtim.tv_nsec;
+        }
+        hash = fnv1a(hash, *iter, strlen(*iter) + 1);
+        hash = fnv1a(hash, stamp, sizeof(stamp));
+    }
+
+    return hash;
+}
+
+char *
+xamine_cache_default_path(void)
+{
+    const char *env;
+
+    env = getenv("XAMINE_CACHE");
+    if (env)
+        return *env ? strdup(env) : NULL;
+
+    env = getenv("XDG_CACHE_HOME");
+    if (env && *env)
+        return afmt("%s/libXamine/definitions.cache", env);
+
+    env = getenv("HOME");
+    if (env && *env)
+        return afmt("%s/.cache/libXamine/definitions.cache", env);
+
+    return NULL;
+}
+
+/********** Writing **********/
+
+struct cache_buf {
+    char *data;
+    size_t size;
+    size_t alloc;
+    bool failed;
+};
+
+static uint32_t
+cache_buf_append(struct cache_buf *buf, const void *data, size_t size)
+{
+    size_t offset = buf->size;
+
+    if (buf->size + size > buf->alloc) {
+        size_t alloc = buf->alloc ? buf->alloc : 4096;
+        char *new_data;
+
+        while (alloc < buf->size + size)
+            alloc *= 2;
+        new_data = realloc(buf->data, alloc);
+        if (!new_data) {
+            buf->failed = true;
+            return CACHE_NONE;
+        }
+        buf->data = new_data;
+        buf->alloc = alloc;
+    }
+
+    memcpy(buf->data + buf->size, data, size);
+    buf->size += size;
+    if (buf->size > CACHE_NONE)
+        buf->failed = true;
+    return offset;
+}
+
+/* Maps definition pointers to their index in the definition table. */
+struct cache_index {
+    const struct xamine_definition *definition;
+    uint32_t index;
+};
+
+struct cache_writer {
+    struct cache_buf sections[CACHE_NUM_SECTIONS];
+    struct cache_index *index;
+    uint32_t ndefinitions;
+};
+
+static int
+cache_index_cmp(const void *a, const void *b)
+{
+    const struct cache_index *x = a, *y = b;
+
+    if (x->definition == y->definition)
+        return 0;
+    return x->definition < y->definition ? -1 : 1;
+}
+
+static uint32_t
+cache_definition_index(struct cache_writer *w,
+                       const struct xamine_definition *definition)
+{
+    struct cache_index key = { definition, 0 };
+    struct cache_index *found;
+
+    if (!definition)
+        return CACHE_NONE;
+
+    found = bsearch(&key, w->index, w->ndefinitions, sizeof(*w->index),
+                    cache_index_cmp);
+    if (!found) {
+        w->sections[CACHE_DEFINITIONS].failed = true;
+        return CACHE_NONE;
+    }
+    return found->index;
+}
+
+static uint32_t
+cache_string(struct cache_writer *w, const char *str)
+{
+    if (!str)
+        return CACHE_NONE;
+    return cache_buf_append(&w->sections[CACHE_STRINGS], str, strlen(str) + 1);
+}
+
+static uint32_t
+cache_record(struct cache_writer *w, enum cache_section section,
+             const void *record)
+{
+    uint32_t offset = cache_buf_append(&w->sections[section], record,
+                                       cache_record_size[section]);
+
+    return offset == CACHE_NONE ? CACHE_NONE
+                                : offset / cache_record_size[section];
+}
+
+static uint32_t
+cache_write_expression(struct cache_writer *w,
+                       const struct xamine_expression *expression)
+{
+    struct cache_expression e = { .left = CACHE_NONE, .right = CACHE_NONE };
+
+    if (!expression)
+        return CACHE_NONE;
+
+    e.type = expression->type;
+    switch (expression->type) {
+    case XAMINE_FIELDREF:
+        e.value = cache_string(w, expression->u.field);
+        break;
+    case XAMINE_VALUE:
+        e.value = expression->u.value;
+        break;
+    case XAMINE_OP:
+        e.op = expression->u.op.op;
+        e.left = cache_write_expression(w, expression->u.op.left);
+        e.right = cache_write_expression(w, expression->u.op.right);
+        break;
+    case XAMINE_IMPLICIT:
+        break;
+    }
+
+    return cache_record(w, CACHE_EXPRESSIONS, &e);
+}
+
+static void
+cache_write_definitions(struct cache_writer *w,
+                        const struct xamine_definition *definitions)
+{
+    for (const struct xamine_definition *def = definitions; def; def = def->next) {
+        struct cache_definition d = { 0 };
+
+        d.name = cache_string(w, def->name);
+        d.type = def->type;
+        switch (def->type) {
+        case XAMINE_BOOL:
+        case XAMINE_CHAR:
+        case XAMINE_SIGNED:
+        case XAMINE_UNSIGNED:
+            d.value = def->u.size;
+            break;
+        case XAMINE_STRUCT:
+        case XAMINE_UNION:
+            d.value = w->sections[CACHE_FIELDS].size / sizeof(struct cache_field);
+            for (const struct xamine_field_definition *field = def->u.fields; field; field = field->next) {
+                struct cache_field f;
+
+                f.name = cache_string(w, field->name);
+                f.definition = cache_definition_index(w, field->definition);
+                f.length = cache_write_expression(w, field->length);
+                cache_record(w, CACHE_FIELDS, &f);
+                d.nfields++;
+            }
+            break;
+        case XAMINE_TYPEDEF:
+            d.value = cache_definition_index(w, def->u.ref);
+            break;
+        }
+
+        cache_record(w, CACHE_DEFINITIONS, &d);
+    }
+}
+
+/* Write the non-NULL entries of a table indexed by number. */
+static uint32_t
+cache_write_numbers(struct cache_writer *w,
+                    struct xamine_definition *const *table, size_t size)
+{
+    uint32_t count = 0;
+
+    for (size_t i = 0; i < size; i++) {
+        struct cache_number n;
+
+        if (!table[i])
+            continue;
+        n.number = i;
+        n.definition = cache_definition_index(w, table[i]);
+        cache_record(w, CACHE_NUMBERS, &n);
+        count++;
+    }
+
+    return count;
+}
+
+static uint32_t
+cache_write_events(struct cache_writer *w, const struct xamine_event *events)
+{
+    uint32_t count = 0;
+
+    for (const struct xamine_event *event = events; event; event = event->next) {
+        struct cache_number n;
+        n.number = event->number;
+        n.definition = cache_definition_index(w, event->definition);
+        cache_record(w, CACHE_NUMBERS, &n);
+        count++;
+    }
+
+    return count;
+}
+
+static void
+cache_write_extensions(struct cache_writer *w,
+                       const struct xamine_extension *extensions)
+{
+    for (const struct xamine_extension *ext = extensions; ext; ext = ext->next) {
+        struct cache_extension e = { 0 };
+
+        e.name = cache_string(w, ext->name);
+        e.xname = cache_string(w, ext->xname);
+
+        e.first_event = w->sections[CACHE_NUMBERS].size / sizeof(struct cache_number);
+        e.nevents = cache_write_events(w, ext->events);
+        e.first_generic_event = w->sections[CACHE_NUMBERS].size / sizeof(struct cache_number);
+        e.ngeneric_events = cache_write_events(w, ext->generic_events);
+
+        e.first_error = w->sections[CACHE_NUMBERS].size / sizeof(struct cache_number);
+        for (const struct xamine_error *error = ext->errors; error; error = error->next) {
+            struct cache_number n;
+            n.number = error->number;
+            n.definition = cache_definition_index(w, error->definition);
+            cache_record(w, CACHE_NUMBERS, &n);
+            e.nerrors++;
+        }
+
+        e.first_request = w->sections[CACHE_NUMBERS].size / sizeof(struct cache_number);
+        e.nrequests = cache_write_numbers(w, ext->requests, ARRAY_SIZE(ext->requests));
+        e.first_reply = w->sections[CACHE_NUMBERS].size / sizeof(struct cache_number);
+        e.nreplies = cache_write_numbers(w, ext->replies, ARRAY_SIZE(ext->replies));
+
+        cache_record(w, CACHE_EXTENSIONS, &e);
+    }
+}
+
+static bool
+cache_write_file(struct cache_writer *w, uint64_t key, const char *path)
+{
+    struct cache_header header = { 0 };
+    struct cache_buf file = { 0 };
+    char *tmp = NULL;
+    int fd = -1;
+    bool ok = false;
+
+    memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+    header.version = CACHE_VERSION;
+    header.byte_order = CACHE_BYTE_ORDER;
+    header.key = key;
+
+    /* Lay out the sections after the header, each aligned to 8 bytes. */
+    cache_buf_append(&file, &header, sizeof(header));
+    for (int i = 0; i < CACHE_NUM_SECTIONS; i++) {
+        static const char zero[8];
+
+        if (w->sections[i].failed)
+            goto out;
+        cache_buf_append(&file, zero, -file.size & 7);
+        header.sections[i].offset = file.size;
+        header.sections[i].count = w->sections[i].size / cache_record_size[i];
+        if (w->sections[i].size)
+            cache_buf_append(&file, w->sections[i].data, w->sections[i].size);
+    }
+    header.size = file.size;
+    if (file.failed)
+        goto out;
+    memcpy(file.data, &header, sizeof(header));
+
+    /* Write to a temporary file and rename it, so readers never see a
+     * partially written cache. */
+    for (char *sep = strchr(path + 1, '/'); sep; sep = strchr(sep + 1, '/')) {
+        *sep = '\0';
+        mkdir(path, 0755);
+        *sep = '/';
+    }
+    tmp = afmt("%s.XXXXXX", path);
+    if (!tmp)
+        goto out;
+    fd = mkstemp(tmp);
+    if (fd < 0)
+        goto out;
+    for (size_t done = 0; done < file.size; ) {
+        ssize_t ret = write(fd, file.data + done, file.size - done);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret < 0)
+            goto out;
+        done += ret;
+    }
+    if (fchmod(fd, 0644) < 0 || close(fd) < 0) {
+        fd = -1;
+        goto out;
+    }
+    fd = -1;
+    ok = rename(tmp, path) == 0;
+
+out:
+    if (fd >= 0)
+        close(fd);
+    if (tmp && !ok)
+        unlink(tmp);
+    free(tmp);
+    free(file.data);
+    return ok;
+}
+
+bool
+xamine_cache_write(const struct xamine_context *ctx, const char *path)
+{
+    struct cache_writer w = { 0 };
+    char *path_copy;
+    bool ok = false;
+
+    for (const struct xamine_definition *def = ctx->definitions; def; def = def->next)
+        w.ndefinitions++;
+    w.index = calloc(w.ndefinitions + 1, sizeof(*w.index));
+    path_copy = strdup(path);
+    if (!w.index || !path_copy)
+        goto out;
+    {
+        uint32_t i = 0;
+        for (const struct xamine_definition *def = ctx->definitions; def; def = def->next) {
+            w.index[i].definition = def;
+            w.index[i].index = i;
+            i++;
+        }
+    }
+    qsort(w.index, w.ndefinitions, sizeof(*w.index), cache_index_cmp);
+
+    cache_write_definitions(&w, ctx->definitions);
+    cache_write_extensions(&w, ctx->extensions);
+    for (int i = 0; i < ARRAY_SIZE(ctx->core_events); i++) {
+        uint32_t index = cache_definition_index(&w, ctx->core_events[i]);
+        cache_record(&w, CACHE_CORE_EVENTS, &index);
+    }
+    for (int i = 0; i < ARRAY_SIZE(ctx->core_errors); i++) {
+        uint32_t index = cache_definition_index(&w, ctx->core_errors[i]);
+        cache_record(&w, CACHE_CORE_ERRORS, &index);
+    }
+    for (int i = 0; i < ARRAY_SIZE(ctx->core_requests); i++) {
+        uint32_t index = cache_definition_index(&w, ctx->core_requests[i]);
+        cache_record(&w, CACHE_CORE_REQUESTS, &index);
+        index = cache_definition_index(&w, ctx->core_replies[i]);
+        cache_record(&w, CACHE_CORE_REPLIES, &index);
+    }
+
+    ok = cache_write_file(&w, ctx->cache_key, path_copy);
+
+out:
+    for (int i = 0; i < CACHE_NUM_SECTIONS; i++)
+        free(w.sections[i].data);
+    free(w.index);
+    free(path_copy);
+    return ok;
+}
+
+/********** Loading **********/
+
+struct cache_reader {
+    const char *base;
+    const struct cache_header *header;
+    struct xamine_cache *cache;
+};
+
+static const void *
+cache_section(const struct cache_reader *r, enum cache_section section)
+{
+    return r->base + r->header->sections[section].offset;
+}
+
+static uint32_t
+cache_count(const struct cache_reader *r, enum cache_section section)
+{
+    return r->header->sections[section].count;
+}
+
+static bool
+cache_get_string(const struct cache_reader *r, uint32_t offset,
+                 const char **str)
+{
+    if (offset == CACHE_NONE) {
+        *str = NULL;
+        return true;
+    }
+    if (offset >= cache_count(r, CACHE_STRINGS))
+        return false;
+    *str = (const char *) cache_section(r, CACHE_STRINGS) + offset;
+    return true;
+}
+
+static bool
+cache_get_definition(const struct cache_reader *r, uint32_t index,
+                     uint32_t after, const struct xamine_definition **def)
+{
+    if (index == CACHE_NONE) {
+        *def = NULL;
+        return true;
+    }
+    if (index >= cache_count(r, CACHE_DEFINITIONS) ||
+        (after != CACHE_NONE && index <= after))
+        return false;
+    *def = &r->cache->definitions[index];
+    return true;
+}
+
+static bool
+cache_check_header(const struct cache_reader *r, size_t size, uint64_t key)
+{
+    const struct cache_header *h = r->header;
+
+    if (size < sizeof(*h) ||
+        memcmp(h->magic, CACHE_MAGIC, sizeof(h->magic)) != 0 ||
+        h->version != CACHE_VERSION ||
+        h->byte_order != CACHE_BYTE_ORDER ||
+        h->size != size ||
+        h->key != key)
+        return false;
+
+    for (int i = 0; i < CACHE_NUM_SECTIONS; i++) {
+        uint64_t end = (uint64_t) h->sections[i].offset +
+                       (uint64_t) h->sections[i].count * cache_record_size[i];
+        if (h->sections[i].offset % 8 != 0 ||
+            h->sections[i].offset < sizeof(*h) || end > size)
+            return false;
+    }
+
+    if (h->sections[CACHE_CORE_EVENTS].count != 64 ||
+        h->sections[CACHE_CORE_ERRORS].count != 128 ||
+        h->sections[CACHE_CORE_REQUESTS].count != 128 ||
+        h->sections[CACHE_CORE_REPLIES].count != 128)
+        return false;
+
+    /* All strings must be terminated within the string table. */
+    if (h->sections[CACHE_STRINGS].count > 0 &&
+        r->base[h->sections[CACHE_STRINGS].offset +
+                h->sections[CACHE_STRINGS].count - 1] != '\0')
+        return false;
+
+    return true;
+}
+
+static bool
+cache_load_expressions(struct cache_reader *r)
+{
+    const struct cache_expression *records = cache_section(r, CACHE_EXPRESSIONS);
+
+    for (uint32_t i = 0; i < cache_count(r, CACHE_EXPRESSIONS); i++) {
+        struct xamine_expression *e = &r->cache->expressions[i];
+
+        e->type = records[i].type;
+        switch (records[i].type) {
+        case XAMINE_FIELDREF:
+            if (records[i].value > CACHE_NONE ||
+                !cache_get_string(r, records[i].value, &e->u.field) ||
+                !e->u.field)
+                return false;
+            break;
+        case XAMINE_VALUE:
+            e->u.value = records[i].value;
+            break;
+        case XAMINE_OP:
+            if (records[i].op > XAMINE_BITWISE_AND ||
+                records[i].left >= i || records[i].right >= i)
+                return false;
+            e->u.op.op = records[i].op;
+            e->u.op.left = &r->cache->expressions[records[i].left];
+            e->u.op.right = &r->cache->expressions[records[i].right];
+            break;
+        case XAMINE_IMPLICIT:
+            break;
+        default:
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool
+cache_load_definitions(struct cache_reader *r)
+{
+    const struct cache_definition *records = cache_section(r, CACHE_DEFINITIONS);
+    const struct cache_field *fields = cache_section(r, CACHE_FIELDS);
+    uint32_t ndefinitions = cache_count(r, CACHE_DEFINITIONS);
+    uint32_t nfields = cache_count(r, CACHE_FIELDS);
+
+    for (uint32_t i = 0; i < ndefinitions; i++) {
+        struct xamine_definition *def = &r->cache->definitions[i];
+
+        if (!cache_get_string(r, records[i].name, &def->name))
+            return false;
+        def->type = records[i].type;
+        def->next = i + 1 < ndefinitions ? &r->cache->definitions[i + 1] : NULL;
+
+        switch (records[i].type) {
+        case XAMINE_BOOL:
+        case XAMINE_CHAR:
+        case XAMINE_SIGNED:
+        case XAMINE_UNSIGNED:
+            def->u.size = records[i].value;
+            break;
+
+        case XAMINE_STRUCT:
+        case XAMINE_UNION:
+        {
+            uint32_t first = records[i].value;
+            struct xamine_field_definition **tail = &def->u.fields;
+
+            if (first > nfields || records[i].nfields > nfields - first)
+                return false;
+
+            for (uint32_t j = first; j < first + records[i].nfields; j++) {
+                struct xamine_field_definition *field = &r->cache->fields[j];
+
+                if (!cache_get_string(r, fields[j].name, &field->name) ||
+                    !cache_get_definition(r, fields[j].definition, i,
+                                          &field->definition))
+                    return false;
+                if (fields[j].length != CACHE_NONE) {
+                    if (fields[j].length >= cache_count(r, CACHE_EXPRESSIONS))
+                        return false;
+                    field->length = &r->cache->expressions[fields[j].length];
+                }
+                *tail = field;
+                tail = &field->next;
+            }
+            *tail = NULL;
+            break;
+        }
+
+        case XAMINE_TYPEDEF:
+            if (!cache_get_definition(r, records[i].value, i, &def->u.ref))
+                return false;
+            break;
+
+        default:
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool
+cache_load_numbers(struct cache_reader *r, uint32_t first, uint32_t count,
+                   struct xamine_definition **table, size_t size)
+{
+    const struct cache_number *numbers = cache_section(r, CACHE_NUMBERS);
+    uint32_t nnumbers = cache_count(r, CACHE_NUMBERS);
+
+    if (first > nnumbers || count > nnumbers - first)
+        return false;
+
+    for (uint32_t j = first; j < first + count; j++) {
+        const struct xamine_definition *def;
+
+        if (numbers[j].number >= size ||
+            !cache_get_definition(r, numbers[j].definition, CACHE_NONE, &def))
+            return false;
+        table[numbers[j].number] = (struct xamine_definition *) def;
+    }
+
+    return true;
+}
+
+/* Load a list of events, whose numbers are below max. */
+static bool
+cache_load_events(struct cache_reader *r, uint32_t first, uint32_t count,
+                  uint32_t max, struct xamine_event **events)
+{
+    const struct cache_number *numbers = cache_section(r, CACHE_NUMBERS);
+    uint32_t nnumbers = cache_count(r, CACHE_NUMBERS);
+
+    if (first > nnumbers || count > nnumbers - first)
+        return false;
+
+    for (uint32_t j = first; j < first + count; j++) {
+        struct xamine_event *event = &r->cache->events[j];
+        if (numbers[j].number >= max ||
+            !cache_get_definition(r, numbers[j].definition, CACHE_NONE,
+                                  &event->definition))
+            return false;
+        event->number = numbers[j].number;
+        *events = event;
+        events = &event->next;
+    }
+    *events = NULL;
+
+    return true;
+}
+
+static bool
+cache_load_extensions(struct cache_reader *r)
+{
+    const struct cache_extension *records = cache_section(r, CACHE_EXTENSIONS);
+    const struct cache_number *numbers = cache_section(r, CACHE_NUMBERS);
+    uint32_t nnumbers = cache_count(r, CACHE_NUMBERS);
+
+    for (uint32_t i = 0; i < cache_count(r, CACHE_EXTENSIONS); i++) {
+        struct xamine_extension *ext = &r->cache->extensions[i];
+        struct xamine_error **errors = &ext->errors;
+
+        if (!cache_get_string(r, records[i].name, &ext->name) ||
+            !cache_get_string(r, records[i].xname, &ext->xname))
+            return false;
+        ext->next = i + 1 < cache_count(r, CACHE_EXTENSIONS)
+                  ? &r->cache->extensions[i + 1] : NULL;
+
+        if (!cache_load_events(r, records[i].first_event, records[i].nevents,
+                               256, &ext->events) ||
+            !cache_load_events(r, records[i].first_generic_event,
+                               records[i].ngeneric_events, 0x10000, &ext->generic_events))
+            return false;
+
+        if (records[i].first_error > nnumbers ||
+            records[i].nerrors > nnumbers - records[i].first_error)
+            return false;
+
+        for (uint32_t j = records[i].first_error; j < records[i].first_error + records[i].nerrors; j++) {
+            struct xamine_error *error = &r->cache->errors[j];
+            if (numbers[j].number > 255 ||
+                !cache_get_definition(r, numbers[j].definition, CACHE_NONE,
+                                      &error->definition))
+                return false;
+            error->number = numbers[j].number;
+            *errors = error;
+            errors = &error->next;
+        }
+        *errors = NULL;
+
+        if (!cache_load_numbers(r, records[i].first_request, records[i].nrequests,
+                                ext->requests, ARRAY_SIZE(ext->requests)) ||
+            !cache_load_numbers(r, records[i].first_reply, records[i].nreplies,
+                                ext->replies, ARRAY_SIZE(ext->replies)))
+            return false;
+    }
+
+    return true;
+}
+
+static bool
+cache_load_table(struct cache_reader *r, enum cache_section section,
+                 struct xamine_definition **table)
+{
+    const uint32_t *records = cache_section(r, section);
+
+    for (uint32_t i = 0; i < cache_count(r, section); i++) {
+        const struct xamine_definition *def;
+        if (!cache_get_definition(r, records[i], CACHE_NONE, &def))
+            return false;
+        table[i] = (struct xamine_definition *) def;
+    }
+
+    return true;
+}
+
+bool
+xamine_cache_load(struct xamine_context *ctx, const char *path)
+{
+    struct cache_reader r = { 0 };
+    struct xamine_cache *cache;
+    struct xamine_definition *core_events[64];
+    struct xamine_definition *core_errors[128];
+    struct xamine_definition *core_requests[128];
+    struct xamine_definition *core_replies[128];
+    struct stat st;
+    void *map;
+    int fd;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t) sizeof(struct cache_header)) {
+        close(fd);
+        return false;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return false;
+
+    r.base = map;
+    r.header = map;
+    if (!cache_check_header(&r, st.st_size, ctx->cache_key)) {
+        munmap(map, st.st_size);
+        return false;
+    }
+
+    cache = calloc(1, sizeof(*cache));
+    if (!cache) {
+        munmap(map, st.st_size);
+        return false;
+    }
+    cache->map = map;
+    cache->map_size = st.st_size;
+    r.cache = cache;
+
+    /* One extra element each, so that empty tables are not NULL. */
+    cache->definitions = calloc(cache_count(&r, CACHE_DEFINITIONS) + 1, sizeof(*cache->definitions));
+    cache->fields = calloc(cache_count(&r, CACHE_FIELDS) + 1, sizeof(*cache->fields));
+    cache->expressions = calloc(cache_count(&r, CACHE_EXPRESSIONS) + 1, sizeof(*cache->expressions));
+    cache->extensions = calloc(cache_count(&r, CACHE_EXTENSIONS) + 1, sizeof(*cache->extensions));
+    cache->events = calloc(cache_count(&r, CACHE_NUMBERS) + 1, sizeof(*cache->events));
+    cache->errors = calloc(cache_count(&r, CACHE_NUMBERS) + 1, sizeof(*cache->errors));
+    if (!cache->definitions || !cache->fields || !cache->expressions ||
+        !cache->extensions || !cache->events || !cache->errors)
+        goto err;
+
+    if (!cache_load_expressions(&r) ||
+        !cache_load_definitions(&r) ||
+        !cache_load_extensions(&r) ||
+        !cache_load_table(&r, CACHE_CORE_EVENTS, core_events) ||
+        !cache_load_table(&r, CACHE_CORE_ERRORS, core_errors) ||
+        !cache_load_table(&r, CACHE_CORE_REQUESTS, core_requests) ||
+        !cache_load_table(&r, CACHE_CORE_REPLIES, core_replies))
+        goto err;
+
+    ctx->definitions = cache_count(&r, CACHE_DEFINITIONS) ? cache->definitions : NULL;
+    ctx->extensions = cache_count(&r, CACHE_EXTENSIONS) ? cache->extensions : NULL;
+    memcpy(ctx->core_events, core_events, sizeof(core_events));
+    memcpy(ctx->core_errors, core_errors, sizeof(core_errors));
+    memcpy(ctx->core_requests, core_requests, sizeof(core_requests));
+    memcpy(ctx->core_replies, core_replies, sizeof(core_replies));
+    ctx->cache = cache;
+    return true;
+
+err:
+    xamine_cache_free(cache);
+    return false;
+}
+
+void
+xamine_cache_free(struct xamine_cache *cache)
+{
+    if (!cache)
+        return;
+
+    free(cache->definitions);
+    free(cache->fields);
+    free(cache->expressions);
+    free(cache->extensions);
+    free(cache->events);
+    free(cache->errors);
+    munmap(cache->map, cache->map_size);
+    free(cache);
+}
@@ -0,0 +1,428 @@
+/*
+ * Copyright (C) 2004-2005 Josh Triplett
+ *
+ * This package is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ *
+ * This package is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "utils.h"
+#include "xamine-private.h"
+
+/*
+ * Decoding of captures with many conversations on a pool of threads.  Each
+ * conversation is decoded by one thread at a time, so its packets stay in
+ * order; the context is shared, and only read while decoding.
+ */
+
+/* A decoded packet, kept for the merge. */
+struct capture_record {
+    uint64_t time;
+    enum xamine_direction direction;
+    const unsigned char *data;
+    size_t size;
+    const struct xamine_item *item;
+    struct capture_record *next;
+};
+
+struct capture_conversation {
+    struct xamine_conversation *conversation;
+    size_t first_chunk;         /* In capture->order */
+    size_t nchunks;
+    size_t bytes;
+
+    /* With XAMINE_CAPTURE_MERGE */
+    struct xamine_arena *arena;
+    struct capture_record *records;
+    struct capture_record **last_record;
+    bool failed;
+};
+
+/*
+ * The conversations dealt to a thread.  The owner takes the next one from
+ * the front, and idle threads steal from the back.
+ */
+struct capture_deque {
+    pthread_mutex_t lock;
+    unsigned *tasks;
+    size_t first;
+    size_t last;
+};
+
+struct capture_worker {
+    struct capture *capture;
+    unsigned index;
+    pthread_t thread;
+    struct xamine_arena *arena;
+
+    /* The chunk being fed */
+    unsigned conversation;
+    uint64_t time;
+};
+
+struct capture {
+    const struct xamine_capture_chunk *chunks;
+    size_t *order;              /* Chunk indices, grouped by conversation */
+    struct capture_conversation *conversations;
+    unsigned nconversations;
+
+    struct capture_deque *deques;
+    struct capture_worker *workers;
+    unsigned nworkers;
+
+    enum xamine_capture_flags flags;
+    xamine_capture_func func;
+    void *closure;
+};
+
+static void
+capture_packet(struct xamine_conversation *conversation,
+               enum xamine_direction direction,
+               const void *data, size_t size, void *closure)
+{
+    struct capture_worker *worker = closure;
+    struct capture *capture = worker->capture;
+    struct capture_conversation *c = &capture->conversations[worker->conversation];
+    struct capture_record *record;
+    unsigned char *copy;
+
+    if (!(capture->flags & XAMINE_CAPTURE_MERGE)) {
+        const struct xamine_item *item =
+            xamine_examine_arena(conversation, direction, data, size, worker->arena);
+        capture->func(worker->conversation, direction, worker->time, data, size,
+                      item, capture->closure);
+        return;
+    }
+
+    /* Keep the packet and its result until the merge. */
+    record = arena_alloc(c->arena, sizeof(*record));
+    copy = arena_alloc(c->arena, size);
+    if (!record || !copy) {
+        c->failed = true;
+        return;
+    }
+    memcpy(copy, data, size);
+    record->time = worker->time;
+    record->direction = direction;
+    record->data = copy;
+    record->size = size;
+    record->item = xamine_examine_arena(conversation, direction, copy, size, c->arena);
+    record->next = NULL;
+    *c->last_record = record;
+    c->last_record = &record->next;
+}
+
+static void
+capture_decode(struct capture_worker *worker, unsigned index)
+{
+    struct capture *capture = worker->capture;
+    struct capture_conversation *c = &capture->conversations[index];
+
+    worker->conversation = index;
+    xamine_conversation_set_packet_func(c->conversation, capture_packet, worker);
+    for (size_t i = 0; i < c->nchunks; i++) {
+        const struct xamine_capture_chunk *chunk =
+            &capture->chunks[capture->order[c->first_chunk + i]];
+
+        worker->time = chunk->time;
+        if (xamine_conversation_feed(c->conversation, chunk->direction,
+                                     chunk->data, chunk->size) < 0)
+            continue;   /* The rest of that direction is lost. */
+        if (!(capture->flags & XAMINE_CAPTURE_MERGE))
+            xamine_arena_reset(worker->arena);
+    }
+}
+
+/* Take the next conversation to decode, or return false if none is left. */
+static bool
+capture_take(struct capture_worker *worker, unsigned *index)
+{
+    struct capture *capture = worker->capture;
+    struct capture_deque *deque = &capture->deques[worker->index];
+    bool found = false;
+
+    pthread_mutex_lock(&deque->lock);
+    if (deque->first < deque->last) {
+        *index = deque->tasks[deque->first++];
+        found = true;
+    }
+    pthread_mutex_unlock(&deque->lock);
+
+    for (unsigned i = 1; !found && i < capture->nworkers; i++) {
+        deque = &capture->deques[(worker->index + i) % capture->nworkers];
+        pthread_mutex_lock(&deque->lock);
+        if (deque->first < deque->last) {
+            *index = deque->tasks[--deque->last];
+            found = true;
+        }
+        pthread_mutex_unlock(&deque->lock);
+    }
+
+    return found;
+}
+
+static void *
+capture_work(void *closure)
+{
+    struct capture_worker *worker = closure;
+    unsigned index;
+
+    while (capture_take(worker, &index))
+        capture_decode(worker, index);
+    return NULL;
+}
+
+struct capture_task {
+    size_t bytes;
+    unsigned index;
+};
+
+/* Compare conversations by size, largest first. */
+static int
+capture_compare_size(const void *a_void, const void *b_void)
+{
+    const struct capture_task *a = a_void, *b = b_void;
+
+    if (a->bytes != b->bytes)
+        return a->bytes < b->bytes ? 1 : -1;
+    return a->index < b->index ? -1 : a->index > b->index;
+}
+
+/* Deal the conversations out largest first, so that the last ones left to
+ * steal are small. */
+static bool
+capture_deal(struct capture *capture)
+{
+    struct capture_task *tasks = malloc(capture->nconversations * sizeof(*tasks));
+
+    if (!tasks)
+        return false;
+    for (unsigned i = 0; i < capture->nconversations; i++) {
+        tasks[i].bytes = capture->conversations[i].bytes;
+        tasks[i].index = i;
+    }
+    qsort(tasks, capture->nconversations, sizeof(*tasks), capture_compare_size);
+
+    for (unsigned i = 0; i < capture->nconversations; i++) {
+        struct capture_deque *deque = &capture->deques[i % capture->nworkers];
+        deque->tasks[deque->last++] = tasks[i].index;
+    }
+
+    free(tasks);
+    return true;
+}
+
+/*
+ * Call the function for the packets of all the conversations in order of
+ * time, and of conversation for equal times.  Each conversation's packets
+ * are already in order, so this repeatedly takes the earliest of their
+ * first packets from a binary heap.
+ */
+static bool
+capture_merge(struct capture *capture)
+{
+    unsigned *heap = malloc(capture->nconversations * sizeof(*heap));
+    struct capture_record **next = malloc(capture->nconversations * sizeof(*next));
+    unsigned n = 0;
+
+    if (!heap || !next) {
+        free(heap);
+        free(next);
+        return false;
+    }
+
+#define EARLIER(a, b) (next[a]->time < next[b]->time || \
+                       (next[a]->time == next[b]->time && (a) < (b)))
+
+    for (unsigned i = 0; i < capture->nconversations; i++) {
+        unsigned pos;
+
+        next[i] = capture->conversations[i].records;
+        if (!next[i])
+            continue;
+        for (pos = n++; pos > 0 && EARLIER(i, heap[(pos - 1) / 2]); pos = (pos - 1) / 2)
+            heap[pos] = heap[(pos - 1) / 2];
+        heap[pos] = i;
+    }
+
+    while (n > 0) {
+        unsigned top = heap[0], pos = 0;
+        const struct capture_record *record = next[top];
+
+        capture->func(top, record->direction, record->time, record->data,
+                      record->size, record->item, capture->closure);
+
+        /* Replace the top with its conversation's next packet, or with
+         * the last entry, and sift down. */
+        next[top] = record->next;
+        if (!next[top])
+            top = heap[--n];
+        for (;;) {
+            unsigned child = 2 * pos + 1;
+            if (child >= n)
+                break;
+            if (child + 1 < n && EARLIER(heap[child + 1], heap[child]))
+                child++;
+            if (!EARLIER(heap[child], top))
+                break;
+            heap[pos] = heap[child];
+            pos = child;
+        }
+        if (n > 0)
+            heap[pos] = top;
+    }
+
+#undef EARLIER
+
+    free(heap);
+    free(next);
+    return true;
+}
+
+static void
+capture_free(struct capture *capture)
+{
+    for (unsigned i = 0; capture->conversations && i < capture->nconversations; i++) {
+        xamine_conversation_unref(capture->conversations[i].conversation);
+        if (capture->conversations[i].arena)
+            xamine_arena_free(capture->conversations[i].arena);
+    }
+    for (unsigned i = 0; capture->workers && i < capture->nworkers; i++)
+        if (capture->workers[i].arena)
+            xamine_arena_free(capture->workers[i].arena);
+    for (unsigned i = 0; capture->deques && i < capture->nworkers; i++) {
+        pthread_mutex_destroy(&capture->deques[i].lock);
+        free(capture->deques[i].tasks);
+    }
+    free(capture->deques);
+    free(capture->workers);
+    free(capture->conversations);
+    free(capture->order);
+}
+
+XAMINE_EXPORT int
+xamine_decode_capture(struct xamine_context *ctx,
+                      const struct xamine_capture_chunk *chunks, size_t nchunks,
+                      enum xamine_conversation_flags conversation_flags,
+                      unsigned nthreads, enum xamine_capture_flags flags,
+                      xamine_capture_func func, void *closure)
+{
+    struct capture capture = { 0 };
+    unsigned started = 0;
+    size_t *next;
+    int ret = -1;
+
+    if ((flags & ~XAMINE_CAPTURE_MERGE) || !func)
+        return -1;
+    capture.chunks = chunks;
+    capture.flags = flags;
+    capture.func = func;
+    capture.closure = closure;
+
+    /* Group the chunks by conversation, keeping their order. */
+    for (size_t i = 0; i < nchunks; i++) {
+        if (chunks[i].direction != XAMINE_REQUEST && chunks[i].direction != XAMINE_RESPONSE)
+            return -1;
+        if (chunks[i].conversation >= capture.nconversations)
+            capture.nconversations = chunks[i].conversation + 1;
+    }
+    if (capture.nconversations == 0)
+        return 0;
+
+    capture.conversations = calloc(capture.nconversations, sizeof(*capture.conversations));
+    capture.order = malloc((nchunks ? nchunks : 1) * sizeof(*capture.order));
+    next = calloc(capture.nconversations, sizeof(*next));
+    if (!capture.conversations || !capture.order || !next) {
+        free(next);
+        goto out;
+    }
+    for (size_t i = 0; i < nchunks; i++) {
+        capture.conversations[chunks[i].conversation].nchunks++;
+        capture.conversations[chunks[i].conversation].bytes += chunks[i].size;
+    }
+    for (unsigned i = 1; i < capture.nconversations; i++)
+        capture.conversations[i].first_chunk = capture.conversations[i - 1].first_chunk +
+                                               capture.conversations[i - 1].nchunks;
+    for (size_t i = 0; i < nchunks; i++) {
+        const struct capture_conversation *c = &capture.conversations[chunks[i].conversation];
+        capture.order[c->first_chunk + next[chunks[i].conversation]++] = i;
+    }
+    free(next);
+
+    /* Conversations take a reference on the context, so they are created
+     * before any threads start. */
+    for (unsigned i = 0; i < capture.nconversations; i++) {
+        struct capture_conversation *c = &capture.conversations[i];
+
+        c->conversation = xamine_conversation_new(ctx, conversation_flags);
+        if (!c->conversation)
+            goto out;
+        c->last_record = &c->records;
+        if (flags & XAMINE_CAPTURE_MERGE) {
+            c->arena = xamine_arena_new();
+            if (!c->arena)
+                goto out;
+        }
+    }
+
+    if (nthreads == 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = online > 0 ? online : 1;
+    }
+    if (nthreads > capture.nconversations)
+        nthreads = capture.nconversations;
+    capture.nworkers = nthreads;
+
+    capture.workers = calloc(nthreads, sizeof(*capture.workers));
+    capture.deques = calloc(nthreads, sizeof(*capture.deques));
+    if (!capture.workers || !capture.deques) {
+        capture.nworkers = 0;
+        goto out;
+    }
+    for (unsigned i = 0; i < nthreads; i++)
+        pthread_mutex_init(&capture.deques[i].lock, NULL);
+    for (unsigned i = 0; i < nthreads; i++) {
+        capture.deques[i].tasks = malloc((capture.nconversations / nthreads + 1) *
+                                         sizeof(*capture.deques[i].tasks));
+        capture.workers[i].capture = &capture;
+        capture.workers[i].index = i;
+        capture.workers[i].arena = xamine_arena_new();
+        if (!capture.deques[i].tasks || !capture.workers[i].arena)
+            goto out;
+    }
+    if (!capture_deal(&capture))
+        goto out;
+
+    /* The calling thread is the first worker. */
+    for (started = 1; started < nthreads; started++)
+        if (pthread_create(&capture.workers[started].thread, NULL, capture_work,
+                           &capture.workers[started]) != 0)
+            break;
+    capture_work(&capture.workers[0]);
+    for (unsigned i = 1; i < started; i++)
+        pthread_join(capture.workers[i].thread, NULL);
+
+    for (unsigned i = 0; i < capture.nconversations; i++)
+        if (capture.conversations[i].failed)
+            goto out;
+    if ((flags & XAMINE_CAPTURE_MERGE) && !capture_merge(&capture))
+        goto out;
+    ret = 0;
+
+out:
+    capture_free(&capture);
+    return ret;
+}
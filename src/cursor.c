@@ -0,0 +1,425 @@
+/*
+ * Copyright (C) 2004-2005 Josh Triplett
+ *
+ * This package is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ *
+ * This package is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ */
+
+/*
+ * Cursors decode single values of a packet on demand.  The offset of a
+ * field is the sum of the sizes of the fields before it, which are known
+ * from the definitions unless a list or a struct containing one comes
+ * first; the sizes of those depend on the data, and are computed from
+ * the length expressions as needed.  Each cursor remembers how far into
+ * its fields or elements it has measured, so that stepping through them
+ * in order measures each one once.
+ */
+
+#include <stdlib.h>
+
+#include "utils.h"
+#include "xamine-private.h"
+
+/* Follow typedefs.  Returns NULL for corrupt chains. */
+static const struct xamine_definition *
+cursor_resolve(const struct xamine_definition *definition)
+{
+    for (int i = 0; definition && definition->type == XAMINE_TYPEDEF; i++) {
+        if (i == 64)
+            return NULL;
+        definition = definition->u.ref;
+    }
+    return definition;
+}
+
+static void
+cursor_make(struct xamine_cursor *cursor, const struct xamine_cursor *from,
+            const struct xamine_definition *definition, const char *name,
+            size_t offset, bool is_list, size_t count)
+{
+    const struct xamine_definition *resolved = cursor_resolve(definition);
+
+    cursor->conversation = from->conversation;
+    cursor->definition = definition;
+    cursor->name = name;
+    cursor->data = from->data;
+    cursor->size = from->size;
+    cursor->offset = offset;
+    cursor->is_list = is_list;
+    cursor->count = count;
+
+    cursor->measured_field = NULL;
+    if (!is_list && resolved &&
+        (resolved->type == XAMINE_STRUCT || resolved->type == XAMINE_UNION))
+        cursor->measured_field = resolved->u.fields;
+    cursor->measured = 0;
+    cursor->measured_offset = offset;
+}
+
+static bool
+cursor_locate(struct xamine_cursor *cursor, size_t index,
+              const struct xamine_field_definition **field, size_t *offset);
+
+static bool
+cursor_locate_element(struct xamine_cursor *cursor, size_t index, size_t *offset);
+
+static bool
+cursor_field_size(struct xamine_cursor *parent, const struct xamine_field_definition *field,
+                  size_t offset, size_t *size);
+
+static bool
+cursor_value(const struct xamine_cursor *cursor, long *value)
+{
+    const struct xamine_definition *definition = cursor_resolve(cursor->definition);
+    struct xamine_item item;
+
+    if (!definition || cursor->is_list)
+        return false;
+    switch (definition->type) {
+    case XAMINE_BOOL:
+    case XAMINE_CHAR:
+    case XAMINE_SIGNED:
+    case XAMINE_UNSIGNED:
+        break;
+    case XAMINE_STRUCT:
+    case XAMINE_UNION:
+    case XAMINE_TYPEDEF:
+        return false;
+    }
+    if ((definition->u.size != 1 && definition->u.size != 2 && definition->u.size != 4) ||
+        cursor->offset > cursor->size || cursor->size - cursor->offset < definition->u.size)
+        return false;
+
+    *value = xamine_decode_scalar(&item, definition->type, definition->u.size,
+                                  cursor->data + cursor->offset,
+                                  cursor->conversation->is_le);
+    return true;
+}
+
+/* Evaluate an expression over the earlier fields of a struct. */
+static bool
+cursor_evaluate(struct xamine_cursor *parent, const struct xamine_expression *expression,
+                long *result)
+{
+    long left, right;
+
+    if (!expression)
+        return false;
+
+    switch (expression->type) {
+    case XAMINE_VALUE:
+        *result = expression->u.value;
+        return true;
+
+    case XAMINE_FIELDREF:
+    {
+        struct xamine_cursor field;
+        return xamine_cursor_child(parent, expression->field_index, &field) == 0 &&
+               cursor_value(&field, result);
+    }
+
+    case XAMINE_OP:
+        if (!cursor_evaluate(parent, expression->u.op.left, &left) ||
+            !cursor_evaluate(parent, expression->u.op.right, &right))
+            return false;
+
+        return xamine_apply_op(expression->u.op.op, left, right, result);
+
+    case XAMINE_IMPLICIT:
+        break;
+    }
+
+    return false;
+}
+
+/* Get the number of elements of a list field of parent at an offset. */
+static bool
+cursor_list_count(struct xamine_cursor *parent, const struct xamine_field_definition *field,
+                  size_t offset, size_t *count)
+{
+    size_t element_size;
+    long length;
+
+    if (offset > parent->size)
+        return false;
+
+    if (field->length->type == XAMINE_IMPLICIT) {
+        if (!xamine_static_size(field->definition, &element_size) || element_size == 0)
+            return false;
+        *count = (parent->size - offset) / element_size;
+        return true;
+    }
+
+    /* Every element takes at least one byte. */
+    if (!cursor_evaluate(parent, field->length, &length) ||
+        length < 0 || (unsigned long) length > parent->size - offset)
+        return false;
+    *count = length;
+    return true;
+}
+
+/* Get the size of a value which is not a list. */
+static bool
+cursor_value_size(const struct xamine_cursor *from, const struct xamine_definition *definition,
+                  size_t offset, size_t *size)
+{
+    const struct xamine_definition *resolved;
+    struct xamine_cursor cursor;
+    size_t end;
+
+    if (xamine_static_size(definition, size))
+        return true;
+
+    resolved = cursor_resolve(definition);
+    if (!resolved || (resolved->type != XAMINE_STRUCT && resolved->type != XAMINE_UNION))
+        return false;
+
+    cursor_make(&cursor, from, definition, NULL, offset, false, 0);
+    if (resolved->type == XAMINE_STRUCT) {
+        size_t nfields = 0;
+
+        for (const struct xamine_field_definition *field = resolved->u.fields; field; field = field->next)
+            nfields++;
+        if (!cursor_locate(&cursor, nfields, NULL, &end))
+            return false;
+        *size = end - offset;
+        return true;
+    }
+
+    /* A union takes the size of its largest member. */
+    *size = 0;
+    for (const struct xamine_field_definition *field = resolved->u.fields; field; field = field->next) {
+        size_t member_size;
+
+        if (!cursor_field_size(&cursor, field, offset, &member_size))
+            return false;
+        if (member_size > *size)
+            *size = member_size;
+    }
+    return true;
+}
+
+/* Get the size of a field of a struct at an offset. */
+static bool
+cursor_field_size(struct xamine_cursor *parent, const struct xamine_field_definition *field,
+                  size_t offset, size_t *size)
+{
+    struct xamine_cursor list;
+    size_t count, end;
+
+    if (!field->length)
+        return cursor_value_size(parent, field->definition, offset, size);
+
+    if (!cursor_list_count(parent, field, offset, &count))
+        return false;
+    cursor_make(&list, parent, field->definition, NULL, offset, true, count);
+    if (!cursor_locate_element(&list, count, &end))
+        return false;
+    *size = end - offset;
+    return true;
+}
+
+/*
+ * Find the field of a struct or union with the given index and its offset,
+ * measuring the fields before it.  An index one past the last field gives
+ * the end of a struct, with a NULL field.
+ */
+static bool
+cursor_locate(struct xamine_cursor *cursor, size_t index,
+              const struct xamine_field_definition **field_out, size_t *offset)
+{
+    const struct xamine_definition *definition = cursor_resolve(cursor->definition);
+    const struct xamine_field_definition *field;
+    size_t i, pos;
+
+    if (!definition || (definition->type != XAMINE_STRUCT && definition->type != XAMINE_UNION))
+        return false;
+
+    /* Union members all start at the start of the union. */
+    if (definition->type == XAMINE_UNION) {
+        for (field = definition->u.fields, i = 0; field && i < index; field = field->next, i++)
+            ;
+        if (!field)
+            return false;
+        if (field_out)
+            *field_out = field;
+        *offset = cursor->offset;
+        return true;
+    }
+
+    /* Carry on from the last field measured, if the field is after it. */
+    if (index >= cursor->measured) {
+        field = cursor->measured_field;
+        i = cursor->measured;
+        pos = cursor->measured_offset;
+    }
+    else {
+        field = definition->u.fields;
+        i = 0;
+        pos = cursor->offset;
+    }
+
+    while (field && i < index) {
+        size_t size;
+
+        if (!cursor_field_size(cursor, field, pos, &size) || size > cursor->size - pos)
+            return false;
+        pos += size;
+        field = field->next;
+        i++;
+        if (i > cursor->measured) {
+            cursor->measured_field = field;
+            cursor->measured = i;
+            cursor->measured_offset = pos;
+        }
+    }
+    if (i < index)
+        return false;
+
+    if (field_out)
+        *field_out = field;
+    *offset = pos;
+    return true;
+}
+
+/* Find the offset of an element of a list, or of its end for the count. */
+static bool
+cursor_locate_element(struct xamine_cursor *cursor, size_t index, size_t *offset)
+{
+    size_t element_size, i, pos;
+
+    if (index > cursor->count)
+        return false;
+
+    if (xamine_static_size(cursor->definition, &element_size)) {
+        if (element_size && index > (cursor->size - cursor->offset) / element_size)
+            return false;
+        *offset = cursor->offset + index * element_size;
+        return true;
+    }
+
+    if (index >= cursor->measured) {
+        i = cursor->measured;
+        pos = cursor->measured_offset;
+    }
+    else {
+        i = 0;
+        pos = cursor->offset;
+    }
+
+    while (i < index) {
+        if (!cursor_value_size(cursor, cursor->definition, pos, &element_size) ||
+            element_size > cursor->size - pos)
+            return false;
+        pos += element_size;
+        i++;
+        if (i > cursor->measured) {
+            cursor->measured = i;
+            cursor->measured_offset = pos;
+        }
+    }
+
+    *offset = pos;
+    return true;
+}
+
+void
+xamine_cursor_start(struct xamine_cursor *cursor,
+                    const struct xamine_conversation *conversation,
+                    const struct xamine_definition *definition,
+                    const unsigned char *data, size_t size)
+{
+    struct xamine_cursor from = { 0 };
+
+    from.conversation = conversation;
+    from.data = data;
+    from.size = size;
+    cursor_make(cursor, &from, definition, NULL, 0, false, 0);
+}
+
+XAMINE_EXPORT int
+xamine_cursor_init(struct xamine_cursor *cursor,
+                   const struct xamine_conversation *conversation,
+                   enum xamine_direction direction,
+                   const void *data, size_t size)
+{
+    const struct xamine_definition *definition;
+
+    definition = xamine_packet_definition(conversation, direction, data, &size);
+    if (!definition)
+        return -1;
+    xamine_cursor_start(cursor, conversation, definition, data, size);
+    return 0;
+}
+
+XAMINE_EXPORT size_t
+xamine_cursor_count(const struct xamine_cursor *cursor)
+{
+    const struct xamine_definition *definition = cursor_resolve(cursor->definition);
+    size_t count = 0;
+
+    if (cursor->is_list)
+        return cursor->count;
+    if (!definition || (definition->type != XAMINE_STRUCT && definition->type != XAMINE_UNION))
+        return 0;
+    for (const struct xamine_field_definition *field = definition->u.fields; field; field = field->next)
+        count++;
+    return count;
+}
+
+XAMINE_EXPORT int
+xamine_cursor_child(struct xamine_cursor *cursor, size_t index,
+                    struct xamine_cursor *child)
+{
+    const struct xamine_field_definition *field;
+    size_t offset, count;
+
+    if (cursor->is_list) {
+        if (index >= cursor->count || !cursor_locate_element(cursor, index, &offset))
+            return -1;
+        cursor_make(child, cursor, cursor->definition, NULL, offset, false, 0);
+        return 0;
+    }
+
+    if (!cursor_locate(cursor, index, &field, &offset) || !field)
+        return -1;
+    if (field->length) {
+        if (!cursor_list_count(cursor, field, offset, &count))
+            return -1;
+        cursor_make(child, cursor, field->definition, field->name, offset, true, count);
+    }
+    else {
+        cursor_make(child, cursor, field->definition, field->name, offset, false, 0);
+    }
+    return 0;
+}
+
+XAMINE_EXPORT int
+xamine_cursor_field(struct xamine_cursor *cursor, const char *name,
+                    struct xamine_cursor *field)
+{
+    const struct xamine_definition *definition = cursor_resolve(cursor->definition);
+    size_t index = 0;
+
+    if (cursor->is_list || !definition ||
+        (definition->type != XAMINE_STRUCT && definition->type != XAMINE_UNION))
+        return -1;
+
+    for (const struct xamine_field_definition *cur = definition->u.fields; cur; cur = cur->next, index++)
+        if (cur->name && streq(cur->name, name))
+            return xamine_cursor_child(cursor, index, field);
+    return -1;
+}
+
+XAMINE_EXPORT int
+xamine_cursor_value(const struct xamine_cursor *cursor, long *value)
+{
+    return cursor_value(cursor, value) ? 0 : -1;
+}
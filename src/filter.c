@@ -0,0 +1,599 @@
+/*
+ * Copyright (C) 2004-2005 Josh Triplett
+ *
+ * This package is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ *
+ * This package is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ */
+
+/*
+ * A filter is parsed once into a tree of conditions.  Packet names are
+ * resolved to their definitions, and compared by pointer with the
+ * definition of each packet.  Field comparisons are expressions in the
+ * same form as the length expressions of the definitions, whose field
+ * references are paths read from the raw packet with accessors.
+ *
+ * The grammar, from the loosest binding:
+ *
+ *   filter     := and { "||" and }
+ *   and        := unary { "&&" unary }
+ *   unary      := "!" unary | comparison | "(" filter ")" | NAME
+ *   comparison := expression ( "==" | "!=" | "<" | "<=" | ">" | ">=" ) expression
+ *   expression := shift { "&" shift }
+ *   shift      := sum { "<<" sum }
+ *   sum        := product { ( "+" | "-" ) product }
+ *   product    := primary { ( "*" | "/" ) primary }
+ *   primary    := NUMBER | PATH | "(" expression ")"
+ */
+
+#include <ctype.h>
+#include <stdlib.h>
+
+#include "utils.h"
+#include "xamine-private.h"
+
+enum filter_type {
+    FILTER_PACKET,
+    FILTER_COMPARE,
+    FILTER_AND,
+    FILTER_OR,
+    FILTER_NOT
+};
+
+enum filter_compare {
+    FILTER_EQUAL,
+    FILTER_NOT_EQUAL,
+    FILTER_LESS,
+    FILTER_LESS_EQUAL,
+    FILTER_GREATER,
+    FILTER_GREATER_EQUAL
+};
+
+struct filter_node {
+    enum filter_type type;
+    union {
+        struct {                                    /* FILTER_PACKET */
+            const struct xamine_definition *definition;
+            const struct xamine_definition *big;    /* As a big request */
+        } packet;
+        struct {                                    /* FILTER_COMPARE */
+            enum filter_compare op;
+            struct xamine_expression *left;
+            struct xamine_expression *right;
+        } compare;
+        struct {                                    /* Others; no right for FILTER_NOT */
+            struct filter_node *left;
+            struct filter_node *right;
+        } op;
+    } u;
+};
+
+/* A field read by the filter.  Field references hold its path, and are
+ * matched to it by address. */
+struct filter_field {
+    char *path;
+    struct xamine_accessor *accessor;
+};
+
+struct xamine_filter {
+    struct xamine_context *ctx;
+    struct filter_node *root;
+    struct filter_field *fields;
+    size_t nfields;
+};
+
+/* The packet a filter is tested against. */
+struct filter_packet {
+    const struct xamine_conversation *conversation;
+    const struct xamine_definition *definition;
+    const unsigned char *data;
+    size_t size;
+};
+
+/********** Parsing **********/
+
+struct filter_parser {
+    struct xamine_filter *filter;
+    const char *pos;
+};
+
+static void
+filter_free_expression(struct xamine_expression *expression)
+{
+    if (!expression)
+        return;
+    if (expression->type == XAMINE_OP) {
+        filter_free_expression(expression->u.op.left);
+        filter_free_expression(expression->u.op.right);
+    }
+    free(expression);
+}
+
+static void
+filter_free_node(struct filter_node *node)
+{
+    if (!node)
+        return;
+    switch (node->type) {
+    case FILTER_PACKET:
+        break;
+    case FILTER_COMPARE:
+        filter_free_expression(node->u.compare.left);
+        filter_free_expression(node->u.compare.right);
+        break;
+    case FILTER_AND:
+    case FILTER_OR:
+    case FILTER_NOT:
+        filter_free_node(node->u.op.left);
+        filter_free_node(node->u.op.right);
+        break;
+    }
+    free(node);
+}
+
+static void
+parser_skip_space(struct filter_parser *p)
+{
+    while (isspace((unsigned char) *p->pos))
+        p->pos++;
+}
+
+/*
+ * Consume an operator if it comes next.  A one-character operator does not
+ * match the start of a two-character one, so that "<" does not match "<=".
+ */
+static bool
+parser_accept(struct filter_parser *p, const char *op)
+{
+    static const char *const longer[] = { "==", "!=", "<=", ">=", "<<", "&&", "||" };
+    size_t length = strlen(op);
+
+    parser_skip_space(p);
+    if (strncmp(p->pos, op, length) != 0)
+        return false;
+    if (length == 1)
+        for (size_t i = 0; i < ARRAY_SIZE(longer); i++)
+            if (longer[i][0] == op[0] && longer[i][1] == p->pos[1])
+                return false;
+    p->pos += length;
+    return true;
+}
+
+static bool
+parser_is_word(char c)
+{
+    return isalnum((unsigned char) c) || c == '_' || c == '.' || c == '[' || c == ']';
+}
+
+/* Consume a name or a path.  Returns a copy, or NULL if none comes next. */
+static char *
+parser_word(struct filter_parser *p)
+{
+    const char *start;
+
+    parser_skip_space(p);
+    if (!isalpha((unsigned char) *p->pos) && *p->pos != '_')
+        return NULL;
+    for (start = p->pos; parser_is_word(*p->pos); p->pos++)
+        ;
+    return strndup(start, p->pos - start);
+}
+
+/* Get the path of the field read by an accessor for path, adding one if
+ * there is none yet. */
+static const char *
+parser_field(struct filter_parser *p, const char *path)
+{
+    struct xamine_filter *filter = p->filter;
+    struct filter_field *fields;
+    struct xamine_accessor *accessor;
+    char *copy;
+
+    for (size_t i = 0; i < filter->nfields; i++)
+        if (streq(filter->fields[i].path, path))
+            return filter->fields[i].path;
+
+    accessor = xamine_accessor_new(filter->ctx, path);
+    if (!accessor)
+        return NULL;
+    fields = realloc(filter->fields, (filter->nfields + 1) * sizeof(*fields));
+    copy = strdup(path);
+    if (!fields || !copy) {
+        if (fields)
+            filter->fields = fields;
+        free(copy);
+        xamine_accessor_free(accessor);
+        return NULL;
+    }
+    filter->fields = fields;
+    filter->fields[filter->nfields].path = copy;
+    filter->fields[filter->nfields].accessor = accessor;
+    return filter->fields[filter->nfields++].path;
+}
+
+static struct xamine_expression *
+parse_expression(struct filter_parser *p);
+
+static struct xamine_expression *
+parse_primary(struct filter_parser *p)
+{
+    struct xamine_expression *e;
+    char *word;
+
+    parser_skip_space(p);
+    if (isdigit((unsigned char) *p->pos)) {
+        char *end;
+
+        e = calloc(1, sizeof(*e));
+        if (!e)
+            return NULL;
+        e->type = XAMINE_VALUE;
+        e->u.value = strtoul(p->pos, &end, 0);
+        p->pos = end;
+        return e;
+    }
+
+    if (parser_accept(p, "(")) {
+        e = parse_expression(p);
+        if (e && !parser_accept(p, ")")) {
+            filter_free_expression(e);
+            return NULL;
+        }
+        return e;
+    }
+
+    /* Only paths are values; a bare name is a packet test. */
+    word = parser_word(p);
+    if (!word || !strchr(word, '.')) {
+        free(word);
+        return NULL;
+    }
+    e = calloc(1, sizeof(*e));
+    if (e) {
+        e->type = XAMINE_FIELDREF;
+        e->u.field = parser_field(p, word);
+        if (!e->u.field) {
+            free(e);
+            e = NULL;
+        }
+    }
+    free(word);
+    return e;
+}
+
+/* Parse operands joined by the operators of one precedence level. */
+static struct xamine_expression *
+parse_binary(struct filter_parser *p, const char *const *ops, const enum xamine_op *codes,
+             size_t nops, struct xamine_expression *(*operand)(struct filter_parser *))
+{
+    struct xamine_expression *left = operand(p);
+
+    while (left) {
+        struct xamine_expression *e;
+        size_t i;
+
+        for (i = 0; i < nops && !parser_accept(p, ops[i]); i++)
+            ;
+        if (i == nops)
+            break;
+
+        e = calloc(1, sizeof(*e));
+        if (!e) {
+            filter_free_expression(left);
+            return NULL;
+        }
+        e->type = XAMINE_OP;
+        e->u.op.op = codes[i];
+        e->u.op.left = left;
+        e->u.op.right = operand(p);
+        if (!e->u.op.right) {
+            filter_free_expression(e);
+            return NULL;
+        }
+        left = e;
+    }
+    return left;
+}
+
+static struct xamine_expression *
+parse_product(struct filter_parser *p)
+{
+    static const char *const ops[] = { "*", "/" };
+    static const enum xamine_op codes[] = { XAMINE_MULTIPLY, XAMINE_DIVIDE };
+
+    return parse_binary(p, ops, codes, ARRAY_SIZE(ops), parse_primary);
+}
+
+static struct xamine_expression *
+parse_sum(struct filter_parser *p)
+{
+    static const char *const ops[] = { "+", "-" };
+    static const enum xamine_op codes[] = { XAMINE_ADD, XAMINE_SUBTRACT };
+
+    return parse_binary(p, ops, codes, ARRAY_SIZE(ops), parse_product);
+}
+
+static struct xamine_expression *
+parse_shift(struct filter_parser *p)
+{
+    static const char *const ops[] = { "<<" };
+    static const enum xamine_op codes[] = { XAMINE_LEFT_SHIFT };
+
+    return parse_binary(p, ops, codes, ARRAY_SIZE(ops), parse_sum);
+}
+
+static struct xamine_expression *
+parse_expression(struct filter_parser *p)
+{
+    static const char *const ops[] = { "&" };
+    static const enum xamine_op codes[] = { XAMINE_BITWISE_AND };
+
+    return parse_binary(p, ops, codes, ARRAY_SIZE(ops), parse_shift);
+}
+
+static struct filter_node *
+parse_comparison(struct filter_parser *p)
+{
+    static const struct {
+        const char *op;
+        enum filter_compare compare;
+    } ops[] = {
+        { "==", FILTER_EQUAL },
+        { "!=", FILTER_NOT_EQUAL },
+        { "<=", FILTER_LESS_EQUAL },
+        { ">=", FILTER_GREATER_EQUAL },
+        { "<",  FILTER_LESS },
+        { ">",  FILTER_GREATER },
+    };
+    struct xamine_expression *left, *right;
+    struct filter_node *node;
+    size_t i;
+
+    left = parse_expression(p);
+    if (!left)
+        return NULL;
+    for (i = 0; i < ARRAY_SIZE(ops) && !parser_accept(p, ops[i].op); i++)
+        ;
+    right = i < ARRAY_SIZE(ops) ? parse_expression(p) : NULL;
+    node = right ? calloc(1, sizeof(*node)) : NULL;
+    if (!node) {
+        filter_free_expression(left);
+        filter_free_expression(right);
+        return NULL;
+    }
+    node->type = FILTER_COMPARE;
+    node->u.compare.op = ops[i].compare;
+    node->u.compare.left = left;
+    node->u.compare.right = right;
+    return node;
+}
+
+static struct filter_node *
+parse_or(struct filter_parser *p);
+
+static struct filter_node *
+parse_unary(struct filter_parser *p)
+{
+    struct filter_node *node;
+    const char *start;
+    char *word;
+
+    if (parser_accept(p, "!")) {
+        node = calloc(1, sizeof(*node));
+        if (!node)
+            return NULL;
+        node->type = FILTER_NOT;
+        node->u.op.left = parse_unary(p);
+        if (!node->u.op.left) {
+            free(node);
+            return NULL;
+        }
+        return node;
+    }
+
+    /* A parenthesis may start either a comparison or a group of
+     * conditions; try the comparison first. */
+    start = p->pos;
+    node = parse_comparison(p);
+    if (node)
+        return node;
+    p->pos = start;
+
+    if (parser_accept(p, "(")) {
+        node = parse_or(p);
+        if (node && !parser_accept(p, ")")) {
+            filter_free_node(node);
+            return NULL;
+        }
+        return node;
+    }
+
+    word = parser_word(p);
+    node = word ? calloc(1, sizeof(*node)) : NULL;
+    if (node) {
+        node->type = FILTER_PACKET;
+        node->u.packet.definition = xamine_find_packet(p->filter->ctx, word);
+        node->u.packet.big = xamine_big_request(p->filter->ctx, node->u.packet.definition);
+        if (!node->u.packet.definition) {
+            free(node);
+            node = NULL;
+        }
+    }
+    free(word);
+    return node;
+}
+
+static struct filter_node *
+parse_logical(struct filter_parser *p, const char *op, enum filter_type type,
+              struct filter_node *(*operand)(struct filter_parser *))
+{
+    struct filter_node *left = operand(p);
+
+    while (left && parser_accept(p, op)) {
+        struct filter_node *node = calloc(1, sizeof(*node));
+
+        if (!node) {
+            filter_free_node(left);
+            return NULL;
+        }
+        node->type = type;
+        node->u.op.left = left;
+        node->u.op.right = operand(p);
+        if (!node->u.op.right) {
+            filter_free_node(node);
+            return NULL;
+        }
+        left = node;
+    }
+    return left;
+}
+
+static struct filter_node *
+parse_and(struct filter_parser *p)
+{
+    return parse_logical(p, "&&", FILTER_AND, parse_unary);
+}
+
+static struct filter_node *
+parse_or(struct filter_parser *p)
+{
+    return parse_logical(p, "||", FILTER_OR, parse_and);
+}
+
+XAMINE_EXPORT struct xamine_filter *
+xamine_filter_new(struct xamine_context *ctx, const char *text)
+{
+    struct xamine_filter *filter;
+    struct filter_parser parser;
+
+    filter = calloc(1, sizeof(*filter));
+    if (!filter)
+        return NULL;
+    filter->ctx = xamine_context_ref(ctx);
+
+    parser.filter = filter;
+    parser.pos = text;
+    filter->root = parse_or(&parser);
+    parser_skip_space(&parser);
+    if (!filter->root || *parser.pos != '\0') {
+        xamine_filter_free(filter);
+        return NULL;
+    }
+    return filter;
+}
+
+XAMINE_EXPORT void
+xamine_filter_free(struct xamine_filter *filter)
+{
+    if (!filter)
+        return;
+    filter_free_node(filter->root);
+    for (size_t i = 0; i < filter->nfields; i++) {
+        free(filter->fields[i].path);
+        xamine_accessor_free(filter->fields[i].accessor);
+    }
+    free(filter->fields);
+    xamine_context_unref(filter->ctx);
+    free(filter);
+}
+
+/********** Testing **********/
+
+static bool
+filter_evaluate(const struct xamine_filter *filter, const struct filter_packet *packet,
+                const struct xamine_expression *expression, long *result)
+{
+    long left, right;
+
+    switch (expression->type) {
+    case XAMINE_VALUE:
+        *result = expression->u.value;
+        return true;
+
+    case XAMINE_FIELDREF:
+        for (size_t i = 0; i < filter->nfields; i++)
+            if (filter->fields[i].path == expression->u.field)
+                return xamine_accessor_read(filter->fields[i].accessor,
+                                            packet->conversation, packet->definition,
+                                            packet->data, packet->size, result) == 0;
+        return false;
+
+    case XAMINE_OP:
+        return filter_evaluate(filter, packet, expression->u.op.left, &left) &&
+               filter_evaluate(filter, packet, expression->u.op.right, &right) &&
+               xamine_apply_op(expression->u.op.op, left, right, result);
+
+    case XAMINE_IMPLICIT:
+        break;
+    }
+    return false;
+}
+
+/* A comparison of fields the packet does not have is false. */
+static bool
+filter_test_node(const struct xamine_filter *filter, const struct filter_packet *packet,
+                 const struct filter_node *node)
+{
+    long left, right;
+
+    switch (node->type) {
+    case FILTER_PACKET:
+        return packet->definition == node->u.packet.definition ||
+               (node->u.packet.big && packet->definition == node->u.packet.big);
+
+    case FILTER_COMPARE:
+        if (!filter_evaluate(filter, packet, node->u.compare.left, &left) ||
+            !filter_evaluate(filter, packet, node->u.compare.right, &right))
+            return false;
+        switch (node->u.compare.op) {
+        case FILTER_EQUAL:         return left == right;
+        case FILTER_NOT_EQUAL:     return left != right;
+        case FILTER_LESS:          return left < right;
+        case FILTER_LESS_EQUAL:    return left <= right;
+        case FILTER_GREATER:       return left > right;
+        case FILTER_GREATER_EQUAL: return left >= right;
+        }
+        return false;
+
+    case FILTER_AND:
+        return filter_test_node(filter, packet, node->u.op.left) &&
+               filter_test_node(filter, packet, node->u.op.right);
+
+    case FILTER_OR:
+        return filter_test_node(filter, packet, node->u.op.left) ||
+               filter_test_node(filter, packet, node->u.op.right);
+
+    case FILTER_NOT:
+        return !filter_test_node(filter, packet, node->u.op.left);
+    }
+    return false;
+}
+
+bool
+xamine_filter_test(const struct xamine_filter *filter,
+                   const struct xamine_conversation *conversation,
+                   const struct xamine_definition *definition,
+                   const unsigned char *data, size_t size)
+{
+    struct filter_packet packet = { conversation, definition, data, size };
+
+    return filter_test_node(filter, &packet, filter->root);
+}
+
+XAMINE_EXPORT bool
+xamine_filter_match(const struct xamine_filter *filter,
+                    const struct xamine_conversation *conversation,
+                    enum xamine_direction direction,
+                    const void *data, size_t size)
+{
+    const struct xamine_definition *definition;
+
+    definition = xamine_packet_definition(conversation, direction, data, &size);
+    return definition && xamine_filter_test(filter, conversation, definition, data, size);
+}
@@ -0,0 +1,972 @@
+/*
+ * Copyright (C) 2004-2005 Josh Triplett
+ *
+ * This package is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ *
+ * This package is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ */
+
+/*
+ * Packets with a decode program are written by running its instructions
+ * over the data, as program_run does, but writing each value out instead
+ * of making an item of it.  The keys of the fields are encoded for both
+ * formats the first time.  Other packets, and the items of
+ * xamine_write_item, are written by walking the items.  Both ways give the
+ * same output.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "output.h"
+#include "program.h"
+#include "stats.h"
+#include "utils.h"
+#include "xamine-private.h"
+
+/* The most a value of a base type takes in either format. */
+#define VALUE_MAX 24
+#define JSON_STRING_MAX(n) (2 + 6 * (size_t) (n))
+#define CBOR_HEAD_MAX 9
+#define CBOR_TEXT_MAX(n) (CBOR_HEAD_MAX + 2 * (size_t) (n))
+
+enum cbor_major {
+    CBOR_UNSIGNED = 0,
+    CBOR_NEGATIVE = 1,
+    CBOR_BYTES = 2,
+    CBOR_TEXT = 3,
+    CBOR_ARRAY = 4,
+    CBOR_MAP = 5
+};
+
+/********** Encoding **********/
+
+static const char digit_pairs[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+static unsigned char *
+json_unsigned(unsigned char *p, unsigned long value)
+{
+    unsigned char buf[24];
+    unsigned char *q = buf + sizeof(buf);
+
+    /* Two digits at a time, from the right. */
+    while (value >= 100) {
+        q -= 2;
+        memcpy(q, digit_pairs + 2 * (value % 100), 2);
+        value /= 100;
+    }
+    if (value >= 10) {
+        q -= 2;
+        memcpy(q, digit_pairs + 2 * value, 2);
+    }
+    else
+        *--q = '0' + value;
+
+    memcpy(p, q, buf + sizeof(buf) - q);
+    return p + (buf + sizeof(buf) - q);
+}
+
+static unsigned char *
+json_signed(unsigned char *p, long value)
+{
+    if (value >= 0)
+        return json_unsigned(p, value);
+    *p++ = '-';
+    return json_unsigned(p, 0UL - (unsigned long) value);
+}
+
+/*
+ * Write a string of Latin-1 characters as a JSON string, in UTF-8, with
+ * quotes, backslashes and control characters escaped.
+ */
+static unsigned char *
+json_string(unsigned char *p, const unsigned char *s, size_t n)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    *p++ = '"';
+    for (size_t i = 0; i < n; i++) {
+        unsigned char c = s[i];
+
+        if (c == '"' || c == '\\') {
+            *p++ = '\\';
+            *p++ = c;
+        }
+        else if (c < 0x20 || c == 0x7f) {
+            memcpy(p, "\\u00", 4);
+            p[4] = hex[c >> 4];
+            p[5] = hex[c & 0xf];
+            p += 6;
+        }
+        else if (c >= 0x80) {
+            *p++ = 0xc0 | c >> 6;
+            *p++ = 0x80 | (c & 0x3f);
+        }
+        else
+            *p++ = c;
+    }
+    *p++ = '"';
+    return p;
+}
+
+static unsigned char *
+cbor_head(unsigned char *p, enum cbor_major major, uint64_t value)
+{
+    unsigned char m = major << 5;
+
+    if (value < 24) {
+        *p++ = m | value;
+    }
+    else if (value <= UINT8_MAX) {
+        *p++ = m | 24;
+        *p++ = value;
+    }
+    else if (value <= UINT16_MAX) {
+        *p++ = m | 25;
+        *p++ = value >> 8;
+        *p++ = value;
+    }
+    else if (value <= UINT32_MAX) {
+        *p++ = m | 26;
+        *p++ = value >> 24;
+        *p++ = value >> 16;
+        *p++ = value >> 8;
+        *p++ = value;
+    }
+    else {
+        *p++ = m | 27;
+        for (int shift = 56; shift >= 0; shift -= 8)
+            *p++ = value >> shift;
+    }
+    return p;
+}
+
+/* Write a string of Latin-1 characters as a CBOR text string, in UTF-8. */
+static unsigned char *
+cbor_text(unsigned char *p, const unsigned char *s, size_t n)
+{
+    size_t length = n;
+
+    for (size_t i = 0; i < n; i++)
+        length += s[i] >> 7;
+    p = cbor_head(p, CBOR_TEXT, length);
+    if (length == n) {
+        memcpy(p, s, n);
+        return p + n;
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (s[i] >= 0x80) {
+            *p++ = 0xc0 | s[i] >> 6;
+            *p++ = 0x80 | (s[i] & 0x3f);
+        }
+        else
+            *p++ = s[i];
+    }
+    return p;
+}
+
+/* Write a value of a base type as decoded by xamine_decode_scalar. */
+static unsigned char *
+write_value(unsigned char *p, enum xamine_format format,
+            enum xamine_type type, long value)
+{
+    unsigned char c;
+
+    switch (type) {
+    case XAMINE_BOOL:
+        if (format == XAMINE_FORMAT_CBOR) {
+            *p++ = value ? 0xf5 : 0xf4;
+            return p;
+        }
+        if (value) {
+            memcpy(p, "true", 4);
+            return p + 4;
+        }
+        memcpy(p, "false", 5);
+        return p + 5;
+
+    case XAMINE_CHAR:
+        c = (unsigned char) value;
+        if (format == XAMINE_FORMAT_CBOR)
+            return cbor_text(p, &c, 1);
+        return json_string(p, &c, 1);
+
+    case XAMINE_SIGNED:
+        if (format == XAMINE_FORMAT_JSON)
+            return json_signed(p, value);
+        if (value < 0)
+            return cbor_head(p, CBOR_NEGATIVE, -1 - value);
+        return cbor_head(p, CBOR_UNSIGNED, value);
+
+    case XAMINE_UNSIGNED:
+        if (format == XAMINE_FORMAT_JSON)
+            return json_unsigned(p, (unsigned long) value);
+        return cbor_head(p, CBOR_UNSIGNED, (unsigned long) value);
+
+    case XAMINE_STRUCT:
+    case XAMINE_UNION:
+    case XAMINE_TYPEDEF:
+        break;
+    }
+    return p;
+}
+
+/********** Buffers **********/
+
+static const char packet_key[] = "packet";
+
+/* Make room for size more bytes, and return where they go. */
+static unsigned char *
+buffer_reserve(struct xamine_buffer *buffer, size_t size)
+{
+    if (buffer->alloc - buffer->size < size) {
+        size_t alloc = buffer->alloc ? buffer->alloc : 4096;
+        unsigned char *data;
+
+        while (alloc - buffer->size < size) {
+            if (alloc > SIZE_MAX / 2)
+                return NULL;
+            alloc *= 2;
+        }
+        data = realloc(buffer->data, alloc);
+        if (!data)
+            return NULL;
+        buffer->data = data;
+        buffer->alloc = alloc;
+    }
+    return buffer->data + buffer->size;
+}
+
+static void
+buffer_commit(struct xamine_buffer *buffer, unsigned char *end)
+{
+    buffer->size = end - buffer->data;
+}
+
+/*
+ * Write count values of a base type of size bytes, in the given byte order:
+ * a string for CHAR, a byte string in CBOR for 1-byte unsigned values, or
+ * an array.
+ */
+static int
+write_array(struct xamine_buffer *buffer, enum xamine_format format,
+            enum xamine_type type, size_t size,
+            const unsigned char *data, size_t count, bool is_le)
+{
+    const bool json = format == XAMINE_FORMAT_JSON;
+    unsigned char *p;
+
+    if (type == XAMINE_CHAR) {
+        p = buffer_reserve(buffer, json ? JSON_STRING_MAX(count) : CBOR_TEXT_MAX(count));
+        if (!p)
+            return -1;
+        p = json ? json_string(p, data, count) : cbor_text(p, data, count);
+    }
+    else if (!json && type == XAMINE_UNSIGNED && size == 1) {
+        p = buffer_reserve(buffer, CBOR_HEAD_MAX + count);
+        if (!p)
+            return -1;
+        p = cbor_head(p, CBOR_BYTES, count);
+        memcpy(p, data, count);
+        p += count;
+    }
+    else {
+        struct xamine_item scratch;
+
+        p = buffer_reserve(buffer, CBOR_HEAD_MAX + count * (VALUE_MAX + 1));
+        if (!p)
+            return -1;
+        if (json)
+            *p++ = '[';
+        else
+            p = cbor_head(p, CBOR_ARRAY, count);
+        for (size_t i = 0; i < count; i++) {
+            long value = xamine_decode_scalar(&scratch, type, size, data + i * size, is_le);
+
+            if (json && i > 0)
+                *p++ = ',';
+            p = write_value(p, format, type, value);
+        }
+        if (json)
+            *p++ = ']';
+    }
+
+    buffer_commit(buffer, p);
+    return 0;
+}
+
+/*
+ * Start a packet of nfields fields: the caller's fields, which come first,
+ * and then its name.
+ */
+static int
+write_head(struct xamine_buffer *buffer, enum xamine_format format,
+           const char *name, size_t nfields,
+           const struct xamine_field *fields, size_t nextra)
+{
+    const bool json = format == XAMINE_FORMAT_JSON;
+    size_t length = strlen(name), size;
+    unsigned char *p;
+
+    size = 1 + CBOR_HEAD_MAX + JSON_STRING_MAX(strlen(packet_key)) + 1 +
+           CBOR_TEXT_MAX(strlen(packet_key)) + JSON_STRING_MAX(length) + CBOR_TEXT_MAX(length);
+    for (size_t i = 0; i < nextra; i++) {
+        size_t n = strlen(fields[i].name);
+
+        size += JSON_STRING_MAX(n) + CBOR_TEXT_MAX(n) + 2;
+        if (fields[i].text) {
+            n = strlen(fields[i].text);
+            size += JSON_STRING_MAX(n) + CBOR_TEXT_MAX(n);
+        }
+        else
+            size += VALUE_MAX;
+    }
+    p = buffer_reserve(buffer, size);
+    if (!p)
+        return -1;
+
+    if (json)
+        *p++ = '{';
+    else
+        p = cbor_head(p, CBOR_MAP, nextra + 1 + nfields);
+    for (size_t i = 0; i < nextra; i++) {
+        const struct xamine_field *field = &fields[i];
+        const unsigned char *key = (const unsigned char *) field->name;
+        const unsigned char *text = (const unsigned char *) field->text;
+
+        if (json) {
+            p = json_string(p, key, strlen(field->name));
+            *p++ = ':';
+        }
+        else
+            p = cbor_text(p, key, strlen(field->name));
+        if (!text)
+            p = write_value(p, format, XAMINE_UNSIGNED, (long) field->number);
+        else if (json)
+            p = json_string(p, text, strlen(field->text));
+        else
+            p = cbor_text(p, text, strlen(field->text));
+        if (json)
+            *p++ = ',';
+    }
+    if (json) {
+        p = json_string(p, (const unsigned char *) packet_key, strlen(packet_key));
+        *p++ = ':';
+        p = json_string(p, (const unsigned char *) name, length);
+    }
+    else {
+        p = cbor_text(p, (const unsigned char *) packet_key, strlen(packet_key));
+        p = cbor_text(p, (const unsigned char *) name, length);
+    }
+    buffer_commit(buffer, p);
+    return 0;
+}
+
+/********** Keys **********/
+
+struct output_key {
+    uint32_t json;          /* Offsets of the encoded key in the strings */
+    uint32_t cbor;
+    uint16_t json_size;
+    uint16_t cbor_size;
+    uint32_t nfields;       /* STRUCT, UNION: number of fields written */
+    bool skip;              /* Padding, which is not written */
+};
+
+struct output_keys {
+    struct output_key *ops;         /* By instruction */
+    unsigned char *strings;
+};
+
+static bool
+is_padding(const char *name)
+{
+    return name && strcmp(name, "pad") == 0;
+}
+
+/* Padding fields are values or arrays named "pad" by the parser. */
+static bool
+op_is_padding(const struct program_op *op)
+{
+    return is_padding(op->name) &&
+           (op->opcode == PROGRAM_SCALAR || (op->opcode == PROGRAM_LIST && op->size));
+}
+
+/* Count the fields of a struct or union which are written. */
+static uint32_t
+count_fields(const struct program *program, uint32_t pc)
+{
+    uint32_t count = 0;
+
+    for (uint32_t i = pc + 1; i < program->ops[pc].end; ) {
+        const struct program_op *op = &program->ops[i];
+
+        if (op->opcode == PROGRAM_MEMBER) {
+            i++;
+            continue;
+        }
+        if (!op_is_padding(op))
+            count++;
+        if (op->opcode == PROGRAM_SCALAR)
+            i++;
+        else
+            i = op->end + 1;
+    }
+    return count;
+}
+
+static struct output_keys *
+output_keys_new(const struct program *program)
+{
+    struct output_keys *keys;
+    size_t strings_size = 0, pos = 0;
+    unsigned char *p;
+
+    /* The packet itself has no key; write_head starts it. */
+    for (uint32_t pc = 0; pc < program->nops; pc++) {
+        const char *name = program->ops[pc].name;
+
+        if (name && pc > 0)
+            strings_size += JSON_STRING_MAX(strlen(name)) + 1 + CBOR_TEXT_MAX(strlen(name));
+    }
+    if (strings_size > UINT32_MAX)
+        return NULL;
+
+    keys = malloc(sizeof(*keys) + program->nops * sizeof(*keys->ops) + strings_size);
+    if (!keys)
+        return NULL;
+    keys->ops = (struct output_key *) (keys + 1);
+    keys->strings = (unsigned char *) (keys->ops + program->nops);
+
+    for (uint32_t pc = 0; pc < program->nops; pc++) {
+        const struct program_op *op = &program->ops[pc];
+        struct output_key *key = &keys->ops[pc];
+        const char *name = op->name;
+
+        memset(key, 0, sizeof(*key));
+        key->skip = op_is_padding(op);
+        if (op->opcode == PROGRAM_STRUCT || op->opcode == PROGRAM_UNION)
+            key->nfields = count_fields(program, pc);
+
+        p = keys->strings + pos;
+        key->json = pos;
+        if (name && pc > 0) {
+            p = json_string(p, (const unsigned char *) name, strlen(name));
+            *p++ = ':';
+        }
+        key->json_size = p - (keys->strings + key->json);
+
+        key->cbor = p - keys->strings;
+        if (name && pc > 0)
+            p = cbor_text(p, (const unsigned char *) name, strlen(name));
+        key->cbor_size = p - (keys->strings + key->cbor);
+        pos = p - keys->strings;
+    }
+
+    return keys;
+}
+
+void
+output_keys_free(struct output_keys *keys)
+{
+    free(keys);
+}
+
+/*
+ * Get the keys of a program, making them if no thread has yet.  Returns
+ * NULL if out of memory.
+ */
+static const struct output_keys *
+program_keys(const struct program *program)
+{
+    /* Programs are shared, but their keys are only ever set once. */
+    _Atomic(struct output_keys *) *slot = (_Atomic(struct output_keys *) *) &program->keys;
+    struct output_keys *keys = atomic_load_explicit(slot, memory_order_acquire);
+    struct output_keys *expected = NULL;
+
+    if (keys)
+        return keys;
+    keys = output_keys_new(program);
+    if (keys && !atomic_compare_exchange_strong_explicit(slot, &expected, keys,
+                                                         memory_order_acq_rel,
+                                                         memory_order_acquire)) {
+        output_keys_free(keys);
+        keys = expected;
+    }
+    return keys;
+}
+
+/********** Writing from programs **********/
+
+struct output_frame {
+    uint32_t op;                /* The STRUCT, UNION or LIST instruction */
+    bool is_list;
+    size_t start;               /* UNION: offset of the union */
+    size_t written;             /* Fields or elements written so far */
+    size_t count;               /* LIST: number of elements */
+};
+
+static int
+write_program(const struct program *program, const struct output_keys *keys,
+              const struct xamine_conversation *conversation,
+              const unsigned char *data, size_t size,
+              const struct xamine_field *fields, size_t nfields,
+              enum xamine_format format, struct xamine_buffer *buffer)
+{
+    const bool json = format == XAMINE_FORMAT_JSON;
+    const bool is_le = conversation->is_le;
+    struct output_frame frames_buf[16], *frames = frames_buf;
+    long slots_buf[32], *slots = slots_buf;
+    size_t pos = 0;
+    int top = -1;
+    uint32_t pc = 0;
+    int ret = -1;
+
+    if (program->depth > ARRAY_SIZE(frames_buf))
+        frames = malloc(program->depth * sizeof(*frames));
+    if (program->nslots > ARRAY_SIZE(slots_buf))
+        slots = malloc(program->nslots * sizeof(*slots));
+    if (!frames || !slots)
+        goto out;
+
+    for (;;) {
+        const struct program_op *op = &program->ops[pc];
+        const struct output_key *key = &keys->ops[pc];
+        struct output_frame *frame = top < 0 ? NULL : &frames[top];
+        unsigned char *p;
+        long count;
+
+        if (op->opcode == PROGRAM_MEMBER) {
+            pos = frame->start;
+            pc++;
+            continue;
+        }
+        if (op->opcode == PROGRAM_END) {
+            const struct program_op *start = &program->ops[frame->op];
+
+            if (frame->is_list && frame->written < frame->count) {
+                pc = frame->op + 1;
+                continue;
+            }
+            if (start->opcode == PROGRAM_UNION)
+                pos = frame->start + start->union_size;
+            if (json) {
+                p = buffer_reserve(buffer, 2);
+                if (!p)
+                    goto out;
+                *p++ = frame->is_list ? ']' : '}';
+                if (top == 0)
+                    *p++ = '\n';
+                buffer_commit(buffer, p);
+            }
+            if (--top < 0)
+                break;
+            pc++;
+            continue;
+        }
+
+        /* The separator and key, which the packet has none of. */
+        p = buffer_reserve(buffer, 1 + (json ? key->json_size : key->cbor_size) + VALUE_MAX);
+        if (!p)
+            goto out;
+        if (!key->skip) {
+            if (json && frame && frame->written > 0)
+                *p++ = ',';
+            if (json) {
+                memcpy(p, keys->strings + key->json, key->json_size);
+                p += key->json_size;
+            }
+            else {
+                memcpy(p, keys->strings + key->cbor, key->cbor_size);
+                p += key->cbor_size;
+            }
+            if (frame)
+                frame->written++;
+        }
+
+        switch (op->opcode) {
+        case PROGRAM_SCALAR:
+        {
+            struct xamine_item scratch;
+            long value;
+
+            if (size - pos < op->size)
+                goto out;
+            value = xamine_decode_scalar(&scratch, op->type, op->size, data + pos, is_le);
+            if (op->slot != PROGRAM_NO_SLOT)
+                slots[op->slot] = value;
+            if (!key->skip)
+                p = write_value(p, format, op->type, value);
+            buffer_commit(buffer, p);
+            pos += op->size;
+            pc++;
+            break;
+        }
+
+        case PROGRAM_STRUCT:
+        case PROGRAM_UNION:
+            if (op->opcode == PROGRAM_UNION && size - pos < op->union_size)
+                goto out;
+            if (frame) {
+                if (json)
+                    *p++ = '{';
+                else
+                    p = cbor_head(p, CBOR_MAP, key->nfields);
+            }
+            buffer_commit(buffer, p);
+            if (!frame &&
+                write_head(buffer, format,
+                           program->definition->name ? program->definition->name : "",
+                           key->nfields, fields, nfields) < 0)
+                goto out;
+            top++;
+            frames[top].op = pc;
+            frames[top].is_list = false;
+            frames[top].start = pos;
+            frames[top].written = frame ? 0 : 1;  /* The packet name */
+            pc++;
+            break;
+
+        case PROGRAM_LIST:
+            buffer_commit(buffer, p);
+            if (op->size) {
+                if (op->expression == PROGRAM_NO_OP)
+                    count = (size - pos) / op->size;
+                else if (!program_evaluate(program, op->expression, slots, &count) ||
+                         count < 0 || (unsigned long) count > (size - pos) / op->size)
+                    goto out;
+                if (!key->skip &&
+                    write_array(buffer, format, op->type, op->size, data + pos, count, is_le) < 0)
+                    goto out;
+                pos += count * op->size;
+                pc = op->end + 1;
+                break;
+            }
+
+            /* Every element takes at least one byte. */
+            if (op->expression == PROGRAM_NO_OP)
+                count = (size - pos) / op->element_size;
+            else if (!program_evaluate(program, op->expression, slots, &count) ||
+                     count < 0 || (unsigned long) count > size - pos)
+                goto out;
+            p = buffer_reserve(buffer, CBOR_HEAD_MAX);
+            if (!p)
+                goto out;
+            if (json)
+                *p++ = '[';
+            else
+                p = cbor_head(p, CBOR_ARRAY, count);
+            if (count == 0) {
+                if (json)
+                    *p++ = ']';
+                buffer_commit(buffer, p);
+                pc = op->end + 1;
+                break;
+            }
+            buffer_commit(buffer, p);
+            top++;
+            frames[top].op = pc;
+            frames[top].is_list = true;
+            frames[top].written = 0;
+            frames[top].count = count;
+            pc++;
+            break;
+        }
+    }
+    ret = 0;
+
+out:
+    if (frames != frames_buf)
+        free(frames);
+    if (slots != slots_buf)
+        free(slots);
+    return ret;
+}
+
+/********** Writing from items **********/
+
+/* List elements are named by their index; struct fields never are. */
+static bool
+item_is_list(const struct xamine_item *item)
+{
+    return !item->child || (item->child->name && item->child->name[0] == '[');
+}
+
+static bool
+item_is_padding(const struct xamine_item *item)
+{
+    return is_padding(item->name) && !item->child;
+}
+
+/* Write an item, and if it is the packet, the caller's fields in front. */
+static int
+write_item(struct xamine_buffer *buffer, enum xamine_format format,
+           const struct xamine_item *item, bool is_packet,
+           const struct xamine_field *fields, size_t nfields)
+{
+    const bool json = format == XAMINE_FORMAT_JSON;
+    const struct xamine_definition *base = item->definition;
+    const char *name;
+    bool is_list;
+    size_t count = 0, written = 0;
+    unsigned char *p;
+
+    for (int i = 0; base && base->type == XAMINE_TYPEDEF && i < 64; i++)
+        base = base->u.ref;
+    if (!base)
+        return -1;
+
+    if (item->element_size)
+        return write_array(buffer, format, item->element_type, item->element_size,
+                           item->u.array, item->count, xamine_host_is_le());
+
+    switch (base->type) {
+    case XAMINE_BOOL:
+    case XAMINE_CHAR:
+    case XAMINE_SIGNED:
+    case XAMINE_UNSIGNED:
+    {
+        long value = 0;
+
+        switch (base->type) {
+        case XAMINE_BOOL:     value = item->u.bool_value; break;
+        case XAMINE_CHAR:     value = item->u.char_value; break;
+        case XAMINE_SIGNED:   value = item->u.signed_value; break;
+        default:              value = (long) item->u.unsigned_value; break;
+        }
+        p = buffer_reserve(buffer, VALUE_MAX);
+        if (!p)
+            return -1;
+        buffer_commit(buffer, write_value(p, format, base->type, value));
+        return 0;
+    }
+
+    case XAMINE_STRUCT:
+    case XAMINE_UNION:
+        break;
+
+    case XAMINE_TYPEDEF:
+        return -1;
+    }
+
+    is_list = !is_packet && item_is_list(item);
+    for (const struct xamine_item *child = item->child; child; child = child->next)
+        if (is_list || !item_is_padding(child))
+            count++;
+
+    if (is_packet) {
+        name = item->definition->name ? item->definition->name : "";
+        if (write_head(buffer, format, name, count, fields, nfields) < 0)
+            return -1;
+        written = 1;
+    }
+    else {
+        p = buffer_reserve(buffer, CBOR_HEAD_MAX);
+        if (!p)
+            return -1;
+        if (json)
+            *p++ = is_list ? '[' : '{';
+        else
+            p = cbor_head(p, is_list ? CBOR_ARRAY : CBOR_MAP, count);
+        buffer_commit(buffer, p);
+    }
+
+    for (const struct xamine_item *child = item->child; child; child = child->next) {
+        size_t length = child->name ? strlen(child->name) : 0;
+
+        if (!is_list && item_is_padding(child))
+            continue;
+        p = buffer_reserve(buffer, 2 + JSON_STRING_MAX(length) + CBOR_TEXT_MAX(length));
+        if (!p)
+            return -1;
+        if (json && written > 0)
+            *p++ = ',';
+        if (!is_list && json) {
+            p = json_string(p, (const unsigned char *) child->name, length);
+            *p++ = ':';
+        }
+        else if (!is_list)
+            p = cbor_text(p, (const unsigned char *) child->name, length);
+        buffer_commit(buffer, p);
+        if (write_item(buffer, format, child, false, NULL, 0) < 0)
+            return -1;
+        written++;
+    }
+
+    if (json) {
+        p = buffer_reserve(buffer, 2);
+        if (!p)
+            return -1;
+        *p++ = is_list ? ']' : '}';
+        if (is_packet)
+            *p++ = '\n';
+        buffer_commit(buffer, p);
+    }
+    return 0;
+}
+
+/********** Interface **********/
+
+/* Write the items of a packet, or nothing if it fails. */
+static int
+write_packet_item(const struct xamine_item *item,
+                  const struct xamine_field *fields, size_t nfields,
+                  enum xamine_format format, struct xamine_buffer *buffer)
+{
+    size_t start = buffer->size;
+
+    if (!item || (format != XAMINE_FORMAT_JSON && format != XAMINE_FORMAT_CBOR))
+        return -1;
+    if (write_item(buffer, format, item, true, fields, nfields) < 0) {
+        buffer->size = start;
+        return -1;
+    }
+    return 0;
+}
+
+XAMINE_EXPORT int
+xamine_write_item(const struct xamine_item *item, enum xamine_format format,
+                  struct xamine_buffer *buffer)
+{
+    return write_packet_item(item, NULL, 0, format, buffer);
+}
+
+/* Write a packet of a compiled context whose definition is known. */
+static int
+write_compiled(const struct xamine_conversation *conversation,
+               const struct xamine_definition *definition,
+               const unsigned char *data, size_t size,
+               const struct xamine_field *fields, size_t nfields,
+               enum xamine_format format, struct xamine_buffer *buffer)
+{
+    const struct program *program;
+    const struct output_keys *keys;
+    struct xamine_item *item;
+    size_t start = buffer->size;
+    int ret;
+
+    program = program_table_find(conversation->ctx->programs, definition);
+    keys = program ? program_keys(program) : NULL;
+    if (keys) {
+        ret = write_program(program, keys, conversation, data, size, fields, nfields,
+                            format, buffer);
+        if (ret < 0)
+            buffer->size = start;
+        return ret;
+    }
+
+    /* Without memory for the keys, or a program, write the items instead. */
+    item = xamine_dissect(conversation, definition, program, NULL, data, size);
+    ret = write_packet_item(item, fields, nfields, format, buffer);
+    xamine_item_free(item);
+    return ret;
+}
+
+/* Like write_compiled, but count the packet in the statistics. */
+static int
+write_counted(const struct xamine_conversation *conversation,
+              enum xamine_direction direction,
+              const struct xamine_definition *definition,
+              const unsigned char *data, size_t size,
+              const struct xamine_field *fields, size_t nfields,
+              enum xamine_format format, struct xamine_buffer *buffer)
+{
+    uint64_t start;
+    int ret;
+
+    if (!definition) {
+        stats_record(conversation->stats, direction, data, size, STATS_UNKNOWN, 0);
+        return -1;
+    }
+    if (conversation->filter &&
+        !xamine_filter_test(conversation->filter, conversation, definition, data, size)) {
+        stats_record(conversation->stats, direction, data, size, STATS_FILTERED, 0);
+        return -1;
+    }
+
+    start = stats_now();
+    ret = write_compiled(conversation, definition, data, size, fields, nfields, format, buffer);
+    stats_record(conversation->stats, direction, data, size,
+                 ret < 0 ? STATS_FAILED : STATS_DECODED, start);
+    return ret;
+}
+
+XAMINE_EXPORT int
+xamine_write_fields(const struct xamine_conversation *conversation,
+                    enum xamine_direction direction,
+                    const void *data, size_t size,
+                    const struct xamine_field *fields, size_t nfields,
+                    enum xamine_format format, struct xamine_buffer *buffer)
+{
+    const struct xamine_definition *definition;
+    struct xamine_item *item;
+    int ret;
+
+    if (format != XAMINE_FORMAT_JSON && format != XAMINE_FORMAT_CBOR)
+        return -1;
+
+    /* Contexts without programs write the items, which xamine_examine
+     * counts in the statistics. */
+    if (!conversation->ctx->programs) {
+        item = xamine_examine(conversation, direction, data, size);
+        ret = write_packet_item(item, fields, nfields, format, buffer);
+        xamine_item_free(item);
+        return ret;
+    }
+
+    definition = xamine_packet_definition(conversation, direction, data, &size);
+    if (conversation->stats)
+        return write_counted(conversation, direction, definition, data, size,
+                             fields, nfields, format, buffer);
+    if (!definition ||
+        (conversation->filter &&
+         !xamine_filter_test(conversation->filter, conversation, definition, data, size)))
+        return -1;
+    return write_compiled(conversation, definition, data, size, fields, nfields,
+                          format, buffer);
+}
+
+XAMINE_EXPORT int
+xamine_write(const struct xamine_conversation *conversation,
+             enum xamine_direction direction,
+             const void *data, size_t size,
+             enum xamine_format format, struct xamine_buffer *buffer)
+{
+    return xamine_write_fields(conversation, direction, data, size, NULL, 0, format, buffer);
+}
+
+XAMINE_EXPORT int
+xamine_buffer_flush(struct xamine_buffer *buffer, int fd)
+{
+    size_t done = 0;
+    int ret = 0;
+
+    while (done < buffer->size) {
+        ssize_t n = write(fd, buffer->data + done, buffer->size - done);
+
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            ret = -1;
+            break;
+        }
+        done += n;
+    }
+
+    if (done > 0) {
+        memmove(buffer->data, buffer->data + done, buffer->size - done);
+        buffer->size -= done;
+    }
+    return ret;
+}
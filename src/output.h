@@ -0,0 +1,28 @@
+/*
+ * Copyright (C) 2004-2005 Josh Triplett
+ *
+ * This package is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ *
+ * This package is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ */
+
+#ifndef XAMINE_OUTPUT_H
+#define XAMINE_OUTPUT_H
+
+/*
+ * The keys of the fields of a program, encoded once for each output format
+ * so that writing a packet just copies them.  They are made the first time
+ * a packet of the program is written.
+ */
+struct output_keys;
+
+void
+output_keys_free(struct output_keys *keys);
+
+#endif /* XAMINE_OUTPUT_H */
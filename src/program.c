@@ -0,0 +1,1038 @@
+/*
+ * Copyright (C) 2004-2005 Josh Triplett
+ *
+ * This package is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ *
+ * This package is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ */
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "output.h"
+#include "program.h"
+#include "utils.h"
+#include "xamine-private.h"
+
+/********** Compiler **********/
+
+struct compiler {
+    struct program_op *ops;
+    uint32_t nops;
+    uint32_t ops_alloc;
+    struct program_expression *expressions;
+    uint32_t nexpressions;
+    uint32_t expressions_alloc;
+    uint16_t nslots;
+    unsigned depth;
+    unsigned max_depth;
+    bool failed;
+};
+
+/*
+ * The fields of the innermost struct or union compiled so far, which list
+ * lengths can refer to.  ops holds the PROGRAM_SCALAR instruction of each
+ * field, or PROGRAM_NO_OP for fields which are not plain values.
+ */
+struct compiler_scope {
+    uint32_t *ops;
+    size_t count;
+};
+
+static void
+compile_type(struct compiler *c, const struct xamine_definition *definition,
+             const char *name);
+
+static const struct xamine_definition *
+resolve_typedefs(const struct xamine_definition *definition)
+{
+    /* Typedefs only refer to earlier definitions, so chains are finite;
+     * the limit only guards against corrupt definitions. */
+    for (int i = 0; definition && definition->type == XAMINE_TYPEDEF; i++) {
+        if (i == 64)
+            return NULL;
+        definition = definition->u.ref;
+    }
+    return definition;
+}
+
+static uint32_t
+emit(struct compiler *c, enum program_opcode opcode, const char *name,
+     const struct xamine_definition *definition)
+{
+    struct program_op *op;
+
+    if (c->nops == c->ops_alloc) {
+        uint32_t alloc = c->ops_alloc ? 2 * c->ops_alloc : 32;
+        struct program_op *ops = realloc(c->ops, alloc * sizeof(*ops));
+        if (!ops) {
+            c->failed = true;
+            return PROGRAM_NO_OP;
+        }
+        c->ops = ops;
+        c->ops_alloc = alloc;
+    }
+
+    op = &c->ops[c->nops];
+    memset(op, 0, sizeof(*op));
+    op->opcode = opcode;
+    op->slot = PROGRAM_NO_SLOT;
+    op->end = PROGRAM_NO_OP;
+    op->name = name;
+    op->definition = definition;
+
+    return c->nops++;
+}
+
+static void
+emit_expression(struct compiler *c, enum program_expression_kind kind,
+                uint8_t op, uint16_t slot, long value)
+{
+    struct program_expression *e;
+
+    if (c->nexpressions == c->expressions_alloc) {
+        uint32_t alloc = c->expressions_alloc ? 2 * c->expressions_alloc : 16;
+        struct program_expression *expressions =
+            realloc(c->expressions, alloc * sizeof(*expressions));
+        if (!expressions) {
+            c->failed = true;
+            return;
+        }
+        c->expressions = expressions;
+        c->expressions_alloc = alloc;
+    }
+
+    e = &c->expressions[c->nexpressions++];
+    e->kind = kind;
+    e->op = op;
+    e->slot = slot;
+    e->value = value;
+}
+
+static void
+compile_enter(struct compiler *c)
+{
+    if (++c->depth > c->max_depth)
+        c->max_depth = c->depth;
+}
+
+/*
+ * Compile an expression in reverse Polish notation.  Returns the depth of
+ * operand stack it needs.
+ */
+static unsigned
+compile_expression(struct compiler *c, const struct xamine_expression *expression,
+                   const struct compiler_scope *scope)
+{
+    unsigned left, right;
+
+    if (!expression) {
+        c->failed = true;
+        return 0;
+    }
+
+    switch (expression->type) {
+    case XAMINE_VALUE:
+        emit_expression(c, PROGRAM_PUSH_VALUE, 0, 0, (long) expression->u.value);
+        return 1;
+
+    case XAMINE_FIELDREF:
+    {
+        struct program_op *op;
+
+        /* Refer to the earlier field resolved at load, as long as it is a
+         * plain value; give it a slot to store its value in. */
+        if (expression->field_index >= scope->count ||
+            scope->ops[expression->field_index] == PROGRAM_NO_OP)
+            break;
+        op = &c->ops[scope->ops[expression->field_index]];
+        if (op->slot == PROGRAM_NO_SLOT) {
+            if (c->nslots == PROGRAM_NO_SLOT)
+                break;
+            op->slot = c->nslots++;
+        }
+        emit_expression(c, PROGRAM_PUSH_SLOT, 0, op->slot, 0);
+        return 1;
+    }
+
+    case XAMINE_IMPLICIT:
+        break;
+
+    case XAMINE_OP:
+        if (expression->u.op.op > XAMINE_BITWISE_AND) {
+            c->failed = true;
+            return 0;
+        }
+        left = compile_expression(c, expression->u.op.left, scope);
+        right = compile_expression(c, expression->u.op.right, scope);
+        emit_expression(c, PROGRAM_APPLY, expression->u.op.op, 0, 0);
+        return left > right + 1 ? left : right + 1;
+    }
+
+    c->failed = true;
+    return 0;
+}
+
+static void
+compile_fields(struct compiler *c, const struct xamine_definition *definition,
+               bool is_union)
+{
+    struct compiler_scope scope = { 0 };
+    size_t nfields = 0;
+
+    for (const struct xamine_field_definition *field = definition->u.fields; field; field = field->next)
+        nfields++;
+
+    scope.ops = calloc(nfields + 1, sizeof(*scope.ops));
+    if (!scope.ops) {
+        c->failed = true;
+        goto out;
+    }
+
+    for (const struct xamine_field_definition *field = definition->u.fields; field; field = field->next) {
+        uint32_t first = c->nops;
+
+        if (!field->definition || !field->name) {
+            c->failed = true;
+            break;
+        }
+
+        if (is_union)
+            first = emit(c, PROGRAM_MEMBER, NULL, NULL) + 1;
+
+        if (field->length) {
+            uint32_t list = emit(c, PROGRAM_LIST, field->name, field->definition);
+            uint32_t expression = PROGRAM_NO_OP;
+            size_t element_size = 0;
+
+            /* Implicit lengths are worked out from the size of the packet,
+             * so the elements must all be the same size. */
+            if (field->length->type == XAMINE_IMPLICIT) {
+                if (!xamine_static_size(field->definition, &element_size) ||
+                    element_size == 0)
+                    c->failed = true;
+            }
+            else {
+                unsigned stack;
+
+                expression = c->nexpressions;
+                stack = compile_expression(c, field->length, &scope);
+                emit_expression(c, PROGRAM_RETURN, 0, 0, 0);
+                if (stack > PROGRAM_STACK_SIZE)
+                    c->failed = true;
+            }
+            if (c->failed)
+                break;
+
+            compile_enter(c);
+            compile_type(c, field->definition, NULL);
+            c->depth--;
+            if (c->failed)
+                break;
+            c->ops[list].expression = expression;
+            c->ops[list].element_size = element_size;
+            c->ops[list].end = emit(c, PROGRAM_END, NULL, NULL);
+            /* Lists of values are decoded as arrays. */
+            if (c->ops[list + 1].opcode == PROGRAM_SCALAR) {
+                c->ops[list].type = c->ops[list + 1].type;
+                c->ops[list].size = c->ops[list + 1].size;
+            }
+        }
+        else {
+            compile_type(c, field->definition, field->name);
+        }
+        if (c->failed)
+            break;
+
+        scope.ops[scope.count] = c->ops[first].opcode == PROGRAM_SCALAR &&
+                                 !field->length ? first : PROGRAM_NO_OP;
+        scope.count++;
+    }
+
+out:
+    free(scope.ops);
+}
+
+static void
+compile_type(struct compiler *c, const struct xamine_definition *definition,
+             const char *name)
+{
+    const struct xamine_definition *base = resolve_typedefs(definition);
+    uint32_t start;
+
+    if (!base || c->failed) {
+        c->failed = true;
+        return;
+    }
+
+    switch (base->type) {
+    case XAMINE_BOOL:
+    case XAMINE_CHAR:
+        if (base->u.size != 1) {
+            c->failed = true;
+            return;
+        }
+        /* fallthrough */
+    case XAMINE_SIGNED:
+    case XAMINE_UNSIGNED:
+        if (base->u.size != 1 && base->u.size != 2 && base->u.size != 4) {
+            c->failed = true;
+            return;
+        }
+        start = emit(c, PROGRAM_SCALAR, name, definition);
+        if (start != PROGRAM_NO_OP) {
+            c->ops[start].type = base->type;
+            c->ops[start].size = base->u.size;
+        }
+        return;
+
+    case XAMINE_STRUCT:
+    case XAMINE_UNION:
+        start = emit(c, base->type == XAMINE_STRUCT ? PROGRAM_STRUCT : PROGRAM_UNION,
+                     name, definition);
+        if (start == PROGRAM_NO_OP)
+            return;
+        /* Union members are decoded in turn from the start of the union,
+         * which then takes the size of its largest member. */
+        if (base->type == XAMINE_UNION &&
+            !xamine_static_size(base, &c->ops[start].union_size)) {
+            c->failed = true;
+            return;
+        }
+        compile_enter(c);
+        compile_fields(c, base, base->type == XAMINE_UNION);
+        c->depth--;
+        if (!c->failed)
+            c->ops[start].end = emit(c, PROGRAM_END, NULL, NULL);
+        return;
+
+    case XAMINE_TYPEDEF:
+        break;
+    }
+
+    c->failed = true;
+}
+
+struct program *
+program_compile(const struct xamine_definition *definition)
+{
+    const struct xamine_definition *base = resolve_typedefs(definition);
+    struct compiler c = { 0 };
+    struct program *program;
+
+    if (!base || (base->type != XAMINE_STRUCT && base->type != XAMINE_UNION))
+        return NULL;
+
+    compile_type(&c, definition, NULL);
+
+    program = calloc(1, sizeof(*program));
+    if (c.failed || !program || c.max_depth > UINT16_MAX) {
+        free(c.ops);
+        free(c.expressions);
+        free(program);
+        return NULL;
+    }
+
+    program->definition = definition;
+    program->ops = c.ops;
+    program->nops = c.nops;
+    program->expressions = c.expressions;
+    program->nexpressions = c.nexpressions;
+    program->nslots = c.nslots;
+    program->depth = c.max_depth;
+
+    return program;
+}
+
+void
+program_free(struct program *program)
+{
+    if (!program)
+        return;
+
+    free(program->ops);
+    free(program->expressions);
+    output_keys_free(program->keys);
+    free(program->layout);
+    free(program);
+}
+
+/********** Interpreter **********/
+
+struct program_frame {
+    struct xamine_item *item;
+    struct xamine_item **tail;  /* Where to link the next child */
+    uint32_t op;                /* The STRUCT, UNION or LIST instruction */
+    bool is_list;
+    size_t start;               /* UNION: offset of the union */
+    size_t index;               /* LIST: number of elements so far */
+    size_t count;               /* LIST: number of elements */
+};
+
+bool
+program_evaluate(const struct program *program, uint32_t pc,
+                 const long *slots, long *result)
+{
+    long stack[PROGRAM_STACK_SIZE];
+    int top = 0;
+
+    for (;; pc++) {
+        const struct program_expression *e = &program->expressions[pc];
+        long left, right;
+
+        switch (e->kind) {
+        case PROGRAM_PUSH_VALUE:
+            stack[top++] = e->value;
+            break;
+
+        case PROGRAM_PUSH_SLOT:
+            stack[top++] = slots[e->slot];
+            break;
+
+        case PROGRAM_APPLY:
+            right = stack[--top];
+            left = stack[--top];
+            if (!xamine_apply_op(e->op, left, right, &stack[top++]))
+                return false;
+            break;
+
+        case PROGRAM_RETURN:
+            *result = stack[0];
+            return true;
+        }
+    }
+}
+
+/* Allocate an item without zeroing it first, as that shows in profiles. */
+static inline struct xamine_item *
+program_item_new(struct xamine_arena *arena, const struct program_op *op,
+                 size_t pos)
+{
+    struct xamine_item *item = arena ? arena_alloc(arena, sizeof(*item))
+                                     : malloc(sizeof(*item));
+
+    if (!item)
+        return NULL;
+    item->name = NULL;
+    item->definition = op->definition;
+    item->offset = pos;
+    item->u.unsigned_value = 0;
+    item->child = NULL;
+    item->next = NULL;
+    item->count = 0;
+    item->element_type = 0;
+    item->element_size = 0;
+    return item;
+}
+
+static inline void
+program_append(const struct program *program, struct xamine_arena *arena,
+               struct program_frame *frame, struct xamine_item *item,
+               const char *name)
+{
+    if (!frame->is_list)
+        item->name = arena ? (char *) name : xamine_item_name(NULL, name);
+    else if (arena && program->index_names && frame->index < PROGRAM_INDEX_NAMES)
+        item->name = (char *) program->index_names[frame->index++];
+    else
+        item->name = xamine_item_index_name(arena, frame->index++);
+    *frame->tail = item;
+    frame->tail = &item->next;
+}
+
+static struct xamine_item *
+program_run_layout(const struct program *program,
+                   const struct xamine_conversation *conversation,
+                   struct xamine_arena *arena,
+                   const unsigned char *data, size_t size);
+
+struct xamine_item *
+program_run(const struct program *program,
+            const struct xamine_conversation *conversation,
+            struct xamine_arena *arena,
+            const unsigned char *data, size_t size)
+{
+    struct program_frame frames_buf[16], *frames = frames_buf;
+    long slots_buf[32], *slots = slots_buf;
+    struct xamine_item *root = NULL;
+    const bool is_le = conversation->is_le;
+    size_t pos = 0;
+    int top = -1;
+    uint32_t pc = 0;
+
+    if (program->layout)
+        return program_run_layout(program, conversation, arena, data, size);
+
+    if (program->depth > ARRAY_SIZE(frames_buf))
+        frames = malloc(program->depth * sizeof(*frames));
+    if (program->nslots > ARRAY_SIZE(slots_buf))
+        slots = malloc(program->nslots * sizeof(*slots));
+    if (!frames || !slots)
+        goto fail;
+
+    for (;;) {
+        const struct program_op *op = &program->ops[pc];
+        struct xamine_item *item;
+        long count;
+
+        switch (op->opcode) {
+        case PROGRAM_SCALAR:
+        {
+            long value;
+
+            if (size - pos < op->size)
+                goto fail;
+            item = program_item_new(arena, op, pos);
+            if (!item)
+                goto fail;
+            value = xamine_decode_scalar(item, op->type, op->size, data + pos, is_le);
+            if (op->slot != PROGRAM_NO_SLOT)
+                slots[op->slot] = value;
+            pos += op->size;
+            program_append(program, arena, &frames[top], item, op->name);
+            pc++;
+            break;
+        }
+
+        case PROGRAM_STRUCT:
+        case PROGRAM_UNION:
+            if (op->opcode == PROGRAM_UNION && size - pos < op->union_size)
+                goto fail;
+            item = program_item_new(arena, op, pos);
+            if (!item)
+                goto fail;
+            if (top < 0)
+                root = item;
+            else
+                program_append(program, arena, &frames[top], item, op->name);
+            top++;
+            frames[top].item = item;
+            frames[top].tail = &item->child;
+            frames[top].op = pc;
+            frames[top].is_list = false;
+            frames[top].start = pos;
+            pc++;
+            break;
+
+        case PROGRAM_MEMBER:
+            pos = frames[top].start;
+            pc++;
+            break;
+
+        case PROGRAM_LIST:
+            if (op->size) {
+                if (op->expression == PROGRAM_NO_OP)
+                    count = (size - pos) / op->size;
+                else if (!program_evaluate(program, op->expression, slots, &count) ||
+                         count < 0 || (unsigned long) count > (size - pos) / op->size)
+                    goto fail;
+                item = xamine_item_new_array(arena, count, op->size);
+                if (!item)
+                    goto fail;
+                item->definition = op->definition;
+                item->offset = pos;
+                item->element_type = op->type;
+                xamine_decode_array(item + 1, op->size, data + pos, count, is_le);
+                pos += count * op->size;
+                program_append(program, arena, &frames[top], item, op->name);
+                pc = op->end + 1;
+                break;
+            }
+
+            item = program_item_new(arena, op, pos);
+            if (!item)
+                goto fail;
+            program_append(program, arena, &frames[top], item, op->name);
+
+            /* Every element takes at least one byte. */
+            if (op->expression == PROGRAM_NO_OP)
+                count = (size - pos) / op->element_size;
+            else if (!program_evaluate(program, op->expression, slots, &count) ||
+                     count < 0 || (unsigned long) count > size - pos)
+                goto fail;
+            if (count == 0) {
+                pc = op->end + 1;
+                break;
+            }
+            top++;
+            frames[top].item = item;
+            frames[top].tail = &item->child;
+            frames[top].op = pc;
+            frames[top].is_list = true;
+            frames[top].index = 0;
+            frames[top].count = count;
+            pc++;
+            break;
+
+        case PROGRAM_END:
+        {
+            struct program_frame *frame = &frames[top];
+            const struct program_op *start = &program->ops[frame->op];
+
+            if (frame->is_list && frame->index < frame->count) {
+                pc = frame->op + 1;
+                break;
+            }
+            if (start->opcode == PROGRAM_UNION)
+                pos = frame->start + start->union_size;
+            if (--top < 0)
+                goto done;
+            pc++;
+            break;
+        }
+        }
+    }
+
+done:
+    if (frames != frames_buf)
+        free(frames);
+    if (slots != slots_buf)
+        free(slots);
+    return root;
+
+fail:
+    xamine_item_discard(arena, root);
+    root = NULL;
+    goto done;
+}
+
+/********** Fixed layouts **********/
+
+struct layout_frame {
+    uint32_t item;
+    uint32_t last;              /* Last child so far, or 0 */
+    uint32_t op;
+    bool is_list;
+    size_t start;
+    size_t index;
+    size_t count;
+};
+
+static uint32_t
+layout_append(struct program *program, struct layout_frame *frame,
+              const struct program_op *op, size_t pos, uint32_t *alloc)
+{
+    struct program_layout_item *item;
+    const char *name = op->name;
+
+    if (frame && frame->is_list) {
+        if (!program->index_names || frame->index >= PROGRAM_INDEX_NAMES)
+            return 0;
+        name = program->index_names[frame->index++];
+    }
+
+    if (program->nlayout == *alloc) {
+        struct program_layout_item *layout;
+
+        *alloc = *alloc ? 2 * *alloc : 32;
+        layout = realloc(program->layout, *alloc * sizeof(*layout));
+        if (!layout)
+            return 0;
+        program->layout = layout;
+    }
+
+    item = &program->layout[program->nlayout];
+    memset(item, 0, sizeof(*item));
+    item->name = name;
+    item->definition = op->definition;
+    item->offset = pos;
+    if (op->opcode == PROGRAM_SCALAR || op->opcode == PROGRAM_LIST) {
+        item->type = op->type;
+        item->size = op->size;
+    }
+
+    if (frame) {
+        if (frame->last)
+            program->layout[frame->last].next = program->nlayout;
+        else
+            program->layout[frame->item].child = program->nlayout;
+        frame->last = program->nlayout;
+    }
+
+    return program->nlayout++;
+}
+
+/*
+ * Lay out the items of a program whose list lengths are all constants,
+ * which is what programs without value slots are.  This mirrors
+ * program_run without any data.
+ */
+static bool
+layout_build(struct program *program)
+{
+    struct layout_frame *frames;
+    uint32_t alloc = 0;
+    size_t pos = 0;
+    int top = -1;
+    uint32_t pc = 0;
+    bool ok = false;
+
+    if (program->nslots > 0)
+        return false;
+
+    frames = calloc(program->depth, sizeof(*frames));
+    if (!frames)
+        return false;
+
+    for (;;) {
+        const struct program_op *op = &program->ops[pc];
+        struct layout_frame *frame = top < 0 ? NULL : &frames[top];
+        uint32_t item;
+        long count;
+
+        if (op->opcode == PROGRAM_MEMBER) {
+            pos = frame->start;
+            pc++;
+            continue;
+        }
+        if (op->opcode == PROGRAM_END) {
+            const struct program_op *start = &program->ops[frame->op];
+
+            if (frame->is_list && frame->index < frame->count) {
+                pc = frame->op + 1;
+                continue;
+            }
+            if (start->opcode == PROGRAM_UNION)
+                pos = frame->start + start->union_size;
+            if (--top < 0)
+                break;
+            pc++;
+            continue;
+        }
+
+        /* Index 0 is the root, so it can mean "none" in links. */
+        item = layout_append(program, frame, op, pos, &alloc);
+        if (item == 0 && (frame || program->nlayout == 0))
+            goto out;
+
+        switch (op->opcode) {
+        case PROGRAM_SCALAR:
+            pos += op->size;
+            pc++;
+            break;
+
+        case PROGRAM_STRUCT:
+        case PROGRAM_UNION:
+            top++;
+            memset(&frames[top], 0, sizeof(frames[top]));
+            frames[top].item = item;
+            frames[top].op = pc;
+            frames[top].start = pos;
+            pc++;
+            break;
+
+        case PROGRAM_LIST:
+            if (op->expression == PROGRAM_NO_OP ||
+                !program_evaluate(program, op->expression, NULL, &count) ||
+                count < 0)
+                goto out;
+            /* The values of arrays follow the items, each array aligned
+             * for its values. */
+            if (op->size) {
+                struct program_layout_item *l = &program->layout[item];
+
+                if (count > UINT16_MAX)
+                    goto out;
+                l->is_array = true;
+                l->count = count;
+                l->values = program->layout_values;
+                program->layout_values += (count * op->size + 7) & ~(size_t) 7;
+                pos += count * op->size;
+                pc = op->end + 1;
+                break;
+            }
+            if (count > PROGRAM_INDEX_NAMES)
+                goto out;
+            if (count == 0) {
+                pc = op->end + 1;
+                break;
+            }
+            top++;
+            memset(&frames[top], 0, sizeof(frames[top]));
+            frames[top].item = item;
+            frames[top].op = pc;
+            frames[top].is_list = true;
+            frames[top].count = count;
+            pc++;
+            break;
+        }
+    }
+
+    program->layout_size = pos;
+    ok = pos <= UINT32_MAX && program->layout_values <= UINT32_MAX;
+
+out:
+    free(frames);
+    if (!ok) {
+        free(program->layout);
+        program->layout = NULL;
+        program->nlayout = 0;
+        program->layout_values = 0;
+    }
+    return ok;
+}
+
+/*
+ * Fill in items from a fixed layout.  This is called with a constant
+ * byte order so that the reads compile to plain or byte-swapped loads.
+ */
+static inline void
+layout_fill(struct xamine_item *const *items, struct xamine_item *array,
+            unsigned char *values, const struct program_layout_item *layout,
+            uint32_t n, struct xamine_arena *arena, const unsigned char *data,
+            bool is_le)
+{
+#define LAYOUT_ITEM(i) (array ? &array[i] : items[i])
+    for (uint32_t i = 0; i < n; i++) {
+        const struct program_layout_item *l = &layout[i];
+        struct xamine_item *item = LAYOUT_ITEM(i);
+
+        if (arena || !l->name)
+            item->name = (char *) l->name;
+        else
+            item->name = xamine_item_name(NULL, l->name);
+        item->definition = l->definition;
+        item->offset = l->offset;
+        item->u.unsigned_value = 0;
+        item->count = 0;
+        item->element_type = 0;
+        item->element_size = 0;
+        if (l->is_array) {
+            /* On the heap, the values follow each array item. */
+            void *v = array ? values + l->values : (void *) (item + 1);
+
+            item->u.array = v;
+            item->count = l->count;
+            item->element_type = l->type;
+            item->element_size = l->size;
+            xamine_decode_array(v, l->size, data + l->offset, l->count, is_le);
+        }
+        else if (l->size)
+            xamine_decode_scalar(item, l->type, l->size, data + l->offset, is_le);
+        item->child = l->child ? LAYOUT_ITEM(l->child) : NULL;
+        item->next = l->next ? LAYOUT_ITEM(l->next) : NULL;
+    }
+#undef LAYOUT_ITEM
+}
+
+static struct xamine_item *
+program_run_layout(const struct program *program,
+                   const struct xamine_conversation *conversation,
+                   struct xamine_arena *arena,
+                   const unsigned char *data, size_t size)
+{
+    const uint32_t n = program->nlayout;
+    struct xamine_item *array = NULL;
+    struct xamine_item **items = NULL;
+    unsigned char *values = NULL;
+
+    if (size < program->layout_size)
+        return NULL;
+
+    /* In an arena the whole tree is one allocation; on the heap each item
+     * must be freed on its own. */
+    if (arena) {
+        array = arena_alloc(arena, n * sizeof(*array) + program->layout_values);
+        if (!array)
+            return NULL;
+        values = (unsigned char *) (array + n);
+    }
+    else {
+        items = malloc(n * sizeof(*items));
+        if (!items)
+            return NULL;
+        for (uint32_t i = 0; i < n; i++) {
+            const struct program_layout_item *l = &program->layout[i];
+
+            items[i] = malloc(sizeof(**items) + (l->is_array ? l->count * l->size : 0));
+            if (!items[i]) {
+                while (i--)
+                    free(items[i]);
+                free(items);
+                return NULL;
+            }
+        }
+    }
+
+    if (conversation->is_le)
+        layout_fill(items, array, values, program->layout, n, arena, data, true);
+    else
+        layout_fill(items, array, values, program->layout, n, arena, data, false);
+
+    if (array)
+        return array;
+
+    array = items[0];
+    free(items);
+    return array;
+}
+
+/*
+ * Open-addressing hash table keyed by definition, at most half full.  The
+ * slots are published atomically, so programs can be found while another
+ * thread adds some; slot arrays outgrown meanwhile are kept until the table
+ * is freed, as a reader may still be probing one.
+ */
+struct program_slots {
+    uint32_t mask;
+    struct program_slots *outgrown;     /* The array this one replaced */
+    _Atomic(struct program *) slots[];
+};
+
+struct program_table {
+    _Atomic(struct program_slots *) slots;
+    uint32_t count;
+    char index_names[PROGRAM_INDEX_NAMES][PROGRAM_INDEX_NAME_SIZE];
+};
+
+static uint32_t
+program_hash(const struct xamine_definition *definition)
+{
+    uint64_t key = (uintptr_t) definition;
+
+    key ^= key >> 33;
+    key *= UINT64_C(0xff51afd7ed558ccd);
+    key ^= key >> 33;
+    return (uint32_t) key;
+}
+
+/* Find the slot of a definition, or the empty slot it would go in. */
+static _Atomic(struct program *) *
+program_slot(struct program_slots *slots, const struct xamine_definition *definition)
+{
+    uint32_t i = program_hash(definition) & slots->mask;
+    struct program *program;
+
+    while ((program = atomic_load_explicit(&slots->slots[i], memory_order_acquire)) &&
+           program->definition != definition)
+        i = (i + 1) & slots->mask;
+    return &slots->slots[i];
+}
+
+static struct program_slots *
+program_slots_new(uint32_t mask)
+{
+    struct program_slots *slots;
+
+    slots = calloc(1, sizeof(*slots) + (mask + 1) * sizeof(slots->slots[0]));
+    if (!slots)
+        return NULL;
+    slots->mask = mask;
+    for (uint32_t i = 0; i <= mask; i++)
+        atomic_init(&slots->slots[i], NULL);
+    return slots;
+}
+
+struct program_table *
+program_table_new(void)
+{
+    struct program_table *table = calloc(1, sizeof(*table));
+    struct program_slots *slots = program_slots_new(255);
+
+    if (!table || !slots) {
+        free(slots);
+        free(table);
+        return NULL;
+    }
+    atomic_init(&table->slots, slots);
+
+    for (int i = 0; i < PROGRAM_INDEX_NAMES; i++)
+        snprintf(table->index_names[i], sizeof(table->index_names[i]), "[%d]", i);
+
+    return table;
+}
+
+void
+program_table_free(struct program_table *table)
+{
+    struct program_slots *slots;
+
+    if (!table)
+        return;
+
+    slots = atomic_load_explicit(&table->slots, memory_order_relaxed);
+    for (uint32_t i = 0; i <= slots->mask; i++)
+        program_free(atomic_load_explicit(&slots->slots[i], memory_order_relaxed));
+    while (slots) {
+        struct program_slots *outgrown = slots->outgrown;
+        free(slots);
+        slots = outgrown;
+    }
+    free(table);
+}
+
+static bool
+program_table_grow(struct program_table *table)
+{
+    struct program_slots *slots = atomic_load_explicit(&table->slots, memory_order_relaxed);
+    struct program_slots *grown = program_slots_new(2 * slots->mask + 1);
+
+    if (!grown)
+        return false;
+
+    for (uint32_t i = 0; i <= slots->mask; i++) {
+        struct program *program = atomic_load_explicit(&slots->slots[i], memory_order_relaxed);
+        if (program)
+            atomic_store_explicit(program_slot(grown, program->definition), program,
+                                  memory_order_relaxed);
+    }
+
+    grown->outgrown = slots;
+    atomic_store_explicit(&table->slots, grown, memory_order_release);
+    return true;
+}
+
+const struct program *
+program_table_add(struct program_table *table,
+                  const struct xamine_definition *definition)
+{
+    struct program_slots *slots;
+    _Atomic(struct program *) *slot;
+    struct program *program;
+
+    if (!definition)
+        return NULL;
+
+    slots = atomic_load_explicit(&table->slots, memory_order_relaxed);
+    slot = program_slot(slots, definition);
+    program = atomic_load_explicit(slot, memory_order_relaxed);
+    if (program)
+        return program;
+
+    if (2 * (table->count + 1) > slots->mask + 1) {
+        if (!program_table_grow(table))
+            return NULL;
+        slots = atomic_load_explicit(&table->slots, memory_order_relaxed);
+        slot = program_slot(slots, definition);
+    }
+
+    program = program_compile(definition);
+    if (!program)
+        return NULL;
+    program->index_names = (const char (*)[PROGRAM_INDEX_NAME_SIZE]) table->index_names;
+    layout_build(program);
+    table->count++;
+    atomic_store_explicit(slot, program, memory_order_release);
+    return program;
+}
+
+const struct program *
+program_table_find(const struct program_table *table,
+                   const struct xamine_definition *definition)
+{
+    struct program_slots *slots;
+
+    if (!definition)
+        return NULL;
+    slots = atomic_load_explicit(&table->slots, memory_order_acquire);
+    return atomic_load_explicit(program_slot(slots, definition), memory_order_acquire);
+}
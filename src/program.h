@@ -0,0 +1,169 @@
+/*
+ * Copyright (C) 2004-2005 Josh Triplett
+ *
+ * This package is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ *
+ * This package is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ */
+
+#ifndef XAMINE_PROGRAM_H
+#define XAMINE_PROGRAM_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "xamine.h"
+
+/*
+ * A decode program is a top-level definition flattened into a linear
+ * sequence of instructions, with typedef chains resolved, nested structs
+ * inlined between PROGRAM_STRUCT and PROGRAM_END, and list length
+ * expressions compiled to reverse Polish notation over a small array of
+ * previously decoded values.  Lists of values are decoded as arrays in one
+ * step, skipping their element instruction.  Running a program produces
+ * exactly the same item tree as walking the definition.
+ */
+
+enum program_opcode {
+    PROGRAM_SCALAR,         /* Read a value of a base type */
+    PROGRAM_STRUCT,         /* Begin a struct; fields follow until PROGRAM_END */
+    PROGRAM_UNION,          /* Begin a union; members follow until PROGRAM_END */
+    PROGRAM_MEMBER,         /* Rewind to the start of the enclosing union */
+    PROGRAM_LIST,           /* Begin a list; the element follows until PROGRAM_END */
+    PROGRAM_END
+};
+
+#define PROGRAM_NO_SLOT UINT16_MAX
+#define PROGRAM_NO_OP UINT32_MAX
+
+struct program_op {
+    uint8_t opcode;
+    uint8_t type;           /* SCALAR: enum xamine_type of the base type;
+                               LIST: of the elements of an array */
+    uint8_t size;           /* SCALAR: size of the base type; LIST: size of
+                               the elements of an array, or 0 for other lists */
+    uint16_t slot;          /* SCALAR: value slot to store into, if any */
+    uint32_t end;           /* STRUCT, UNION, LIST: the matching PROGRAM_END */
+    uint32_t expression;    /* LIST: first element of the length expression,
+                               or PROGRAM_NO_OP for an implicit length */
+    size_t union_size;      /* UNION: size of the largest member */
+    size_t element_size;    /* LIST: element size, for an implicit length */
+    const char *name;       /* Field name; NULL for list elements and the root */
+    const struct xamine_definition *definition;
+};
+
+enum program_expression_kind {
+    PROGRAM_PUSH_VALUE,
+    PROGRAM_PUSH_SLOT,
+    PROGRAM_APPLY,          /* Pop two operands and push the result */
+    PROGRAM_RETURN
+};
+
+struct program_expression {
+    uint8_t kind;
+    uint8_t op;             /* APPLY: enum xamine_op */
+    uint16_t slot;          /* PUSH_SLOT */
+    long value;             /* PUSH_VALUE */
+};
+
+/*
+ * An item of a fixed layout.  Programs without data-dependent list lengths
+ * always produce the same tree shape, so the tree is laid out once in
+ * preorder and decoding just fills in the values.
+ */
+struct program_layout_item {
+    const char *name;
+    const struct xamine_definition *definition;
+    uint32_t offset;
+    uint8_t type;           /* Values and arrays only */
+    uint8_t size;           /* Size of the value or elements, or 0 for other items */
+    bool is_array;
+    uint16_t count;         /* Arrays: number of elements */
+    uint32_t values;        /* Arrays: offset of the values after the items */
+    uint32_t child;         /* Index of the first child, or 0 for none */
+    uint32_t next;          /* Index of the next sibling, or 0 for none */
+};
+
+/* List elements with small indices share their names in arenas. */
+#define PROGRAM_INDEX_NAMES 256
+#define PROGRAM_INDEX_NAME_SIZE 8
+
+struct program {
+    const struct xamine_definition *definition;
+    struct program_op *ops;
+    uint32_t nops;
+    struct program_expression *expressions;
+    uint32_t nexpressions;
+    uint16_t nslots;
+    uint16_t depth;         /* Maximum nesting of structs, unions and lists */
+    const char (*index_names)[PROGRAM_INDEX_NAME_SIZE];  /* Or NULL */
+
+    _Atomic(struct output_keys *) keys;     /* Made when first written */
+
+    struct program_layout_item *layout;     /* NULL unless the layout is fixed */
+    uint32_t nlayout;
+    size_t layout_size;                     /* Bytes of data the layout covers */
+    size_t layout_values;                   /* Bytes of array values, aligned */
+};
+
+/* Maximum depth of a length expression's operand stack. */
+#define PROGRAM_STACK_SIZE 16
+
+/*
+ * Compile a definition.  Returns NULL if the definition cannot be decoded,
+ * for instance because it refers to an unknown type or field.
+ */
+struct program *
+program_compile(const struct xamine_definition *definition);
+
+void
+program_free(struct program *program);
+
+/*
+ * Evaluate the length expression starting at pc over the value slots.
+ * Returns false if it cannot be computed, as on division by zero.
+ */
+bool
+program_evaluate(const struct program *program, uint32_t pc,
+                 const long *slots, long *result);
+
+struct xamine_item *
+program_run(const struct program *program,
+            const struct xamine_conversation *conversation,
+            struct xamine_arena *arena,
+            const unsigned char *data, size_t size);
+
+/*
+ * Programs of a context, found by their definition.  Programs can be found
+ * while one thread adds others, but only one thread may add at a time.
+ */
+
+struct program_table;
+
+struct program_table *
+program_table_new(void);
+
+void
+program_table_free(struct program_table *table);
+
+/*
+ * Compile a definition and add its program to the table, unless it is
+ * already there.  Returns the program, or NULL if it cannot be compiled.
+ */
+const struct program *
+program_table_add(struct program_table *table,
+                  const struct xamine_definition *definition);
+
+const struct program *
+program_table_find(const struct program_table *table,
+                   const struct xamine_definition *definition);
+
+#endif /* XAMINE_PROGRAM_H */
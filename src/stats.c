@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2004-2005 Josh Triplett
+ *
+ * This package is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ *
+ * This package is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ */
+
+#include "stats.h"
+#include "utils.h"
+#include "xamine-private.h"
+
+static struct stats_counts *
+stats_counts(struct stats *stats, enum xamine_direction direction,
+             const unsigned char *data, size_t size)
+{
+    if (direction == XAMINE_REQUEST)
+        return size >= 1 ? &stats->requests[data[0]] : NULL;
+    if (size < 2)
+        return NULL;
+    if (data[0] == 0)
+        return &stats->errors[data[1]];
+    if (data[0] == 1)
+        return &stats->replies;
+    return &stats->events[data[0] & ~0x80];
+}
+
+/* Find the bucket of a latency: its bit length, so bucket i starts at 2^(i-1). */
+static unsigned
+stats_bucket(uint64_t ns)
+{
+    unsigned bucket = ns ? 64 - __builtin_clzll(ns) : 0;
+
+    return bucket < XAMINE_STATS_LATENCY_BUCKETS ? bucket : XAMINE_STATS_LATENCY_BUCKETS - 1;
+}
+
+void
+stats_record(struct stats *stats, enum xamine_direction direction,
+             const unsigned char *data, size_t size,
+             enum stats_outcome outcome, uint64_t start)
+{
+    struct stats_counts *counts = stats_counts(stats, direction, data, size);
+
+    if (!counts)
+        return;
+    atomic_fetch_add_explicit(&counts->packets, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&counts->bytes, size, memory_order_relaxed);
+
+    switch (outcome) {
+    case STATS_FAILED:
+        atomic_fetch_add_explicit(&counts->failures, 1, memory_order_relaxed);
+        /* fall through */
+    case STATS_DECODED:
+        atomic_fetch_add_explicit(&stats->latency[stats_bucket(stats_now() - start)], 1,
+                                  memory_order_relaxed);
+        break;
+    case STATS_UNKNOWN:
+        atomic_fetch_add_explicit(&counts->unknown, 1, memory_order_relaxed);
+        break;
+    case STATS_FILTERED:
+        break;
+    }
+}
+
+static void
+stats_copy_counts(struct xamine_stats_counts *to, const struct stats_counts *from)
+{
+    to->packets = atomic_load_explicit(&from->packets, memory_order_relaxed);
+    to->bytes = atomic_load_explicit(&from->bytes, memory_order_relaxed);
+    to->failures = atomic_load_explicit(&from->failures, memory_order_relaxed);
+    to->unknown = atomic_load_explicit(&from->unknown, memory_order_relaxed);
+}
+
+XAMINE_EXPORT int
+xamine_conversation_get_stats(const struct xamine_conversation *conversation,
+                              struct xamine_stats *stats)
+{
+    const struct stats *from = conversation->stats;
+
+    if (!from)
+        return -1;
+
+    for (int i = 0; i < 256; i++)
+        stats_copy_counts(&stats->requests[i], &from->requests[i]);
+    for (int i = 0; i < 128; i++)
+        stats_copy_counts(&stats->events[i], &from->events[i]);
+    for (int i = 0; i < 256; i++)
+        stats_copy_counts(&stats->errors[i], &from->errors[i]);
+    stats_copy_counts(&stats->replies, &from->replies);
+    for (int i = 0; i < XAMINE_STATS_LATENCY_BUCKETS; i++)
+        stats->latency[i] = atomic_load_explicit(&from->latency[i], memory_order_relaxed);
+    return 0;
+}
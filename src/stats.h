@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2004-2005 Josh Triplett
+ *
+ * This package is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ *
+ * This package is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ */
+
+#ifndef XAMINE_STATS_H
+#define XAMINE_STATS_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "xamine.h"
+
+/*
+ * The statistics of a conversation, counted with relaxed atomics so that
+ * threads examining packets of the same conversation, and a thread taking
+ * snapshots, need no lock.  Conversations without XAMINE_CONVERSATION_STATS
+ * have none, and pay one branch per packet for them.
+ */
+
+struct stats_counts {
+    atomic_uint_fast64_t packets;
+    atomic_uint_fast64_t bytes;
+    atomic_uint_fast64_t failures;
+    atomic_uint_fast64_t unknown;
+};
+
+struct stats {
+    struct stats_counts requests[256];
+    struct stats_counts events[128];
+    struct stats_counts errors[256];
+    struct stats_counts replies;
+    atomic_uint_fast64_t latency[XAMINE_STATS_LATENCY_BUCKETS];
+};
+
+enum stats_outcome {
+    STATS_DECODED,
+    STATS_FAILED,
+    STATS_UNKNOWN,
+    STATS_FILTERED
+};
+
+/* Get the time in nanoseconds to start timing a decode. */
+static inline uint64_t
+stats_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Count a packet of size bytes, and for decoded and failed packets, the time
+ * since start.
+ */
+void
+stats_record(struct stats *stats, enum xamine_direction direction,
+             const unsigned char *data, size_t size,
+             enum stats_outcome outcome, uint64_t start);
+
+#endif /* XAMINE_STATS_H */
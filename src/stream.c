@@ -0,0 +1,300 @@
+/*
+ * Copyright (C) 2004-2005 Josh Triplett
+ *
+ * This package is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ *
+ * This package is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+#include "xamine-private.h"
+
+/* Framing of the X protocol streams fed to a conversation. */
+
+#define QUERY_EXTENSION 98
+
+static uint64_t
+pad4(uint64_t length)
+{
+    return (length + 3) & ~(uint64_t) 3;
+}
+
+/* Like xamine_packet_size, but for the connection setup as well. */
+static uint64_t
+stream_packet_size(const struct xamine_conversation *conversation,
+                   enum xamine_direction direction,
+                   const struct xamine_stream *stream,
+                   const unsigned char *data, size_t avail)
+{
+    bool is_le = conversation->is_le;
+
+    if (!stream->setup_done) {
+        if (direction == XAMINE_REQUEST) {
+            /* Byte order, pad, protocol version, authorization name and
+             * data lengths, pad; then the authorization name and data. */
+            if (avail < 12)
+                return 12;
+            if (data[0] != 'l' && data[0] != 'B')
+                return 0;
+            is_le = data[0] == 'l';
+            return 12 + pad4(xamine_read_unsigned(data + 6, 2, is_le))
+                      + pad4(xamine_read_unsigned(data + 8, 2, is_le));
+        }
+
+        /* Status, then the length of the rest in 4-byte units. */
+        if (avail < 8)
+            return 8;
+        return 8 + 4 * (uint64_t) xamine_read_unsigned(data + 6, 2, is_le);
+    }
+
+    return xamine_packet_size(conversation, direction, data, avail);
+}
+
+uint64_t
+xamine_packet_size(const struct xamine_conversation *conversation,
+                   enum xamine_direction direction,
+                   const unsigned char *data, size_t avail)
+{
+    bool is_le = conversation->is_le;
+    uint64_t length;
+
+    if (direction == XAMINE_REQUEST) {
+        /* A zero length means a BIG-REQUESTS length follows. */
+        if (avail < 4)
+            return 4;
+        length = xamine_read_unsigned(data + 2, 2, is_le);
+        if (length)
+            return 4 * length;
+        if (avail < 8)
+            return 8;
+        length = xamine_read_unsigned(data + 4, 4, is_le);
+        return length >= 2 ? 4 * length : 0;
+    }
+
+    /* Replies and generic events have extra data after 32 bytes. */
+    if (avail < 32)
+        return 32;
+    if (data[0] == 1 || data[0] == XAMINE_GENERIC_EVENT)
+        return 32 + 4 * (uint64_t) xamine_read_unsigned(data + 4, 4, is_le);
+    return 32;
+}
+
+static bool
+stream_append(struct xamine_stream *stream, const unsigned char *data,
+              size_t size)
+{
+    if (stream->length + size > stream->alloc) {
+        size_t alloc = stream->alloc ? 2 * stream->alloc : 64;
+        unsigned char *buffer;
+
+        if (alloc < stream->length + size)
+            alloc = stream->length + size;
+        buffer = realloc(stream->buffer, alloc);
+        if (!buffer)
+            return false;
+        stream->buffer = buffer;
+        stream->alloc = alloc;
+    }
+
+    memcpy(stream->buffer + stream->length, data, size);
+    stream->length += size;
+    return true;
+}
+
+/* Replies */
+
+uint64_t
+xamine_response_sequence(const struct xamine_conversation *conversation,
+                         const unsigned char *data)
+{
+    /* Responses come after their requests, so take the latest sequence
+     * number at or before the last request with the same low bits. */
+    uint16_t low = xamine_read_unsigned(data + 2, 2, conversation->is_le);
+    uint16_t behind = (uint16_t) conversation->sequence - low;
+
+    if (behind > conversation->sequence)
+        return 0;               /* Before the first request */
+    return conversation->sequence - behind;
+}
+
+const struct xamine_definition *
+xamine_pending_reply(const struct xamine_conversation *conversation,
+                     uint64_t sequence)
+{
+    const struct xamine_pending_reply *pending =
+        &conversation->pending[sequence % XAMINE_PENDING_REPLIES];
+
+    return pending->sequence == sequence ? pending->definition : NULL;
+}
+
+/*
+ * Forget the pending replies to requests up to sequence, which will get no
+ * more.  Only the slots of the requests retired since last time are
+ * cleared, at most the whole ring.
+ */
+static void
+stream_retire(struct xamine_conversation *conversation, uint64_t sequence)
+{
+    uint64_t first = conversation->retired + 1;
+
+    if (sequence <= conversation->retired)
+        return;
+    if (sequence - conversation->retired > XAMINE_PENDING_REPLIES)
+        first = sequence - XAMINE_PENDING_REPLIES + 1;
+    for (uint64_t i = first; i <= sequence; i++) {
+        struct xamine_pending_reply *pending =
+            &conversation->pending[i % XAMINE_PENDING_REPLIES];
+
+        if (pending->sequence <= sequence)
+            memset(pending, 0, sizeof(*pending));
+    }
+    conversation->retired = sequence;
+}
+
+/*
+ * Follow the sequence numbers of a packet.  Every request gets the next
+ * sequence number, and a request with replies takes the slot for it in
+ * the ring of pending replies, until a later response retires it.
+ * Replies to QueryExtension tell where the extension's requests, events
+ * and errors are.
+ */
+static void
+stream_track(struct xamine_conversation *conversation,
+             enum xamine_direction direction, const unsigned char *data,
+             size_t size)
+{
+    if (direction == XAMINE_REQUEST) {
+        const struct xamine_definition *reply;
+        struct xamine_pending_reply *pending;
+
+        conversation->sequence++;
+        reply = xamine_request_definition(conversation, data, true);
+        if (!reply)
+            return;
+        pending = &conversation->pending[conversation->sequence % XAMINE_PENDING_REPLIES];
+        pending->sequence = conversation->sequence;
+        pending->definition = reply;
+        pending->extension = NULL;
+
+        /* The name length, 2 bytes of pad, then the name. */
+        if (data[0] == QUERY_EXTENSION && size >= 8) {
+            size_t length = xamine_read_unsigned(data + 4, 2, conversation->is_le);
+            if (length <= size - 8)
+                pending->extension = xamine_find_extension(conversation->ctx,
+                                                           (const char *) data + 8,
+                                                           length);
+        }
+    }
+    else if (data[0] == 1) {
+        uint64_t sequence = xamine_response_sequence(conversation, data);
+        const struct xamine_pending_reply *pending =
+            &conversation->pending[sequence % XAMINE_PENDING_REPLIES];
+
+        /* Present, major opcode, first event, first error. */
+        if (pending->sequence == sequence && pending->extension &&
+            data[8] && data[9] >= 128)
+            xamine_conversation_add_extension(conversation, pending->extension,
+                                              data[9], data[10], data[11]);
+        if (sequence > 0)
+            stream_retire(conversation, sequence - 1);
+    }
+    else if (data[0] == 0)
+        stream_retire(conversation, xamine_response_sequence(conversation, data));
+}
+
+static void
+stream_deliver(struct xamine_conversation *conversation,
+               enum xamine_direction direction, struct xamine_stream *stream,
+               const unsigned char *data, size_t size)
+{
+    if (!stream->setup_done) {
+        if (direction == XAMINE_REQUEST)
+            conversation->is_le = data[0] == 'l';
+        stream->setup_done = true;
+        return;
+    }
+
+    stream_track(conversation, direction, data, size);
+    if (conversation->packet_func)
+        conversation->packet_func(conversation, direction, data, size,
+                                  conversation->packet_closure);
+}
+
+XAMINE_EXPORT void
+xamine_conversation_set_packet_func(struct xamine_conversation *conversation,
+                                    xamine_packet_func func, void *closure)
+{
+    conversation->packet_func = func;
+    conversation->packet_closure = closure;
+}
+
+XAMINE_EXPORT int
+xamine_conversation_feed(struct xamine_conversation *conversation,
+                         enum xamine_direction direction,
+                         const void *data_void, size_t size)
+{
+    const unsigned char *data = data_void;
+    struct xamine_stream *stream;
+    uint64_t need;
+
+    if (direction != XAMINE_REQUEST && direction != XAMINE_RESPONSE)
+        return -1;
+    stream = &conversation->streams[direction];
+    if (stream->broken)
+        return -1;
+
+    /* Complete a packet left over from earlier chunks, copying only the
+     * bytes it is missing.  Completing the header may make it bigger. */
+    while (stream->length > 0) {
+        need = stream_packet_size(conversation, direction, stream,
+                                  stream->buffer, stream->length);
+        if (need == 0 || need > SIZE_MAX)
+            goto broken;
+        if (need > stream->length) {
+            size_t take = need - stream->length < size ? need - stream->length : size;
+
+            if (!stream_append(stream, data, take))
+                goto broken;
+            data += take;
+            size -= take;
+            if (stream->length < need)
+                return 0;
+            continue;
+        }
+        stream->length = 0;
+        stream_deliver(conversation, direction, stream, stream->buffer, need);
+    }
+
+    /* Deliver whole packets in place, and keep the start of the last one
+     * if it is incomplete. */
+    while (size > 0) {
+        need = stream_packet_size(conversation, direction, stream, data, size);
+        if (need == 0 || need > SIZE_MAX)
+            goto broken;
+        if (need > size) {
+            if (!stream_append(stream, data, size))
+                goto broken;
+            return 0;
+        }
+        stream_deliver(conversation, direction, stream, data, need);
+        data += need;
+        size -= need;
+    }
+
+    return 0;
+
+broken:
+    stream->broken = true;
+    stream->length = 0;
+    return -1;
+}
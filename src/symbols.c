@@ -0,0 +1,143 @@
+/*
+ * Copyright (C) 2004-2005 Josh Triplett
+ *
+ * This package is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ *
+ * This package is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ */
+
+#include <stdlib.h>
+
+#include "symbols.h"
+
+/* Open-addressing hash table with linear probing, at most half full. */
+
+struct symbol {
+    uint32_t kind;
+    xamine_atom scope;
+    xamine_atom name;   /* XAMINE_ATOM_NONE for an empty slot */
+    void *value;
+};
+
+struct symbol_table {
+    struct symbol *slots;
+    uint32_t mask;
+    uint32_t count;
+};
+
+static uint32_t
+symbol_hash(enum symbol_kind kind, xamine_atom scope, xamine_atom name)
+{
+    uint64_t key = ((uint64_t) scope << 32 | name) ^ ((uint64_t) kind << 61);
+
+    key ^= key >> 33;
+    key *= UINT64_C(0xff51afd7ed558ccd);
+    key ^= key >> 33;
+    return (uint32_t) key;
+}
+
+struct symbol_table *
+symbol_table_new(void)
+{
+    struct symbol_table *table = calloc(1, sizeof(*table));
+
+    if (!table)
+        return NULL;
+
+    table->mask = 4095;
+    table->slots = calloc(table->mask + 1, sizeof(*table->slots));
+    if (!table->slots) {
+        free(table);
+        return NULL;
+    }
+
+    return table;
+}
+
+void
+symbol_table_free(struct symbol_table *table)
+{
+    if (!table)
+        return;
+
+    free(table->slots);
+    free(table);
+}
+
+static struct symbol *
+symbol_slot(struct symbol *slots, uint32_t mask, enum symbol_kind kind,
+            xamine_atom scope, xamine_atom name)
+{
+    uint32_t i = symbol_hash(kind, scope, name) & mask;
+
+    while (slots[i].name != XAMINE_ATOM_NONE &&
+           (slots[i].kind != kind || slots[i].scope != scope ||
+            slots[i].name != name))
+        i = (i + 1) & mask;
+
+    return &slots[i];
+}
+
+static bool
+symbol_table_grow(struct symbol_table *table)
+{
+    uint32_t mask = table->mask * 2 + 1;
+    struct symbol *slots = calloc(mask + 1, sizeof(*slots));
+
+    if (!slots)
+        return false;
+
+    for (uint32_t i = 0; i <= table->mask; i++) {
+        const struct symbol *old = &table->slots[i];
+        if (old->name != XAMINE_ATOM_NONE)
+            *symbol_slot(slots, mask, old->kind, old->scope, old->name) = *old;
+    }
+
+    free(table->slots);
+    table->slots = slots;
+    table->mask = mask;
+    return true;
+}
+
+bool
+symbol_table_add(struct symbol_table *table, enum symbol_kind kind,
+                 xamine_atom scope, xamine_atom name, void *value)
+{
+    struct symbol *slot;
+
+    if (name == XAMINE_ATOM_NONE)
+        return false;
+
+    if (2 * (table->count + 1) > table->mask + 1 && !symbol_table_grow(table))
+        return false;
+
+    slot = symbol_slot(table->slots, table->mask, kind, scope, name);
+    if (slot->name != XAMINE_ATOM_NONE)
+        return false;
+
+    slot->kind = kind;
+    slot->scope = scope;
+    slot->name = name;
+    slot->value = value;
+    table->count++;
+    return true;
+}
+
+void *
+symbol_table_find(const struct symbol_table *table, enum symbol_kind kind,
+                  xamine_atom scope, xamine_atom name)
+{
+    const struct symbol *slot;
+
+    if (name == XAMINE_ATOM_NONE)
+        return NULL;
+
+    slot = symbol_slot(table->slots, table->mask, kind, scope, name);
+    return slot->name != XAMINE_ATOM_NONE ? slot->value : NULL;
+}
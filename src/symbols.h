@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2004-2005 Josh Triplett
+ *
+ * This package is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ *
+ * This package is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ */
+
+#ifndef XAMINE_SYMBOLS_H
+#define XAMINE_SYMBOLS_H
+
+#include "atom.h"
+
+/*
+ * The symbol table maps the unqualified names used in the XML-XCB
+ * descriptions to definitions.  Each name lives in the scope of the module
+ * (XML file) that defines it, and events and errors have namespaces of
+ * their own, as in XCB.
+ */
+
+enum symbol_kind {
+    SYMBOL_TYPE,
+    SYMBOL_EVENT,
+    SYMBOL_ERROR
+};
+
+struct symbol_table;
+
+struct symbol_table *
+symbol_table_new(void);
+
+void
+symbol_table_free(struct symbol_table *table);
+
+/*
+ * Add a definition.  Returns false if the name is already defined in the
+ * scope, or on allocation failure.
+ */
+bool
+symbol_table_add(struct symbol_table *table, enum symbol_kind kind,
+                 xamine_atom scope, xamine_atom name, void *value);
+
+/* Find a definition in exactly the given scope, or return NULL. */
+void *
+symbol_table_find(const struct symbol_table *table, enum symbol_kind kind,
+                  xamine_atom scope, xamine_atom name);
+
+#endif /* XAMINE_SYMBOLS_H */
@@ -0,0 +1,320 @@
+/*
+ * Copyright (C) 2004-2005 Josh Triplett
+ *
+ * This package is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ *
+ * This package is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ */
+
+/*
+ * A trace file holds raw chunks of X protocol streams, as captured, in
+ * order of time.  It is written in host byte order: a header, then the
+ * records, each aligned to 8 bytes, then an index with an entry for every
+ * block of TRACE_BLOCK_RECORDS records.  The header is written last, so a
+ * file whose writer did not finish has no index and is not read.
+ *
+ * Readers map the file and return pointers to the data of the records in
+ * place.  Seeking to a record number or a time looks the block up in the
+ * index, and then steps through at most one block of records.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "utils.h"
+#include "xamine-private.h"
+
+#define TRACE_MAGIC "XAMINE\0T"
+#define TRACE_VERSION 1
+#define TRACE_BYTE_ORDER 0x01020304
+#define TRACE_BLOCK_RECORDS 256
+
+struct trace_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;    /* TRACE_BYTE_ORDER in the writer's byte order */
+    uint64_t size;          /* Size of the whole file */
+    uint64_t nrecords;
+    uint64_t index;         /* Offset of the index */
+    uint64_t nblocks;
+};
+
+struct trace_record {
+    uint64_t time;
+    uint32_t conversation;
+    uint32_t direction;
+    uint64_t size;          /* Of the data that follows */
+};
+
+struct trace_block {
+    uint64_t offset;        /* Of the first record */
+    uint64_t time;          /* Of the first record */
+};
+
+static uint64_t
+pad8(uint64_t length)
+{
+    return (length + 7) & ~(uint64_t) 7;
+}
+
+/********** Writing **********/
+
+struct xamine_trace_writer {
+    FILE *file;
+    uint64_t offset;
+    uint64_t nrecords;
+    uint64_t last_time;
+    struct trace_block *blocks;
+    uint64_t nblocks;
+    uint64_t alloc;
+    bool failed;
+};
+
+static void
+trace_write(struct xamine_trace_writer *writer, const void *data, size_t size)
+{
+    if (size && fwrite(data, size, 1, writer->file) != 1)
+        writer->failed = true;
+    writer->offset += size;
+}
+
+XAMINE_EXPORT struct xamine_trace_writer *
+xamine_trace_writer_new(const char *path)
+{
+    struct trace_header header = { { 0 } };
+    struct xamine_trace_writer *writer;
+
+    writer = calloc(1, sizeof(*writer));
+    if (!writer)
+        return NULL;
+    writer->file = fopen(path, "wbe");
+    if (!writer->file) {
+        free(writer);
+        return NULL;
+    }
+
+    /* Leave room for the header, which is written when the file is done. */
+    trace_write(writer, &header, sizeof(header));
+    return writer;
+}
+
+XAMINE_EXPORT int
+xamine_trace_write(struct xamine_trace_writer *writer, uint64_t time,
+                   unsigned conversation, enum xamine_direction direction,
+                   const void *data, size_t size)
+{
+    static const char zero[8];
+    struct trace_record record = { 0 };
+
+    if (writer->failed || time < writer->last_time ||
+        (direction != XAMINE_REQUEST && direction != XAMINE_RESPONSE))
+        return -1;
+
+    if (writer->nrecords % TRACE_BLOCK_RECORDS == 0) {
+        if (writer->nblocks == writer->alloc) {
+            uint64_t alloc = writer->alloc ? 2 * writer->alloc : 64;
+            struct trace_block *blocks = realloc(writer->blocks, alloc * sizeof(*blocks));
+
+            if (!blocks)
+                return -1;
+            writer->blocks = blocks;
+            writer->alloc = alloc;
+        }
+        writer->blocks[writer->nblocks].offset = writer->offset;
+        writer->blocks[writer->nblocks].time = time;
+        writer->nblocks++;
+    }
+
+    record.time = time;
+    record.conversation = conversation;
+    record.direction = direction;
+    record.size = size;
+    trace_write(writer, &record, sizeof(record));
+    trace_write(writer, data, size);
+    trace_write(writer, zero, pad8(size) - size);
+    writer->nrecords++;
+    writer->last_time = time;
+
+    return writer->failed ? -1 : 0;
+}
+
+XAMINE_EXPORT int
+xamine_trace_writer_close(struct xamine_trace_writer *writer)
+{
+    struct trace_header header = { { 0 } };
+    bool ok;
+
+    if (!writer)
+        return -1;
+
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.version = TRACE_VERSION;
+    header.byte_order = TRACE_BYTE_ORDER;
+    header.nrecords = writer->nrecords;
+    header.index = writer->offset;
+    header.nblocks = writer->nblocks;
+    trace_write(writer, writer->blocks, writer->nblocks * sizeof(*writer->blocks));
+    header.size = writer->offset;
+
+    if (!writer->failed &&
+        (fseek(writer->file, 0, SEEK_SET) != 0 ||
+         fwrite(&header, sizeof(header), 1, writer->file) != 1))
+        writer->failed = true;
+    ok = fclose(writer->file) == 0 && !writer->failed;
+
+    free(writer->blocks);
+    free(writer);
+    return ok ? 0 : -1;
+}
+
+/********** Reading **********/
+
+struct xamine_trace {
+    const unsigned char *map;
+    size_t size;
+    const struct trace_header *header;
+    const struct trace_block *blocks;
+};
+
+XAMINE_EXPORT struct xamine_trace *
+xamine_trace_open(const char *path)
+{
+    struct xamine_trace *trace;
+    const struct trace_header *h;
+    struct stat st;
+    void *map;
+    int fd;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t) sizeof(struct trace_header)) {
+        close(fd);
+        return NULL;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    h = map;
+    if (memcmp(h->magic, TRACE_MAGIC, sizeof(h->magic)) != 0 ||
+        h->version != TRACE_VERSION ||
+        h->byte_order != TRACE_BYTE_ORDER ||
+        h->size != (uint64_t) st.st_size ||
+        h->index % 8 != 0 || h->index < sizeof(*h) || h->index > h->size ||
+        h->nblocks > (h->size - h->index) / sizeof(struct trace_block) ||
+        h->nblocks != (h->nrecords + TRACE_BLOCK_RECORDS - 1) / TRACE_BLOCK_RECORDS) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    trace = calloc(1, sizeof(*trace));
+    if (!trace) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    trace->map = map;
+    trace->size = st.st_size;
+    trace->header = h;
+    trace->blocks = (const struct trace_block *) (trace->map + h->index);
+    return trace;
+}
+
+XAMINE_EXPORT void
+xamine_trace_close(struct xamine_trace *trace)
+{
+    if (!trace)
+        return;
+    munmap((void *) trace->map, trace->size);
+    free(trace);
+}
+
+XAMINE_EXPORT uint64_t
+xamine_trace_count(const struct xamine_trace *trace)
+{
+    return trace->header->nrecords;
+}
+
+/* Read the record at an offset, checking that it lies within the records. */
+static int
+trace_read(const struct xamine_trace *trace, uint64_t number, uint64_t offset,
+           struct xamine_trace_record *record)
+{
+    const struct trace_record *r;
+
+    if (number >= trace->header->nrecords || offset % 8 != 0 ||
+        offset < sizeof(struct trace_header) || offset > trace->header->index ||
+        trace->header->index - offset < sizeof(*r))
+        return -1;
+    r = (const struct trace_record *) (trace->map + offset);
+    if (r->size > trace->header->index - offset - sizeof(*r) ||
+        (r->direction != XAMINE_REQUEST && r->direction != XAMINE_RESPONSE))
+        return -1;
+
+    record->number = number;
+    record->time = r->time;
+    record->conversation = r->conversation;
+    record->direction = r->direction;
+    record->data = r + 1;
+    record->size = r->size;
+    record->next = offset + sizeof(*r) + pad8(r->size);
+    return 0;
+}
+
+XAMINE_EXPORT int
+xamine_trace_next(const struct xamine_trace *trace,
+                  struct xamine_trace_record *record)
+{
+    return trace_read(trace, record->number + 1, record->next, record);
+}
+
+XAMINE_EXPORT int
+xamine_trace_seek(const struct xamine_trace *trace, uint64_t number,
+                  struct xamine_trace_record *record)
+{
+    uint64_t block = number / TRACE_BLOCK_RECORDS;
+
+    if (number >= trace->header->nrecords)
+        return -1;
+    if (trace_read(trace, block * TRACE_BLOCK_RECORDS, trace->blocks[block].offset, record) < 0)
+        return -1;
+    while (record->number < number)
+        if (xamine_trace_next(trace, record) < 0)
+            return -1;
+    return 0;
+}
+
+XAMINE_EXPORT int
+xamine_trace_seek_time(const struct xamine_trace *trace, uint64_t time,
+                       struct xamine_trace_record *record)
+{
+    uint64_t low = 0, high = trace->header->nblocks;
+
+    /* Find the last block starting before the time; the record may be
+     * in it, or be the first of the next block. */
+    while (low < high) {
+        uint64_t mid = low + (high - low) / 2;
+        if (trace->blocks[mid].time < time)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    if (xamine_trace_seek(trace, low > 0 ? (low - 1) * TRACE_BLOCK_RECORDS : 0, record) < 0)
+        return -1;
+    while (record->time < time)
+        if (xamine_trace_next(trace, record) < 0)
+            return -1;
+    return 0;
+}
@@ -102,3 +102,51 @@ strsplit_free(char **tokens)
     free(*tokens);
     free(tokens);
 }
+
+/*
+ * The values are swapped in blocks of 32 bytes, which the compiler turns
+ * into vector shuffles even where it does not vectorize loops of unknown
+ * length, and with ATTR_TARGET_CLONES, into the widest ones the processor
+ * has.
+ */
+ATTR_TARGET_CLONES void
+swap16_array(uint16_t *restrict values, const unsigned char *restrict data, size_t count)
+{
+    size_t i = 0;
+
+    for (; i + 16 <= count; i += 16) {
+        for (int j = 0; j < 16; j++) {
+            uint16_t value;
+
+            memcpy(&value, data + 2 * (i + j), sizeof(value));
+            values[i + j] = __builtin_bswap16(value);
+        }
+    }
+    for (; i < count; i++) {
+        uint16_t value;
+
+        memcpy(&value, data + 2 * i, sizeof(value));
+        values[i] = __builtin_bswap16(value);
+    }
+}
+
+ATTR_TARGET_CLONES void
+swap32_array(uint32_t *restrict values, const unsigned char *restrict data, size_t count)
+{
+    size_t i = 0;
+
+    for (; i + 8 <= count; i += 8) {
+        for (int j = 0; j < 8; j++) {
+            uint32_t value;
+
+            memcpy(&value, data + 4 * (i + j), sizeof(value));
+            values[i + j] = __builtin_bswap32(value);
+        }
+    }
+    for (; i < count; i++) {
+        uint32_t value;
+
+        memcpy(&value, data + 4 * i, sizeof(value));
+        values[i] = __builtin_bswap32(value);
+    }
+}
@@ -16,6 +16,8 @@
 #define XAMINE_UTILS_H
 
 #include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <string.h>
 
 #if defined(__GNUC__) && (__GNUC__ >= 4) && !defined(__CYGWIN__)
@@ -32,6 +34,12 @@
 # define ATTR_PRINTF(x,y)
 #endif
 
+#ifdef HAVE_TARGET_CLONES
+# define ATTR_TARGET_CLONES __attribute__((target_clones("avx2", "ssse3", "default")))
+#else
+# define ATTR_TARGET_CLONES
+#endif
+
 #define ARRAY_SIZE(arr) (sizeof(arr) / sizeof(*arr))
 
 #define streq(s1, s2) (strcmp((s1), (s2)) == 0)
@@ -56,4 +64,14 @@ strsplit(const char *str, const char *delim);
 void
 strsplit_free(char **tokens);
 
+/*
+ * Byte-swap count 16-bit or 32-bit values from data into values, which
+ * must not overlap.
+ */
+void
+swap16_array(uint16_t *values, const unsigned char *data, size_t count);
+
+void
+swap32_array(uint32_t *values, const unsigned char *data, size_t count);
+
 #endif
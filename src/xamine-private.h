@@ -0,0 +1,481 @@
+/*
+ * Copyright (C) 2004-2005 Josh Triplett
+ *
+ * This package is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ *
+ * This package is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ */
+
+#ifndef XAMINE_PRIVATE_H
+#define XAMINE_PRIVATE_H
+
+#include <glob.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "atom.h"
+#include "utils.h"
+#include "xamine.h"
+
+/*
+ * The event code of GenericEvent, which carries the events of extensions
+ * marked xge="true": they are told apart by the major opcode of their
+ * extension and an event type of 16 bits, not by their event code.
+ */
+#define XAMINE_GENERIC_EVENT 35
+
+/* Concrete definitions for opaque and private structure types. */
+struct xamine_event {
+    uint16_t number;            /* The event type, for XGE events */
+    const struct xamine_definition *definition;
+    struct xamine_event *next;
+};
+
+struct xamine_error {
+    unsigned char number;
+    const struct xamine_definition *definition;
+    struct xamine_error *next;
+};
+
+struct xamine_extension {
+    const char *name;
+    const char *xname;
+    struct xamine_event *events;
+    struct xamine_event *generic_events;    /* Sent in GenericEvent, by event type */
+    struct xamine_error *errors;
+    struct xamine_definition *requests[256];    /* By minor opcode */
+    struct xamine_definition *replies[256];     /* By minor opcode */
+    struct xamine_definition *big_requests[256];    /* With BIG-REQUESTS length */
+    struct xamine_extension *next;
+
+    /* With XAMINE_CONTEXT_LAZY, the description is parsed when the
+     * extension is first looked up. */
+    size_t file;                /* Index of its description in the files */
+    atomic_bool pending;        /* Not parsed yet */
+};
+
+/* An XML-XCB description file, and the scopes its names are looked up in. */
+struct xamine_module {
+    char *filename;
+    xamine_atom name;                   /* The "header" attribute */
+    xamine_atom *imports;
+    size_t nimports;
+    struct xamine_extension *extension; /* NULL for the core protocol */
+    struct xamine_module *next;
+};
+
+/*
+ * A context is not changed after xamine_context_new returns, apart from its
+ * reference count, so any number of threads can use it at once.  The
+ * exception is a lazy context loading an extension: that happens under the
+ * lock, adds definitions only ahead of the list, and publishes the extension
+ * by clearing its pending flag once it is complete.
+ */
+struct xamine_context {
+    atomic_int refcnt;
+    enum xamine_context_flags flags;
+
+    unsigned char host_is_le;
+    struct xamine_definition *definitions;
+    struct xamine_definition *core_events[64];  /* Core events 2-63 (0-1 unused) */
+    struct xamine_definition *core_errors[128]; /* Core errors 0-127             */
+    struct xamine_definition *core_requests[128];   /* Core requests 1-127       */
+    struct xamine_definition *core_replies[128];    /* Their replies             */
+    struct xamine_definition *core_big_requests[128];   /* As big requests       */
+    struct xamine_definition *big_requests; /* Owns the big request variants */
+    struct xamine_extension *extensions;
+
+    struct atom_table *atoms;       /* Owns all definition names */
+    struct symbol_table *symbols;   /* Used while loading definitions */
+    struct xamine_module *modules;
+
+    uint64_t cache_key;         /* Identifies the XML files loaded */
+    struct xamine_cache *cache; /* Non-NULL if loaded from a cache file */
+
+    struct program_table *programs; /* NULL with XAMINE_CONTEXT_NO_COMPILE */
+
+    pthread_mutex_t lock;       /* Held while loading lazily */
+    glob_t files;               /* The XML files, kept to load lazily */
+};
+
+/* One direction of a connection, as fed to xamine_conversation_feed. */
+struct xamine_stream {
+    unsigned char *buffer;      /* The start of a packet split across chunks */
+    size_t length;
+    size_t alloc;
+    bool setup_done;
+    bool broken;
+};
+
+/*
+ * Requests with replies are kept in a ring of fixed size, indexed by their
+ * sequence numbers, so a reply finds its request in one step.  If a client
+ * sends more requests than the ring holds without waiting for the replies,
+ * the oldest are overwritten and their replies cannot be examined.
+ * Responses come in the order of their requests, so a reply retires the
+ * requests before its own, which may have more replies, and an error
+ * retires its own request as well.
+ */
+#define XAMINE_PENDING_REPLIES 256
+
+struct xamine_pending_reply {
+    uint64_t sequence;
+    const struct xamine_definition *definition;     /* Of the reply */
+    const struct xamine_extension *extension;       /* Queried, if known */
+};
+
+struct stats;
+
+struct xamine_conversation {
+    struct xamine_context *ctx;
+    atomic_int refcnt;
+    enum xamine_conversation_flags flags;
+
+    unsigned char is_le;
+    const struct xamine_definition *extension_events[64];  /* Extension events 64-127  */
+    const struct xamine_definition *extension_errors[128]; /* Extension errors 128-255 */
+    const struct xamine_extension *extensions[128];        /* Extensions 128-255       */
+
+    struct xamine_stream streams[2];    /* Indexed by enum xamine_direction */
+    xamine_packet_func packet_func;
+    void *packet_closure;
+    const struct xamine_filter *filter;
+    struct stats *stats;                /* NULL without XAMINE_CONVERSATION_STATS */
+
+    uint64_t sequence;                  /* Of the last request fed */
+    uint64_t retired;                   /* Of the last request answered */
+    struct xamine_pending_reply pending[XAMINE_PENDING_REPLIES];
+};
+
+/* Definitions (xamine.c) */
+
+/*
+ * Get the size of a definition whose layout does not depend on the data.
+ * Returns false for other definitions.
+ */
+bool
+xamine_static_size(const struct xamine_definition *definition, size_t *size);
+
+/*
+ * Find an extension by its X name, which need not be NUL-terminated, loading
+ * its description first if the context is lazy.
+ */
+const struct xamine_extension *
+xamine_find_extension(struct xamine_context *ctx, const char *xname,
+                      size_t length);
+
+/* Get the definitions loaded so far, which later loads only add ahead of. */
+const struct xamine_definition *
+xamine_context_definitions(struct xamine_context *ctx);
+
+/*
+ * Load the extensions of a lazy context that a packet name could belong to,
+ * as extension packets are named after their extension.  Returns true if
+ * any were loaded.
+ */
+bool
+xamine_load_packet_extensions(struct xamine_context *ctx, const char *name);
+
+/* Dispatch the requests, events and errors of an extension. */
+void
+xamine_conversation_add_extension(struct xamine_conversation *conversation,
+                                  const struct xamine_extension *extension,
+                                  unsigned char major_opcode,
+                                  unsigned char first_event,
+                                  unsigned char first_error);
+
+/*
+ * Get the definition of a request, or of its reply if reply is true, from
+ * the first bytes of the request.  Returns NULL if there is none.
+ */
+const struct xamine_definition *
+xamine_request_definition(const struct xamine_conversation *conversation,
+                          const unsigned char *data, bool reply);
+
+/*
+ * Find the definition of a packet, and reduce size to the data it covers.
+ * Returns NULL if there is none.
+ */
+const struct xamine_definition *
+xamine_packet_definition(const struct xamine_conversation *conversation,
+                         enum xamine_direction direction,
+                         const unsigned char *data, size_t *size);
+
+struct program;
+
+/*
+ * Decode a packet with its program, or by walking its definition if it has
+ * none.  Returns NULL on failure.
+ */
+struct xamine_item *
+xamine_dissect(const struct xamine_conversation *conversation,
+               const struct xamine_definition *definition,
+               const struct program *program, struct xamine_arena *arena,
+               const unsigned char *data, size_t size);
+
+/*
+ * Get the form of a request used when it is sent as a big request, with an
+ * extra CARD32 length after the header.  Returns NULL if definition is not
+ * a request.
+ */
+const struct xamine_definition *
+xamine_big_request(const struct xamine_context *ctx,
+                   const struct xamine_definition *definition);
+
+/* Cursors and accessors (cursor.c, accessor.c) */
+
+/* Point a cursor at a whole packet whose definition is known. */
+void
+xamine_cursor_start(struct xamine_cursor *cursor,
+                    const struct xamine_conversation *conversation,
+                    const struct xamine_definition *definition,
+                    const unsigned char *data, size_t size);
+
+/*
+ * Find the definition of an event, request, reply or error by name.
+ * Returns NULL if there is none.
+ */
+const struct xamine_definition *
+xamine_find_packet(struct xamine_context *ctx, const char *name);
+
+/*
+ * Get the value of an accessor from a packet whose definition is known, with
+ * size reduced as by xamine_packet_definition.  Returns 0 on success, or -1
+ * if the packet is another one or is too short.
+ */
+int
+xamine_accessor_read(const struct xamine_accessor *accessor,
+                     const struct xamine_conversation *conversation,
+                     const struct xamine_definition *definition,
+                     const unsigned char *data, size_t size, long *value);
+
+/* Filters (filter.c) */
+
+/* Test a packet whose definition is known against a filter. */
+bool
+xamine_filter_test(const struct xamine_filter *filter,
+                   const struct xamine_conversation *conversation,
+                   const struct xamine_definition *definition,
+                   const unsigned char *data, size_t size);
+
+/* Framing and replies (stream.c) */
+
+/*
+ * Get the size of the packet after the connection setup at the start of
+ * data, of which avail bytes are available.  If that is not enough to tell,
+ * returns the number of bytes needed to tell instead, which is more than
+ * avail.  Returns 0 if the data is not a valid packet.
+ */
+uint64_t
+xamine_packet_size(const struct xamine_conversation *conversation,
+                   enum xamine_direction direction,
+                   const unsigned char *data, size_t avail);
+
+/* Widen the 16-bit sequence number of a response. */
+uint64_t
+xamine_response_sequence(const struct xamine_conversation *conversation,
+                         const unsigned char *data);
+
+/*
+ * Get the definition of the reply to a request fed to the conversation,
+ * or NULL if it is unknown.
+ */
+const struct xamine_definition *
+xamine_pending_reply(const struct xamine_conversation *conversation,
+                     uint64_t sequence);
+
+/* Results (xamine.c) */
+
+/*
+ * Allocate a zeroed item, from the arena if there is one and from the heap
+ * otherwise.
+ */
+struct xamine_item *
+xamine_item_new(struct xamine_arena *arena);
+
+/*
+ * Allocate an array item of count values of size bytes, zeroed but for the
+ * values, which follow the item in the same allocation.
+ */
+struct xamine_item *
+xamine_item_new_array(struct xamine_arena *arena, size_t count, size_t size);
+
+/* Get an item name for a definition name. */
+char *
+xamine_item_name(struct xamine_arena *arena, const char *name);
+
+/* Get the item name of a list element, "[index]". */
+char *
+xamine_item_index_name(struct xamine_arena *arena, size_t index);
+
+/* Release a partially built result. */
+static inline void
+xamine_item_discard(struct xamine_arena *arena, struct xamine_item *item)
+{
+    if (!arena)
+        xamine_item_free(item);
+}
+
+/* Read an unsigned integer of 1, 2 or 4 bytes in the given byte order. */
+static inline unsigned long
+xamine_read_unsigned(const unsigned char *data, size_t size, bool is_le)
+{
+    switch (size) {
+    case 1:
+        return data[0];
+    case 2:
+        return is_le ? (unsigned long) data[0] | (unsigned long) data[1] << 8
+                     : (unsigned long) data[0] << 8 | (unsigned long) data[1];
+    case 4:
+        return is_le ? (unsigned long) data[0] | (unsigned long) data[1] << 8 |
+                       (unsigned long) data[2] << 16 | (unsigned long) data[3] << 24
+                     : (unsigned long) data[0] << 24 | (unsigned long) data[1] << 16 |
+                       (unsigned long) data[2] << 8 | (unsigned long) data[3];
+    }
+    return 0;
+}
+
+/*
+ * Decode a value of a base type into item, and return it as an integer for
+ * use in expressions.
+ */
+static inline long
+xamine_decode_scalar(struct xamine_item *item, enum xamine_type type,
+                     size_t size, const unsigned char *data, bool is_le)
+{
+    unsigned long value = xamine_read_unsigned(data, size, is_le);
+
+    switch (type) {
+    case XAMINE_BOOL:
+        item->u.bool_value = value ? 1 : 0;
+        return item->u.bool_value;
+
+    case XAMINE_CHAR:
+        item->u.char_value = (char) value;
+        return item->u.char_value;
+
+    case XAMINE_SIGNED:
+        if (size < sizeof(long)) {
+            unsigned long sign = 1UL << (size * 8 - 1);
+            value = (value ^ sign) - sign;
+        }
+        item->u.signed_value = (long) value;
+        return item->u.signed_value;
+
+    case XAMINE_UNSIGNED:
+        item->u.unsigned_value = value;
+        return (long) value;
+
+    case XAMINE_STRUCT:
+    case XAMINE_UNION:
+    case XAMINE_TYPEDEF:
+        break;
+    }
+    return 0;
+}
+
+static inline bool
+xamine_host_is_le(void)
+{
+    const uint16_t one = 1;
+
+    return *(const unsigned char *) &one;
+}
+
+/*
+ * Decode count values of a base type of size bytes into an array in host
+ * byte order.  Data in host byte order is copied, and other data swapped
+ * in bulk.
+ */
+static inline void
+xamine_decode_array(void *values, size_t size, const unsigned char *data,
+                    size_t count, bool is_le)
+{
+    switch (size) {
+    case 1:
+        memcpy(values, data, count);
+        break;
+
+    case 2:
+        if (is_le == xamine_host_is_le())
+            memcpy(values, data, 2 * count);
+        else
+            swap16_array(values, data, count);
+        break;
+
+    case 4:
+        if (is_le == xamine_host_is_le())
+            memcpy(values, data, 4 * count);
+        else
+            swap32_array(values, data, count);
+        break;
+    }
+}
+
+/* Apply the operator of an expression.  Returns false if the result is
+ * undefined. */
+static inline bool
+xamine_apply_op(enum xamine_op op, long left, long right, long *result)
+{
+    switch (op) {
+    case XAMINE_ADD:         *result = left + right; return true;
+    case XAMINE_SUBTRACT:    *result = left - right; return true;
+    case XAMINE_MULTIPLY:    *result = left * right; return true;
+    case XAMINE_DIVIDE:
+        if (right == 0 || (left == LONG_MIN && right == -1))
+            return false;
+        *result = left / right;
+        return true;
+    case XAMINE_LEFT_SHIFT:
+        if (right < 0 || right >= (long) (sizeof(long) * CHAR_BIT))
+            return false;
+        *result = (long) ((unsigned long) left << right);
+        return true;
+    case XAMINE_BITWISE_AND: *result = left & right; return true;
+    }
+    return false;
+}
+
+/* Definition cache (cache.c) */
+
+/*
+ * Compute the cache key for a list of XML-XCB files, from their paths,
+ * sizes and modification times.
+ */
+uint64_t
+xamine_cache_key(char **files);
+
+/*
+ * Get the default location of the cache file.  Returns a newly allocated
+ * string, or NULL if there is no suitable location.
+ */
+char *
+xamine_cache_default_path(void);
+
+/*
+ * Fill in the definitions of ctx from the cache file at path, if it is valid
+ * and its key matches ctx->cache_key.  Returns true on success; on failure
+ * ctx is left untouched.
+ */
+bool
+xamine_cache_load(struct xamine_context *ctx, const char *path);
+
+/* Write the definitions of ctx to the cache file at path. */
+bool
+xamine_cache_write(const struct xamine_context *ctx, const char *path);
+
+/* Release the storage of a context loaded by xamine_cache_load. */
+void
+xamine_cache_free(struct xamine_cache *cache);
+
+#endif /* XAMINE_PRIVATE_H */
@@ -12,64 +12,28 @@
  * License for more details.
  */
 
-#include <assert.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include <glob.h>
+#include <unistd.h>
 #include <libxml/parser.h>
+#include <libxml/xmlreader.h>
 
+#include "arena.h"
+#include "atom.h"
+#include "program.h"
+#include "stats.h"
+#include "symbols.h"
 #include "utils.h"
-#include "xamine.h"
+#include "xamine-private.h"
 
 const char *XAMINE_PATH_DEFAULT = "/usr/share/xcb";
 const char *XAMINE_PATH_DELIM = ":";
 const char *XAMINE_PATH_GLOB = "/*.xml";
 
-/* Concrete definitions for opaque and private structure types. */
-struct xamine_event {
-    unsigned char number;
-    const struct xamine_definition *definition;
-    struct xamine_event *next;
-};
-
-struct xamine_error {
-    unsigned char number;
-    const struct xamine_definition *definition;
-    struct xamine_error *next;
-};
-
-struct xamine_extension {
-    char *name;
-    char *xname;
-    struct xamine_event *events;
-    struct xamine_error *errors;
-    struct xamine_extension *next;
-};
-
-struct xamine_context {
-    int refcnt;
-    enum xamine_context_flags flags;
-
-    unsigned char host_is_le;
-    struct xamine_definition *definitions;
-    struct xamine_definition *core_events[64];  /* Core events 2-63 (0-1 unused) */
-    struct xamine_definition *core_errors[128]; /* Core errors 0-127             */
-    struct xamine_extension *extensions;
-};
-
-struct xamine_conversation {
-    struct xamine_context *ctx;
-    int refcnt;
-    enum xamine_conversation_flags flags;
-
-    unsigned char is_le;
-    struct xamine_definition *extension_events[64];  /* Extension events 64-127  */
-    struct xamine_definition *extension_errors[128]; /* Extension errors 128-255 */
-    struct xamine_extension *extensions[128];        /* Extensions 128-255       */
-};
-
 /********** Private functions **********/
 
 /* Helper function to avoid casting. */
@@ -101,38 +65,111 @@ xamine_xml_next_elem(xmlNode *elem)
     return elem;
 }
 
-static char *
-xamine_make_name(struct xamine_extension *extension, xmlNode *elem,
-                 const char *prop)
+static const char *
+xamine_make_name(struct xamine_context *ctx,
+                 const struct xamine_extension *extension, const char *name)
 {
-    char *name, *qualified_name;
+    char *qualified_name;
+    const char *interned;
 
-    name = xamine_xml_get_prop(elem, prop);
     if (!extension)
-        return name;
+        return atom_strdup(ctx->atoms, name);
 
     qualified_name = afmt("%s%s", extension->name, name);
-    free(name);
+    interned = atom_strdup(ctx->atoms, qualified_name);
+    free(qualified_name);
+
+    return interned;
+}
+
+/*
+ * Look up a name used in a module.  A name qualified with a module, as in
+ * "xproto:WINDOW", is looked up in that module only.  Otherwise the module
+ * itself is searched first, then the modules it imports, then the core
+ * protocol and the built-in types.
+ */
+static void *
+xamine_find_symbol(struct xamine_context *ctx,
+                   const struct xamine_module *module,
+                   enum symbol_kind kind, const char *name)
+{
+    const char *colon;
+    xamine_atom name_atom, xproto_atom;
+    void *value;
+
+    if (!name)
+        return NULL;
+
+    colon = strchr(name, ':');
+    if (colon) {
+        xamine_atom scope = atom_intern(ctx->atoms, name, colon - name, false);
+        name_atom = atom_intern(ctx->atoms, colon + 1, strlen(colon + 1), false);
+        if (scope == XAMINE_ATOM_NONE)
+            return NULL;
+        return symbol_table_find(ctx->symbols, kind, scope, name_atom);
+    }
+
+    name_atom = atom_intern(ctx->atoms, name, strlen(name), false);
+    if (name_atom == XAMINE_ATOM_NONE)
+        return NULL;
+
+    value = symbol_table_find(ctx->symbols, kind, module->name, name_atom);
+    if (value)
+        return value;
 
-    return qualified_name;
+    for (size_t i = 0; i < module->nimports; i++) {
+        value = symbol_table_find(ctx->symbols, kind, module->imports[i], name_atom);
+        if (value)
+            return value;
+    }
+
+    xproto_atom = atom_intern(ctx->atoms, "xproto", strlen("xproto"), false);
+    if (xproto_atom != XAMINE_ATOM_NONE && xproto_atom != module->name) {
+        value = symbol_table_find(ctx->symbols, kind, xproto_atom, name_atom);
+        if (value)
+            return value;
+    }
+
+    return symbol_table_find(ctx->symbols, kind, XAMINE_ATOM_NONE, name_atom);
 }
 
 static const struct xamine_definition *
-xamine_find_type(struct xamine_context *ctx, const char *name)
+xamine_find_type(struct xamine_context *ctx,
+                 const struct xamine_module *module, const char *name)
 {
-    /* FIXME: does not work for extension types. */
-    for (const struct xamine_definition *def = ctx->definitions; def; def = def->next)
-        if (streq(def->name, name))
-            return def;
-    return NULL;
+    return xamine_find_symbol(ctx, module, SYMBOL_TYPE, name);
+}
+
+/*
+ * Add a definition to the context, and its unqualified name to the scope
+ * of the module.  Definitions must be added after all the types they refer
+ * to.
+ */
+static void
+xamine_add_definition(struct xamine_context *ctx,
+                      const struct xamine_module *module,
+                      enum symbol_kind kind, const char *name,
+                      struct xamine_definition *def)
+{
+    if (name)
+        symbol_table_add(ctx->symbols, kind, module->name,
+                         atom_intern(ctx->atoms, name, strlen(name), true),
+                         def);
+
+    def->next = ctx->definitions;
+    ctx->definitions = def;
 }
 
 static struct xamine_expression *
 xamine_parse_expression(struct xamine_context *ctx, xmlNode *elem)
 {
-    struct xamine_expression *e = calloc(1, sizeof(*e));
+    struct xamine_expression *e;
 
     elem = xamine_xml_next_elem(elem);
+    if (!elem)
+        return NULL;
+
+    e = calloc(1, sizeof(*e));
     if (streq(xamine_xml_get_node_name(elem), "op")) {
         {
             char *prop = xamine_xml_get_prop(elem, "op");
@@ -165,47 +202,203 @@ xamine_parse_expression(struct xamine_context *ctx, xmlNode *elem)
         }
     }
     else if (streq(xamine_xml_get_node_name(elem), "fieldref")) {
+        char *content = xamine_xml_get_node_content(elem);
         e->type = XAMINE_FIELDREF;
-        e->u.field = xamine_xml_get_node_content(elem);
+        e->u.field = atom_strdup(ctx->atoms, content);
+        free(content);
     }
 
     return e;
 }
 
+/* Make a field of a named type, as in the headers of packets. */
+static struct xamine_field_definition *
+xamine_make_field(struct xamine_context *ctx,
+                  const struct xamine_module *module,
+                  const char *name, const char *type)
+{
+    struct xamine_field_definition *field = calloc(1, sizeof(*field));
+
+    field->name = atom_strdup(ctx->atoms, name);
+    field->definition = xamine_find_type(ctx, module, type);
+    return field;
+}
+
+/* Make a list of CARD32 values running to the end of the packet. */
+static struct xamine_field_definition *
+xamine_make_value_list(struct xamine_context *ctx,
+                       const struct xamine_module *module, const char *name)
+{
+    struct xamine_field_definition *field;
+
+    field = xamine_make_field(ctx, module, name ? name : "values", "CARD32");
+    field->length = calloc(1, sizeof(*field->length));
+    field->length->type = XAMINE_IMPLICIT;
+    return field;
+}
+
+/*
+ * Make a field for a part of a description that cannot be decoded.  It is a
+ * list whose length divides by zero, which never resolves, so
+ * xamine_resolve_definitions drops everything laid out with it.
+ */
+static struct xamine_field_definition *
+xamine_make_unsupported(struct xamine_context *ctx,
+                        const struct xamine_module *module, const char *name)
+{
+    struct xamine_field_definition *field;
+    struct xamine_expression *length;
+
+    field = xamine_make_field(ctx, module, name, "CARD8");
+    field->length = length = calloc(1, sizeof(*length));
+    length->type = XAMINE_OP;
+    length->u.op.op = XAMINE_DIVIDE;
+    length->u.op.left = calloc(1, sizeof(*length->u.op.left));
+    length->u.op.left->type = XAMINE_VALUE;
+    length->u.op.left->u.value = 1;
+    length->u.op.right = calloc(1, sizeof(*length->u.op.right));
+    length->u.op.right->type = XAMINE_VALUE;
+    return field;
+}
+
+static bool
+xamine_is_field_elem(xmlNode *elem)
+{
+    const char *node_name = xamine_xml_get_node_name(elem);
+
+    return streq(node_name, "pad") || streq(node_name, "field") ||
+           streq(node_name, "exprfield") || streq(node_name, "list") ||
+           streq(node_name, "valueparam") || streq(node_name, "switch");
+}
+
+/* Whether no field follows an element of a description. */
+static bool
+xamine_is_last_field(xmlNode *elem)
+{
+    for (elem = xamine_xml_next_elem(elem->next); elem; elem = xamine_xml_next_elem(elem->next))
+        if (xamine_is_field_elem(elem))
+            return false;
+    return true;
+}
+
+/*
+ * Whether a switch is a list of values selected by the bits of a mask, as
+ * in the core requests, with a 4-byte value for each bit set.  Such a switch
+ * is laid out like a valueparam.
+ */
+static bool
+xamine_is_value_switch(struct xamine_context *ctx,
+                       const struct xamine_module *module, xmlNode *elem)
+{
+    xmlNode *cur = xamine_xml_next_elem(elem->children);
+
+    if (!cur || !streq(xamine_xml_get_node_name(cur), "fieldref"))
+        return false;
+    for (cur = xamine_xml_next_elem(cur->next); cur; cur = xamine_xml_next_elem(cur->next)) {
+        if (streq(xamine_xml_get_node_name(cur), "doc"))
+            continue;
+        if (!streq(xamine_xml_get_node_name(cur), "bitcase"))
+            return false;
+        for (xmlNode *item = xamine_xml_next_elem(cur->children); item; item = xamine_xml_next_elem(item->next)) {
+            const struct xamine_definition *definition;
+            size_t size;
+
+            if (!xamine_is_field_elem(item))
+                continue;
+            if (!streq(xamine_xml_get_node_name(item), "field"))
+                return false;
+            {
+                char *prop = xamine_xml_get_prop(item, "type");
+                definition = xamine_find_type(ctx, module, prop);
+                free(prop);
+            }
+            if (!xamine_static_size(definition, &size) || size != 4)
+                return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Parse the fields of a struct, union or packet.  Alignment pads are only
+ * understood at the end of a packet, where nothing follows them.
+ */
 static struct xamine_field_definition *
-xamine_parse_fields(struct xamine_context *ctx, xmlNode *elem)
+xamine_parse_fields(struct xamine_context *ctx,
+                    const struct xamine_module *module, xmlNode *elem,
+                    bool is_packet)
 {
     xmlNode *cur;
     struct xamine_field_definition *head;
     struct xamine_field_definition **tail = &head;
 
     for (cur = elem->children; cur; cur = xamine_xml_next_elem(cur->next)) {
-        /* FIXME: handle elements other than "field", "pad", "doc" and "list". */
+        const char *node_name = xamine_xml_get_node_name(cur);
 
-        if (streq(xamine_xml_get_node_name(cur), "doc"))
-            continue;
+        if (streq(node_name, "pad")) {
+            char *prop = xamine_xml_get_prop(cur, "bytes");
 
-        *tail = calloc(1, sizeof(**tail));
-        if (streq(xamine_xml_get_node_name(cur), "pad")) {
-            (*tail)->name = strdup("pad");
-            (*tail)->definition = xamine_find_type(ctx, "CARD8");
-            (*tail)->length = calloc(1, sizeof(*(*tail)->length));
-            (*tail)->length->type = XAMINE_VALUE;
-            {
-                char *prop = xamine_xml_get_prop(cur, "bytes");
+            if (!prop) {
+                if (is_packet && xamine_is_last_field(cur))
+                    continue;
+                *tail = xamine_make_unsupported(ctx, module, "align");
+            }
+            else {
+                *tail = xamine_make_field(ctx, module, "pad", "CARD8");
+                (*tail)->length = calloc(1, sizeof(*(*tail)->length));
+                (*tail)->length->type = XAMINE_VALUE;
                 (*tail)->length->u.value = atoi(prop);
                 free(prop);
             }
-        } else {
-            (*tail)->name = xamine_xml_get_prop(cur, "name");
+        }
+        else if (streq(node_name, "field") || streq(node_name, "exprfield") ||
+                 streq(node_name, "list")) {
+            *tail = calloc(1, sizeof(**tail));
+            {
+                char *prop = xamine_xml_get_prop(cur, "name");
+                (*tail)->name = atom_strdup(ctx->atoms, prop);
+                free(prop);
+            }
             {
                 char *prop = xamine_xml_get_prop(cur, "type");
-                (*tail)->definition = xamine_find_type(ctx, prop);
+                (*tail)->definition = xamine_find_type(ctx, module, prop);
                 free(prop);
             }
-            /* FIXME: handle missing length expressions. */
-            if (streq(xamine_xml_get_node_name(cur), "list"))
+            if (streq(node_name, "list")) {
                 (*tail)->length = xamine_parse_expression(ctx, cur->children);
+                if (!(*tail)->length) {
+                    (*tail)->length = calloc(1, sizeof(*(*tail)->length));
+                    (*tail)->length->type = XAMINE_IMPLICIT;
+                }
+            }
+        }
+        else if (streq(node_name, "valueparam")) {
+            /* A value mask, and a value for each bit set in it. */
+            char *mask_name = xamine_xml_get_prop(cur, "value-mask-name");
+            char *mask_type = xamine_xml_get_prop(cur, "value-mask-type");
+            char *list_name = xamine_xml_get_prop(cur, "value-list-name");
+
+            *tail = xamine_make_field(ctx, module, mask_name ? mask_name : "value_mask",
+                                      mask_type);
+            tail = &(*tail)->next;
+            *tail = xamine_make_value_list(ctx, module, list_name);
+            free(mask_name);
+            free(mask_type);
+            free(list_name);
+        }
+        else if (streq(node_name, "switch")) {
+            /* The values run to the end of the packet, like those of a
+             * valueparam; other switches cannot be decoded. */
+            char *prop = xamine_xml_get_prop(cur, "name");
+            if (xamine_is_last_field(cur) && xamine_is_value_switch(ctx, module, cur))
+                *tail = xamine_make_value_list(ctx, module, prop);
+            else
+                *tail = xamine_make_unsupported(ctx, module, prop ? prop : "switch");
+            free(prop);
+        }
+        else {
+            /* Documentation, file descriptors, replies of requests... */
+            continue;
         }
 
         tail = &(*tail)->next;
@@ -215,25 +408,178 @@ xamine_parse_fields(struct xamine_context *ctx, xmlNode *elem)
     return head;
 }
 
+/*
+ * Whether a field takes exactly one byte, and so fits in the byte after the
+ * major opcode of a core request or the type of a response.
+ */
+static bool
+xamine_is_byte_field(const struct xamine_field_definition *field)
+{
+    size_t size;
+
+    if (!field || !xamine_static_size(field->definition, &size))
+        return false;
+    if (field->length)
+        return field->length->type == XAMINE_VALUE &&
+               field->length->u.value * size == 1;
+    return size == 1;
+}
+
+/*
+ * Add the header fields of a request or reply.  Requests start with the
+ * major opcode, then the minor opcode for extensions or otherwise the first
+ * field if it fits in a byte, then the length.  Replies start with the
+ * response type, the first field if it fits in a byte, the sequence number
+ * and the length.
+ */
+static struct xamine_field_definition *
+xamine_make_header(struct xamine_context *ctx,
+                   const struct xamine_module *module,
+                   struct xamine_field_definition *fields, bool is_reply)
+{
+    struct xamine_field_definition *first, *second, *rest = fields;
+
+    first = xamine_make_field(ctx, module, is_reply ? "response_type" : "major_opcode",
+                              is_reply ? "BYTE" : "CARD8");
+    if (!is_reply && module->extension) {
+        second = xamine_make_field(ctx, module, "minor_opcode", "CARD8");
+    }
+    else if (xamine_is_byte_field(fields)) {
+        second = fields;
+        rest = fields->next;
+    }
+    else {
+        second = xamine_make_field(ctx, module, "pad", "CARD8");
+    }
+    first->next = second;
+
+    if (is_reply) {
+        second->next = xamine_make_field(ctx, module, "sequence", "CARD16");
+        second->next->next = xamine_make_field(ctx, module, "length", "CARD32");
+        second->next->next->next = rest;
+    }
+    else {
+        second->next = xamine_make_field(ctx, module, "length", "CARD16");
+        second->next->next = rest;
+    }
+
+    return first;
+}
+
+/*
+ * Make the header of an event sent in GenericEvent: the response type, the
+ * major opcode of its extension, the sequence number, the length and the
+ * event type, which come before the fields of the description.
+ */
+static struct xamine_field_definition *
+xamine_make_generic_header(struct xamine_context *ctx,
+                           const struct xamine_module *module,
+                           struct xamine_field_definition *fields)
+{
+    static const char *const header[][2] = {
+        { "response_type", "BYTE" },
+        { "extension", "CARD8" },
+        { "sequence", "CARD16" },
+        { "length", "CARD32" },
+        { "event_type", "CARD16" },
+    };
+    struct xamine_field_definition *first = NULL, **next = &first;
+
+    for (int i = 0; i < ARRAY_SIZE(header); i++) {
+        *next = xamine_make_field(ctx, module, header[i][0], header[i][1]);
+        next = &(*next)->next;
+    }
+    *next = fields;
+    return first;
+}
+
+/* Find an event by its definition in a list of events. */
+static const struct xamine_event *
+xamine_find_event(const struct xamine_event *events,
+                  const struct xamine_definition *definition)
+{
+    for (; events; events = events->next)
+        if (events->definition == definition)
+            return events;
+    return NULL;
+}
+
+/* The XML-XCB files to load from. */
+struct xamine_files {
+    char **names;
+    xmlDoc **docs;      /* Each file read ahead, or NULL to read when parsed */
+};
+
+static void
+xamine_parse_xmlxcb_file(struct xamine_context *ctx, struct xamine_files *files,
+                         size_t index);
+
+/*
+ * Load the description of the module called name from the list of files,
+ * if it is not loaded yet, so that the names it defines can be imported.
+ */
+static void
+xamine_import_module(struct xamine_context *ctx, struct xamine_files *files,
+                     const char *name)
+{
+    size_t len = strlen(name);
+
+    for (size_t i = 0; files->names && files->names[i]; i++) {
+        const char *base = strrchr(files->names[i], '/');
+        base = base ? base + 1 : files->names[i];
+        if (strncmp(base, name, len) == 0 && streq(base + len, ".xml")) {
+            xamine_parse_xmlxcb_file(ctx, files, i);
+            return;
+        }
+    }
+}
+
+/* Ignore text nodes consisting entirely of whitespace.  The option is given
+ * per document rather than through the global default, which would affect
+ * other users of libxml2 in the process. */
+static xmlDoc *
+xamine_read_xml(const char *filename)
+{
+    return xmlReadFile(filename, NULL, XML_PARSE_NOBLANKS);
+}
+
 static void
-xamine_parse_xmlxcb_file(struct xamine_context *ctx,
-                         const char *filename)
+xamine_parse_xmlxcb_file(struct xamine_context *ctx, struct xamine_files *files,
+                         size_t index)
 {
+    const char *filename = files->names[index];
     xmlDoc *doc;
     xmlNode *root;
     char *extension_xname;
     struct xamine_extension *extension;
-
-    /* Ignore text nodes consisting entirely of whitespace. */
-    xmlKeepBlanksDefault(0);
-
-    doc = xmlParseFile(filename);
+    struct xamine_module *module;
+
+    /* Files are loaded once, either in order or when first imported.  The
+     * module is registered before parsing, so import cycles terminate. */
+    for (module = ctx->modules; module; module = module->next)
+        if (streq(module->filename, filename))
+            return;
+
+    module = calloc(1, sizeof(*module));
+    module->filename = strdup(filename);
+    module->next = ctx->modules;
+    ctx->modules = module;
+
+    if (files->docs) {
+        doc = files->docs[index];
+        files->docs[index] = NULL;
+    }
+    else {
+        doc = xamine_read_xml(filename);
+    }
     if (!doc)
         return;
 
     root = xmlDocGetRootElement(doc);
-    if (!root)
+    if (!root) {
+        xmlFreeDoc(doc);
         return;
+    }
 
     extension = NULL;
     extension_xname = xamine_xml_get_prop(root, "extension-xname");
@@ -242,25 +588,89 @@ xamine_parse_xmlxcb_file(struct xamine_context *ctx,
             if (streq(extension->xname, extension_xname))
                 break;
 
-        if (extension) {
+        /* Lazy contexts know their extensions from the start, and other
+         * threads may be walking the list; skip a file changed since. */
+        if (!extension && (ctx->flags & XAMINE_CONTEXT_LAZY)) {
+            free(extension_xname);
+            xmlFreeDoc(doc);
+            return;
+        }
+        if (!extension) {
             extension = calloc(1, sizeof(*extension));
-            extension->name = xamine_xml_get_prop(root, "extension-name");
-            extension->xname = extension_xname;
+            {
+                char *prop = xamine_xml_get_prop(root, "extension-name");
+                extension->name = atom_strdup(ctx->atoms, prop);
+                free(prop);
+            }
+            extension->xname = atom_strdup(ctx->atoms, extension_xname);
             extension->next = ctx->extensions;
             ctx->extensions = extension;
-        } else {
-            free(extension_xname);
         }
+        free(extension_xname);
+    }
+
+    {
+        char *prop = xamine_xml_get_prop(root, "header");
+        if (prop)
+            module->name = atom_intern(ctx->atoms, prop, strlen(prop), true);
+        free(prop);
     }
+    module->extension = extension;
 
     for (xmlNode *elem = root->children; elem; elem = xamine_xml_next_elem(elem->next)) {
         if (streq(xamine_xml_get_node_name(elem), "request")) {
-            /* TODO */
+            struct xamine_definition *def, *reply_def = NULL;
+            char *name;
+            int opcode;
+
+            {
+                char *prop = xamine_xml_get_prop(elem, "opcode");
+                opcode = prop ? atoi(prop) : -1;
+                free(prop);
+            }
+            if (opcode < 0 || opcode > (extension ? 255 : 127))
+                continue;
+
+            name = xamine_xml_get_prop(elem, "name");
+            def = calloc(1, sizeof(*def));
+            def->name = xamine_make_name(ctx, extension, name);
+            def->type = XAMINE_STRUCT;
+            def->u.fields = xamine_make_header(ctx, module,
+                                               xamine_parse_fields(ctx, module, elem, true),
+                                               false);
+            xamine_add_definition(ctx, module, SYMBOL_TYPE, NULL, def);
+
+            for (xmlNode *cur = xamine_xml_next_elem(elem->children); cur; cur = xamine_xml_next_elem(cur->next)) {
+                if (streq(xamine_xml_get_node_name(cur), "reply")) {
+                    char *reply_name = afmt("%sReply", name);
+
+                    reply_def = calloc(1, sizeof(*reply_def));
+                    reply_def->name = xamine_make_name(ctx, extension, reply_name);
+                    reply_def->type = XAMINE_STRUCT;
+                    reply_def->u.fields = xamine_make_header(ctx, module,
+                                                             xamine_parse_fields(ctx, module, cur, true),
+                                                             true);
+                    xamine_add_definition(ctx, module, SYMBOL_TYPE, NULL, reply_def);
+                    free(reply_name);
+                    break;
+                }
+            }
+            free(name);
+
+            if (extension) {
+                extension->requests[opcode] = def;
+                extension->replies[opcode] = reply_def;
+            }
+            else {
+                ctx->core_requests[opcode] = def;
+                ctx->core_replies[opcode] = reply_def;
+            }
         }
         else if (streq(xamine_xml_get_node_name(elem), "event")) {
-            bool no_sequence_number;
+            bool no_sequence_number, generic;
             struct xamine_definition *def;
             struct xamine_field_definition *fields;
+            char *name;
             int number;
 
             {
@@ -268,54 +678,72 @@ xamine_parse_xmlxcb_file(struct xamine_context *ctx,
                 number = atoi(prop);
                 free(prop);
             }
-            if (number > 64)
+            {
+                char *prop = xamine_xml_get_prop(elem, "xge");
+                generic = prop && streq(prop, "true");
+                free(prop);
+            }
+            /* The numbers of XGE events of extensions are event types. */
+            if (number < 0 || number >= (generic && extension ? 0x10000 : 64))
                 continue;
 
+            name = xamine_xml_get_prop(elem, "name");
             def = calloc(1, sizeof(*def));
-            def->name = xamine_make_name(extension, elem, "name");
+            def->name = xamine_make_name(ctx, extension, name);
             def->type = XAMINE_STRUCT;
 
-            fields = xamine_parse_fields(ctx, elem);
-            if (!fields) {
+            fields = xamine_parse_fields(ctx, module, elem, true);
+            if (generic) {
+                def->u.fields = xamine_make_generic_header(ctx, module, fields);
+            }
+            else if (!fields) {
                 fields = calloc(1, sizeof(*fields));
-                fields->name = strdup("pad");
-                fields->definition = xamine_find_type(ctx, "CARD8");
+                fields->name = atom_strdup(ctx->atoms, "pad");
+                fields->definition = xamine_find_type(ctx, module, "CARD8");
             }
 
-            def->u.fields = calloc(1, sizeof(*def->u.fields));
-            def->u.fields->name = strdup("response_type");
-            def->u.fields->definition = xamine_find_type(ctx, "BYTE");
-            def->u.fields->next = fields;
-            fields = fields->next;
-            {
-                char *prop = xamine_xml_get_prop(elem, "no-sequence-number");
-                no_sequence_number = prop && streq(prop, "true");
-                free(prop);
-            }
-            if (no_sequence_number) {
-                def->u.fields->next->next = fields;
-            }
-            else {
-                def->u.fields->next->next = calloc(1, sizeof(*def->u.fields->next->next));
-                def->u.fields->next->next->name = strdup("sequence");
-                def->u.fields->next->next->definition = xamine_find_type(ctx, "CARD16");
-                def->u.fields->next->next->next = fields;
+            if (!generic) {
+                def->u.fields = calloc(1, sizeof(*def->u.fields));
+                def->u.fields->name = atom_strdup(ctx->atoms, "response_type");
+                def->u.fields->definition = xamine_find_type(ctx, module, "BYTE");
+                def->u.fields->next = fields;
+                fields = fields->next;
+                {
+                    char *prop = xamine_xml_get_prop(elem, "no-sequence-number");
+                    no_sequence_number = prop && streq(prop, "true");
+                    free(prop);
+                }
+                if (no_sequence_number) {
+                    def->u.fields->next->next = fields;
+                }
+                else {
+                    def->u.fields->next->next = calloc(1, sizeof(*def->u.fields->next->next));
+                    def->u.fields->next->next->name = atom_strdup(ctx->atoms, "sequence");
+                    def->u.fields->next->next->definition = xamine_find_type(ctx, module, "CARD16");
+                    def->u.fields->next->next->next = fields;
+                }
             }
-            def->next = ctx->definitions;
-            ctx->definitions = def;
+            xamine_add_definition(ctx, module, SYMBOL_EVENT, name, def);
+            free(name);
 
             if (extension) {
+                struct xamine_event **events = generic ? &extension->generic_events
+                                                       : &extension->events;
                 struct xamine_event *event = calloc(1, sizeof(*event));
                 event->number = number;
                 event->definition = def;
-                event->next = extension->events;
+                event->next = *events;
+                *events = event;
             }
             else {
                 ctx->core_events[number] = def;
             }
         }
         else if (streq(xamine_xml_get_node_name(elem), "eventcopy")) {
+            const struct xamine_definition *ref;
             struct xamine_definition *def;
+            char *name;
+            bool generic;
             int number;
 
             {
@@ -323,229 +751,1084 @@ xamine_parse_xmlxcb_file(struct xamine_context *ctx,
                 number = atoi(prop);
                 free(prop);
             }
-            if (number > 64)
-                continue;
-
-            def = calloc(1, sizeof(*def));
-            def->name = xamine_xml_get_prop(elem, "name");
-            def->type = XAMINE_TYPEDEF;
             {
                 char *prop = xamine_xml_get_prop(elem, "ref");
-                def->u.ref = xamine_find_type(ctx, prop);
+                ref = xamine_find_symbol(ctx, module, SYMBOL_EVENT, prop);
                 free(prop);
             }
-            def->next = ctx->definitions;
-            ctx->definitions = def;
+            /* Copies of XGE events are sent in GenericEvent as well. */
+            generic = extension && xamine_find_event(extension->generic_events, ref);
+            if (number < 0 || number >= (generic ? 0x10000 : 64))
+                continue;
+
+            name = xamine_xml_get_prop(elem, "name");
+            def = calloc(1, sizeof(*def));
+            def->name = xamine_make_name(ctx, extension, name);
+            def->type = XAMINE_TYPEDEF;
+            def->u.ref = ref;
+            xamine_add_definition(ctx, module, SYMBOL_EVENT, name, def);
+            free(name);
 
             if (extension) {
+                struct xamine_event **events = generic ? &extension->generic_events
+                                                       : &extension->events;
                 struct xamine_event *event = calloc(1, sizeof(*event));
                 event->number = number;
                 event->definition = def;
-                event->next = extension->events;
+                event->next = *events;
+                *events = event;
             }
             else {
                 ctx->core_events[number] = def;
             }
         }
-        else if (streq(xamine_xml_get_node_name(elem), "error")) {
-        }
-        else if (streq(xamine_xml_get_node_name(elem), "errorcopy")) {
+        else if (streq(xamine_xml_get_node_name(elem), "error") ||
+                 streq(xamine_xml_get_node_name(elem), "errorcopy")) {
+            struct xamine_definition *def;
+            struct xamine_field_definition *fields;
+            char *name;
+            int number;
+
+            {
+                char *prop = xamine_xml_get_prop(elem, "number");
+                number = prop ? atoi(prop) : -1;
+                free(prop);
+            }
+            if (number < 0 || number > (extension ? 255 : 127))
+                continue;
+
+            name = xamine_xml_get_prop(elem, "name");
+            def = calloc(1, sizeof(*def));
+            def->name = xamine_make_name(ctx, extension, name);
+            if (streq(xamine_xml_get_node_name(elem), "errorcopy")) {
+                char *prop = xamine_xml_get_prop(elem, "ref");
+                def->type = XAMINE_TYPEDEF;
+                def->u.ref = xamine_find_symbol(ctx, module, SYMBOL_ERROR, prop);
+                free(prop);
+            }
+            else {
+                /* Errors start with a zero response type, the error code
+                 * and the sequence number. */
+                fields = xamine_make_field(ctx, module, "response_type", "BYTE");
+                fields->next = xamine_make_field(ctx, module, "error_code", "CARD8");
+                fields->next->next = xamine_make_field(ctx, module, "sequence", "CARD16");
+                fields->next->next->next = xamine_parse_fields(ctx, module, elem, true);
+                def->type = XAMINE_STRUCT;
+                def->u.fields = fields;
+            }
+            xamine_add_definition(ctx, module, SYMBOL_ERROR, name, def);
+            free(name);
+
+            if (extension) {
+                struct xamine_error *error = calloc(1, sizeof(*error));
+                error->number = number;
+                error->definition = def;
+                error->next = extension->errors;
+                extension->errors = error;
+            }
+            else {
+                ctx->core_errors[number] = def;
+            }
         }
         else if (streq(xamine_xml_get_node_name(elem), "struct")) {
             struct xamine_definition *def = calloc(1, sizeof(*def));
-            def->name = xamine_make_name(extension, elem, "name");
+            char *name = xamine_xml_get_prop(elem, "name");
+            def->name = xamine_make_name(ctx, extension, name);
             def->type = XAMINE_STRUCT;
-            def->u.fields = xamine_parse_fields(ctx, elem);
-            def->next = ctx->definitions;
-            ctx->definitions = def;
+            def->u.fields = xamine_parse_fields(ctx, module, elem, false);
+            xamine_add_definition(ctx, module, SYMBOL_TYPE, name, def);
+            free(name);
         }
         else if (streq(xamine_xml_get_node_name(elem), "union")) {
+            struct xamine_definition *def = calloc(1, sizeof(*def));
+            char *name = xamine_xml_get_prop(elem, "name");
+            def->name = xamine_make_name(ctx, extension, name);
+            def->type = XAMINE_UNION;
+            def->u.fields = xamine_parse_fields(ctx, module, elem, false);
+            xamine_add_definition(ctx, module, SYMBOL_TYPE, name, def);
+            free(name);
         }
-        else if (streq(xamine_xml_get_node_name(elem), "xidtype")) {
+        else if (streq(xamine_xml_get_node_name(elem), "xidtype") ||
+                 streq(xamine_xml_get_node_name(elem), "xidunion")) {
             struct xamine_definition *def = calloc(1, sizeof(*def));
-            def->name = xamine_make_name(extension, elem, "name");
+            char *name = xamine_xml_get_prop(elem, "name");
+            def->name = xamine_make_name(ctx, extension, name);
             def->type = XAMINE_UNSIGNED;
             def->u.size = 4;
-            def->next = ctx->definitions;
-            ctx->definitions = def;
+            xamine_add_definition(ctx, module, SYMBOL_TYPE, name, def);
+            free(name);
         }
         else if (streq(xamine_xml_get_node_name(elem), "enum")) {
         }
         else if (streq(xamine_xml_get_node_name(elem), "typedef")) {
             struct xamine_definition *def = calloc(1, sizeof(*def));
-            def->name = xamine_make_name(extension, elem, "newname");
+            char *name = xamine_xml_get_prop(elem, "newname");
+            def->name = xamine_make_name(ctx, extension, name);
             def->type = XAMINE_TYPEDEF;
             {
                 char *prop = xamine_xml_get_prop(elem, "oldname");
-                def->u.ref = xamine_find_type(ctx, prop);
+                def->u.ref = xamine_find_type(ctx, module, prop);
                 free(prop);
             }
-            def->next = ctx->definitions;
-            ctx->definitions = def;
+            xamine_add_definition(ctx, module, SYMBOL_TYPE, name, def);
+            free(name);
         }
         else if (streq(xamine_xml_get_node_name(elem), "import")) {
+            char *content = xamine_xml_get_node_content(elem);
+            xamine_atom *imports;
+
+            xamine_import_module(ctx, files, content);
+            imports = realloc(module->imports,
+                              (module->nimports + 1) * sizeof(*imports));
+            if (imports) {
+                imports[module->nimports++] =
+                    atom_intern(ctx->atoms, content, strlen(content), true);
+                module->imports = imports;
+            }
+            free(content);
         }
     }
 
     xmlFreeDoc(doc);
 }
 
-static long
-xamine_evaluate_expression(const struct xamine_expression *expression,
-                           const struct xamine_item *parent)
+static void
+free_expression(struct xamine_expression *expr);
+
+static void
+free_field_definitions(struct xamine_field_definition *fields);
+
+/*
+ * Resolve the field references of the length expression of a list to the
+ * fields before it, and replace operators on constants by their results.
+ * Returns false if the expression refers to anything but an earlier field
+ * holding a single value, or has no defined result.
+ */
+static bool
+xamine_resolve_expression(struct xamine_context *ctx,
+                          struct xamine_expression *expression,
+                          const struct xamine_field_definition *fields,
+                          const struct xamine_field_definition *list)
 {
+    struct xamine_expression *left, *right;
+    long value;
+
+    if (!expression)
+        return false;
+
     switch (expression->type) {
     case XAMINE_VALUE:
-        return expression->u.value;
+        return true;
 
     case XAMINE_FIELDREF:
-        for (struct xamine_item *cur = parent->child; cur; cur = cur->next) {
-            if (streq(cur->name, expression->u.field)) {
-                switch (cur->definition->type) {
-                case XAMINE_BOOL: return cur->u.bool_value;
-                case XAMINE_CHAR: return cur->u.char_value;
-                case XAMINE_SIGNED: return cur->u.signed_value;
-                case XAMINE_UNSIGNED: return cur->u.unsigned_value;
-
-                /* FIXME: Remove assert. */
-                case XAMINE_STRUCT:
-                case XAMINE_UNION:
-                case XAMINE_TYPEDEF:
-                    assert(!"unreachable");
-                    return 0;
-                }
-            }
-        }
-
-    case XAMINE_OP:
     {
-        long left  = xamine_evaluate_expression(expression->u.op.left, parent);
-        long right = xamine_evaluate_expression(expression->u.op.right, parent);
+        size_t index = 0;
 
-        switch (expression->u.op.op) {
-        case XAMINE_ADD:         return left + right;
-        case XAMINE_SUBTRACT:    return left - right;
-        case XAMINE_MULTIPLY:    return left * right;
-        case XAMINE_DIVIDE:      return left / right; /* FIXME: divide by zero */
-        case XAMINE_LEFT_SHIFT:  return left << right;
-        case XAMINE_BITWISE_AND: return left & right;
+        for (const struct xamine_field_definition *field = fields; field != list;
+             field = field->next, index++) {
+            const struct xamine_definition *definition = field->definition;
+
+            if (!field->name || !streq(field->name, expression->u.field))
+                continue;
+            for (int i = 0; definition && definition->type == XAMINE_TYPEDEF && i < 64; i++)
+                definition = definition->u.ref;
+            if (field->length || !definition ||
+                definition->type == XAMINE_STRUCT || definition->type == XAMINE_UNION ||
+                definition->type == XAMINE_TYPEDEF)
+                return false;
+            expression->field_index = index;
+            return true;
         }
+        return false;
     }
+
+    case XAMINE_OP:
+        left = expression->u.op.left;
+        right = expression->u.op.right;
+        if (expression->u.op.op > XAMINE_BITWISE_AND ||
+            !xamine_resolve_expression(ctx, left, fields, list) ||
+            !xamine_resolve_expression(ctx, right, fields, list))
+            return false;
+        if (left->type != XAMINE_VALUE || right->type != XAMINE_VALUE)
+            return true;
+        if (!xamine_apply_op(expression->u.op.op, (long) left->u.value,
+                             (long) right->u.value, &value))
+            return false;
+
+        /* Expressions loaded from a cache are freed with it. */
+        expression->type = XAMINE_VALUE;
+        expression->u.value = (unsigned long) value;
+        if (!ctx->cache) {
+            free_expression(left);
+            free_expression(right);
+        }
+        return true;
+
+    case XAMINE_IMPLICIT:
+        break;
     }
 
-    /* FIXME: Remove assert. */
-    assert(!"unreachable");
-    return 0;
+    return false;
 }
 
-static struct xamine_item *
-xamine_definition(const struct xamine_conversation *conversation,
-                  const unsigned char **data, size_t *size, size_t *offset,
-                  const struct xamine_definition *definition,
-                  const struct xamine_item *parent);
+/* Evaluate an expression over the values of the earlier fields of a struct. */
+static bool
+xamine_evaluate_expression(const struct xamine_expression *expression,
+                           const long *values, long *result)
+{
+    long left, right;
+
+    switch (expression->type) {
+    case XAMINE_VALUE:
+        *result = expression->u.value;
+        return true;
+
+    case XAMINE_FIELDREF:
+        *result = values[expression->field_index];
+        return true;
+
+    case XAMINE_OP:
+        return xamine_evaluate_expression(expression->u.op.left, values, &left) &&
+               xamine_evaluate_expression(expression->u.op.right, values, &right) &&
+               xamine_apply_op(expression->u.op.op, left, right, result);
+
+    case XAMINE_IMPLICIT:
+        break;
+    }
+
+    return false;
+}
+
+bool
+xamine_static_size(const struct xamine_definition *definition, size_t *size)
+{
+    /* Typedef chains are finite unless the definitions are corrupt. */
+    for (int i = 0; definition && definition->type == XAMINE_TYPEDEF; i++) {
+        if (i == 64)
+            return false;
+        definition = definition->u.ref;
+    }
+    if (!definition)
+        return false;
+
+    switch (definition->type) {
+    case XAMINE_BOOL:
+    case XAMINE_CHAR:
+    case XAMINE_SIGNED:
+    case XAMINE_UNSIGNED:
+        *size = definition->u.size;
+        return true;
+
+    case XAMINE_STRUCT:
+    case XAMINE_UNION:
+        *size = 0;
+        for (const struct xamine_field_definition *field = definition->u.fields; field; field = field->next) {
+            size_t field_size;
+
+            if (!xamine_static_size(field->definition, &field_size))
+                return false;
+            if (field->length) {
+                if (field->length->type != XAMINE_VALUE)
+                    return false;
+                field_size *= field->length->u.value;
+            }
+            if (definition->type == XAMINE_STRUCT)
+                *size += field_size;
+            else if (field_size > *size)
+                *size = field_size;
+        }
+        return true;
+
+    case XAMINE_TYPEDEF:
+        break;
+    }
+
+    return false;
+}
+
+/*
+ * Items are allocated from the arena if there is one, and from the heap
+ * otherwise.  In an arena, names point to the interned names of the
+ * definitions rather than to copies.
+ */
+struct xamine_item *
+xamine_item_new(struct xamine_arena *arena)
+{
+    if (arena)
+        return arena_zalloc(arena, sizeof(struct xamine_item));
+    return calloc(1, sizeof(struct xamine_item));
+}
+
+struct xamine_item *
+xamine_item_new_array(struct xamine_arena *arena, size_t count, size_t size)
+{
+    size_t alloc = sizeof(struct xamine_item) + count * size;
+    struct xamine_item *item = arena ? arena_alloc(arena, alloc) : malloc(alloc);
+
+    if (!item)
+        return NULL;
+    memset(item, 0, sizeof(*item));
+    item->u.array = item + 1;
+    item->count = count;
+    item->element_size = size;
+    return item;
+}
+
+char *
+xamine_item_name(struct xamine_arena *arena, const char *name)
+{
+    if (arena)
+        return (char *) name;
+    return strdup(name);
+}
+
+char *
+xamine_item_index_name(struct xamine_arena *arena, size_t index)
+{
+    char buf[24];
+    char *p = buf + sizeof(buf);
+    char *name;
+    size_t len;
+
+    if (!arena)
+        return afmt("[%lu]", index);
+
+    /* Lists can have many elements, so avoid the cost of snprintf. */
+    *--p = '\0';
+    *--p = ']';
+    do {
+        *--p = '0' + index % 10;
+        index /= 10;
+    } while (index);
+    *--p = '[';
+
+    len = buf + sizeof(buf) - p;
+    name = arena_alloc(arena, len);
+    if (name)
+        memcpy(name, p, len);
+    return name;
+}
+
+static struct xamine_item *
+xamine_definition(const struct xamine_conversation *conversation,
+                  struct xamine_arena *arena,
+                  const unsigned char *data, size_t size, size_t *offset,
+                  const struct xamine_definition *definition);
+
+/* Get the value of an item of a base type, or 0 for other items. */
+static long
+xamine_item_value(const struct xamine_item *item)
+{
+    const struct xamine_definition *definition = item->definition;
+
+    for (int i = 0; definition && definition->type == XAMINE_TYPEDEF && i < 64; i++)
+        definition = definition->u.ref;
+    if (!definition || item->child || item->element_size)
+        return 0;
+
+    switch (definition->type) {
+    case XAMINE_BOOL:     return item->u.bool_value;
+    case XAMINE_CHAR:     return item->u.char_value;
+    case XAMINE_SIGNED:   return item->u.signed_value;
+    case XAMINE_UNSIGNED: return (long) item->u.unsigned_value;
+    case XAMINE_STRUCT:
+    case XAMINE_UNION:
+    case XAMINE_TYPEDEF:
+        break;
+    }
+    return 0;
+}
+
+/*
+ * Get the base type of the elements of a list if it is an array, that is if
+ * they are values of a base type, or NULL otherwise.
+ */
+static const struct xamine_definition *
+xamine_array_base(const struct xamine_definition *definition)
+{
+    for (int i = 0; definition && definition->type == XAMINE_TYPEDEF && i < 64; i++)
+        definition = definition->u.ref;
+    if (!definition)
+        return NULL;
+
+    switch (definition->type) {
+    case XAMINE_BOOL:
+    case XAMINE_CHAR:
+        return definition->u.size == 1 ? definition : NULL;
+    case XAMINE_SIGNED:
+    case XAMINE_UNSIGNED:
+        return definition->u.size == 1 || definition->u.size == 2 ||
+               definition->u.size == 4 ? definition : NULL;
+    case XAMINE_STRUCT:
+    case XAMINE_UNION:
+    case XAMINE_TYPEDEF:
+        break;
+    }
+    return NULL;
+}
+
+static struct xamine_item *
+xamine_array(const struct xamine_conversation *conversation,
+             struct xamine_arena *arena,
+             const unsigned char *data, size_t size, size_t *offset,
+             const struct xamine_field_definition *field,
+             const struct xamine_definition *base, const long *values)
+{
+    struct xamine_item *item;
+    long length;
+
+    if (field->length->type == XAMINE_IMPLICIT)
+        length = (size - *offset) / base->u.size;
+    else if (!xamine_evaluate_expression(field->length, values, &length) ||
+             length < 0 || (unsigned long) length > (size - *offset) / base->u.size)
+        return NULL;
+
+    item = xamine_item_new_array(arena, length, base->u.size);
+    if (!item)
+        return NULL;
+    item->name = xamine_item_name(arena, field->name);
+    item->definition = field->definition;
+    item->offset = *offset;
+    item->element_type = base->type;
+    xamine_decode_array(item + 1, base->u.size, data + *offset, length,
+                        conversation->is_le);
+    *offset += length * base->u.size;
+    return item;
+}
+
+static struct xamine_item *
+xamine_field_definition(const struct xamine_conversation *conversation,
+                        struct xamine_arena *arena,
+                        const unsigned char *data, size_t size, size_t *offset,
+                        const struct xamine_field_definition *field,
+                        const long *values)
+{
+    const struct xamine_definition *base;
+    struct xamine_item *item;
+
+    if (field->length && (base = xamine_array_base(field->definition)))
+        return xamine_array(conversation, arena, data, size, offset, field, base, values);
+
+    if (field->length) {
+        struct xamine_item **end;
+        long length;
+
+        item = xamine_item_new(arena);
+        if (!item)
+            return NULL;
+        item->name = xamine_item_name(arena, field->name);
+        item->definition = field->definition;
+        item->offset = *offset;
+
+        /* Every element takes at least one byte.  Implicit lengths are
+         * as many elements as the rest of the packet holds. */
+        if (field->length->type == XAMINE_IMPLICIT) {
+            size_t element_size;
+
+            if (!xamine_static_size(field->definition, &element_size) ||
+                element_size == 0) {
+                xamine_item_discard(arena, item);
+                return NULL;
+            }
+            length = (size - *offset) / element_size;
+        }
+        else if (!xamine_evaluate_expression(field->length, values, &length) ||
+                 length < 0 || (unsigned long) length > size - *offset) {
+            xamine_item_discard(arena, item);
+            return NULL;
+        }
+
+        end = &item->child;
+        for (long i = 0; i < length; i++) {
+            *end = xamine_definition(conversation, arena, data, size, offset, field->definition);
+            if (!*end) {
+                xamine_item_discard(arena, item);
+                return NULL;
+            }
+            (*end)->name = xamine_item_index_name(arena, i);
+            end = &(*end)->next;
+        }
+        *end = NULL;
+    }
+    else {
+        item = xamine_definition(conversation, arena, data, size, offset, field->definition);
+        if (item)
+            item->name = xamine_item_name(arena, field->name);
+    }
+
+    return item;
+}
+
+static struct xamine_item *
+xamine_definition(const struct xamine_conversation *conversation,
+                  struct xamine_arena *arena,
+                  const unsigned char *data, size_t size, size_t *offset,
+                  const struct xamine_definition *definition)
+{
+    struct xamine_item *item;
+
+    if (!definition)
+        return NULL;
+
+    if (definition->type == XAMINE_TYPEDEF) {
+        item = xamine_definition(conversation, arena, data, size, offset, definition->u.ref);
+        if (item)
+            item->definition = definition;
+        return item;
+    }
+
+    item = xamine_item_new(arena);
+    if (!item)
+        return NULL;
+    item->definition = definition;
+    item->offset = *offset;
+    switch (definition->type) {
+    case XAMINE_STRUCT:
+    case XAMINE_UNION:
+    {
+        struct xamine_item **end = &item->child;
+        size_t start = *offset;
+        size_t union_end = start;
+        long values_buf[32], *values = values_buf;
+        size_t nfields = 0, i = 0;
+
+        /* The values of the fields, by position, for the lengths of lists. */
+        for (struct xamine_field_definition *child = definition->u.fields; child; child = child->next)
+            nfields++;
+        if (nfields > ARRAY_SIZE(values_buf)) {
+            values = malloc(nfields * sizeof(*values));
+            if (!values) {
+                xamine_item_discard(arena, item);
+                return NULL;
+            }
+        }
+
+        /* Union members all start at the start of the union, which then
+         * takes the size of its largest member. */
+        for (struct xamine_field_definition *child = definition->u.fields; child; child = child->next, i++) {
+            if (definition->type == XAMINE_UNION)
+                *offset = start;
+            *end = xamine_field_definition(conversation, arena, data, size, offset, child, values);
+            if (!*end) {
+                if (values != values_buf)
+                    free(values);
+                xamine_item_discard(arena, item);
+                return NULL;
+            }
+            values[i] = xamine_item_value(*end);
+            end = &(*end)->next;
+            if (*offset > union_end)
+                union_end = *offset;
+        }
+        *end = NULL;
+        if (definition->type == XAMINE_UNION)
+            *offset = union_end;
+        if (values != values_buf)
+            free(values);
+        break;
+    }
+
+    case XAMINE_BOOL:
+    case XAMINE_CHAR:
+    case XAMINE_SIGNED:
+    case XAMINE_UNSIGNED:
+        if ((definition->u.size != 1 && definition->u.size != 2 && definition->u.size != 4) ||
+            ((definition->type == XAMINE_BOOL || definition->type == XAMINE_CHAR) &&
+             definition->u.size != 1) ||
+            size - *offset < definition->u.size) {
+            xamine_item_discard(arena, item);
+            return NULL;
+        }
+        xamine_decode_scalar(item, definition->type, definition->u.size,
+                             data + *offset, conversation->is_le);
+        *offset += definition->u.size;
+        break;
+
+    case XAMINE_TYPEDEF:
+        break;
+    }
+
+    return item;
+}
+
+/* Check whether a definition is or contains one of a set. */
+static bool
+xamine_uses_definition(const struct xamine_definition *definition,
+                       const struct xamine_definition **set, size_t count, int depth)
+{
+    if (!definition || depth > 64)
+        return false;
+    for (size_t i = 0; i < count; i++)
+        if (set[i] == definition)
+            return true;
+
+    switch (definition->type) {
+    case XAMINE_STRUCT:
+    case XAMINE_UNION:
+        for (const struct xamine_field_definition *field = definition->u.fields; field; field = field->next)
+            if (xamine_uses_definition(field->definition, set, count, depth + 1))
+                return true;
+        return false;
+    case XAMINE_TYPEDEF:
+        return xamine_uses_definition(definition->u.ref, set, count, depth + 1);
+    case XAMINE_BOOL:
+    case XAMINE_CHAR:
+    case XAMINE_SIGNED:
+    case XAMINE_UNSIGNED:
+        break;
+    }
+    return false;
+}
+
+static void
+xamine_drop_invalid(struct xamine_definition **definition,
+                    const struct xamine_definition **invalid, size_t ninvalid)
+{
+    if (xamine_uses_definition(*definition, invalid, ninvalid, 0))
+        *definition = NULL;
+}
+
+static void
+xamine_drop_invalid_events(const struct xamine_context *ctx, struct xamine_event **events,
+                           const struct xamine_definition **invalid, size_t ninvalid)
+{
+    while (*events) {
+        struct xamine_event *cur = *events;
+
+        if (!xamine_uses_definition(cur->definition, invalid, ninvalid, 0)) {
+            events = &cur->next;
+            continue;
+        }
+        *events = cur->next;
+        if (!ctx->cache)
+            free(cur);
+    }
+}
+
+/*
+ * Resolve the length expressions of the definitions added since stop (all of
+ * them for NULL), so that decoding looks fields up by position and never
+ * meets an invalid expression.  Requests, replies, events and errors whose
+ * layout depends on an invalid expression cannot be examined.
+ */
+static void
+xamine_resolve_definitions(struct xamine_context *ctx,
+                           const struct xamine_definition *stop)
+{
+    const struct xamine_definition **invalid = NULL;
+    size_t ninvalid = 0, alloc = 0;
+
+    for (struct xamine_definition *def = ctx->definitions; def != stop; def = def->next) {
+        bool valid = true;
+
+        if (def->type != XAMINE_STRUCT && def->type != XAMINE_UNION)
+            continue;
+        for (struct xamine_field_definition *field = def->u.fields; field; field = field->next)
+            if (field->length && field->length->type != XAMINE_IMPLICIT &&
+                !xamine_resolve_expression(ctx, field->length, def->u.fields, field))
+                valid = false;
+        if (valid)
+            continue;
+
+        if (ninvalid == alloc) {
+            const struct xamine_definition **grown;
+
+            alloc = alloc ? 2 * alloc : 8;
+            grown = realloc(invalid, alloc * sizeof(*invalid));
+            if (!grown)
+                break;
+            invalid = grown;
+        }
+        invalid[ninvalid++] = def;
+    }
+    if (ninvalid == 0) {
+        free(invalid);
+        return;
+    }
+
+    for (int i = 0; i < ARRAY_SIZE(ctx->core_events); i++)
+        xamine_drop_invalid(&ctx->core_events[i], invalid, ninvalid);
+    for (int i = 0; i < ARRAY_SIZE(ctx->core_errors); i++)
+        xamine_drop_invalid(&ctx->core_errors[i], invalid, ninvalid);
+    for (int i = 0; i < ARRAY_SIZE(ctx->core_requests); i++) {
+        xamine_drop_invalid(&ctx->core_requests[i], invalid, ninvalid);
+        xamine_drop_invalid(&ctx->core_replies[i], invalid, ninvalid);
+    }
+    for (struct xamine_extension *extension = ctx->extensions; extension; extension = extension->next) {
+        for (int i = 0; i < ARRAY_SIZE(extension->requests); i++) {
+            xamine_drop_invalid(&extension->requests[i], invalid, ninvalid);
+            xamine_drop_invalid(&extension->replies[i], invalid, ninvalid);
+        }
+        /* Event and error entries loaded from a cache are freed with it. */
+        xamine_drop_invalid_events(ctx, &extension->events, invalid, ninvalid);
+        xamine_drop_invalid_events(ctx, &extension->generic_events, invalid, ninvalid);
+        for (struct xamine_error **error = &extension->errors; *error;) {
+            struct xamine_error *cur = *error;
+
+            if (!xamine_uses_definition(cur->definition, invalid, ninvalid, 0)) {
+                error = &cur->next;
+                continue;
+            }
+            *error = cur->next;
+            if (!ctx->cache)
+                free(cur);
+        }
+    }
+    free(invalid);
+}
+
+/*
+ * Copy a length expression of a request for its big request variant, in
+ * which the fields after the header are one further on.
+ */
+static struct xamine_expression *
+xamine_copy_big_expression(const struct xamine_expression *expression)
+{
+    struct xamine_expression *copy = malloc(sizeof(*copy));
+
+    if (!copy)
+        return NULL;
+    *copy = *expression;
+    if (copy->type == XAMINE_FIELDREF && copy->field_index >= 3)
+        copy->field_index++;
+    if (copy->type == XAMINE_OP) {
+        copy->u.op.left = xamine_copy_big_expression(expression->u.op.left);
+        copy->u.op.right = xamine_copy_big_expression(expression->u.op.right);
+        if (!copy->u.op.left || !copy->u.op.right) {
+            free_expression(copy);
+            return NULL;
+        }
+    }
+    return copy;
+}
+
+/*
+ * Make the variant of a request for the BIG-REQUESTS extension, whose
+ * 16-bit length is 0 and followed by the length in 32 bits.  The variant
+ * copies the fields of the request, whose lengths refer to fields by
+ * position, with the 32-bit length after the three fields of the header.
+ */
+static struct xamine_definition *
+xamine_make_big_request(struct xamine_context *ctx,
+                        const struct xamine_definition *request,
+                        const struct xamine_definition *card32)
+{
+    struct xamine_field_definition *fields = NULL, **tail = &fields;
+    struct xamine_definition *def;
+    size_t i = 0;
+
+    for (const struct xamine_field_definition *field = request->u.fields; field; field = field->next, i++) {
+        struct xamine_field_definition *copy;
+
+        if (i == 2 && !streq(field->name, "length"))
+            goto fail;
+        copy = calloc(1, sizeof(*copy));
+        if (!copy)
+            goto fail;
+        *copy = *field;
+        copy->next = NULL;
+        *tail = copy;
+        tail = &copy->next;
+        if (field->length) {
+            copy->length = xamine_copy_big_expression(field->length);
+            if (!copy->length)
+                goto fail;
+        }
+
+        if (i == 2) {
+            copy = calloc(1, sizeof(*copy));
+            if (!copy)
+                goto fail;
+            copy->name = atom_strdup(ctx->atoms, "big_length");
+            copy->definition = card32;
+            *tail = copy;
+            tail = &copy->next;
+        }
+    }
+    if (i < 3)
+        goto fail;
+
+    def = calloc(1, sizeof(*def));
+    if (!def)
+        goto fail;
+    *def = *request;
+    def->u.fields = fields;
+    def->next = NULL;
+    return def;
+
+fail:
+    free_field_definitions(fields);
+    return NULL;
+}
+
+static void
+free_big_requests(struct xamine_definition *defs)
+{
+    while (defs) {
+        struct xamine_definition *def = defs;
+
+        defs = defs->next;
+        free_field_definitions(def->u.fields);
+        free(def);
+    }
+}
+
+/* Make the big request variants of a table of requests. */
+static void
+xamine_add_big_requests(struct xamine_context *ctx,
+                        struct xamine_definition **big,
+                        struct xamine_definition *const *requests, size_t count)
+{
+    const struct xamine_definition *card32 = NULL;
+
+    for (const struct xamine_definition *def = ctx->definitions; def; def = def->next)
+        if (def->type == XAMINE_UNSIGNED && streq(def->name, "CARD32")) {
+            card32 = def;
+            break;
+        }
+    if (!card32)
+        return;
+
+    for (size_t i = 0; i < count; i++) {
+        if (!requests[i] || big[i])
+            continue;
+        big[i] = xamine_make_big_request(ctx, requests[i], card32);
+        if (big[i]) {
+            big[i]->next = ctx->big_requests;
+            ctx->big_requests = big[i];
+        }
+    }
+}
+
+/* Make the big request variants of the core requests and loaded extensions. */
+static void
+xamine_add_context_big_requests(struct xamine_context *ctx)
+{
+    xamine_add_big_requests(ctx, ctx->core_big_requests, ctx->core_requests,
+                            ARRAY_SIZE(ctx->core_requests));
+    for (struct xamine_extension *extension = ctx->extensions; extension; extension = extension->next)
+        if (!atomic_load_explicit(&extension->pending, memory_order_relaxed))
+            xamine_add_big_requests(ctx, extension->big_requests, extension->requests,
+                                    ARRAY_SIZE(extension->requests));
+}
+
+static void
+xamine_compile_extension(struct xamine_context *ctx,
+                         const struct xamine_extension *extension)
+{
+    if (!ctx->programs)
+        return;
+
+    for (int i = 0; i < ARRAY_SIZE(extension->requests); i++) {
+        program_table_add(ctx->programs, extension->requests[i]);
+        program_table_add(ctx->programs, extension->big_requests[i]);
+        program_table_add(ctx->programs, extension->replies[i]);
+    }
+    for (struct xamine_event *event = extension->events; event; event = event->next)
+        program_table_add(ctx->programs, event->definition);
+    for (struct xamine_event *event = extension->generic_events; event; event = event->next)
+        program_table_add(ctx->programs, event->definition);
+    for (struct xamine_error *error = extension->errors; error; error = error->next)
+        program_table_add(ctx->programs, error->definition);
+}
+
+/*
+ * Compile the definitions of all requests, replies, events and errors,
+ * which are the roots xamine_examine decodes from.  Definitions which fail to compile cannot
+ * be examined.
+ */
+static void
+xamine_compile_programs(struct xamine_context *ctx)
+{
+    if (ctx->flags & XAMINE_CONTEXT_NO_COMPILE)
+        return;
+
+    ctx->programs = program_table_new();
+    if (!ctx->programs)
+        return;
+
+    for (int i = 0; i < ARRAY_SIZE(ctx->core_events); i++)
+        program_table_add(ctx->programs, ctx->core_events[i]);
+    for (int i = 0; i < ARRAY_SIZE(ctx->core_errors); i++)
+        program_table_add(ctx->programs, ctx->core_errors[i]);
+    for (int i = 0; i < ARRAY_SIZE(ctx->core_requests); i++) {
+        program_table_add(ctx->programs, ctx->core_requests[i]);
+        program_table_add(ctx->programs, ctx->core_big_requests[i]);
+        program_table_add(ctx->programs, ctx->core_replies[i]);
+    }
+    for (struct xamine_extension *extension = ctx->extensions; extension; extension = extension->next)
+        if (!atomic_load_explicit(&extension->pending, memory_order_relaxed))
+            xamine_compile_extension(ctx, extension);
+}
+
+/*
+ * Read the extension names from the root element of a description, without
+ * parsing the rest.  Returns false if the file cannot be read; the names
+ * are NULL for the core protocol.
+ */
+static bool
+xamine_peek_extension(const char *filename, char **name, char **xname)
+{
+    xmlTextReader *reader = xmlReaderForFile(filename, NULL, XML_PARSE_NOBLANKS);
+    int ret;
+
+    *name = *xname = NULL;
+    if (!reader)
+        return false;
+
+    while ((ret = xmlTextReaderRead(reader)) == 1 &&
+           xmlTextReaderNodeType(reader) != XML_READER_TYPE_ELEMENT)
+        ;
+    if (ret == 1) {
+        *name = (char *) xmlTextReaderGetAttribute(reader, BAD_CAST "extension-name");
+        *xname = (char *) xmlTextReaderGetAttribute(reader, BAD_CAST "extension-xname");
+    }
+
+    xmlFreeTextReader(reader);
+    return ret == 1;
+}
+
+static bool
+xamine_module_loaded(const struct xamine_context *ctx, const char *filename)
+{
+    for (const struct xamine_module *module = ctx->modules; module; module = module->next)
+        if (streq(module->filename, filename))
+            return true;
+    return false;
+}
+
+/*
+ * Compile the pending extensions of a lazy context whose descriptions have
+ * been parsed, and let other threads use them.
+ */
+static void
+xamine_publish_extensions(struct xamine_context *ctx)
+{
+    for (struct xamine_extension *extension = ctx->extensions; extension; extension = extension->next) {
+        if (!atomic_load_explicit(&extension->pending, memory_order_relaxed) ||
+            !xamine_module_loaded(ctx, ctx->files.gl_pathv[extension->file]))
+            continue;
+        xamine_add_big_requests(ctx, extension->big_requests, extension->requests,
+                                ARRAY_SIZE(extension->requests));
+        xamine_compile_extension(ctx, extension);
+        atomic_store_explicit(&extension->pending, false, memory_order_release);
+    }
+}
+
+/* Parse the description of an extension, and the ones it imports.  Called
+ * with the lock held. */
+static void
+xamine_load_extension(struct xamine_context *ctx,
+                      const struct xamine_extension *extension)
+{
+    const struct xamine_definition *loaded = ctx->definitions;
+    struct xamine_files files = { ctx->files.gl_pathv, NULL };
 
-static struct xamine_item *
-xamine_field_definition(const struct xamine_conversation *conversation,
-                        const unsigned char **data, size_t *size, size_t *offset,
-                        const struct xamine_field_definition *field,
-                        const struct xamine_item *parent)
+    xamine_parse_xmlxcb_file(ctx, &files, extension->file);
+    xamine_resolve_definitions(ctx, loaded);
+    xamine_publish_extensions(ctx);
+}
+
+/*
+ * Create a pending extension for each description of an extension, and
+ * parse the others, which describe the core protocol.
+ */
+static void
+xamine_load_lazily(struct xamine_context *ctx)
 {
-    struct xamine_item *item;
+    struct xamine_files files = { ctx->files.gl_pathv, NULL };
+    bool *is_core;
+    size_t nfiles = ctx->files.gl_pathc;
 
-    if (field->length) {
-        struct xamine_item **end;
-        size_t length;
+    is_core = calloc(nfiles + 1, sizeof(*is_core));
+    if (!is_core)
+        return;
 
-        item = calloc(1, sizeof(*item));
-        item->name = strdup(field->name);
-        item->definition = field->definition;
-        item->offset = *offset;
+    for (size_t i = 0; i < nfiles; i++) {
+        struct xamine_extension *extension;
+        char *name, *xname;
 
-        end = &item->child;
-        length = xamine_evaluate_expression(field->length, parent);
-        for (size_t i = 0; i < length; i++) {
-            *end = xamine_definition(conversation, data, size, offset, field->definition, parent);
-            (*end)->name = afmt("[%lu]", i);
-            end = &(*end)->next;
+        if (!xamine_peek_extension(files.names[i], &name, &xname))
+            continue;
+        is_core[i] = !xname;
+        for (extension = ctx->extensions; xname && extension; extension = extension->next)
+            if (streq(extension->xname, xname))
+                break;
+        if (xname && !extension) {
+            extension = calloc(1, sizeof(*extension));
+            extension->name = atom_strdup(ctx->atoms, name);
+            extension->xname = atom_strdup(ctx->atoms, xname);
+            extension->file = i;
+            atomic_init(&extension->pending, true);
+            extension->next = ctx->extensions;
+            ctx->extensions = extension;
         }
-        *end = NULL;
-    }
-    else {
-        item = xamine_definition(conversation, data, size, offset, field->definition, parent);
-        item->name = strdup(field->name);
+        free(name);
+        free(xname);
     }
 
-    return item;
+    for (size_t i = 0; i < nfiles; i++)
+        if (is_core[i])
+            xamine_parse_xmlxcb_file(ctx, &files, i);
+    free(is_core);
 }
 
-static struct xamine_item *
-xamine_definition(const struct xamine_conversation *conversation,
-                  const unsigned char **data, size_t *size, size_t *offset,
-                  const struct xamine_definition *definition,
-                  const struct xamine_item *parent)
+struct xamine_reader {
+    struct xamine_files *files;
+    size_t nfiles;
+    atomic_size_t next;
+};
+
+static void *
+xamine_read_files(void *closure)
 {
-    struct xamine_item *item;
+    struct xamine_reader *reader = closure;
+    size_t i;
 
-    if (definition->type == XAMINE_TYPEDEF) {
-        item = xamine_definition(conversation, data, size, offset, definition->u.ref, parent);
-        item->definition = definition;
-        return item;
-    }
+    while ((i = atomic_fetch_add_explicit(&reader->next, 1, memory_order_relaxed)) < reader->nfiles)
+        reader->files->docs[i] = xamine_read_xml(reader->files->names[i]);
+    return NULL;
+}
 
-    item = calloc(1, sizeof(*item));
-    item->definition = definition;
-    if (definition->type == XAMINE_STRUCT) {
-        struct xamine_item **end = &item->child;
+/*
+ * Read every file into a document on one thread per processor, as reading
+ * the XML takes most of the time; the documents are then parsed into
+ * definitions in order on the calling thread, exactly as when they are
+ * read one at a time.  Leaves files->docs NULL if that is not worthwhile.
+ */
+static void
+xamine_read_ahead(struct xamine_files *files, size_t nfiles)
+{
+    struct xamine_reader reader = { files, nfiles };
+    pthread_t *threads;
+    unsigned nthreads, started;
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+
+    nthreads = online > 0 ? online : 1;
+    if (nthreads > nfiles)
+        nthreads = nfiles;
+    if (nthreads <= 1)
+        return;
 
-        for (struct xamine_field_definition *child = definition->u.fields; child; child = child->next) {
-            *end = xamine_field_definition(conversation, data, size, offset, child, item);
-            end = &(*end)->next;
-        }
-        *end = NULL;
+    files->docs = calloc(nfiles, sizeof(*files->docs));
+    threads = calloc(nthreads, sizeof(*threads));
+    if (!files->docs || !threads) {
+        free(files->docs);
+        files->docs = NULL;
+        free(threads);
+        return;
     }
-    else {
-        switch (definition->type) {
-        case XAMINE_BOOL:
-            /* FIXME: field->definition->size must be 1 */
-            item->u.bool_value = *(const unsigned char *) (*data) ? 1 : 0;
-            break;
-
-        case XAMINE_CHAR:
-            /* FIXME: field->definition->size must be 1 */
-            item->u.char_value = *(const char *) (*data);
-            break;
+    atomic_init(&reader.next, 0);
 
-        case XAMINE_SIGNED:
-        case XAMINE_UNSIGNED:
-        {
-            unsigned char *dest = definition->type == XAMINE_SIGNED
-                                ? (unsigned char *) &(item->u.signed_value)
-                                : (unsigned char *) &(item->u.unsigned_value);
-            const unsigned char *src = *data;
-            if (definition->u.size == 1 || conversation->is_le == conversation->ctx->host_is_le) {
-                memcpy(dest, src, definition->u.size);
-            }
-            else {
-                dest += definition->u.size - 1;
-                for (int i = 0; i < definition->u.size; i++)
-                    *dest-- = *src++;
-            }
+    /* The calling thread reads too. */
+    for (started = 1; started < nthreads; started++)
+        if (pthread_create(&threads[started], NULL, xamine_read_files, &reader) != 0)
             break;
-        }
-
-        /* FIXME: Remove assert. */
-        case XAMINE_STRUCT:
-        case XAMINE_UNION:
-        case XAMINE_TYPEDEF:
-            assert(!"unreachable");
-            return 0;
-        }
-        *data += definition->u.size;
-        *size -= definition->u.size;
-        *offset += definition->u.size;
-    }
+    xamine_read_files(&reader);
+    for (unsigned i = 1; i < started; i++)
+        pthread_join(threads[i], NULL);
 
-    return item;
+    free(threads);
 }
 
 /********** Public functions **********/
@@ -557,11 +1840,13 @@ xamine_context_new(enum xamine_context_flags flags)
     const char *xamine_path_env;
     char **xamine_path;
     glob_t xml_files;
+    char *cache_path = NULL;
     static const struct {
         const char *name;
         enum xamine_type type;
         size_t size;
     } core_types[] = {
+        { "void",   XAMINE_UNSIGNED, 1 },
         { "char",   XAMINE_CHAR,     1 },
         { "BOOL",   XAMINE_BOOL,     1 },
         { "BYTE",   XAMINE_UNSIGNED, 1 },
@@ -573,30 +1858,29 @@ xamine_context_new(enum xamine_context_flags flags)
         { "INT32",  XAMINE_SIGNED,   4 },
     };
 
-    if (flags & ~XAMINE_CONTEXT_NO_FLAGS)
+    if (flags & ~(XAMINE_CONTEXT_NO_CACHE | XAMINE_CONTEXT_NO_COMPILE |
+                  XAMINE_CONTEXT_LAZY | XAMINE_CONTEXT_NO_THREADS))
         return NULL;
 
     ctx = calloc(1, sizeof(*ctx));
-    ctx->refcnt = 1;
+    atomic_init(&ctx->refcnt, 1);
+    pthread_mutex_init(&ctx->lock, NULL);
     ctx->flags = flags;
+    ctx->atoms = atom_table_new();
+    ctx->symbols = symbol_table_new();
+    if (!ctx->atoms || !ctx->symbols) {
+        atom_table_free(ctx->atoms);
+        symbol_table_free(ctx->symbols);
+        pthread_mutex_destroy(&ctx->lock);
+        free(ctx);
+        return NULL;
+    }
 
     {
         unsigned long l = 1;
         ctx->host_is_le = *(unsigned char*) &l;
     }
 
-    /* Add definitions of core types. */
-    for (int i = 0; i < ARRAY_SIZE(core_types); i++) {
-        struct xamine_definition *def = calloc(1, sizeof(*def));
-
-        def->name = strdup(core_types[i].name);
-        def->type = core_types[i].type;
-        def->u.size = core_types[i].size;
-
-        def->next = ctx->definitions;
-        ctx->definitions = def;
-    }
-
     /* Set up the search path for XML-XCB descriptions. */
     xamine_path_env = getenv("XAMINE_PATH");
     if (!xamine_path_env)
@@ -605,6 +1889,7 @@ xamine_context_new(enum xamine_context_flags flags)
 
     /* Find all the XML files on the search path. */
     xamine_path = strsplit(xamine_path_env, XAMINE_PATH_DELIM);
+    xml_files.gl_pathc = 0;
     xml_files.gl_pathv = NULL;
     for (char **iter = xamine_path; *iter; iter++) {
         char *pattern = afmt("%s%s", *iter, XAMINE_PATH_GLOB);
@@ -613,20 +1898,75 @@ xamine_context_new(enum xamine_context_flags flags)
     }
     strsplit_free(xamine_path);
 
-    /* Parse the XML files. */
-    if (xml_files.gl_pathv)
-        for (char **iter = xml_files.gl_pathv; *iter; iter++)
-            xamine_parse_xmlxcb_file(ctx, *iter);
+    /* Use the cached definitions if they were built from the same files.
+     * The cache holds every extension, so lazy contexts do without it. */
+    ctx->cache_key = xamine_cache_key(xml_files.gl_pathv);
+    if (xml_files.gl_pathv && !(flags & (XAMINE_CONTEXT_NO_CACHE | XAMINE_CONTEXT_LAZY))) {
+        cache_path = xamine_cache_default_path();
+        if (cache_path && xamine_cache_load(ctx, cache_path)) {
+            free(cache_path);
+            globfree(&xml_files);
+            xamine_resolve_definitions(ctx, NULL);
+            xamine_add_context_big_requests(ctx);
+            xamine_compile_programs(ctx);
+            return ctx;
+        }
+    }
+
+    /* Add definitions of core types, in the built-in scope. */
+    for (int i = 0; i < ARRAY_SIZE(core_types); i++) {
+        struct xamine_definition *def = calloc(1, sizeof(*def));
+
+        def->name = atom_strdup(ctx->atoms, core_types[i].name);
+        def->type = core_types[i].type;
+        def->u.size = core_types[i].size;
+
+        symbol_table_add(ctx->symbols, SYMBOL_TYPE, XAMINE_ATOM_NONE,
+                         atom_intern(ctx->atoms, def->name, strlen(def->name), true),
+                         def);
+        def->next = ctx->definitions;
+        ctx->definitions = def;
+    }
+
+    /* Parse the XML files.  Setting up libxml2 first makes it safe for
+     * several threads to create contexts at once; it is done only once. */
+    xmlInitParser();
+    if (flags & XAMINE_CONTEXT_LAZY) {
+        ctx->files = xml_files;
+        xamine_load_lazily(ctx);
+    }
+    else {
+        struct xamine_files files = { xml_files.gl_pathv, NULL };
+
+        if (!(flags & XAMINE_CONTEXT_NO_THREADS))
+            xamine_read_ahead(&files, xml_files.gl_pathc);
+        for (size_t i = 0; i < xml_files.gl_pathc; i++)
+            xamine_parse_xmlxcb_file(ctx, &files, i);
+
+        /* Documents of files listed twice are left over. */
+        if (files.docs)
+            for (size_t i = 0; i < xml_files.gl_pathc; i++)
+                xmlFreeDoc(files.docs[i]);
+        free(files.docs);
+        globfree(&xml_files);
+    }
+    xamine_resolve_definitions(ctx, NULL);
 
-    globfree(&xml_files);
+    /* Failing to write the cache only costs time on the next run. */
+    if (cache_path)
+        xamine_cache_write(ctx, cache_path);
+    free(cache_path);
 
+    xamine_add_context_big_requests(ctx);
+    xamine_compile_programs(ctx);
+    xamine_publish_extensions(ctx);
     return ctx;
 }
 
 XAMINE_EXPORT struct xamine_context *
 xamine_context_ref(struct xamine_context *ctx)
 {
-    ctx->refcnt++;
+    atomic_fetch_add_explicit(&ctx->refcnt, 1, memory_order_relaxed);
     return ctx;
 }
 
@@ -643,7 +1983,7 @@ free_expression(struct xamine_expression *expr)
         free_expression(expr->u.op.right);
         break;
     case XAMINE_FIELDREF:
-        free(expr->u.field);
+    case XAMINE_IMPLICIT:
         break;
     }
     free(expr);
@@ -656,7 +1996,6 @@ free_field_definitions(struct xamine_field_definition *fields)
         struct xamine_field_definition *field = fields;
         fields = fields->next;
         free_expression(field->length);
-        free(field->name);
         free(field);
     }
 }
@@ -679,7 +2018,6 @@ free_definitions(struct xamine_definition *defs)
             free_field_definitions(def->u.fields);
             break;
         }
-        free(def->name);
         free(def);
     }
 }
@@ -694,16 +2032,37 @@ free_events(struct xamine_event *events)
     }
 }
 
+static void
+free_errors(struct xamine_error *errors)
+{
+    while (errors) {
+        struct xamine_error *error = errors;
+        errors = errors->next;
+        free(error);
+    }
+}
+
+static void
+free_modules(struct xamine_module *modules)
+{
+    while (modules) {
+        struct xamine_module *module = modules;
+        modules = modules->next;
+        free(module->filename);
+        free(module->imports);
+        free(module);
+    }
+}
+
 static void
 free_extensions(struct xamine_extension *extensions)
 {
     while (extensions) {
         struct xamine_extension *extension = extensions;
         extensions = extensions->next;
-        free(extension->name);
-        free(extension->xname);
         free_events(extension->events);
-        /* struct xamine_error *errors; */
+        free_events(extension->generic_events);
+        free_errors(extension->errors);
         free(extension);
     }
 }
@@ -711,20 +2070,58 @@ free_extensions(struct xamine_extension *extensions)
 XAMINE_EXPORT struct xamine_context *
 xamine_context_unref(struct xamine_context *ctx)
 {
-    if (!ctx || --ctx->refcnt > 0)
+    /* The last reference frees the context, after every other thread
+     * has finished with it. */
+    if (!ctx || atomic_fetch_sub_explicit(&ctx->refcnt, 1, memory_order_acq_rel) > 1)
         return ctx;
 
-    free_definitions(ctx->definitions);
-    free_extensions(ctx->extensions);
+    program_table_free(ctx->programs);
+    free_big_requests(ctx->big_requests);
+    if (ctx->cache) {
+        xamine_cache_free(ctx->cache);
+    }
+    else {
+        free_definitions(ctx->definitions);
+        free_extensions(ctx->extensions);
+    }
+    free_modules(ctx->modules);
+    symbol_table_free(ctx->symbols);
+    atom_table_free(ctx->atoms);
+    if (ctx->flags & XAMINE_CONTEXT_LAZY)
+        globfree(&ctx->files);
+    pthread_mutex_destroy(&ctx->lock);
     free(ctx);
 
     return NULL;
 }
 
+XAMINE_EXPORT int
+xamine_context_write_cache(struct xamine_context *ctx, const char *path)
+{
+    char *default_path = NULL;
+    bool ok;
+
+    /* A lazy context lacks the extensions it has not loaded. */
+    if (ctx->flags & XAMINE_CONTEXT_LAZY)
+        return -1;
+
+    if (!path) {
+        default_path = xamine_cache_default_path();
+        if (!default_path)
+            return -1;
+        path = default_path;
+    }
+
+    ok = xamine_cache_write(ctx, path);
+    free(default_path);
+
+    return ok ? 0 : -1;
+}
+
 XAMINE_EXPORT const struct xamine_definition *
 xamine_get_definitions(struct xamine_context *ctx)
 {
-    return ctx->definitions;
+    return xamine_context_definitions(ctx);
 }
 
 XAMINE_EXPORT struct xamine_conversation *
@@ -733,16 +2130,30 @@ xamine_conversation_new(struct xamine_context *ctx,
 {
     struct xamine_conversation *conversation;
 
-    if (flags & ~XAMINE_CONVERSATION_NO_FLAGS)
+    if (flags & ~(XAMINE_CONVERSATION_NO_SETUP | XAMINE_CONVERSATION_LSB_FIRST |
+                  XAMINE_CONVERSATION_MSB_FIRST | XAMINE_CONVERSATION_STATS))
+        return NULL;
+    if ((flags & XAMINE_CONVERSATION_LSB_FIRST) && (flags & XAMINE_CONVERSATION_MSB_FIRST))
         return NULL;
 
     conversation = calloc(1, sizeof(*conversation));
-    conversation->refcnt = 1;
+    if (flags & XAMINE_CONVERSATION_STATS)
+        conversation->stats = calloc(1, sizeof(*conversation->stats));
+    atomic_init(&conversation->refcnt, 1);
     conversation->flags = flags;
     conversation->ctx = xamine_context_ref(ctx);
 
-    /* FIXME */
-    conversation->is_le = ctx->host_is_le;
+    /* The connection setup gives the byte order, if it is fed. */
+    if (flags & XAMINE_CONVERSATION_LSB_FIRST)
+        conversation->is_le = true;
+    else if (flags & XAMINE_CONVERSATION_MSB_FIRST)
+        conversation->is_le = false;
+    else
+        conversation->is_le = ctx->host_is_le;
+    if (flags & XAMINE_CONVERSATION_NO_SETUP) {
+        conversation->streams[XAMINE_REQUEST].setup_done = true;
+        conversation->streams[XAMINE_RESPONSE].setup_done = true;
+    }
 
     return conversation;
 }
@@ -750,72 +2161,465 @@ xamine_conversation_new(struct xamine_context *ctx,
 XAMINE_EXPORT struct xamine_conversation *
 xamine_conversation_ref(struct xamine_conversation *conversation)
 {
-    conversation->refcnt++;
+    atomic_fetch_add_explicit(&conversation->refcnt, 1, memory_order_relaxed);
     return conversation;
 }
 
 XAMINE_EXPORT struct xamine_conversation *
 xamine_conversation_unref(struct xamine_conversation *conversation)
 {
-    if (!conversation || --conversation->refcnt > 0)
+    if (!conversation ||
+        atomic_fetch_sub_explicit(&conversation->refcnt, 1, memory_order_acq_rel) > 1)
         return conversation;
 
     xamine_context_unref(conversation->ctx);
+    free(conversation->streams[XAMINE_REQUEST].buffer);
+    free(conversation->streams[XAMINE_RESPONSE].buffer);
+    free(conversation->stats);
     free(conversation);
     return NULL;
 }
 
-XAMINE_EXPORT struct xamine_item *
-xamine_examine(const struct xamine_conversation *conversation,
-               enum xamine_direction direction,
-               const void *data_void, size_t size)
+XAMINE_EXPORT void
+xamine_conversation_set_filter(struct xamine_conversation *conversation,
+                               const struct xamine_filter *filter)
 {
-    const struct xamine_definition *definition = NULL;
-    size_t offset = 0;
-    const unsigned char *data = data_void;
+    conversation->filter = filter;
+}
+
+XAMINE_EXPORT int
+xamine_conversation_set_extension(struct xamine_conversation *conversation,
+                                  const char *name, unsigned char major_opcode,
+                                  unsigned char first_event,
+                                  unsigned char first_error)
+{
+    const struct xamine_extension *extension;
+
+    if (major_opcode < 128)
+        return -1;
+
+    extension = xamine_find_extension(conversation->ctx, name, strlen(name));
+    if (!extension)
+        return -1;
 
+    xamine_conversation_add_extension(conversation, extension, major_opcode,
+                                      first_event, first_error);
+    return 0;
+}
+
+const struct xamine_extension *
+xamine_find_extension(struct xamine_context *ctx, const char *xname,
+                      size_t length)
+{
+    for (const struct xamine_extension *extension = ctx->extensions; extension; extension = extension->next) {
+        if (strncmp(extension->xname, xname, length) != 0 || extension->xname[length] != '\0')
+            continue;
+
+        /* Another thread may be loading it, or have done so already. */
+        if (atomic_load_explicit(&extension->pending, memory_order_acquire)) {
+            pthread_mutex_lock(&ctx->lock);
+            if (atomic_load_explicit(&extension->pending, memory_order_relaxed))
+                xamine_load_extension(ctx, extension);
+            pthread_mutex_unlock(&ctx->lock);
+        }
+        return extension;
+    }
+    return NULL;
+}
+
+const struct xamine_definition *
+xamine_context_definitions(struct xamine_context *ctx)
+{
+    const struct xamine_definition *definitions;
+
+    if (!(ctx->flags & XAMINE_CONTEXT_LAZY))
+        return ctx->definitions;
+
+    pthread_mutex_lock(&ctx->lock);
+    definitions = ctx->definitions;
+    pthread_mutex_unlock(&ctx->lock);
+    return definitions;
+}
+
+bool
+xamine_load_packet_extensions(struct xamine_context *ctx, const char *name)
+{
+    bool loaded = false;
+
+    if (!(ctx->flags & XAMINE_CONTEXT_LAZY))
+        return false;
+
+    pthread_mutex_lock(&ctx->lock);
+    for (const struct xamine_extension *extension = ctx->extensions; extension; extension = extension->next) {
+        if (!atomic_load_explicit(&extension->pending, memory_order_relaxed) ||
+            !extension->name || strncmp(name, extension->name, strlen(extension->name)) != 0)
+            continue;
+        xamine_load_extension(ctx, extension);
+        loaded = true;
+    }
+    pthread_mutex_unlock(&ctx->lock);
+    return loaded;
+}
+
+const struct xamine_definition *
+xamine_big_request(const struct xamine_context *ctx,
+                   const struct xamine_definition *definition)
+{
+    if (!definition)
+        return NULL;
+    for (int i = 0; i < ARRAY_SIZE(ctx->core_requests); i++)
+        if (ctx->core_requests[i] == definition)
+            return ctx->core_big_requests[i];
+    for (const struct xamine_extension *extension = ctx->extensions; extension; extension = extension->next) {
+        if (atomic_load_explicit(&extension->pending, memory_order_acquire))
+            continue;
+        for (int i = 0; i < ARRAY_SIZE(extension->requests); i++)
+            if (extension->requests[i] == definition)
+                return extension->big_requests[i];
+    }
+    return NULL;
+}
+
+void
+xamine_conversation_add_extension(struct xamine_conversation *conversation,
+                                  const struct xamine_extension *extension,
+                                  unsigned char major_opcode,
+                                  unsigned char first_event,
+                                  unsigned char first_error)
+{
+    conversation->extensions[major_opcode - 128] = extension;
+    for (const struct xamine_event *event = extension->events; event; event = event->next) {
+        unsigned code = first_event + event->number;
+        if (code >= 64 && code < 128)
+            conversation->extension_events[code - 64] = event->definition;
+    }
+    for (const struct xamine_error *error = extension->errors; error; error = error->next) {
+        unsigned code = first_error + error->number;
+        if (code >= 128 && code < 256)
+            conversation->extension_errors[code - 128] = error->definition;
+    }
+}
+
+/* The XGE event of an extension with an event type, or NULL. */
+static const struct xamine_definition *
+xamine_generic_event(const struct xamine_extension *extension, unsigned event_type)
+{
+    if (!extension)
+        return NULL;
+    for (const struct xamine_event *event = extension->generic_events; event; event = event->next)
+        if (event->number == event_type)
+            return event->definition;
+    return NULL;
+}
+
+const struct xamine_definition *
+xamine_request_definition(const struct xamine_conversation *conversation,
+                          const unsigned char *data, bool reply)
+{
+    const struct xamine_extension *extension;
+    unsigned char major_opcode = data[0];
+
+    if (major_opcode < 128)
+        return reply ? conversation->ctx->core_replies[major_opcode]
+                     : conversation->ctx->core_requests[major_opcode];
+
+    extension = conversation->extensions[major_opcode - 128];
+    if (!extension)
+        return NULL;
+    return reply ? extension->replies[data[1]] : extension->requests[data[1]];
+}
+
+const struct xamine_definition *
+xamine_packet_definition(const struct xamine_conversation *conversation,
+                         enum xamine_direction direction,
+                         const unsigned char *data, size_t *size)
+{
     if (direction == XAMINE_REQUEST) {
         /* Request layout:
          * 1-byte major opcode
-         * 1 byte of request-specific data
+         * 1 byte of request-specific data (minor opcode for extensions)
          * 2-byte length (0 if big request)
          * If 2-byte length is zero, 4-byte length.
          * Rest of request-specific data
          */
-        return NULL; /* Not yet implemented. */
+        const struct xamine_extension *extension;
+        uint64_t length;
+        bool big;
+
+        if (*size < 4)
+            return NULL;
+        length = xamine_read_unsigned(data + 2, 2, conversation->is_le);
+        big = length == 0;
+        if (big) {
+            if (*size < 8)
+                return NULL;
+            length = xamine_read_unsigned(data + 4, 4, conversation->is_le);
+        }
+
+        /* Lists of implicit length end with the request, not the data. */
+        if (length && 4 * length < *size)
+            *size = 4 * length;
+
+        if (!big)
+            return xamine_request_definition(conversation, data, false);
+        if (data[0] < 128)
+            return conversation->ctx->core_big_requests[data[0]];
+        extension = conversation->extensions[data[0] - 128];
+        return extension ? extension->big_requests[data[1]] : NULL;
     }
     else if (direction == XAMINE_RESPONSE) {
         unsigned char response_type;
 
-        if (size < 32)
+        if (*size < 32)
             return NULL;
 
         response_type = *data;
         if (response_type == 0) {      /* Error */
             unsigned char error_code = *(data + 1);
             if (error_code < 128)
-                definition = conversation->ctx->core_errors[error_code];
+                return conversation->ctx->core_errors[error_code];
             else
-                definition = conversation->extension_errors[error_code - 128];
+                return conversation->extension_errors[error_code - 128];
         }
         else if (response_type == 1) { /* Reply */
-            return NULL;            /* Not yet implemented. */
+            return xamine_pending_reply(conversation,
+                                        xamine_response_sequence(conversation, data));
         }
         else {                        /* Event */
             /* Turn off SendEvent flag before looking up by event number. */
             const unsigned char event_code = response_type & ~0x80;
+            if (event_code == XAMINE_GENERIC_EVENT && data[1] >= 128) {
+                const struct xamine_definition *definition;
+
+                definition = xamine_generic_event(conversation->extensions[data[1] - 128],
+                                                  xamine_read_unsigned(data + 8, 2,
+                                                                       conversation->is_le));
+                if (definition)
+                    return definition;
+            }
             if (event_code < 64)
-                definition = conversation->ctx->core_events[event_code];
+                return conversation->ctx->core_events[event_code];
             else
-                definition = conversation->extension_events[event_code - 64];
+                return conversation->extension_events[event_code - 64];
         }
     }
 
-    if (!definition)
+    return NULL;
+}
+
+/*
+ * Dissect the data based on the definition.  Definitions which could not be
+ * compiled are walked instead.
+ */
+struct xamine_item *
+xamine_dissect(const struct xamine_conversation *conversation,
+               const struct xamine_definition *definition,
+               const struct program *program, struct xamine_arena *arena,
+               const unsigned char *data, size_t size)
+{
+    size_t offset = 0;
+
+    if (!program)
+        return xamine_definition(conversation, arena, data, size, &offset, definition);
+    return program_run(program, conversation, arena, data, size);
+}
+
+/*
+ * Examine a packet whose definition, and program if compiled, have been
+ * looked up, and count it in the statistics of the conversation.
+ */
+static struct xamine_item *
+xamine_examine_counted(const struct xamine_conversation *conversation,
+                       enum xamine_direction direction,
+                       const struct xamine_definition *definition,
+                       const struct program *program, struct xamine_arena *arena,
+                       const unsigned char *data, size_t size)
+{
+    struct xamine_item *item;
+    uint64_t start;
+
+    if (!definition) {
+        stats_record(conversation->stats, direction, data, size, STATS_UNKNOWN, 0);
+        return NULL;
+    }
+    if (conversation->filter &&
+        !xamine_filter_test(conversation->filter, conversation, definition, data, size)) {
+        stats_record(conversation->stats, direction, data, size, STATS_FILTERED, 0);
+        return NULL;
+    }
+
+    start = stats_now();
+    item = xamine_dissect(conversation, definition, program, arena, data, size);
+    stats_record(conversation->stats, direction, data, size,
+                 item ? STATS_DECODED : STATS_FAILED, start);
+    return item;
+}
+
+static struct xamine_item *
+xamine_examine_internal(const struct xamine_conversation *conversation,
+                        enum xamine_direction direction,
+                        const void *data, size_t size,
+                        struct xamine_arena *arena)
+{
+    const struct xamine_definition *definition;
+
+    definition = xamine_packet_definition(conversation, direction, data, &size);
+    if (conversation->stats)
+        return xamine_examine_counted(conversation, direction, definition,
+                                      definition && conversation->ctx->programs
+                                          ? program_table_find(conversation->ctx->programs,
+                                                               definition)
+                                          : NULL,
+                                      arena, data, size);
+    if (!definition ||
+        (conversation->filter &&
+         !xamine_filter_test(conversation->filter, conversation, definition, data, size)))
+        return NULL;
+    return xamine_dissect(conversation, definition,
+                          conversation->ctx->programs
+                              ? program_table_find(conversation->ctx->programs, definition)
+                              : NULL,
+                          arena, data, size);
+}
+
+XAMINE_EXPORT struct xamine_item *
+xamine_examine(const struct xamine_conversation *conversation,
+               enum xamine_direction direction,
+               const void *data, size_t size)
+{
+    return xamine_examine_internal(conversation, direction, data, size, NULL);
+}
+
+XAMINE_EXPORT struct xamine_item *
+xamine_examine_arena(const struct xamine_conversation *conversation,
+                     enum xamine_direction direction,
+                     const void *data, size_t size,
+                     struct xamine_arena *arena)
+{
+    if (!arena)
         return NULL;
+    return xamine_examine_internal(conversation, direction, data, size, arena);
+}
+
+XAMINE_EXPORT size_t
+xamine_examine_batch(const struct xamine_conversation *conversation,
+                     enum xamine_direction direction,
+                     const void *data_void, size_t size,
+                     struct xamine_arena *arena,
+                     struct xamine_item **results, size_t max, size_t *used)
+{
+    /* Events are most of a response stream, so their definitions and
+     * programs are looked up once per batch, by event code. */
+    struct {
+        const struct xamine_definition *definition;
+        const struct program *program;
+    } events[128] = { { NULL, NULL } };
+    const unsigned char *data = data_void;
+    size_t n = 0, pos = 0;
+
+    if (!arena || (direction != XAMINE_REQUEST && direction != XAMINE_RESPONSE)) {
+        if (used)
+            *used = 0;
+        return 0;
+    }
+
+    while (n < max && pos < size) {
+        const unsigned char *packet = data + pos;
+        const struct xamine_definition *definition;
+        const struct program *program = NULL;
+        uint64_t packet_size;
+        size_t examined;
+
+        packet_size = xamine_packet_size(conversation, direction, packet, size - pos);
+        if (packet_size == 0 || packet_size > size - pos)
+            break;
+        examined = packet_size;
+
+        /* GenericEvent packets are looked up by extension and event type. */
+        if (direction == XAMINE_RESPONSE && packet[0] > 1 &&
+            (packet[0] & ~0x80) != XAMINE_GENERIC_EVENT) {
+            unsigned char code = packet[0] & ~0x80;
+
+            if (!events[code].definition) {
+                events[code].definition =
+                    xamine_packet_definition(conversation, direction, packet, &examined);
+                if (events[code].definition && conversation->ctx->programs)
+                    events[code].program = program_table_find(conversation->ctx->programs,
+                                                              events[code].definition);
+            }
+            definition = events[code].definition;
+            program = events[code].program;
+        }
+        else {
+            definition = xamine_packet_definition(conversation, direction, packet, &examined);
+            if (definition && conversation->ctx->programs)
+                program = program_table_find(conversation->ctx->programs, definition);
+        }
+
+        if (conversation->stats) {
+            results[n++] = xamine_examine_counted(conversation, direction, definition,
+                                                  program, arena, packet, examined);
+            pos += packet_size;
+            continue;
+        }
+        if (definition && conversation->filter &&
+            !xamine_filter_test(conversation->filter, conversation, definition, packet, examined))
+            definition = NULL;
+        results[n++] = definition ? xamine_dissect(conversation, definition, program,
+                                                   arena, packet, examined)
+                                  : NULL;
+        pos += packet_size;
+    }
+
+    if (used)
+        *used = pos;
+    return n;
+}
+
+XAMINE_EXPORT int
+xamine_item_element(const struct xamine_item *item, size_t index,
+                    struct xamine_item *element)
+{
+    const unsigned char *value;
+    unsigned long bits = 0;
+
+    if (!item || !item->element_size || index >= item->count)
+        return -1;
+
+    value = (const unsigned char *) item->u.array + index * item->element_size;
+    memset(element, 0, sizeof(*element));
+    element->definition = item->definition;
+    element->offset = item->offset + index * item->element_size;
+
+    switch (item->element_size) {
+    case 1: bits = *(const uint8_t *) value; break;
+    case 2: bits = *(const uint16_t *) value; break;
+    case 4: bits = *(const uint32_t *) value; break;
+    }
 
-    /* Dissect the data based on the definition. */
-    return xamine_definition(conversation, &data, &size, &offset, definition, NULL);
+    switch (item->element_type) {
+    case XAMINE_BOOL:
+        element->u.bool_value = bits ? 1 : 0;
+        break;
+    case XAMINE_CHAR:
+        element->u.char_value = (char) bits;
+        break;
+    case XAMINE_SIGNED:
+        switch (item->element_size) {
+        case 1: element->u.signed_value = *(const int8_t *) value; break;
+        case 2: element->u.signed_value = *(const int16_t *) value; break;
+        case 4: element->u.signed_value = *(const int32_t *) value; break;
+        }
+        break;
+    case XAMINE_UNSIGNED:
+        element->u.unsigned_value = bits;
+        break;
+    case XAMINE_STRUCT:
+    case XAMINE_UNION:
+    case XAMINE_TYPEDEF:
+        return -1;
+    }
+    return 0;
 }
 
 XAMINE_EXPORT void
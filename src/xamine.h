@@ -15,6 +15,10 @@
 #ifndef XAMINE_H
 #define XAMINE_H
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
 enum xamine_type {
     XAMINE_BOOL,
     XAMINE_CHAR,
@@ -26,7 +30,7 @@ enum xamine_type {
 };
 
 struct xamine_definition {
-    char *name;
+    const char *name;
     enum xamine_type type;
     union {
         size_t size;                            /* base types */
@@ -37,7 +41,7 @@ struct xamine_definition {
 };
 
 struct xamine_field_definition {
-    char *name;
+    const char *name;
     const struct xamine_definition *definition;
     struct xamine_expression *length;       /* List length; NULL for non-list */
     struct xamine_field_definition *next;
@@ -46,7 +50,8 @@ struct xamine_field_definition {
 enum xamine_expression_type {
     XAMINE_FIELDREF,
     XAMINE_VALUE,
-    XAMINE_OP
+    XAMINE_OP,
+    XAMINE_IMPLICIT                         /* As many as fit in the packet */
 };
 
 enum xamine_op {
@@ -61,7 +66,7 @@ enum xamine_op {
 struct xamine_expression {
     enum xamine_expression_type type;
     union {
-        char *field;                        /* Field name for XAMINE_FIELDREF */
+        const char *field;                  /* Field name for XAMINE_FIELDREF */
         unsigned long value;                /* Value for XAMINE_VALUE */
         struct {                            /* Operator and operands for XAMINE_OP */
             enum xamine_op op;
@@ -69,14 +74,41 @@ struct xamine_expression {
             struct xamine_expression *right;
         } op;
     } u;
+    size_t field_index;                     /* For XAMINE_FIELDREF, the position of
+                                             * the field in its struct */
 };
 
 /* Context */
 
+/*
+ * Threads: a context does not change after xamine_context_new returns, so
+ * one context can be shared by any number of threads.  Its definitions,
+ * and the filters and accessors made from it, are only read.  A
+ * conversation changes as it is fed and as extensions and filters are set,
+ * which must not happen while another thread uses it; several threads may
+ * examine it at once.  Reference counts can be changed from any thread.
+ * A context created with XAMINE_CONTEXT_LAZY does add definitions as
+ * extensions are first used, but that is safe from any thread too.
+ */
 struct xamine_context;
 
 enum xamine_context_flags {
-    XAMINE_CONTEXT_NO_FLAGS = 0
+    XAMINE_CONTEXT_NO_FLAGS = 0,
+    /* Parse the XML-XCB descriptions even if the definition cache is valid,
+     * and do not update the cache. */
+    XAMINE_CONTEXT_NO_CACHE = (1 << 0),
+    /* Decode by walking the definitions rather than compiling them into
+     * decode programs; slower, and mostly useful for testing. */
+    XAMINE_CONTEXT_NO_COMPILE = (1 << 1),
+    /* Parse only the core protocol up front, and the description of each
+     * extension (with the ones it imports) when it is first looked up: by
+     * a QueryExtension fed to a conversation, xamine_conversation_set_extension,
+     * or a packet name given to an accessor or filter.  The definition
+     * cache is not used, as it holds every extension. */
+    XAMINE_CONTEXT_LAZY = (1 << 2),
+    /* Read the XML-XCB files one after another on the calling thread,
+     * rather than on one thread per processor. */
+    XAMINE_CONTEXT_NO_THREADS = (1 << 3)
 };
 
 struct xamine_context *
@@ -88,6 +120,15 @@ xamine_context_ref(struct xamine_context *context);
 struct xamine_context *
 xamine_context_unref(struct xamine_context *context);
 
+/*
+ * Write the definitions of the context to a definition cache file at path,
+ * or at the default location if path is NULL.  Contexts created later from
+ * the same XML-XCB files load the cache instead of parsing XML.
+ * Returns 0 on success, -1 on failure, or for a lazy context.
+ */
+int
+xamine_context_write_cache(struct xamine_context *context, const char *path);
+
 const struct xamine_definition *
 xamine_get_definitions(struct xamine_context *state);
 
@@ -96,7 +137,20 @@ xamine_get_definitions(struct xamine_context *state);
 struct xamine_conversation;
 
 enum xamine_conversation_flags {
-    XAMINE_CONVERSATION_NO_FLAGS = 0
+    XAMINE_CONVERSATION_NO_FLAGS = 0,
+    /* The streams passed to xamine_conversation_feed start after the
+     * connection setup, rather than at the start of the connection. */
+    XAMINE_CONVERSATION_NO_SETUP = (1 << 0),
+    /* The client sends its least or most significant byte first.  Without
+     * either flag, it is taken to use the byte order of the host until a
+     * connection setup fed to the conversation gives it; conversations
+     * with XAMINE_CONVERSATION_NO_SETUP need one for clients of the other
+     * byte order.  The two flags cannot be given together. */
+    XAMINE_CONVERSATION_LSB_FIRST = (1 << 1),
+    XAMINE_CONVERSATION_MSB_FIRST = (1 << 2),
+    /* Count the packets examined by code, and time their decoding, for
+     * xamine_conversation_get_stats. */
+    XAMINE_CONVERSATION_STATS = (1 << 3)
 };
 
 struct xamine_conversation *
@@ -109,8 +163,67 @@ xamine_conversation_ref(struct xamine_conversation *conversation);
 struct xamine_conversation *
 xamine_conversation_unref(struct xamine_conversation *conversation);
 
+/*
+ * Tell the conversation which major opcode and first event and error codes
+ * the server assigned to an extension, given its X name such as "SHAPE",
+ * so that its requests, events and errors can be examined.  Conversations
+ * fed with xamine_conversation_feed learn this from QueryExtension replies.
+ * Returns 0 on success, or -1 if there is no description of the extension.
+ */
+int
+xamine_conversation_set_extension(struct xamine_conversation *conversation,
+                                  const char *name, unsigned char major_opcode,
+                                  unsigned char first_event,
+                                  unsigned char first_error);
+
+/* Statistics */
+
+#define XAMINE_STATS_LATENCY_BUCKETS 32
+
+/*
+ * Counts of the packets with one code.  Packets with no definition are
+ * counted as unknown, and packets with a definition which cannot be
+ * decoded, for instance because they are too short, as failures.  Packets
+ * rejected by the filter are only counted in packets and bytes.
+ */
+struct xamine_stats_counts {
+    uint64_t packets;
+    uint64_t bytes;
+    uint64_t failures;
+    uint64_t unknown;
+};
+
+struct xamine_stats {
+    struct xamine_stats_counts requests[256];   /* By major opcode */
+    struct xamine_stats_counts events[128];     /* By code, without the sent bit */
+    struct xamine_stats_counts errors[256];     /* By error code */
+    struct xamine_stats_counts replies;
+    /* Packets decoded, or decoded and written, in [2^(i-1), 2^i)
+     * nanoseconds, with the last bucket holding all the slower ones. */
+    uint64_t latency[XAMINE_STATS_LATENCY_BUCKETS];
+};
+
+/*
+ * Copy the statistics of a conversation created with
+ * XAMINE_CONVERSATION_STATS, which may be called while other threads
+ * examine packets of the conversation.  Each counter is read atomically,
+ * but the snapshot is not, so counters may disagree by the packets
+ * examined meanwhile.  Returns 0 on success, or -1 if the conversation
+ * keeps no statistics.
+ */
+int
+xamine_conversation_get_stats(const struct xamine_conversation *conversation,
+                              struct xamine_stats *stats);
+
 /* Analysis */
 
+/*
+ * A list of values of a base type is an array: a single item with no
+ * children, whose u.array holds count values of element_size bytes each,
+ * in host byte order, as uint8_t, int16_t, uint32_t and so on according to
+ * element_type.  Values of BOOL arrays are nonzero for true.  element_size
+ * is 0 for other items.  Other lists have a child item per element.
+ */
 struct xamine_item {
     char *name;
     const struct xamine_definition *definition;
@@ -120,9 +233,13 @@ struct xamine_item {
         char          char_value;
         signed long   signed_value;
         unsigned long unsigned_value;
+        const void   *array;
     } u;
     struct xamine_item *child;
     struct xamine_item *next;
+    size_t count;
+    enum xamine_type element_type;
+    unsigned char element_size;
 };
 
 enum xamine_direction {
@@ -138,4 +255,420 @@ xamine_examine(const struct xamine_conversation *conversation,
 void
 xamine_item_free(struct xamine_item *item);
 
+/*
+ * Fill in element with element index of an array as it would be as a child
+ * item, without a name, so that it can be read like any other value.
+ * Returns 0 on success, or -1 if item is not an array or index is out of
+ * range.
+ */
+int
+xamine_item_element(const struct xamine_item *item, size_t index,
+                    struct xamine_item *element);
+
+/* Cursors */
+
+/*
+ * A cursor is a view of one value of a packet, which decodes nothing until
+ * asked.  Cursors live wherever the caller puts them and need no freeing;
+ * they point into the packet data, which must outlive them.
+ */
+struct xamine_cursor {
+    const struct xamine_conversation *conversation;
+    const struct xamine_definition *definition; /* Of the elements of a list */
+    const char *name;               /* Field name; NULL for list elements and the packet */
+    const unsigned char *data;      /* The whole packet */
+    size_t size;
+    size_t offset;                  /* Of the value in the packet */
+    bool is_list;
+    size_t count;                   /* Number of elements of a list */
+
+    /* Private: how far the fields or elements have been measured */
+    const struct xamine_field_definition *measured_field;
+    size_t measured;
+    size_t measured_offset;
+};
+
+/*
+ * Point a cursor at a whole packet, as passed to xamine_examine.
+ * Returns 0 on success, or -1 if there is no definition for the packet.
+ */
+int
+xamine_cursor_init(struct xamine_cursor *cursor,
+                   const struct xamine_conversation *conversation,
+                   enum xamine_direction direction,
+                   const void *data, size_t size);
+
+/* Get the number of fields of a struct or union, or elements of a list. */
+size_t
+xamine_cursor_count(const struct xamine_cursor *cursor);
+
+/*
+ * Point child at a field of a struct or union, or an element of a list, by
+ * index or by field name.  The offsets of the fields before it are worked
+ * out as needed and remembered in cursor.
+ * Returns 0 on success, or -1 if there is no such field or element or the
+ * packet is too short.
+ */
+int
+xamine_cursor_child(struct xamine_cursor *cursor, size_t index,
+                    struct xamine_cursor *child);
+
+int
+xamine_cursor_field(struct xamine_cursor *cursor, const char *name,
+                    struct xamine_cursor *field);
+
+/*
+ * Decode a value of a base type, as a signed or unsigned value according
+ * to its type.  Returns 0 on success, or -1 if the cursor is not at a
+ * value of a base type or the packet is too short.
+ */
+int
+xamine_cursor_value(const struct xamine_cursor *cursor, long *value);
+
+/* Accessors */
+
+struct xamine_accessor;
+
+/*
+ * Resolve a path to a value of a packet, such as "KeyPress.detail" or
+ * "GetGeometryReply.x", once for repeated use.  The path starts with the
+ * name of an event, request, reply or error, followed by field names; a
+ * list field is followed by an element index, as in "KeymapNotify.keys[3]".
+ * Returns NULL if the path does not lead to a value of a base type.
+ */
+struct xamine_accessor *
+xamine_accessor_new(struct xamine_context *context, const char *path);
+
+void
+xamine_accessor_free(struct xamine_accessor *accessor);
+
+/*
+ * Get the value of the field from a packet, as passed to xamine_examine,
+ * without decoding the rest of the packet.  Returns 0 on success, or -1 if
+ * the packet is not the one named by the path or is too short.
+ */
+int
+xamine_accessor_get(const struct xamine_accessor *accessor,
+                    const struct xamine_conversation *conversation,
+                    enum xamine_direction direction,
+                    const void *data, size_t size, long *value);
+
+/* Filters */
+
+struct xamine_filter;
+
+/*
+ * Compile a filter selecting packets, such as
+ *
+ *   ConfigureNotify.window == 0x1200003 || PutImage.length > 1024
+ *
+ * A name on its own matches packets of that event, request, reply or error.
+ * Values are numbers and field paths as taken by xamine_accessor_new, with
+ * the operators *, /, +, -, << and & of the length expressions, binding in
+ * that order, and are compared with ==, !=, <, <=, > and >=.  A comparison
+ * involving a field the packet does not have is false.  Conditions combine
+ * with !, && and ||, and parentheses group values or conditions.
+ * Returns NULL if the filter is malformed or names unknown packets or fields.
+ */
+struct xamine_filter *
+xamine_filter_new(struct xamine_context *context, const char *filter);
+
+void
+xamine_filter_free(struct xamine_filter *filter);
+
+/*
+ * Test a packet, as passed to xamine_examine, against a filter.  Packets
+ * that cannot be examined never match.
+ */
+bool
+xamine_filter_match(const struct xamine_filter *filter,
+                    const struct xamine_conversation *conversation,
+                    enum xamine_direction direction,
+                    const void *data, size_t size);
+
+/*
+ * Examine only the packets matching the filter, or all packets if it is
+ * NULL.  xamine_examine and the functions based on it return NULL for the
+ * others, which are tested on their raw bytes and never decoded.  The
+ * filter must not be freed while the conversation uses it.
+ */
+void
+xamine_conversation_set_filter(struct xamine_conversation *conversation,
+                               const struct xamine_filter *filter);
+
+/* Streams */
+
+/*
+ * Called with each complete packet found by xamine_conversation_feed.  The
+ * data is only valid during the call, and the callback must not feed the
+ * same conversation.
+ */
+typedef void (*xamine_packet_func)(struct xamine_conversation *conversation,
+                                   enum xamine_direction direction,
+                                   const void *data, size_t size,
+                                   void *closure);
+
+void
+xamine_conversation_set_packet_func(struct xamine_conversation *conversation,
+                                    xamine_packet_func func, void *closure);
+
+/*
+ * Feed the next chunk of one direction of the connection, split anywhere.
+ * Each complete packet is passed to the packet function; the bytes of a
+ * packet split across chunks are kept until the rest arrives.  Unless the
+ * conversation has XAMINE_CONVERSATION_NO_SETUP, each stream starts with
+ * the connection setup, which is consumed to learn the byte order of the
+ * connection rather than passed on.
+ * Requests are followed by sequence number, so that a reply can be examined
+ * once the request it answers has been fed.
+ * Returns 0 on success, or -1 if the stream cannot be framed, after which
+ * that direction of the conversation is unusable.
+ */
+int
+xamine_conversation_feed(struct xamine_conversation *conversation,
+                         enum xamine_direction direction,
+                         const void *data, size_t size);
+
+/* Arenas */
+
+/*
+ * An arena holds the items of any number of results, and releases them all
+ * at once.  Names of items in an arena point to the definitions' names, so
+ * the items must not outlive the context.
+ */
+struct xamine_arena;
+
+struct xamine_arena *
+xamine_arena_new(void);
+
+/* Release all the items in the arena, keeping its memory for reuse. */
+void
+xamine_arena_reset(struct xamine_arena *arena);
+
+void
+xamine_arena_free(struct xamine_arena *arena);
+
+/*
+ * Like xamine_examine, but allocate the result in the arena.  The result
+ * is released by xamine_arena_reset or xamine_arena_free, and must not be
+ * passed to xamine_item_free.
+ */
+struct xamine_item *
+xamine_examine_arena(const struct xamine_conversation *conversation,
+                     enum xamine_direction direction,
+                     const void *data, size_t size,
+                     struct xamine_arena *arena);
+
+/*
+ * Examine the whole packets at the start of a buffer holding one direction
+ * of a connection after the connection setup, back to back, up to max of
+ * them.  The result for each packet is stored in results, or NULL if it
+ * cannot be examined, and allocated in the arena as by xamine_examine_arena.
+ * Returns the number of packets examined, and if used is not NULL, sets it
+ * to the number of bytes they span.  Examining stops early at a packet
+ * which is incomplete or cannot be framed.
+ */
+size_t
+xamine_examine_batch(const struct xamine_conversation *conversation,
+                     enum xamine_direction direction,
+                     const void *data, size_t size,
+                     struct xamine_arena *arena,
+                     struct xamine_item **results, size_t max, size_t *used);
+
+/* Output */
+
+/*
+ * Packets can be written as JSON Lines, a JSON object and a newline per
+ * packet, or as a CBOR sequence, a CBOR map per packet.  A packet is
+ * written with its name under "packet" followed by its fields by name,
+ * leaving out padding.  Structs and unions are objects, lists are arrays,
+ * and lists of CHAR are strings, read as Latin-1.  In CBOR, lists of 1-byte
+ * unsigned values are byte strings.
+ */
+enum xamine_format {
+    XAMINE_FORMAT_JSON,
+    XAMINE_FORMAT_CBOR
+};
+
+/*
+ * A growable output buffer, which starts zeroed.  The data is allocated
+ * with malloc and is the caller's to free.
+ */
+struct xamine_buffer {
+    unsigned char *data;
+    size_t size;
+    size_t alloc;
+};
+
+/*
+ * Examine a packet and append it to buffer, without building its items
+ * where possible.  Returns 0 on success, or -1 if the packet cannot be
+ * examined or memory runs out, leaving the buffer as it was.
+ */
+int
+xamine_write(const struct xamine_conversation *conversation,
+             enum xamine_direction direction,
+             const void *data, size_t size,
+             enum xamine_format format, struct xamine_buffer *buffer);
+
+/*
+ * A field written in front of a packet's own by xamine_write_fields: a
+ * string of Latin-1 characters if text is not NULL, and otherwise an
+ * unsigned number.
+ */
+struct xamine_field {
+    const char *name;
+    const char *text;
+    unsigned long number;
+};
+
+/*
+ * Like xamine_write, but with the nfields fields given written first, such
+ * as where the packet was seen.
+ */
+int
+xamine_write_fields(const struct xamine_conversation *conversation,
+                    enum xamine_direction direction,
+                    const void *data, size_t size,
+                    const struct xamine_field *fields, size_t nfields,
+                    enum xamine_format format, struct xamine_buffer *buffer);
+
+/*
+ * Append the result of examining a packet to buffer.  Returns 0 on
+ * success, or -1 if memory runs out, leaving the buffer as it was.
+ */
+int
+xamine_write_item(const struct xamine_item *item, enum xamine_format format,
+                  struct xamine_buffer *buffer);
+
+/*
+ * Write the contents of buffer to a file descriptor and empty it.  Returns
+ * 0 on success, or -1 with errno set, keeping the data not written.
+ */
+int
+xamine_buffer_flush(struct xamine_buffer *buffer, int fd);
+
+/* Captures */
+
+/* A chunk of one direction of a conversation in a capture. */
+struct xamine_capture_chunk {
+    uint64_t time;                  /* When it was captured, in any unit */
+    unsigned conversation;          /* Numbered from 0 */
+    enum xamine_direction direction;
+    const void *data;
+    size_t size;
+};
+
+enum xamine_capture_flags {
+    XAMINE_CAPTURE_NO_FLAGS = 0,
+    /* Call the function for the packets of all the conversations in order
+     * of time, from the calling thread. */
+    XAMINE_CAPTURE_MERGE = (1 << 0)
+};
+
+/*
+ * Called with each packet of a capture and its result, which is NULL if
+ * the packet cannot be examined.  The data and result are only valid
+ * during the call.  The time is that of the chunk which completed the
+ * packet.
+ */
+typedef void (*xamine_capture_func)(unsigned conversation,
+                                    enum xamine_direction direction,
+                                    uint64_t time, const void *data, size_t size,
+                                    const struct xamine_item *item,
+                                    void *closure);
+
+/*
+ * Decode a capture of many conversations on nthreads threads, or one per
+ * processor if nthreads is 0.  The chunks of each conversation are fed to
+ * a conversation of its own with the given flags, in the order they appear
+ * in the array.  Without the connection setups, the flags must give the
+ * byte order of the clients unless it is that of the host.  The function
+ * is called for the packets of a conversation in order; without
+ * XAMINE_CAPTURE_MERGE, it is called from any of the threads, for
+ * different conversations at the same time.  With it, all the results are
+ * kept until the capture is decoded, and the function is then called from
+ * the calling thread in order of time, so the chunks of each conversation
+ * must be in order of time.
+ * Returns 0 on success, or -1 on failure.
+ */
+int
+xamine_decode_capture(struct xamine_context *context,
+                      const struct xamine_capture_chunk *chunks, size_t nchunks,
+                      enum xamine_conversation_flags conversation_flags,
+                      unsigned nthreads, enum xamine_capture_flags flags,
+                      xamine_capture_func func, void *closure);
+
+/* Traces */
+
+/*
+ * A trace file records chunks of X protocol streams, with the conversation,
+ * direction and time of each, and an index for seeking.  Records are read
+ * in place from a mapping of the file.
+ */
+struct xamine_trace_writer;
+
+/* Create or truncate a trace file.  Returns NULL on failure. */
+struct xamine_trace_writer *
+xamine_trace_writer_new(const char *path);
+
+/*
+ * Add a record.  Times must not decrease from one record to the next.
+ * Returns 0 on success, or -1 on failure.
+ */
+int
+xamine_trace_write(struct xamine_trace_writer *writer, uint64_t time,
+                   unsigned conversation, enum xamine_direction direction,
+                   const void *data, size_t size);
+
+/*
+ * Write the index, close the file and free the writer.  The file is not a
+ * valid trace until then.  Returns 0 on success, or -1 if any write failed.
+ */
+int
+xamine_trace_writer_close(struct xamine_trace_writer *writer);
+
+struct xamine_trace;
+
+struct xamine_trace_record {
+    uint64_t number;                /* Position in the trace, from 0 */
+    uint64_t time;
+    unsigned conversation;
+    enum xamine_direction direction;
+    const void *data;               /* Valid until the trace is closed */
+    size_t size;
+    uint64_t next;                  /* Private */
+};
+
+/* Open a trace file for reading.  Returns NULL on failure. */
+struct xamine_trace *
+xamine_trace_open(const char *path);
+
+void
+xamine_trace_close(struct xamine_trace *trace);
+
+uint64_t
+xamine_trace_count(const struct xamine_trace *trace);
+
+/*
+ * Get the record with the given number, or the first record at or after
+ * the given time.  Returns 0 on success, or -1 if there is no such record
+ * or the file is corrupt.
+ */
+int
+xamine_trace_seek(const struct xamine_trace *trace, uint64_t number,
+                  struct xamine_trace_record *record);
+
+int
+xamine_trace_seek_time(const struct xamine_trace *trace, uint64_t time,
+                       struct xamine_trace_record *record);
+
+/*
+ * Advance to the record after the one in record.  Returns 0 on success, or
+ * -1 at the end of the trace or if the file is corrupt.
+ */
+int
+xamine_trace_next(const struct xamine_trace *trace,
+                  struct xamine_trace_record *record);
+
 #endif /* XAMINE_H */
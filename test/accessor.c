@@ -0,0 +1,245 @@
+/*
+ * Read values of packets of the description in protocol.h through
+ * accessors, with every way of loading a context: values at fixed offsets,
+ * values after lists, whose offsets depend on the data, elements of lists
+ * of fixed and of variable size, elements which are not there, packets
+ * which are too short or are other packets, paths into a big request, and
+ * paths which lead to no value.
+ *
+ * usage: accessor
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "xamine.h"
+#include "protocol.h"
+
+static int failures;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+/* A path, and the value it gets from a packet, or -1 if it gets none. */
+struct access {
+    const char *path;
+    long value;
+};
+
+static void
+put16(unsigned char *p, uint16_t value)
+{
+    memcpy(p, &value, sizeof(value));
+}
+
+static void
+put32(unsigned char *p, uint32_t value)
+{
+    memcpy(p, &value, sizeof(value));
+}
+
+/* Get a value through each path of a table, and check it. */
+static void
+check_accesses(struct xamine_context *ctx, const struct xamine_conversation *conversation,
+               enum xamine_direction direction, const unsigned char *data, size_t size,
+               const struct access *accesses, size_t naccesses)
+{
+    for (size_t i = 0; i < naccesses; i++) {
+        struct xamine_accessor *accessor = xamine_accessor_new(ctx, accesses[i].path);
+        long value = -1;
+        int result = -1;
+
+        if (accessor)
+            result = xamine_accessor_get(accessor, conversation, direction, data, size, &value);
+        if (!accessor || (result < 0 ? -1 : value) != accesses[i].value) {
+            fprintf(stderr, "%s from %zu bytes: got %ld, expected %ld\n", accesses[i].path,
+                    size, result < 0 ? -1 : value, accesses[i].value);
+            failures++;
+        }
+        xamine_accessor_free(accessor);
+    }
+}
+
+/*
+ * A FieldsAfterLists request with the points (1, 2) and (3, 4), and the
+ * names "a", "bcd" and "", followed by the fields after the lists.
+ */
+static void
+check_fields_after_lists(struct xamine_context *ctx,
+                         const struct xamine_conversation *conversation)
+{
+    static const struct access whole[] = {
+        { "FieldsAfterLists.names_len", 3 },
+        { "FieldsAfterLists.after", 0x01020304 },
+        { "FieldsAfterLists.last", 5 },
+        { "FieldsAfterLists.points[1].y", 4 },
+        { "FieldsAfterLists.names[1].name_len", 3 },
+        { "FieldsAfterLists.names[1].name[2]", 'd' },
+        { "FieldsAfterLists.names[2].name_len", 0 },
+        { "FieldsAfterLists.points[2].x", -1 },
+        { "FieldsAfterLists.names[3].name_len", -1 },
+        { "FieldsAfterLists.names[2].name[0]", -1 },
+        { "PolyPoint.gc", -1 },
+    };
+    static const struct access cut[] = {
+        { "FieldsAfterLists.names_len", 3 },
+        { "FieldsAfterLists.after", 0x01020304 },
+        { "FieldsAfterLists.last", -1 },
+    };
+    unsigned char data[28];
+
+    memset(data, 0, sizeof(data));
+    data[0] = 123;
+    put16(data + 2, sizeof(data) / 4);
+    put16(data + 4, 2);
+    put16(data + 6, 3);
+    for (int i = 0; i < 4; i++)
+        put16(data + 8 + 2 * i, i + 1);
+    memcpy(data + 16, "\001a\003bcd\000", 7);
+    put32(data + 23, 0x01020304);
+    data[27] = 5;
+
+    check_accesses(ctx, conversation, XAMINE_REQUEST, data, sizeof(data),
+                   whole, sizeof(whole) / sizeof(*whole));
+    check_accesses(ctx, conversation, XAMINE_REQUEST, data, sizeof(data) - 1,
+                   cut, sizeof(cut) / sizeof(*cut));
+}
+
+/* A PolyPoint of the points (1, 2) and (3, 4), as a big request or not. */
+static void
+check_poly_point(struct xamine_context *ctx, const struct xamine_conversation *conversation,
+                 bool big)
+{
+    static const struct access accesses[] = {
+        { "PolyPoint.coordinate_mode", 1 },
+        { "PolyPoint.drawable", 0x200001 },
+        { "PolyPoint.gc", 0x200002 },
+        { "PolyPoint.points[0].x", 1 },
+        { "PolyPoint.points[1].y", 4 },
+        { "PolyPoint.points[2].x", -1 },
+        { "FieldsAfterLists.names_len", -1 },
+    };
+    static const struct access cut[] = {
+        { "PolyPoint.coordinate_mode", -1 },
+        { "PolyPoint.gc", -1 },
+    };
+    unsigned char data[24];
+    size_t header = big ? 8 : 4, size = header + 16;
+
+    memset(data, 0, sizeof(data));
+    data[0] = 64;
+    data[1] = 1;
+    put16(data + 2, big ? 0 : size / 4);
+    if (big)
+        put32(data + 4, size / 4);
+    put32(data + header, 0x200001);
+    put32(data + header + 4, 0x200002);
+    put16(data + header + 8, 1);
+    put16(data + header + 10, 2);
+    put16(data + header + 12, 3);
+    put16(data + header + 14, 4);
+
+    check_accesses(ctx, conversation, XAMINE_REQUEST, data, size,
+                   accesses, sizeof(accesses) / sizeof(*accesses));
+
+    /* Too short to hold the length of a big request, or the gc. */
+    check_accesses(ctx, conversation, XAMINE_REQUEST, data, big ? 6 : 11,
+                   cut + !big, sizeof(cut) / sizeof(*cut) - !big);
+}
+
+static void
+check_key_press(struct xamine_context *ctx, const struct xamine_conversation *conversation)
+{
+    static const struct access accesses[] = {
+        { "KeyPress.detail", 9 },
+        { "KeyPress.root_x", 0x1234 },
+        { "Expose.window", -1 },
+    };
+    unsigned char data[32];
+
+    memset(data, 0, sizeof(data));
+    data[0] = 2;
+    data[1] = 9;
+    put16(data + 20, 0x1234);
+    check_accesses(ctx, conversation, XAMINE_RESPONSE, data, sizeof(data),
+                   accesses, sizeof(accesses) / sizeof(*accesses));
+}
+
+/* Paths which lead to no value of a base type. */
+static void
+check_paths(struct xamine_context *ctx)
+{
+    static const char *const paths[] = {
+        "",
+        "PolyPoint",
+        "PolyPoint.",
+        "NoSuchRequest.gc",
+        "PolyPoint.nosuch",
+        "PolyPoint.points",
+        "PolyPoint.points[1]",
+        "PolyPoint.points[].x",
+        "PolyPoint.points[x].x",
+        "PolyPoint.points[1]x.x",
+        "PolyPoint.points[1].z",
+        "PolyPoint.gc[0]",
+        "PolyPoint.gc.x",
+    };
+
+    for (size_t i = 0; i < sizeof(paths) / sizeof(*paths); i++) {
+        struct xamine_accessor *accessor = xamine_accessor_new(ctx, paths[i]);
+
+        if (accessor) {
+            fprintf(stderr, "\"%s\" was accepted\n", paths[i]);
+            failures++;
+        }
+        xamine_accessor_free(accessor);
+    }
+}
+
+int
+main(void)
+{
+    /* The first default context writes the cache, and the second reads it. */
+    static const enum xamine_context_flags modes[] = {
+        XAMINE_CONTEXT_NO_CACHE,
+        XAMINE_CONTEXT_LAZY,
+        XAMINE_CONTEXT_NO_FLAGS,
+        XAMINE_CONTEXT_NO_FLAGS,
+    };
+    char *dir = protocol_write();
+
+    if (!dir) {
+        fprintf(stderr, "failed to write the protocol description\n");
+        return EXIT_FAILURE;
+    }
+
+    for (size_t i = 0; i < sizeof(modes) / sizeof(*modes); i++) {
+        struct xamine_context *ctx = xamine_context_new(modes[i]);
+        struct xamine_conversation *conversation = NULL;
+
+        if (ctx)
+            conversation = xamine_conversation_new(ctx, XAMINE_CONVERSATION_NO_SETUP);
+        CHECK(conversation);
+        if (conversation) {
+            check_fields_after_lists(ctx, conversation);
+            check_poly_point(ctx, conversation, false);
+            check_poly_point(ctx, conversation, true);
+            check_key_press(ctx, conversation);
+            check_paths(ctx);
+        }
+        xamine_conversation_unref(conversation);
+        xamine_context_unref(ctx);
+    }
+
+    protocol_remove(dir);
+    if (failures)
+        fprintf(stderr, "%d checks failed\n", failures);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
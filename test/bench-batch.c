@@ -0,0 +1,170 @@
+/*
+ * Measure the rate of examining a large buffer of events one call at a
+ * time and with xamine_examine_batch, after checking that both produce the
+ * same results.  The events are synthetic: pseudo-random bytes with the
+ * codes of the core events there are definitions for.
+ *
+ * usage: bench-batch [EVENTS]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "xamine.h"
+#include "compare.h"
+
+#define EVENT_SIZE 32
+#define BATCH 4096
+#define ROUNDS 5
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Examine every event with its own call, and return the best time. */
+static double
+bench_single(struct xamine_conversation *conversation, struct xamine_arena *arena,
+             const unsigned char *buffer, size_t nevents)
+{
+    double best = 0;
+
+    for (int round = 0; round < ROUNDS; round++) {
+        double start = now(), elapsed;
+
+        for (size_t i = 0; i < nevents; i++)
+            xamine_examine_arena(conversation, XAMINE_RESPONSE,
+                                 buffer + i * EVENT_SIZE, EVENT_SIZE, arena);
+        xamine_arena_reset(arena);
+
+        elapsed = now() - start;
+        if (round == 0 || elapsed < best)
+            best = elapsed;
+    }
+
+    return best;
+}
+
+/* Examine the events in batches, and return the best time. */
+static double
+bench_batch(struct xamine_conversation *conversation, struct xamine_arena *arena,
+            const unsigned char *buffer, size_t nevents,
+            struct xamine_item **results)
+{
+    double best = 0;
+
+    for (int round = 0; round < ROUNDS; round++) {
+        double start = now(), elapsed;
+        size_t pos = 0, size = nevents * EVENT_SIZE, used;
+
+        while (pos < size) {
+            xamine_examine_batch(conversation, XAMINE_RESPONSE, buffer + pos,
+                                 size - pos, arena, results, BATCH, &used);
+            pos += used;
+        }
+        xamine_arena_reset(arena);
+
+        elapsed = now() - start;
+        if (round == 0 || elapsed < best)
+            best = elapsed;
+    }
+
+    return best;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct xamine_context *ctx;
+    struct xamine_conversation *conversation;
+    struct xamine_arena *single_arena, *batch_arena;
+    struct xamine_item *results[BATCH];
+    unsigned char codes[64], event[EVENT_SIZE], *buffer;
+    size_t nevents = argc > 1 ? strtoul(argv[1], NULL, 10) : 100000;
+    size_t examined, used;
+    int ncodes = 0, mismatched = 0;
+    double single, batch;
+
+    if (nevents == 0)
+        nevents = 1;
+
+    ctx = xamine_context_new(XAMINE_CONTEXT_NO_FLAGS);
+    if (!ctx) {
+        fprintf(stderr, "failed to create context\n");
+        return EXIT_FAILURE;
+    }
+    conversation = xamine_conversation_new(ctx, XAMINE_CONVERSATION_NO_SETUP);
+    single_arena = xamine_arena_new();
+    batch_arena = xamine_arena_new();
+
+    /* Find the core events there are definitions for. */
+    srand(1);
+    for (int code = 2; code < 64; code++) {
+        struct xamine_item *item;
+
+        for (int j = 0; j < EVENT_SIZE; j++)
+            event[j] = rand();
+        event[0] = code;
+        item = xamine_examine(conversation, XAMINE_RESPONSE, event, EVENT_SIZE);
+        if (item)
+            codes[ncodes++] = code;
+        xamine_item_free(item);
+    }
+    if (ncodes == 0) {
+        fprintf(stderr, "no events to decode\n");
+        return EXIT_FAILURE;
+    }
+
+    buffer = malloc(nevents * EVENT_SIZE);
+    if (!buffer) {
+        fprintf(stderr, "out of memory\n");
+        return EXIT_FAILURE;
+    }
+    for (size_t i = 0; i < nevents; i++) {
+        unsigned char *e = buffer + i * EVENT_SIZE;
+        for (int j = 0; j < EVENT_SIZE; j++)
+            e[j] = rand();
+        e[0] = codes[rand() % ncodes];
+    }
+
+    /* Compare the first batch with examining each event. */
+    examined = xamine_examine_batch(conversation, XAMINE_RESPONSE, buffer,
+                                    nevents * EVENT_SIZE, batch_arena,
+                                    results, BATCH, &used);
+    if (examined != (nevents < BATCH ? nevents : BATCH) || used != examined * EVENT_SIZE) {
+        fprintf(stderr, "batch examined %zu events in %zu bytes\n", examined, used);
+        mismatched++;
+    }
+    for (size_t i = 0; i < examined; i++) {
+        const struct xamine_item *item =
+            xamine_examine_arena(conversation, XAMINE_RESPONSE,
+                                 buffer + i * EVENT_SIZE, EVENT_SIZE, single_arena);
+        if (!results[i] || !same_tree(item, results[i])) {
+            fprintf(stderr, "event %zu: results differ\n", i);
+            mismatched++;
+        }
+    }
+    xamine_arena_reset(single_arena);
+    xamine_arena_reset(batch_arena);
+
+    single = bench_single(conversation, single_arena, buffer, nevents);
+    batch = bench_batch(conversation, batch_arena, buffer, nevents, results);
+
+    printf("events:       %zu of %d kinds, %d mismatched\n", nevents, ncodes, mismatched);
+    printf("single:       %12.0f events/s\n", nevents / single);
+    printf("batch:        %12.0f events/s\n", nevents / batch);
+
+    free(buffer);
+    xamine_arena_free(single_arena);
+    xamine_arena_free(batch_arena);
+    xamine_conversation_unref(conversation);
+    xamine_context_unref(ctx);
+
+    return mismatched ? EXIT_FAILURE : 0;
+}
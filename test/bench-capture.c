@@ -0,0 +1,232 @@
+/*
+ * Measure the rate of decoding a capture of many conversations with
+ * xamine_decode_capture on increasing numbers of threads, after checking
+ * that every run produces the same results.  The capture is synthetic: each
+ * conversation sends GetInputFocus requests and receives their replies and
+ * some events, split into chunks at random, most significant byte first.
+ *
+ * usage: bench-capture [CONVERSATIONS [ROUNDS [MAX-THREADS]]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "xamine.h"
+
+#define EVENTS_PER_ROUND 3
+
+static const unsigned char event_codes[] = { 6, 12, 28, 2, 7, 22 };
+
+struct counts {
+    unsigned long *packets;     /* By conversation */
+    unsigned long *decoded;
+    uint64_t last_time;
+    int out_of_order;
+};
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Conversations are decoded by one thread at a time, so each count is only
+ * updated by one thread at a time. */
+static void
+count(unsigned conversation, enum xamine_direction direction, uint64_t time,
+      const void *data, size_t size, const struct xamine_item *item, void *closure)
+{
+    struct counts *counts = closure;
+
+    counts->packets[conversation]++;
+    if (item)
+        counts->decoded[conversation]++;
+}
+
+/* With a merge, the function is called from one thread in order of time. */
+static void
+count_merged(unsigned conversation, enum xamine_direction direction, uint64_t time,
+             const void *data, size_t size, const struct xamine_item *item, void *closure)
+{
+    struct counts *counts = closure;
+
+    if (time < counts->last_time)
+        counts->out_of_order++;
+    counts->last_time = time;
+    count(conversation, direction, time, data, size, item, closure);
+}
+
+/* The clients send their most significant byte first, which is the
+ * opposite byte order on most hosts. */
+static void
+put16(unsigned char *p, uint16_t value)
+{
+    p[0] = value >> 8;
+    p[1] = value;
+}
+
+/* Add a packet to the capture, in one or two chunks. */
+static void
+add_packet(struct xamine_capture_chunk *chunks, size_t *nchunks, uint64_t *time,
+           unsigned conversation, enum xamine_direction direction,
+           const unsigned char *data, size_t size)
+{
+    size_t split = rand() % 2 ? rand() % size : 0;
+
+    if (split) {
+        chunks[*nchunks] = (struct xamine_capture_chunk) {
+            (*time)++, conversation, direction, data, split
+        };
+        ++*nchunks;
+    }
+    chunks[*nchunks] = (struct xamine_capture_chunk) {
+        (*time)++, conversation, direction, data + split, size - split
+    };
+    ++*nchunks;
+}
+
+int
+main(int argc, char *argv[])
+{
+    unsigned nconversations = argc > 1 ? strtoul(argv[1], NULL, 10) : 128;
+    unsigned rounds = argc > 2 ? strtoul(argv[2], NULL, 10) : 1000;
+    long max_threads = argc > 3 ? strtol(argv[3], NULL, 10) : sysconf(_SC_NPROCESSORS_ONLN);
+    size_t packet_bytes = 4 + 32 * (1 + EVENTS_PER_ROUND);
+    size_t npackets, nchunks = 0;
+    struct xamine_context *ctx;
+    struct xamine_capture_chunk *chunks;
+    unsigned char *buffer;
+    struct counts counts, expected;
+    unsigned long total = 0, decoded = 0;
+    double single = 0;
+    uint64_t time = 0;
+    int mismatched = 0;
+
+    if (nconversations == 0)
+        nconversations = 1;
+    if (rounds == 0)
+        rounds = 1;
+    if (max_threads < 1)
+        max_threads = 1;
+
+    ctx = xamine_context_new(XAMINE_CONTEXT_NO_FLAGS);
+    if (!ctx) {
+        fprintf(stderr, "failed to create context\n");
+        return EXIT_FAILURE;
+    }
+
+    /* Round after round, each conversation sends a request and gets its
+     * reply and some events, all with the request's sequence number. */
+    npackets = (size_t) nconversations * rounds * (2 + EVENTS_PER_ROUND);
+    buffer = malloc((size_t) nconversations * rounds * packet_bytes);
+    chunks = malloc(2 * npackets * sizeof(*chunks));
+    counts.packets = calloc(nconversations, sizeof(*counts.packets));
+    counts.decoded = calloc(nconversations, sizeof(*counts.decoded));
+    expected.packets = calloc(nconversations, sizeof(*expected.packets));
+    expected.decoded = calloc(nconversations, sizeof(*expected.decoded));
+    if (!buffer || !chunks || !counts.packets || !counts.decoded ||
+        !expected.packets || !expected.decoded) {
+        fprintf(stderr, "out of memory\n");
+        return EXIT_FAILURE;
+    }
+
+    srand(1);
+    for (unsigned r = 0; r < rounds; r++) {
+        for (unsigned c = 0; c < nconversations; c++) {
+            unsigned char *p = buffer + ((size_t) r * nconversations + c) * packet_bytes;
+            unsigned sequence = (r + 1) & 0xffff;
+
+            p[0] = 43;              /* GetInputFocus */
+            p[1] = 0;
+            put16(p + 2, 1);
+            add_packet(chunks, &nchunks, &time, c, XAMINE_REQUEST, p, 4);
+            p += 4;
+
+            for (int i = 0; i <= EVENTS_PER_ROUND; i++, p += 32) {
+                for (int j = 0; j < 32; j++)
+                    p[j] = rand();
+                p[0] = i == 0 ? 1 : event_codes[rand() % sizeof(event_codes)];
+                put16(p + 2, sequence);
+                if (i == 0)
+                    memset(p + 4, 0, 4);    /* Reply length */
+                add_packet(chunks, &nchunks, &time, c, XAMINE_RESPONSE, p, 32);
+            }
+        }
+    }
+
+    printf("capture:      %u conversations, %zu packets, %zu chunks, %zu bytes\n",
+           nconversations, npackets, nchunks, (size_t) nconversations * rounds * packet_bytes);
+
+    for (long threads = 1;; threads = 2 * threads < max_threads ? 2 * threads : max_threads) {
+        double start, elapsed;
+
+        memset(counts.packets, 0, nconversations * sizeof(*counts.packets));
+        memset(counts.decoded, 0, nconversations * sizeof(*counts.decoded));
+        start = now();
+        if (xamine_decode_capture(ctx, chunks, nchunks,
+                                  XAMINE_CONVERSATION_NO_SETUP | XAMINE_CONVERSATION_MSB_FIRST,
+                                  threads, XAMINE_CAPTURE_NO_FLAGS, count, &counts) < 0) {
+            fprintf(stderr, "failed to decode capture\n");
+            return EXIT_FAILURE;
+        }
+        elapsed = now() - start;
+
+        if (threads == 1) {
+            single = elapsed;
+            memcpy(expected.packets, counts.packets, nconversations * sizeof(*counts.packets));
+            memcpy(expected.decoded, counts.decoded, nconversations * sizeof(*counts.decoded));
+        }
+        else if (memcmp(expected.packets, counts.packets, nconversations * sizeof(*counts.packets)) ||
+                 memcmp(expected.decoded, counts.decoded, nconversations * sizeof(*counts.decoded))) {
+            fprintf(stderr, "%ld threads: results differ\n", threads);
+            mismatched++;
+        }
+
+        printf("%3ld threads:  %12.0f packets/s, %5.2fx\n",
+               threads, npackets / elapsed, single / elapsed);
+        if (threads == max_threads)
+            break;
+    }
+
+    /* The merge must see the same packets, in order of time. */
+    memset(counts.packets, 0, nconversations * sizeof(*counts.packets));
+    memset(counts.decoded, 0, nconversations * sizeof(*counts.decoded));
+    counts.last_time = 0;
+    counts.out_of_order = 0;
+    if (xamine_decode_capture(ctx, chunks, nchunks,
+                              XAMINE_CONVERSATION_NO_SETUP | XAMINE_CONVERSATION_MSB_FIRST,
+                              max_threads, XAMINE_CAPTURE_MERGE, count_merged, &counts) < 0) {
+        fprintf(stderr, "failed to decode capture\n");
+        return EXIT_FAILURE;
+    }
+    if (counts.out_of_order ||
+        memcmp(expected.packets, counts.packets, nconversations * sizeof(*counts.packets)) ||
+        memcmp(expected.decoded, counts.decoded, nconversations * sizeof(*counts.decoded))) {
+        fprintf(stderr, "merge: results differ\n");
+        mismatched++;
+    }
+
+    for (unsigned c = 0; c < nconversations; c++) {
+        total += expected.packets[c];
+        decoded += expected.decoded[c];
+    }
+    printf("packets:      %lu found, %lu decoded, %d mismatched\n", total, decoded, mismatched);
+    if (total != npackets)
+        mismatched++;
+
+    free(expected.packets);
+    free(expected.decoded);
+    free(counts.packets);
+    free(counts.decoded);
+    free(chunks);
+    free(buffer);
+    xamine_context_unref(ctx);
+
+    return mismatched ? EXIT_FAILURE : 0;
+}
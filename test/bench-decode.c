@@ -0,0 +1,134 @@
+/*
+ * Measure the time to examine events with compiled decode programs and by
+ * walking the definitions, after checking that both produce the same
+ * results.  The events are synthetic: pseudo-random bytes with each core
+ * event code in turn, of which only the codes with definitions are timed.
+ *
+ * usage: bench-decode [ITERATIONS]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "xamine.h"
+#include "compare.h"
+
+#define NEVENTS 64
+#define EVENT_SIZE 32
+#define ROUNDS 5
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Returns the mean time in nanoseconds to examine an event, over the best
+ * of several rounds.  Without an arena, results are allocated on the heap.
+ */
+static double
+bench(struct xamine_conversation *conversation, struct xamine_arena *arena,
+      unsigned char events[][EVENT_SIZE], int nevents, int iterations)
+{
+    double best = 0;
+
+    for (int round = 0; round < ROUNDS; round++) {
+        double start = now(), elapsed;
+
+        for (int i = 0; i < iterations; i++) {
+            for (int j = 0; j < nevents; j++) {
+                if (arena)
+                    xamine_examine_arena(conversation, XAMINE_RESPONSE, events[j],
+                                         EVENT_SIZE, arena);
+                else
+                    xamine_item_free(xamine_examine(conversation, XAMINE_RESPONSE,
+                                                    events[j], EVENT_SIZE));
+            }
+            if (arena)
+                xamine_arena_reset(arena);
+        }
+
+        elapsed = now() - start;
+        if (round == 0 || elapsed < best)
+            best = elapsed;
+    }
+
+    return best * 1e9 / ((double) iterations * nevents);
+}
+
+int
+main(int argc, char *argv[])
+{
+    static unsigned char events[NEVENTS][EVENT_SIZE];
+    static unsigned char decodable[NEVENTS][EVENT_SIZE];
+    struct xamine_context *compiled_ctx, *walked_ctx;
+    struct xamine_conversation *compiled, *walked;
+    struct xamine_arena *arena;
+    int iterations = argc > 1 ? atoi(argv[1]) : 10000;
+    int decoded = 0, mismatched = 0;
+    double compiled_ns, walked_ns, compiled_heap_ns, walked_heap_ns;
+
+    if (iterations <= 0)
+        iterations = 1;
+
+    compiled_ctx = xamine_context_new(XAMINE_CONTEXT_NO_FLAGS);
+    walked_ctx = xamine_context_new(XAMINE_CONTEXT_NO_COMPILE);
+    if (!compiled_ctx || !walked_ctx) {
+        fprintf(stderr, "failed to create context\n");
+        return EXIT_FAILURE;
+    }
+    compiled = xamine_conversation_new(compiled_ctx, XAMINE_CONVERSATION_NO_FLAGS);
+    walked = xamine_conversation_new(walked_ctx, XAMINE_CONVERSATION_NO_FLAGS);
+    arena = xamine_arena_new();
+
+    srand(1);
+    for (int i = 0; i < NEVENTS; i++) {
+        for (int j = 0; j < EVENT_SIZE; j++)
+            events[i][j] = rand();
+        events[i][0] = i;
+    }
+
+    for (int i = 2; i < NEVENTS; i++) {
+        struct xamine_item *a = xamine_examine(compiled, XAMINE_RESPONSE, events[i], EVENT_SIZE);
+        struct xamine_item *b = xamine_examine(walked, XAMINE_RESPONSE, events[i], EVENT_SIZE);
+
+        if (!same_tree(a, b)) {
+            fprintf(stderr, "event %d: results differ\n", i);
+            mismatched++;
+        }
+        if (a)
+            memcpy(decodable[decoded++], events[i], EVENT_SIZE);
+        xamine_item_free(a);
+        xamine_item_free(b);
+    }
+
+    /* Time only the events there are definitions for. */
+    if (decoded == 0) {
+        fprintf(stderr, "no events to decode\n");
+        return EXIT_FAILURE;
+    }
+    compiled_ns = bench(compiled, arena, decodable, decoded, iterations);
+    walked_ns = bench(walked, arena, decodable, decoded, iterations);
+    compiled_heap_ns = bench(compiled, NULL, decodable, decoded, iterations);
+    walked_heap_ns = bench(walked, NULL, decodable, decoded, iterations);
+
+    printf("events:       %d decoded, %d mismatched\n", decoded, mismatched);
+    printf("compiled:     %10.1f ns/event (arena), %10.1f ns/event (heap)\n",
+           compiled_ns, compiled_heap_ns);
+    printf("walked:       %10.1f ns/event (arena), %10.1f ns/event (heap)\n",
+           walked_ns, walked_heap_ns);
+
+    xamine_arena_free(arena);
+    xamine_conversation_unref(compiled);
+    xamine_conversation_unref(walked);
+    xamine_context_unref(compiled_ctx);
+    xamine_context_unref(walked_ctx);
+
+    return mismatched ? EXIT_FAILURE : 0;
+}
@@ -0,0 +1,165 @@
+/*
+ * Measure the time to examine requests carrying long lists, from clients of
+ * each byte order, with compiled decode programs and by walking the
+ * definitions, after checking that both produce the same results.  The
+ * requests are PolyPoint with a list of POINT, PutImage with a list of
+ * BYTE and QueryColors with a list of CARD32, filled with pseudo-random
+ * data.
+ *
+ * usage: bench-lists [ITERATIONS [ELEMENTS]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "xamine.h"
+#include "compare.h"
+
+#define ROUNDS 5
+
+struct request {
+    const char *name;
+    unsigned char *data;
+    size_t size;
+    size_t nvalues;
+};
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* A conversation whose client has the given byte order, 'l' or 'B'. */
+static struct xamine_conversation *
+conversation_new(struct xamine_context *ctx, unsigned char byte_order)
+{
+    struct xamine_conversation *conversation;
+    unsigned char setup[12] = { byte_order };
+
+    conversation = xamine_conversation_new(ctx, XAMINE_CONVERSATION_NO_FLAGS);
+    xamine_conversation_feed(conversation, XAMINE_REQUEST, setup, sizeof(setup));
+    return conversation;
+}
+
+static void
+put16(unsigned char *p, unsigned value, int is_le)
+{
+    p[is_le ? 0 : 1] = value;
+    p[is_le ? 1 : 0] = value >> 8;
+}
+
+/* Fill a request with random data, then set its opcode and length. */
+static void
+request_init(struct request *request, const char *name, unsigned char opcode,
+             size_t size, size_t nvalues, int is_le)
+{
+    request->name = name;
+    request->size = size;
+    request->nvalues = nvalues;
+    request->data = malloc(size);
+    for (size_t i = 0; i < size; i++)
+        request->data[i] = rand();
+    request->data[0] = opcode;
+    put16(request->data + 2, size / 4, is_le);
+}
+
+/* Returns the mean time in nanoseconds to examine the request. */
+static double
+bench(struct xamine_conversation *conversation, struct xamine_arena *arena,
+      const struct request *request, int iterations)
+{
+    double best = 0;
+
+    for (int round = 0; round < ROUNDS; round++) {
+        double start = now(), elapsed;
+
+        for (int i = 0; i < iterations; i++) {
+            xamine_examine_arena(conversation, XAMINE_REQUEST, request->data,
+                                 request->size, arena);
+            xamine_arena_reset(arena);
+        }
+
+        elapsed = now() - start;
+        if (round == 0 || elapsed < best)
+            best = elapsed;
+    }
+
+    return best * 1e9 / iterations;
+}
+
+int
+main(int argc, char *argv[])
+{
+    static const unsigned char byte_orders[] = { 'l', 'B' };
+    struct xamine_context *compiled_ctx, *walked_ctx;
+    struct xamine_arena *arena;
+    int iterations = argc > 1 ? atoi(argv[1]) : 200;
+    size_t nelements = argc > 2 ? strtoul(argv[2], NULL, 10) : 4000;
+    int mismatched = 0;
+
+    if (iterations <= 0)
+        iterations = 1;
+    /* The length of a request is counted in 16 bits of 4-byte units. */
+    if (nelements > 60000)
+        nelements = 60000;
+
+    compiled_ctx = xamine_context_new(XAMINE_CONTEXT_NO_FLAGS);
+    walked_ctx = xamine_context_new(XAMINE_CONTEXT_NO_COMPILE);
+    if (!compiled_ctx || !walked_ctx) {
+        fprintf(stderr, "failed to create context\n");
+        return EXIT_FAILURE;
+    }
+    arena = xamine_arena_new();
+
+    srand(1);
+    for (int order = 0; order < 2; order++) {
+        int is_le = byte_orders[order] == 'l';
+        struct xamine_conversation *compiled = conversation_new(compiled_ctx, byte_orders[order]);
+        struct xamine_conversation *walked = conversation_new(walked_ctx, byte_orders[order]);
+        struct request requests[3];
+
+        /* PolyPoint: a 12-byte header then x and y of each point. */
+        request_init(&requests[0], "PolyPoint", 64, 12 + 4 * nelements, 2 * nelements, is_le);
+        /* PutImage: a 24-byte header then the image data. */
+        request_init(&requests[1], "PutImage", 72, 24 + 4 * nelements, 4 * nelements, is_le);
+        /* QueryColors: an 8-byte header then the pixels. */
+        request_init(&requests[2], "QueryColors", 91, 8 + 4 * nelements, nelements, is_le);
+
+        for (int i = 0; i < 3; i++) {
+            const struct request *request = &requests[i];
+            struct xamine_item *a = xamine_examine(compiled, XAMINE_REQUEST, request->data, request->size);
+            struct xamine_item *b = xamine_examine(walked, XAMINE_REQUEST, request->data, request->size);
+            double compiled_ns, walked_ns;
+
+            if (!a || !same_tree(a, b)) {
+                fprintf(stderr, "%s (%c): results differ\n", request->name, byte_orders[order]);
+                mismatched++;
+            }
+            xamine_item_free(a);
+            xamine_item_free(b);
+
+            compiled_ns = bench(compiled, arena, request, iterations);
+            walked_ns = bench(walked, arena, request, iterations);
+            printf("%-11s %s:  compiled %8.2f ns/value, %8.1f MB/s;  walked %8.2f ns/value\n",
+                   request->name, is_le ? "LSB first" : "MSB first",
+                   compiled_ns / request->nvalues, request->size * 1e3 / compiled_ns,
+                   walked_ns / request->nvalues);
+            free(request->data);
+        }
+
+        xamine_conversation_unref(compiled);
+        xamine_conversation_unref(walked);
+    }
+
+    xamine_arena_free(arena);
+    xamine_context_unref(compiled_ctx);
+    xamine_context_unref(walked_ctx);
+
+    return mismatched ? EXIT_FAILURE : 0;
+}
@@ -0,0 +1,99 @@
+/*
+ * Measure the time to create a context from the XML-XCB descriptions on
+ * XAMINE_PATH, by parsing the XML on one thread per processor and on the
+ * calling thread alone, by loading the definition cache, and by parsing only
+ * the core protocol as a lazy context does.
+ *
+ * usage: bench-load [ITERATIONS]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "xamine.h"
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Returns the mean time in milliseconds to create and destroy a context. */
+static double
+bench(enum xamine_context_flags flags, int iterations, int *ndefinitions)
+{
+    double total = 0;
+
+    for (int i = 0; i < iterations; i++) {
+        struct xamine_context *ctx;
+        double start = now();
+
+        ctx = xamine_context_new(flags);
+        if (!ctx) {
+            fprintf(stderr, "failed to create context\n");
+            exit(EXIT_FAILURE);
+        }
+        if (i == 0) {
+            *ndefinitions = 0;
+            for (const struct xamine_definition *def = xamine_get_definitions(ctx); def; def = def->next)
+                (*ndefinitions)++;
+        }
+        xamine_context_unref(ctx);
+
+        total += now() - start;
+    }
+
+    return total * 1000 / iterations;
+}
+
+int
+main(int argc, char *argv[])
+{
+    char cache_path[] = "/tmp/xamine-bench-load.XXXXXX";
+    struct xamine_context *ctx;
+    int iterations = argc > 1 ? atoi(argv[1]) : 20;
+    int ndefinitions, nserial, ncached, nlazy;
+    double xml, serial, cache, lazy;
+    int fd;
+
+    if (iterations <= 0)
+        iterations = 1;
+
+    /* Use a private cache file rather than the user's. */
+    fd = mkstemp(cache_path);
+    if (fd < 0) {
+        perror("mkstemp");
+        return EXIT_FAILURE;
+    }
+    close(fd);
+    setenv("XAMINE_CACHE", cache_path, 1);
+
+    xml = bench(XAMINE_CONTEXT_NO_CACHE, iterations, &ndefinitions);
+    serial = bench(XAMINE_CONTEXT_NO_CACHE | XAMINE_CONTEXT_NO_THREADS, iterations, &nserial);
+    lazy = bench(XAMINE_CONTEXT_LAZY, iterations, &nlazy);
+
+    ctx = xamine_context_new(XAMINE_CONTEXT_NO_CACHE);
+    if (xamine_context_write_cache(ctx, NULL) < 0) {
+        fprintf(stderr, "failed to write the definition cache\n");
+        unlink(cache_path);
+        return EXIT_FAILURE;
+    }
+    xamine_context_unref(ctx);
+
+    cache = bench(XAMINE_CONTEXT_NO_FLAGS, iterations, &ncached);
+    unlink(cache_path);
+
+    printf("definitions:  %d (%d serially, %d from cache, %d lazily)\n",
+           ndefinitions, nserial, ncached, nlazy);
+    printf("xml:          %10.3f ms/context\n", xml);
+    printf("xml serial:   %10.3f ms/context\n", serial);
+    printf("cache:        %10.3f ms/context\n", cache);
+    printf("lazy:         %10.3f ms/context\n", lazy);
+
+    return 0;
+}
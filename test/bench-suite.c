@@ -0,0 +1,558 @@
+/*
+ * Benchmark examining packets and creating contexts, over deterministic
+ * synthetic corpora made from the loaded definitions, in both byte orders:
+ * every core event and error, core requests, requests carrying large
+ * lists, and a conversation of requests, their replies and events fed to
+ * xamine_conversation_feed.  Packets are pseudo-random bytes with their
+ * codes and lengths set, kept if they can be examined.  Reports the time
+ * per packet, packets per second, allocations per packet and peak resident
+ * set size; with -j, as JSON Lines for comparing between releases.  With
+ * -s, the conversations keep statistics, to measure what they cost.
+ *
+ * usage: bench-suite [-j] [-s] [ITERATIONS]
+ */
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "xamine.h"
+
+#define ROUNDS 5
+#define CONTEXT_ROUNDS 5
+#define LIST_REQUEST_SIZE 16384
+
+/*
+ * Count allocations by wrapping the allocator, where the C library lets
+ * the program replace it.  Counts are -1 elsewhere.  The wrappers must be
+ * visible to the library despite -fvisibility=hidden.
+ */
+#ifdef __GLIBC__
+#define ALLOCATOR __attribute__((visibility("default")))
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static atomic_ulong allocations;
+
+ALLOCATOR void *
+malloc(size_t size)
+{
+    atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+ALLOCATOR void *
+calloc(size_t nmemb, size_t size)
+{
+    atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    return __libc_calloc(nmemb, size);
+}
+
+ALLOCATOR void *
+realloc(void *ptr, size_t size)
+{
+    atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+
+ALLOCATOR void
+free(void *ptr)
+{
+    __libc_free(ptr);
+}
+
+static long
+allocation_count(void)
+{
+    return atomic_load_explicit(&allocations, memory_order_relaxed);
+}
+#else
+static long
+allocation_count(void)
+{
+    return -1;
+}
+#endif
+
+struct packet {
+    enum xamine_direction direction;
+    unsigned char *data;
+    size_t size;
+};
+
+struct corpus {
+    const char *name;
+    bool is_le;
+    struct packet *packets;
+    size_t count;
+    size_t alloc;
+    /* A conversation is fed as two streams rather than examined packet by
+     * packet. */
+    bool is_stream;
+    unsigned char *streams[2];
+    size_t stream_sizes[2];
+};
+
+struct result {
+    size_t packets;
+    size_t decoded;
+    double ns;                      /* Per packet or per context */
+    double allocations;             /* Per packet or per context, or -1 */
+    long peak_rss;                  /* In kilobytes */
+};
+
+static bool json_output;
+static enum xamine_conversation_flags conversation_flags;
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long
+peak_rss(void)
+{
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+static void
+put16(unsigned char *p, unsigned value, bool is_le)
+{
+    p[is_le ? 0 : 1] = value;
+    p[is_le ? 1 : 0] = value >> 8;
+}
+
+static void
+put32(unsigned char *p, unsigned long value, bool is_le)
+{
+    for (int i = 0; i < 4; i++)
+        p[is_le ? i : 3 - i] = value >> (8 * i);
+}
+
+/* A conversation past the connection setup, in the given byte order. */
+static struct xamine_conversation *
+conversation_new(struct xamine_context *ctx, bool is_le)
+{
+    struct xamine_conversation *conversation;
+    unsigned char setup[12] = { is_le ? 'l' : 'B' };
+    unsigned char reply[8] = { 1 };
+
+    conversation = xamine_conversation_new(ctx, conversation_flags);
+    if (!conversation)
+        return NULL;
+    xamine_conversation_feed(conversation, XAMINE_REQUEST, setup, sizeof(setup));
+    xamine_conversation_feed(conversation, XAMINE_RESPONSE, reply, sizeof(reply));
+    return conversation;
+}
+
+static unsigned char *
+random_bytes(size_t size, unsigned *seed)
+{
+    unsigned char *data = malloc(size);
+
+    for (size_t i = 0; i < size; i++)
+        data[i] = rand_r(seed);
+    return data;
+}
+
+/* Add a packet to a corpus if it can be examined, and free it otherwise. */
+static bool
+corpus_add(struct corpus *corpus, struct xamine_conversation *conversation,
+           enum xamine_direction direction, unsigned char *data, size_t size)
+{
+    struct xamine_item *item = xamine_examine(conversation, direction, data, size);
+
+    if (!item) {
+        free(data);
+        return false;
+    }
+    xamine_item_free(item);
+
+    if (corpus->count == corpus->alloc) {
+        corpus->alloc = corpus->alloc ? 2 * corpus->alloc : 64;
+        corpus->packets = realloc(corpus->packets, corpus->alloc * sizeof(*corpus->packets));
+    }
+    corpus->packets[corpus->count].direction = direction;
+    corpus->packets[corpus->count].data = data;
+    corpus->packets[corpus->count].size = size;
+    corpus->count++;
+    return true;
+}
+
+static void
+make_events(struct corpus *corpus, struct xamine_conversation *conversation,
+            unsigned *seed)
+{
+    for (int code = 2; code < 64; code++) {
+        unsigned char *data = random_bytes(32, seed);
+
+        data[0] = code;
+        corpus_add(corpus, conversation, XAMINE_RESPONSE, data, 32);
+    }
+}
+
+static void
+make_errors(struct corpus *corpus, struct xamine_conversation *conversation,
+            unsigned *seed)
+{
+    for (int code = 1; code < 128; code++) {
+        unsigned char *data = random_bytes(32, seed);
+
+        data[0] = 0;
+        data[1] = code;
+        corpus_add(corpus, conversation, XAMINE_RESPONSE, data, 32);
+    }
+}
+
+/* For each core request, the shortest random request that can be examined. */
+static void
+make_requests(struct corpus *corpus, struct xamine_conversation *conversation,
+              unsigned *seed)
+{
+    for (int opcode = 1; opcode < 128; opcode++) {
+        for (size_t size = 4; size <= 64; size += 4) {
+            unsigned char *data = random_bytes(size, seed);
+
+            data[0] = opcode;
+            put16(data + 2, size / 4, corpus->is_le);
+            if (corpus_add(corpus, conversation, XAMINE_REQUEST, data, size))
+                break;
+        }
+    }
+}
+
+/* The bytes of data a list item covers, or 0 for other items. */
+static size_t
+list_size(const struct xamine_item *item)
+{
+    const struct xamine_item *last = NULL;
+
+    if (item->element_size)
+        return item->count * item->element_size;
+    for (const struct xamine_item *child = item->child; child && child->name &&
+         child->name[0] == '['; child = child->next)
+        last = child;
+    return last ? last->offset - item->offset : 0;
+}
+
+/* Requests with a list filling most of a large request, such as PolyPoint. */
+static void
+make_lists(struct corpus *corpus, struct xamine_conversation *conversation,
+           unsigned *seed)
+{
+    for (int opcode = 1; opcode < 128; opcode++) {
+        unsigned char *data = random_bytes(LIST_REQUEST_SIZE, seed);
+        struct xamine_item *item;
+        bool has_list = false;
+
+        data[0] = opcode;
+        put16(data + 2, LIST_REQUEST_SIZE / 4, corpus->is_le);
+
+        item = xamine_examine(conversation, XAMINE_REQUEST, data, LIST_REQUEST_SIZE);
+        for (const struct xamine_item *field = item ? item->child : NULL; field; field = field->next)
+            if (list_size(field) >= LIST_REQUEST_SIZE / 2)
+                has_list = true;
+        xamine_item_free(item);
+        if (has_list)
+            corpus_add(corpus, conversation, XAMINE_REQUEST, data, LIST_REQUEST_SIZE);
+        else
+            free(data);
+    }
+}
+
+static void
+stream_append(struct corpus *corpus, int stream, const unsigned char *data, size_t size)
+{
+    corpus->streams[stream] = realloc(corpus->streams[stream], corpus->stream_sizes[stream] + size);
+    memcpy(corpus->streams[stream] + corpus->stream_sizes[stream], data, size);
+    corpus->stream_sizes[stream] += size;
+}
+
+/*
+ * A conversation made of the requests of another corpus, each answered by
+ * a reply without extra data and followed by an event, with sequence
+ * numbers to match.  Replies to requests which have none are not examined.
+ */
+static void
+make_conversation(struct corpus *corpus, const struct corpus *requests,
+                  const struct corpus *events, unsigned *seed)
+{
+    unsigned char *setup = calloc(1, 12);
+
+    setup[0] = corpus->is_le ? 'l' : 'B';
+    stream_append(corpus, XAMINE_REQUEST, setup, 12);
+    memset(setup, 0, 12);
+    setup[0] = 1;
+    stream_append(corpus, XAMINE_RESPONSE, setup, 8);
+    free(setup);
+
+    for (size_t i = 0; i < requests->count; i++) {
+        const struct packet *request = &requests->packets[i];
+        unsigned char *reply = random_bytes(32, seed);
+        unsigned sequence = i + 1;
+
+        stream_append(corpus, XAMINE_REQUEST, request->data, request->size);
+
+        reply[0] = 1;
+        put16(reply + 2, sequence, corpus->is_le);
+        put32(reply + 4, 0, corpus->is_le);
+        stream_append(corpus, XAMINE_RESPONSE, reply, 32);
+        free(reply);
+
+        if (events->count > 0) {
+            const struct packet *event = &events->packets[i % events->count];
+            unsigned char copy[32];
+
+            memcpy(copy, event->data, 32);
+            put16(copy + 2, sequence, corpus->is_le);
+            stream_append(corpus, XAMINE_RESPONSE, copy, 32);
+        }
+    }
+    corpus->is_stream = true;
+}
+
+static void
+corpus_free(struct corpus *corpus)
+{
+    for (size_t i = 0; i < corpus->count; i++)
+        free(corpus->packets[i].data);
+    free(corpus->packets);
+    free(corpus->streams[0]);
+    free(corpus->streams[1]);
+}
+
+struct stream_totals {
+    size_t packets;
+    size_t decoded;
+};
+
+static void
+examine_packet(struct xamine_conversation *conversation, enum xamine_direction direction,
+               const void *data, size_t size, void *closure)
+{
+    struct stream_totals *totals = closure;
+    struct xamine_item *item = xamine_examine(conversation, direction, data, size);
+
+    totals->packets++;
+    if (item)
+        totals->decoded++;
+    xamine_item_free(item);
+}
+
+/* Feed a whole conversation, requests first so that replies can be matched. */
+static void
+feed_conversation(struct xamine_context *ctx, const struct corpus *corpus,
+                  struct stream_totals *totals)
+{
+    struct xamine_conversation *conversation;
+
+    conversation = xamine_conversation_new(ctx, conversation_flags);
+    xamine_conversation_set_packet_func(conversation, examine_packet, totals);
+    xamine_conversation_feed(conversation, XAMINE_REQUEST,
+                             corpus->streams[XAMINE_REQUEST], corpus->stream_sizes[XAMINE_REQUEST]);
+    xamine_conversation_feed(conversation, XAMINE_RESPONSE,
+                             corpus->streams[XAMINE_RESPONSE], corpus->stream_sizes[XAMINE_RESPONSE]);
+    xamine_conversation_unref(conversation);
+}
+
+static void
+examine_corpus(struct xamine_context *ctx, struct xamine_conversation *conversation,
+               const struct corpus *corpus, struct stream_totals *totals)
+{
+    if (corpus->is_stream) {
+        feed_conversation(ctx, corpus, totals);
+        return;
+    }
+    for (size_t i = 0; i < corpus->count; i++) {
+        const struct packet *packet = &corpus->packets[i];
+
+        examine_packet(conversation, packet->direction, packet->data, packet->size, totals);
+    }
+}
+
+static struct result
+bench_corpus(struct xamine_context *ctx, struct xamine_conversation *conversation,
+             const struct corpus *corpus, int iterations)
+{
+    struct stream_totals totals = { 0, 0 };
+    struct result result;
+    double best = 0;
+    long before;
+
+    before = allocation_count();
+    examine_corpus(ctx, conversation, corpus, &totals);
+    result.packets = totals.packets;
+    result.decoded = totals.decoded;
+    result.allocations = before < 0 || totals.packets == 0 ? -1 :
+                         (double) (allocation_count() - before) / totals.packets;
+
+    for (int round = 0; round < ROUNDS; round++) {
+        double start = now(), elapsed;
+
+        for (int i = 0; i < iterations; i++) {
+            totals.packets = 0;
+            examine_corpus(ctx, conversation, corpus, &totals);
+        }
+
+        elapsed = now() - start;
+        if (round == 0 || elapsed < best)
+            best = elapsed;
+    }
+
+    result.ns = result.packets ? best * 1e9 / iterations / result.packets : 0;
+    result.peak_rss = peak_rss();
+    return result;
+}
+
+static struct result
+bench_context(enum xamine_context_flags flags)
+{
+    struct result result = { 1, 0, 0, -1, 0 };
+    double best = 0;
+
+    for (int round = 0; round < CONTEXT_ROUNDS; round++) {
+        long before = allocation_count();
+        double start = now(), elapsed;
+        struct xamine_context *ctx = xamine_context_new(flags);
+
+        elapsed = now() - start;
+        if (ctx)
+            result.decoded = 1;
+        if (round == 0 && before >= 0)
+            result.allocations = allocation_count() - before;
+        xamine_context_unref(ctx);
+        if (round == 0 || elapsed < best)
+            best = elapsed;
+    }
+
+    result.ns = best * 1e9;
+    result.peak_rss = peak_rss();
+    return result;
+}
+
+static void
+print_examine(const char *corpus, bool is_le, const struct result *r)
+{
+    const char *order = is_le ? "LSB" : "MSB";
+    double per_second = r->ns > 0 ? 1e9 / r->ns : 0;
+
+    if (json_output) {
+        printf("{\"benchmark\":\"examine\",\"corpus\":\"%s\",\"byte_order\":\"%s\","
+               "\"packets\":%zu,\"decoded\":%zu,\"ns_per_packet\":%.2f,"
+               "\"packets_per_second\":%.0f,", corpus, order, r->packets, r->decoded,
+               r->ns, per_second);
+        if (r->allocations < 0)
+            printf("\"allocations_per_packet\":null,");
+        else
+            printf("\"allocations_per_packet\":%.2f,", r->allocations);
+        printf("\"peak_rss_kb\":%ld}\n", r->peak_rss);
+        return;
+    }
+    printf("examine %-13s %s %7zu %7zu %10.1f %12.0f %9.2f %10ld\n", corpus, order,
+           r->packets, r->decoded, r->ns, per_second, r->allocations, r->peak_rss);
+}
+
+static void
+print_context(const char *name, const struct result *r)
+{
+    if (json_output) {
+        printf("{\"benchmark\":\"context\",\"flags\":\"%s\",\"created\":%s,"
+               "\"ms_per_context\":%.3f,", name, r->decoded ? "true" : "false", r->ns / 1e6);
+        if (r->allocations < 0)
+            printf("\"allocations_per_context\":null,");
+        else
+            printf("\"allocations_per_context\":%.0f,", r->allocations);
+        printf("\"peak_rss_kb\":%ld}\n", r->peak_rss);
+        return;
+    }
+    printf("context %-17s %10.3f ms %22.0f %10ld\n", name, r->ns / 1e6,
+           r->allocations, r->peak_rss);
+}
+
+int
+main(int argc, char *argv[])
+{
+    static const struct {
+        const char *name;
+        enum xamine_context_flags flags;
+    } contexts[] = {
+        { "default", XAMINE_CONTEXT_NO_FLAGS },
+        { "no-cache", XAMINE_CONTEXT_NO_CACHE },
+        { "no-cache,serial", XAMINE_CONTEXT_NO_CACHE | XAMINE_CONTEXT_NO_THREADS },
+        { "lazy", XAMINE_CONTEXT_LAZY },
+    };
+    struct xamine_context *ctx;
+    int iterations = 20;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-j") == 0)
+            json_output = true;
+        else if (strcmp(argv[i], "-s") == 0)
+            conversation_flags |= XAMINE_CONVERSATION_STATS;
+        else
+            iterations = atoi(argv[i]);
+    }
+    if (iterations <= 0)
+        iterations = 1;
+
+    if (!json_output)
+        printf("        %-13s %3s %7s %7s %10s %12s %9s %10s\n", "corpus", "", "packets",
+               "decoded", "ns/packet", "packets/s", "allocs", "peak KB");
+
+    /* Contexts first, so the peak size is theirs. */
+    for (size_t i = 0; i < sizeof(contexts) / sizeof(contexts[0]); i++) {
+        struct result result = bench_context(contexts[i].flags);
+
+        print_context(contexts[i].name, &result);
+    }
+
+    ctx = xamine_context_new(XAMINE_CONTEXT_NO_FLAGS);
+    if (!ctx) {
+        fprintf(stderr, "failed to create context\n");
+        return EXIT_FAILURE;
+    }
+
+    for (int order = 0; order < 2; order++) {
+        bool is_le = order == 0;
+        struct xamine_conversation *conversation = conversation_new(ctx, is_le);
+        struct corpus corpora[5] = {
+            { .name = "events", .is_le = is_le },
+            { .name = "errors", .is_le = is_le },
+            { .name = "requests", .is_le = is_le },
+            { .name = "lists", .is_le = is_le },
+            { .name = "conversation", .is_le = is_le },
+        };
+        unsigned seed = 1;
+
+        make_events(&corpora[0], conversation, &seed);
+        make_errors(&corpora[1], conversation, &seed);
+        make_requests(&corpora[2], conversation, &seed);
+        make_lists(&corpora[3], conversation, &seed);
+        make_conversation(&corpora[4], &corpora[2], &corpora[0], &seed);
+
+        for (int i = 0; i < 5; i++) {
+            struct result result = bench_corpus(ctx, conversation, &corpora[i], iterations);
+
+            print_examine(corpora[i].name, is_le, &result);
+            corpus_free(&corpora[i]);
+        }
+        xamine_conversation_unref(conversation);
+    }
+
+    xamine_context_unref(ctx);
+    return 0;
+}
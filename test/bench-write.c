@@ -0,0 +1,290 @@
+/*
+ * Measure the throughput of writing packets as JSON Lines and CBOR: with
+ * xamine_write straight from compiled decode programs, with
+ * xamine_write_item from examined items, and with xamine_write in a
+ * context which walks the definitions, after checking that all three write
+ * the same bytes.  For comparison, the items are also printed as JSON with
+ * stdio.  The packets are synthetic: core events of random bytes, and
+ * PolyPoint, PutImage and InternAtom requests carrying lists.
+ *
+ * usage: bench-write [ITERATIONS]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "xamine.h"
+
+#define ROUNDS 5
+#define MAX_PACKETS 128
+
+struct packet {
+    enum xamine_direction direction;
+    unsigned char *data;
+    size_t size;
+};
+
+struct packets {
+    struct packet packets[MAX_PACKETS];
+    int count;
+    size_t size;
+};
+
+enum method {
+    DIRECT,
+    ITEMS,
+    PRINTF
+};
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+put16(unsigned char *p, unsigned value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+}
+
+static void
+add(struct packets *packets, enum xamine_direction direction, size_t size,
+    unsigned char code)
+{
+    struct packet *packet = &packets->packets[packets->count++];
+
+    packet->direction = direction;
+    packet->size = size;
+    packet->data = malloc(size);
+    for (size_t i = 0; i < size; i++)
+        packet->data[i] = rand();
+    packet->data[0] = code;
+    if (direction == XAMINE_REQUEST)
+        put16(packet->data + 2, size / 4);
+    packets->size += size;
+}
+
+/* Print items as JSON with stdio, as a caller without a writer would. */
+static void
+print_item(FILE *f, const struct xamine_item *item)
+{
+    const struct xamine_definition *base = item->definition;
+    struct xamine_item element;
+
+    while (base->type == XAMINE_TYPEDEF)
+        base = base->u.ref;
+
+    if (item->element_size) {
+        fputc('[', f);
+        for (size_t i = 0; xamine_item_element(item, i, &element) == 0; i++)
+            fprintf(f, i ? ",%ld" : "%ld", element.u.signed_value);
+        fputc(']', f);
+    }
+    else if (item->child) {
+        fputc('{', f);
+        for (const struct xamine_item *child = item->child; child; child = child->next) {
+            fprintf(f, "\"%s\":", child->name);
+            print_item(f, child);
+            if (child->next)
+                fputc(',', f);
+        }
+        fputc('}', f);
+    }
+    else if (base->type == XAMINE_SIGNED)
+        fprintf(f, "%ld", item->u.signed_value);
+    else
+        fprintf(f, "%lu", item->u.unsigned_value);
+}
+
+static int
+write_packet(struct xamine_conversation *conversation, struct xamine_arena *arena,
+             const struct packet *packet, enum method method,
+             enum xamine_format format, struct xamine_buffer *buffer, FILE *f)
+{
+    struct xamine_item *item;
+
+    if (method == DIRECT)
+        return xamine_write(conversation, packet->direction, packet->data,
+                            packet->size, format, buffer);
+
+    item = xamine_examine_arena(conversation, packet->direction, packet->data,
+                                packet->size, arena);
+    if (method == ITEMS)
+        return xamine_write_item(item, format, buffer);
+    if (!item)
+        return -1;
+    print_item(f, item);
+    fputc('\n', f);
+    return 0;
+}
+
+/*
+ * Returns the best time in seconds to write all the packets, and the size
+ * of the output in out_size.
+ */
+static double
+bench(struct xamine_conversation *conversation, struct xamine_arena *arena,
+      const struct packets *packets, enum method method,
+      enum xamine_format format, int iterations, size_t *out_size)
+{
+    struct xamine_buffer buffer = { 0 };
+    char *text = NULL;
+    size_t text_size = 0;
+    FILE *f = open_memstream(&text, &text_size);
+    double best = 0;
+
+    for (int round = 0; round < ROUNDS; round++) {
+        double start = now(), elapsed;
+
+        for (int i = 0; i < iterations; i++) {
+            buffer.size = 0;
+            rewind(f);
+            for (int j = 0; j < packets->count; j++) {
+                write_packet(conversation, arena, &packets->packets[j], method,
+                             format, &buffer, f);
+                xamine_arena_reset(arena);
+            }
+            fflush(f);
+        }
+
+        elapsed = now() - start;
+        if (round == 0 || elapsed < best)
+            best = elapsed;
+    }
+
+    *out_size = method == PRINTF ? text_size : buffer.size;
+    fclose(f);
+    free(text);
+    free(buffer.data);
+    return best / iterations;
+}
+
+/* Write all the packets into buffer, one way. */
+static void
+write_all(struct xamine_conversation *conversation, struct xamine_arena *arena,
+          const struct packets *packets, enum method method,
+          enum xamine_format format, struct xamine_buffer *buffer)
+{
+    buffer->size = 0;
+    for (int j = 0; j < packets->count; j++) {
+        write_packet(conversation, arena, &packets->packets[j], method, format,
+                     buffer, NULL);
+        xamine_arena_reset(arena);
+    }
+}
+
+static struct xamine_conversation *
+conversation_new(struct xamine_context *ctx)
+{
+    struct xamine_conversation *conversation;
+    unsigned char setup[12] = { 'l' };
+
+    conversation = xamine_conversation_new(ctx, XAMINE_CONVERSATION_NO_FLAGS);
+    xamine_conversation_feed(conversation, XAMINE_REQUEST, setup, sizeof(setup));
+    return conversation;
+}
+
+int
+main(int argc, char *argv[])
+{
+    static const char *const formats[] = { "JSON", "CBOR" };
+    struct xamine_context *compiled_ctx, *walked_ctx;
+    struct xamine_conversation *compiled, *walked;
+    struct xamine_arena *arena;
+    struct packets all = { .count = 0 }, packets = { .count = 0 };
+    int iterations = argc > 1 ? atoi(argv[1]) : 2000;
+    int mismatched = 0;
+
+    if (iterations <= 0)
+        iterations = 1;
+
+    compiled_ctx = xamine_context_new(XAMINE_CONTEXT_NO_FLAGS);
+    walked_ctx = xamine_context_new(XAMINE_CONTEXT_NO_COMPILE);
+    if (!compiled_ctx || !walked_ctx) {
+        fprintf(stderr, "failed to create context\n");
+        return EXIT_FAILURE;
+    }
+    compiled = conversation_new(compiled_ctx);
+    walked = conversation_new(walked_ctx);
+    arena = xamine_arena_new();
+
+    srand(1);
+    for (int code = 2; code < 64; code++)
+        add(&all, XAMINE_RESPONSE, 32, code);
+    add(&all, XAMINE_REQUEST, 12 + 4 * 200, 64);        /* PolyPoint */
+    add(&all, XAMINE_REQUEST, 24 + 4 * 1000, 72);       /* PutImage */
+    add(&all, XAMINE_REQUEST, 8 + 20, 16);              /* InternAtom */
+    put16(all.packets[all.count - 1].data + 4, 20);
+
+    /* Keep the packets with definitions. */
+    for (int j = 0; j < all.count; j++) {
+        struct xamine_buffer buffer = { 0 };
+
+        if (xamine_write(compiled, all.packets[j].direction, all.packets[j].data,
+                         all.packets[j].size, XAMINE_FORMAT_JSON, &buffer) == 0) {
+            packets.packets[packets.count++] = all.packets[j];
+            packets.size += all.packets[j].size;
+        }
+        else
+            free(all.packets[j].data);
+        free(buffer.data);
+    }
+    if (packets.count == 0) {
+        fprintf(stderr, "no packets to write\n");
+        return EXIT_FAILURE;
+    }
+    printf("packets:  %d, %zu bytes\n", packets.count, packets.size);
+
+    for (int format = 0; format < 2; format++) {
+        struct xamine_buffer direct = { 0 }, items = { 0 }, walk = { 0 };
+        double direct_s, items_s, walked_s, printf_s = 0;
+        size_t direct_size, items_size, walked_size, printf_size;
+
+        write_all(compiled, arena, &packets, DIRECT, format, &direct);
+        write_all(compiled, arena, &packets, ITEMS, format, &items);
+        write_all(walked, arena, &packets, DIRECT, format, &walk);
+        if (direct.size != items.size || direct.size != walk.size ||
+            memcmp(direct.data, items.data, direct.size) != 0 ||
+            memcmp(direct.data, walk.data, direct.size) != 0) {
+            fprintf(stderr, "%s: output differs\n", formats[format]);
+            mismatched++;
+        }
+        free(direct.data);
+        free(items.data);
+        free(walk.data);
+
+        direct_s = bench(compiled, arena, &packets, DIRECT, format, iterations, &direct_size);
+        items_s = bench(compiled, arena, &packets, ITEMS, format, iterations, &items_size);
+        walked_s = bench(walked, arena, &packets, DIRECT, format, iterations, &walked_size);
+        if (format == XAMINE_FORMAT_JSON)
+            printf_s = bench(compiled, arena, &packets, PRINTF, format, iterations, &printf_size);
+
+        printf("%s:     %zu bytes out\n", formats[format], direct_size);
+        printf("  direct: %8.1f MB/s in, %8.1f MB/s out\n",
+               packets.size / direct_s / 1e6, direct_size / direct_s / 1e6);
+        printf("  items:  %8.1f MB/s in, %8.1f MB/s out\n",
+               packets.size / items_s / 1e6, items_size / items_s / 1e6);
+        printf("  walked: %8.1f MB/s in, %8.1f MB/s out\n",
+               packets.size / walked_s / 1e6, walked_size / walked_s / 1e6);
+        if (format == XAMINE_FORMAT_JSON)
+            printf("  stdio:  %8.1f MB/s in, %8.1f MB/s out\n",
+                   packets.size / printf_s / 1e6, printf_size / printf_s / 1e6);
+    }
+
+    for (int j = 0; j < packets.count; j++)
+        free(packets.packets[j].data);
+    xamine_arena_free(arena);
+    xamine_conversation_unref(compiled);
+    xamine_conversation_unref(walked);
+    xamine_context_unref(compiled_ctx);
+    xamine_context_unref(walked_ctx);
+
+    return mismatched ? EXIT_FAILURE : 0;
+}
@@ -0,0 +1,257 @@
+/*
+ * Check the definition cache on the description in protocol.h: the first
+ * context writes it, the next one maps it instead of writing it again,
+ * both decode packets the same, events sent in GenericEvent among them, and
+ * touching an XML file makes the next context parse the XML and write the
+ * cache anew.
+ *
+ * usage: cache
+ */
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "xamine.h"
+#include "compare.h"
+#include "protocol.h"
+
+#define MAX_PACKETS 9
+
+static int failures;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+/* A packet, and the direction it goes in. */
+struct packet {
+    enum xamine_direction direction;
+    unsigned char data[40];
+    size_t size;
+};
+
+static void
+put16(unsigned char *p, uint16_t value)
+{
+    memcpy(p, &value, sizeof(value));
+}
+
+static void
+put32(unsigned char *p, uint32_t value)
+{
+    memcpy(p, &value, sizeof(value));
+}
+
+/*
+ * Requests, events and an error of each kind of layout in protocol.h, with
+ * SHAPE at major opcode 130.
+ */
+static size_t
+make_packets(struct packet packets[MAX_PACKETS])
+{
+    struct packet *p = packets;
+
+    memset(packets, 0, MAX_PACKETS * sizeof(*packets));
+
+    /* ChangeWindowAttributes with a value for each bit of the mask. */
+    p->data[0] = 2;
+    put16(p->data + 2, 5);
+    put32(p->data + 4, 0x200001);
+    put32(p->data + 8, 3);
+    put32(p->data + 12, 0x400001);
+    put32(p->data + 16, 0xff0000);
+    p++->size = 20;
+
+    /* InternAtom of "abc". */
+    p->data[0] = 16;
+    put16(p->data + 2, 3);
+    put16(p->data + 4, 3);
+    memcpy(p->data + 8, "abc", 3);
+    p++->size = 12;
+
+    /* PolyPoint of (1, -2) and (3, 4), as a big request. */
+    p->data[0] = 64;
+    put32(p->data + 4, 6);
+    put32(p->data + 8, 0x200001);
+    put32(p->data + 12, 0x200002);
+    put16(p->data + 16, 1);
+    put16(p->data + 18, -2);
+    put16(p->data + 20, 3);
+    put16(p->data + 22, 4);
+    p++->size = 24;
+
+    /* FieldsAfterLists with the points (1, 2) and (3, 4), and the names
+     * "a", "bcd" and "". */
+    p->data[0] = 123;
+    put16(p->data + 2, 7);
+    put16(p->data + 4, 2);
+    put16(p->data + 6, 3);
+    for (int i = 0; i < 4; i++)
+        put16(p->data + 8 + 2 * i, i + 1);
+    memcpy(p->data + 16, "\001a\003bcd\000", 7);
+    put32(p->data + 23, 0x01020304);
+    p->data[27] = 5;
+    p++->size = 28;
+
+    /* DeepLength, which is walked rather than compiled. */
+    p->data[0] = 124;
+    put16(p->data + 2, 3);
+    put16(p->data + 4, 3);
+    memcpy(p->data + 8, "abc", 3);
+    p++->size = 12;
+
+    /* KeyPress, Expose, and a Value error. */
+    p->direction = XAMINE_RESPONSE;
+    p->data[0] = 2;
+    p->data[1] = 9;
+    put16(p->data + 20, 0x1234);
+    p++->size = 32;
+    p->direction = XAMINE_RESPONSE;
+    p->data[0] = 12;
+    put32(p->data + 4, 0x200001);
+    put16(p->data + 16, 3);
+    p++->size = 32;
+    p->direction = XAMINE_RESPONSE;
+    p->data[1] = 2;
+    put32(p->data + 4, 7);
+    p->data[10] = 64;
+    p++->size = 32;
+
+    /* ShapeChanged, sent in GenericEvent, with one rectangle. */
+    p->direction = XAMINE_RESPONSE;
+    p->data[0] = 35;
+    p->data[1] = 130;
+    put32(p->data + 4, 2);
+    put16(p->data + 8, 1);
+    put32(p->data + 10, 0x200001);
+    put16(p->data + 14, 1);
+    for (int i = 0; i < 4; i++)
+        put16(p->data + 32 + 2 * i, i + 1);
+    p++->size = 40;
+
+    return p - packets;
+}
+
+/* Check that two contexts decode each packet, and decode them the same. */
+static void
+check_same(struct xamine_context *a, struct xamine_context *b)
+{
+    struct packet packets[MAX_PACKETS];
+    size_t npackets = make_packets(packets);
+    struct xamine_conversation *x, *y;
+
+    x = a ? xamine_conversation_new(a, XAMINE_CONVERSATION_NO_SETUP) : NULL;
+    y = b ? xamine_conversation_new(b, XAMINE_CONVERSATION_NO_SETUP) : NULL;
+    CHECK(x && y);
+    CHECK(x && xamine_conversation_set_extension(x, "SHAPE", 130, 90, 150) == 0);
+    CHECK(y && xamine_conversation_set_extension(y, "SHAPE", 130, 90, 150) == 0);
+    for (size_t i = 0; x && y && i < npackets; i++) {
+        struct xamine_item *from_a, *from_b;
+
+        from_a = xamine_examine(x, packets[i].direction, packets[i].data, packets[i].size);
+        from_b = xamine_examine(y, packets[i].direction, packets[i].data, packets[i].size);
+        if (!from_a || !from_b || !same_tree(from_a, from_b)) {
+            fprintf(stderr, "packet %zu (code %u): decoded %d and %d, %s\n", i,
+                    packets[i].data[0], from_a != NULL, from_b != NULL,
+                    same_tree(from_a, from_b) ? "the same" : "differently");
+            failures++;
+        }
+        if (packets[i].data[0] == 35)
+            CHECK(from_a && from_a->definition &&
+                  strcmp(from_a->definition->name, "ShapeChanged") == 0);
+        xamine_item_free(from_a);
+        xamine_item_free(from_b);
+    }
+    xamine_conversation_unref(x);
+    xamine_conversation_unref(y);
+}
+
+/* Get the inode of the cache file, or 0 if there is none. */
+static ino_t
+cache_inode(const char *path)
+{
+    struct stat st;
+
+    return stat(path, &st) == 0 && st.st_size > 0 ? st.st_ino : 0;
+}
+
+/* Move the modification time of a file a second on. */
+static int
+touch(const char *path)
+{
+    struct stat st;
+    struct timespec times[2];
+
+    if (stat(path, &st) < 0)
+        return -1;
+    times[0] = st.st_atim;
+    times[1] = st.st_mtim;
+    times[1].tv_sec++;
+    return utimensat(AT_FDCWD, path, times, 0);
+}
+
+int
+main(void)
+{
+    struct xamine_context *written, *mapped, *parsed, *uncached;
+    char *dir = protocol_write();
+    char *cache, *xml;
+    ino_t inode;
+
+    if (!dir) {
+        fprintf(stderr, "failed to write the protocol description\n");
+        return EXIT_FAILURE;
+    }
+    cache = protocol_path(dir, "definitions.cache");
+    xml = protocol_path(dir, "xproto.xml");
+    if (!cache || !xml) {
+        fprintf(stderr, "out of memory\n");
+        return EXIT_FAILURE;
+    }
+
+    /* The first context parses the XML and writes the cache. */
+    CHECK(cache_inode(cache) == 0);
+    written = xamine_context_new(XAMINE_CONTEXT_NO_FLAGS);
+    inode = cache_inode(cache);
+    CHECK(written && inode != 0);
+
+    /* The next one maps it, and leaves it as it is. */
+    mapped = xamine_context_new(XAMINE_CONTEXT_NO_FLAGS);
+    CHECK(mapped && cache_inode(cache) == inode);
+    check_same(written, mapped);
+
+    /* Contexts without the cache neither read nor write it. */
+    CHECK(touch(xml) == 0);
+    uncached = xamine_context_new(XAMINE_CONTEXT_NO_CACHE);
+    CHECK(uncached && cache_inode(cache) == inode);
+    check_same(written, uncached);
+
+    /* A touched XML file leaves the cache stale, so it is written anew. */
+    parsed = xamine_context_new(XAMINE_CONTEXT_NO_FLAGS);
+    CHECK(parsed && cache_inode(cache) != inode);
+    check_same(written, parsed);
+    inode = cache_inode(cache);
+    xamine_context_unref(mapped);
+    mapped = xamine_context_new(XAMINE_CONTEXT_NO_FLAGS);
+    CHECK(mapped && cache_inode(cache) == inode);
+    check_same(written, mapped);
+
+    xamine_context_unref(written);
+    xamine_context_unref(mapped);
+    xamine_context_unref(parsed);
+    xamine_context_unref(uncached);
+    free(cache);
+    free(xml);
+    protocol_remove(dir);
+    if (failures)
+        fprintf(stderr, "%d checks failed\n", failures);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
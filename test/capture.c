@@ -0,0 +1,363 @@
+/*
+ * Decode a synthetic capture of many conversations on the description in
+ * protocol.h with xamine_decode_capture, on one thread and on several,
+ * with and without XAMINE_CAPTURE_MERGE.  Each conversation looks SHAPE up
+ * at a major opcode and event code of its own, then sends requests and
+ * gets replies and events, split into chunks at random and interleaved
+ * with the other conversations.  Every run must pass each conversation's
+ * packets in order and examine them as the first run did, and a merge must
+ * pass all of them in order of time, then of conversation.
+ *
+ * usage: capture [CONVERSATIONS [ROUNDS [THREADS]]]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "xamine.h"
+#include "protocol.h"
+
+#define SHAPE_OPCODE 128
+#define SHAPE_EVENT 64
+#define SHAPE_ERROR 128
+
+/* The bytes of a round of a conversation, and of its first packets. */
+#define ROUND_BYTES (8 + 16 + 5 * 32)
+#define QUERY_BYTES (16 + 32)
+
+/* A packet of a conversation, what it is examined as, and what it was
+ * examined as in the first run. */
+struct packet {
+    enum xamine_direction direction;
+    const unsigned char *data;
+    size_t size;
+    const char *name;       /* NULL if it cannot be examined */
+    unsigned long checksum;
+};
+
+struct conversation {
+    unsigned char *buffer;
+    size_t used;
+    struct packet *packets;
+    size_t npackets;
+    size_t seen;            /* Passed to the function in this run */
+    int failures;
+};
+
+struct capture {
+    struct conversation *conversations;
+    unsigned nconversations;
+    struct xamine_capture_chunk *chunks;
+    size_t nchunks, alloc;
+    uint64_t time;
+    bool first_run;
+    /* With a merge, the function is only called from one thread. */
+    uint64_t last_time;
+    unsigned last_conversation;
+    int out_of_order;
+};
+
+static unsigned long
+checksum(const struct xamine_item *item)
+{
+    unsigned long sum = 0;
+
+    /* The values of lists of numbers are summed, not their address. */
+    for (; item; item = item->next) {
+        unsigned long value = item->u.unsigned_value;
+
+        if (item->element_size)
+            value = 0;
+        for (size_t i = 0; i < item->count * item->element_size; i++)
+            value = value * 31 + ((const unsigned char *) item->u.array)[i];
+        sum = sum * 31 + item->offset + value + checksum(item->child);
+    }
+    return sum;
+}
+
+/* The clients send their most significant byte first. */
+static void
+put16(unsigned char *p, uint16_t value)
+{
+    p[0] = value >> 8;
+    p[1] = value;
+}
+
+/* Start a packet of size bytes of pseudo-random data in a conversation. */
+static unsigned char *
+begin_packet(struct conversation *c, enum xamine_direction direction, size_t size,
+             const char *name)
+{
+    unsigned char *p = c->buffer + c->used;
+
+    for (size_t i = 0; i < size; i++)
+        p[i] = rand();
+    c->packets[c->npackets++] = (struct packet) { direction, p, size, name, 0 };
+    c->used += size;
+    return p;
+}
+
+/* A response to request number sequence. */
+static unsigned char *
+begin_response(struct conversation *c, unsigned code, unsigned sequence, const char *name)
+{
+    unsigned char *p = begin_packet(c, XAMINE_RESPONSE, 32, name);
+
+    p[0] = code;
+    put16(p + 2, sequence);
+    if (code == 1)
+        memset(p + 4, 0, 4);    /* Reply length */
+    return p;
+}
+
+/*
+ * Add the packets of a conversation from first on to the capture, each in
+ * up to three chunks.  The time moves on by 0 or 1 with each chunk, so
+ * chunks of different conversations often have the same time.
+ */
+static void
+add_chunks(struct capture *capture, unsigned conversation, size_t first)
+{
+    const struct conversation *c = &capture->conversations[conversation];
+
+    for (size_t i = first; i < c->npackets; i++) {
+        const struct packet *packet = &c->packets[i];
+        size_t pos = 0;
+
+        while (pos < packet->size) {
+            size_t size = packet->size - pos;
+
+            if (rand() % 2)
+                size = 1 + rand() % size;
+            if (capture->nchunks == capture->alloc) {
+                capture->alloc = capture->alloc ? 2 * capture->alloc : 1024;
+                capture->chunks = realloc(capture->chunks,
+                                          capture->alloc * sizeof(*capture->chunks));
+                if (!capture->chunks) {
+                    fprintf(stderr, "out of memory\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            capture->time += rand() % 2;
+            capture->chunks[capture->nchunks++] = (struct xamine_capture_chunk) {
+                capture->time, conversation, packet->direction, packet->data + pos, size
+            };
+            pos += size;
+        }
+    }
+}
+
+/*
+ * Each conversation queries SHAPE, which is at an opcode and event code of
+ * its own, then round after round maps a window, interns an atom and gets
+ * the reply, a KeyPress, a ShapeNotify, an Expose, and an event at the
+ * code SHAPE has in the next conversation, which it does not have here.
+ * The rounds of the conversations are interleaved.
+ */
+static void
+make_capture(struct capture *capture, unsigned rounds)
+{
+    unsigned n = capture->nconversations;
+
+    for (unsigned i = 0; i < n; i++) {
+        struct conversation *c = &capture->conversations[i];
+
+        c->buffer = malloc(QUERY_BYTES + (size_t) rounds * ROUND_BYTES);
+        c->packets = calloc(2 + 7 * (size_t) rounds, sizeof(*c->packets));
+        if (!c->buffer || !c->packets) {
+            fprintf(stderr, "out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    for (unsigned r = 0; r <= rounds; r++) {
+        for (unsigned k = 0; k < n; k++) {
+            unsigned i = (k + r) % n;
+            struct conversation *c = &capture->conversations[i];
+            size_t first = c->npackets;
+            unsigned sequence = 2 * r;
+            unsigned char *p;
+
+            if (r == 0) {
+                p = begin_packet(c, XAMINE_REQUEST, 16, "QueryExtension");
+                p[0] = 98;
+                put16(p + 2, 4);
+                put16(p + 4, 5);
+                memcpy(p + 8, "SHAPE", 5);
+                p = begin_response(c, 1, 1, "QueryExtensionReply");
+                p[8] = 1;
+                p[9] = SHAPE_OPCODE + i;
+                p[10] = SHAPE_EVENT + i;
+                p[11] = SHAPE_ERROR + i;
+                add_chunks(capture, i, first);
+                continue;
+            }
+
+            p = begin_packet(c, XAMINE_REQUEST, 8, "MapWindow");
+            p[0] = 8;
+            put16(p + 2, 2);
+            p = begin_packet(c, XAMINE_REQUEST, 16, "InternAtom");
+            p[0] = 16;
+            put16(p + 2, 4);
+            put16(p + 4, 7);
+            memcpy(p + 8, "WM_NAME", 7);
+            begin_response(c, 1, sequence + 1, "InternAtomReply");
+            begin_response(c, 2, sequence + 1, "KeyPress");
+            begin_response(c, SHAPE_EVENT + i, sequence + 1, "ShapeNotify");
+            begin_response(c, 12, sequence + 1, "Expose");
+            begin_response(c, SHAPE_EVENT + (i + 1) % n, sequence + 1, NULL);
+            add_chunks(capture, i, first);
+        }
+    }
+}
+
+static void
+record(unsigned conversation, enum xamine_direction direction, uint64_t time,
+       const void *data, size_t size, const struct xamine_item *item, void *closure)
+{
+    struct capture *capture = closure;
+    struct conversation *c = &capture->conversations[conversation];
+    struct packet *packet;
+    const char *name = item && item->definition ? item->definition->name : NULL;
+
+    if (c->seen == c->npackets) {
+        c->failures++;
+        return;
+    }
+
+    /* The packets differ in their random bytes, so these only match in
+     * order. */
+    packet = &c->packets[c->seen++];
+    if (direction != packet->direction || size != packet->size ||
+        memcmp(data, packet->data, size) != 0) {
+        fprintf(stderr, "conversation %u: packet %zu out of order\n", conversation, c->seen - 1);
+        c->failures++;
+        return;
+    }
+    if (!(name == packet->name || (name && packet->name && strcmp(name, packet->name) == 0))) {
+        fprintf(stderr, "conversation %u: packet %zu is %s, expected %s\n", conversation,
+                c->seen - 1, name ? name : "(unknown)",
+                packet->name ? packet->name : "(unknown)");
+        c->failures++;
+    }
+
+    if (capture->first_run)
+        packet->checksum = checksum(item);
+    else if (checksum(item) != packet->checksum)
+        c->failures++;
+}
+
+static void
+record_merged(unsigned conversation, enum xamine_direction direction, uint64_t time,
+              const void *data, size_t size, const struct xamine_item *item, void *closure)
+{
+    struct capture *capture = closure;
+
+    if (time < capture->last_time ||
+        (time == capture->last_time && conversation < capture->last_conversation))
+        capture->out_of_order++;
+    capture->last_time = time;
+    capture->last_conversation = conversation;
+    record(conversation, direction, time, data, size, item, closure);
+}
+
+/* Decode the capture once.  Returns the number of failures. */
+static int
+run(struct xamine_context *ctx, struct capture *capture, unsigned nthreads,
+    enum xamine_capture_flags flags)
+{
+    bool merge = flags & XAMINE_CAPTURE_MERGE;
+    int failures = 0;
+
+    for (unsigned i = 0; i < capture->nconversations; i++) {
+        capture->conversations[i].seen = 0;
+        capture->conversations[i].failures = 0;
+    }
+    capture->last_time = 0;
+    capture->last_conversation = 0;
+    capture->out_of_order = 0;
+
+    if (xamine_decode_capture(ctx, capture->chunks, capture->nchunks,
+                              XAMINE_CONVERSATION_NO_SETUP | XAMINE_CONVERSATION_MSB_FIRST,
+                              nthreads, flags, merge ? record_merged : record, capture) < 0) {
+        fprintf(stderr, "failed to decode the capture\n");
+        return 1;
+    }
+    capture->first_run = false;
+
+    for (unsigned i = 0; i < capture->nconversations; i++) {
+        const struct conversation *c = &capture->conversations[i];
+
+        if (c->seen != c->npackets)
+            fprintf(stderr, "conversation %u: %zu of %zu packets\n", i, c->seen, c->npackets);
+        failures += c->failures + (c->seen != c->npackets);
+    }
+    failures += capture->out_of_order;
+
+    printf("%u threads%s: %d mismatched, %d out of order\n", nthreads,
+           merge ? ", merged" : "", failures, capture->out_of_order);
+    return failures;
+}
+
+int
+main(int argc, char *argv[])
+{
+    static const enum xamine_context_flags modes[] = {
+        XAMINE_CONTEXT_NO_FLAGS,
+        XAMINE_CONTEXT_LAZY,
+    };
+    unsigned nconversations = argc > 1 ? strtoul(argv[1], NULL, 10) : 16;
+    unsigned rounds = argc > 2 ? strtoul(argv[2], NULL, 10) : 100;
+    unsigned nthreads = argc > 3 ? strtoul(argv[3], NULL, 10) : 4;
+    struct capture capture = { 0 };
+    char *dir = protocol_write();
+    int failures = 0;
+
+    if (!dir) {
+        fprintf(stderr, "failed to write the protocol description\n");
+        return EXIT_FAILURE;
+    }
+    /* Each conversation has SHAPE at an event code of its own. */
+    if (nconversations < 2 || nconversations > 64)
+        nconversations = 16;
+    if (nthreads < 2)
+        nthreads = 2;
+
+    capture.nconversations = nconversations;
+    capture.conversations = calloc(nconversations, sizeof(*capture.conversations));
+    if (!capture.conversations) {
+        fprintf(stderr, "out of memory\n");
+        return EXIT_FAILURE;
+    }
+    srand(1);
+    make_capture(&capture, rounds);
+    capture.first_run = true;
+
+    /* A lazy context's threads race to load SHAPE. */
+    for (size_t i = 0; i < sizeof(modes) / sizeof(*modes); i++) {
+        struct xamine_context *ctx = xamine_context_new(modes[i]);
+
+        if (!ctx) {
+            fprintf(stderr, "failed to create context\n");
+            failures++;
+            continue;
+        }
+        printf("%s context:\n", modes[i] & XAMINE_CONTEXT_LAZY ? "lazy" : "cached");
+        failures += run(ctx, &capture, 1, XAMINE_CAPTURE_NO_FLAGS);
+        failures += run(ctx, &capture, nthreads, XAMINE_CAPTURE_NO_FLAGS);
+        failures += run(ctx, &capture, 1, XAMINE_CAPTURE_MERGE);
+        failures += run(ctx, &capture, nthreads, XAMINE_CAPTURE_MERGE);
+        xamine_context_unref(ctx);
+    }
+
+    for (unsigned i = 0; i < nconversations; i++) {
+        free(capture.conversations[i].buffer);
+        free(capture.conversations[i].packets);
+    }
+    free(capture.conversations);
+    free(capture.chunks);
+    protocol_remove(dir);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,45 @@
+/*
+ * Comparing the results of examining packets in different ways, for the
+ * tests and benchmarks which check that the ways agree.  Definitions are
+ * compared by name, so that results of different contexts can be compared.
+ */
+
+#ifndef COMPARE_H
+#define COMPARE_H
+
+#include <string.h>
+
+#include "xamine.h"
+
+/* Arrays hold their values apart from the item, so compare those. */
+static int
+same_value(const struct xamine_item *a, const struct xamine_item *b)
+{
+    if (a->element_size || b->element_size)
+        return a->element_size == b->element_size &&
+               a->element_type == b->element_type && a->count == b->count &&
+               memcmp(a->u.array, b->u.array, a->count * a->element_size) == 0;
+    return memcmp(&a->u, &b->u, sizeof(a->u)) == 0;
+}
+
+static int
+same_name(const char *a, const char *b)
+{
+    return a == b || (a && b && strcmp(a, b) == 0);
+}
+
+static int
+same_tree(const struct xamine_item *a, const struct xamine_item *b)
+{
+    for (; a && b; a = a->next, b = b->next) {
+        if (!same_name(a->name, b->name) ||
+            !same_name(a->definition->name, b->definition->name) ||
+            a->offset != b->offset ||
+            !same_value(a, b) ||
+            !same_tree(a->child, b->child))
+            return 0;
+    }
+    return !a && !b;
+}
+
+#endif /* COMPARE_H */
@@ -0,0 +1,220 @@
+/*
+ * Walk requests of the description in protocol.h with cursors, with every
+ * way of loading a context: fields after lists, whose offsets depend on
+ * the data, looked up in order and out of order; elements of lists of
+ * fixed and of variable size; fields and elements which are not there;
+ * packets cut short; and a request sent as a big request.
+ *
+ * usage: cursor
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "xamine.h"
+#include "protocol.h"
+
+static int failures;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+static void
+put16(unsigned char *p, uint16_t value)
+{
+    memcpy(p, &value, sizeof(value));
+}
+
+static void
+put32(unsigned char *p, uint32_t value)
+{
+    memcpy(p, &value, sizeof(value));
+}
+
+/* Get the value of a field of a cursor, or -1. */
+static long
+field_value(struct xamine_cursor *cursor, const char *name)
+{
+    struct xamine_cursor field;
+    long value;
+
+    if (xamine_cursor_field(cursor, name, &field) < 0 ||
+        xamine_cursor_value(&field, &value) < 0)
+        return -1;
+    return value;
+}
+
+/*
+ * A FieldsAfterLists request with the points (1, 2) and (3, 4), and the
+ * names "a", "bcd" and "", followed by the fields after the lists.
+ */
+static const unsigned char *
+make_fields_after_lists(void)
+{
+    static unsigned char data[28];
+
+    data[0] = 123;
+    put16(data + 2, sizeof(data) / 4);
+    put16(data + 4, 2);
+    put16(data + 6, 3);
+    for (int i = 0; i < 4; i++)
+        put16(data + 8 + 2 * i, i + 1);
+    memcpy(data + 16, "\001a\003bcd\000", 7);
+    put32(data + 23, 0x01020304);
+    data[27] = 5;
+    return data;
+}
+
+static void
+check_fields_after_lists(const struct xamine_conversation *conversation)
+{
+    const unsigned char *data = make_fields_after_lists();
+    struct xamine_cursor packet, names, name, element, field;
+    long value;
+
+    /* Straight to a field after the lists, then back to them. */
+    CHECK(xamine_cursor_init(&packet, conversation, XAMINE_REQUEST, data, 28) == 0);
+    CHECK(xamine_cursor_count(&packet) == 9);
+    CHECK(xamine_cursor_field(&packet, "after", &field) == 0 && field.offset == 23 &&
+          xamine_cursor_value(&field, &value) == 0 && value == 0x01020304);
+
+    /* The offsets measured on the way are kept, up to the field found. */
+    CHECK(packet.measured == 7 && packet.measured_offset == 23);
+    CHECK(xamine_cursor_field(&packet, "names", &names) == 0 && names.offset == 16 &&
+          names.is_list && xamine_cursor_count(&names) == 3);
+    CHECK(packet.measured == 7 && packet.measured_offset == 23);
+    CHECK(field_value(&packet, "last") == 5);
+    CHECK(packet.measured == 8 && packet.measured_offset == 27);
+
+    /* Elements of variable size, out of order. */
+    CHECK(xamine_cursor_child(&names, 2, &element) == 0 && element.offset == 22 &&
+          field_value(&element, "name_len") == 0);
+    CHECK(names.measured == 2 && names.measured_offset == 22);
+    CHECK(xamine_cursor_child(&names, 1, &element) == 0 && element.offset == 18 &&
+          xamine_cursor_field(&element, "name", &name) == 0 && name.offset == 19 &&
+          xamine_cursor_count(&name) == 3);
+    CHECK(xamine_cursor_child(&name, 2, &field) == 0 && field.offset == 21 &&
+          xamine_cursor_value(&field, &value) == 0 && value == 'd');
+    CHECK(names.measured == 2);
+
+    /* Elements of fixed size, located without measuring. */
+    CHECK(xamine_cursor_field(&packet, "points", &field) == 0 && field.offset == 8 &&
+          xamine_cursor_child(&field, 1, &element) == 0 && element.offset == 12 &&
+          field_value(&element, "y") == 4);
+
+    /* Fields and elements which are not there, and values which are not
+     * of a base type. */
+    CHECK(xamine_cursor_child(&packet, 9, &field) < 0);
+    CHECK(xamine_cursor_field(&packet, "before", &field) < 0);
+    CHECK(xamine_cursor_child(&names, 3, &element) < 0);
+    CHECK(xamine_cursor_child(&name, 3, &element) < 0);
+    CHECK(xamine_cursor_field(&names, "name", &field) < 0);
+    CHECK(xamine_cursor_value(&names, &value) < 0);
+    CHECK(xamine_cursor_child(&names, 1, &element) == 0 &&
+          xamine_cursor_value(&element, &value) < 0);
+
+    /* In order, each field once. */
+    CHECK(xamine_cursor_init(&packet, conversation, XAMINE_REQUEST, data, 28) == 0);
+    for (size_t i = 0; i < 9; i++) {
+        static const size_t offsets[] = { 0, 1, 2, 4, 6, 8, 16, 23, 27 };
+
+        CHECK(xamine_cursor_child(&packet, i, &field) == 0 && field.offset == offsets[i]);
+        CHECK(packet.measured == i && packet.measured_offset == offsets[i]);
+    }
+
+    /* Cut short in the names: the fields before them are still there. */
+    CHECK(xamine_cursor_init(&packet, conversation, XAMINE_REQUEST, data, 20) == 0);
+    CHECK(field_value(&packet, "names_len") == 3);
+    CHECK(xamine_cursor_field(&packet, "after", &field) < 0);
+    CHECK(xamine_cursor_field(&packet, "names", &names) == 0 &&
+          xamine_cursor_child(&names, 0, &element) == 0 &&
+          xamine_cursor_child(&names, 2, &element) < 0);
+
+    /* Cut short in the last field. */
+    CHECK(xamine_cursor_init(&packet, conversation, XAMINE_REQUEST, data, 27) == 0);
+    CHECK(field_value(&packet, "after") == 0x01020304);
+    CHECK(xamine_cursor_field(&packet, "last", &field) == 0 &&
+          xamine_cursor_value(&field, &value) < 0);
+}
+
+/* A PolyPoint of the points (1, -2) and (3, 4), as a big request or not. */
+static void
+check_poly_point(const struct xamine_conversation *conversation, bool big)
+{
+    unsigned char data[24];
+    size_t header = big ? 8 : 4, size = header + 16;
+    struct xamine_cursor packet, points, point;
+
+    memset(data, 0, sizeof(data));
+    data[0] = 64;
+    put16(data + 2, big ? 0 : size / 4);
+    if (big)
+        put32(data + 4, size / 4);
+    put32(data + header, 0x200001);
+    put32(data + header + 4, 0x200002);
+    put16(data + header + 8, 1);
+    put16(data + header + 10, -2);
+    put16(data + header + 12, 3);
+    put16(data + header + 14, 4);
+
+    CHECK(xamine_cursor_init(&packet, conversation, XAMINE_REQUEST, data, size) == 0);
+    CHECK(xamine_cursor_count(&packet) == (big ? 7 : 6));
+    CHECK(field_value(&packet, "big_length") == (big ? 6 : -1));
+    CHECK(field_value(&packet, "gc") == 0x200002);
+    CHECK(xamine_cursor_field(&packet, "points", &points) == 0 &&
+          points.offset == header + 8 && xamine_cursor_count(&points) == 2);
+    CHECK(xamine_cursor_child(&points, 0, &point) == 0 && field_value(&point, "y") == -2);
+    CHECK(xamine_cursor_child(&points, 1, &point) == 0 && field_value(&point, "x") == 3 &&
+          field_value(&point, "y") == 4);
+    CHECK(xamine_cursor_child(&points, 2, &point) < 0);
+
+    /* Too short to hold the length of a big request. */
+    if (big)
+        CHECK(xamine_cursor_init(&packet, conversation, XAMINE_REQUEST, data, 6) < 0);
+}
+
+int
+main(void)
+{
+    /* The first default context writes the cache, and the second reads it. */
+    static const enum xamine_context_flags modes[] = {
+        XAMINE_CONTEXT_NO_CACHE,
+        XAMINE_CONTEXT_LAZY,
+        XAMINE_CONTEXT_NO_FLAGS,
+        XAMINE_CONTEXT_NO_FLAGS,
+    };
+    char *dir = protocol_write();
+
+    if (!dir) {
+        fprintf(stderr, "failed to write the protocol description\n");
+        return EXIT_FAILURE;
+    }
+
+    for (size_t i = 0; i < sizeof(modes) / sizeof(*modes); i++) {
+        struct xamine_context *ctx = xamine_context_new(modes[i]);
+        struct xamine_conversation *conversation = NULL;
+
+        if (ctx)
+            conversation = xamine_conversation_new(ctx, XAMINE_CONVERSATION_NO_SETUP);
+        CHECK(conversation);
+        if (conversation) {
+            check_fields_after_lists(conversation);
+            check_poly_point(conversation, false);
+            check_poly_point(conversation, true);
+        }
+        xamine_conversation_unref(conversation);
+        xamine_context_unref(ctx);
+    }
+
+    protocol_remove(dir);
+    if (failures)
+        fprintf(stderr, "%d checks failed\n", failures);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
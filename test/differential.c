@@ -0,0 +1,242 @@
+/*
+ * Check that the ways of examining packets agree, as the benchmarks do
+ * before timing them, but on the description in protocol.h rather than
+ * the installed one: compiled decode programs with walking the
+ * definitions, and examining packets one at a time with examining them in
+ * a batch.  The packets are events, errors and requests of pseudo-random
+ * bytes, mostly with lengths and counts which fit, from clients of either
+ * byte order.
+ *
+ * usage: differential [PACKETS]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "xamine.h"
+#include "compare.h"
+#include "protocol.h"
+
+#define EVENT_SIZE 32
+#define REQUEST_MAX 96
+
+static int failures;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+/* The two ways of examining, each with a conversation of a byte order. */
+struct ways {
+    const struct xamine_conversation *compiled;
+    const struct xamine_conversation *walked;
+    bool is_le;
+};
+
+static void
+put(unsigned char *p, unsigned size, uint32_t value, bool is_le)
+{
+    for (unsigned i = 0; i < size; i++)
+        p[is_le ? i : size - 1 - i] = value >> (8 * i);
+}
+
+/*
+ * Pseudo-random bytes with the codes of events and errors there are and some
+ * which there are not, but never of a reply or a generic event, whose sizes
+ * differ.
+ */
+static void
+make_response(unsigned char *p, unsigned *seed)
+{
+    static const unsigned char codes[] = { 0, 2, 12 };
+
+    for (int i = 0; i < EVENT_SIZE; i++)
+        p[i] = rand_r(seed);
+    if (rand_r(seed) % 4)
+        p[0] = codes[rand_r(seed) % sizeof(codes)];
+    else if (p[0] == 1 || p[0] == 35)
+        p[0]++;
+    if (p[0] == 0 && rand_r(seed) % 2)
+        p[1] = 2;
+}
+
+/*
+ * Pseudo-random bytes with the opcode of a request, a length, and mostly
+ * counts which fit it.  A quarter are big requests.  Returns the size.
+ */
+static size_t
+make_request(unsigned char *p, bool is_le, unsigned *seed)
+{
+    static const unsigned char opcodes[] = { 2, 8, 16, 64, 98, 120, 43 };
+    bool big = rand_r(seed) % 4 == 0;
+    size_t header = big ? 8 : 4, body, count;
+    uint32_t mask;
+
+    for (int i = 0; i < REQUEST_MAX; i++)
+        p[i] = rand_r(seed);
+    p[0] = opcodes[rand_r(seed) % sizeof(opcodes)];
+    count = rand_r(seed) % 17;
+
+    switch (p[0]) {
+    case 2:
+        mask = rand_r(seed) % 4;
+        put(p + header + 4, 4, mask, is_le);
+        body = 8 + 4 * ((mask & 1) + (mask >> 1));
+        break;
+    case 16:
+    case 98:
+    case 120:
+        put(p + header, 2, count, is_le);
+        body = 4 + ((count + 3) & ~3);
+        break;
+    case 64:
+        body = 8 + 4 * count;
+        break;
+    case 8:
+        body = 4;
+        break;
+    default:
+        body = 0;
+        break;
+    }
+
+    /* Spoil some of the counts. */
+    if (rand_r(seed) % 8 == 0)
+        p[header + rand_r(seed) % 4] = rand_r(seed);
+
+    if (big) {
+        put(p + 2, 2, 0, is_le);
+        put(p + 4, 4, (header + body) / 4, is_le);
+    }
+    else
+        put(p + 2, 2, (header + body) / 4, is_le);
+    return header + body;
+}
+
+/*
+ * Examine each packet of a buffer both ways, one at a time and in a batch,
+ * and count the packets examined.
+ */
+static size_t
+check_packets(const struct ways *ways, enum xamine_direction direction,
+              const unsigned char *buffer, const size_t *sizes, size_t npackets)
+{
+    struct xamine_arena *arena = xamine_arena_new();
+    struct xamine_item **results = calloc(npackets, sizeof(*results));
+    size_t decoded = 0, offset = 0, total = 0, used = 0, examined;
+
+    CHECK(arena && results);
+    if (!arena || !results) {
+        xamine_arena_free(arena);
+        free(results);
+        return 0;
+    }
+    for (size_t i = 0; i < npackets; i++)
+        total += sizes[i];
+
+    examined = xamine_examine_batch(ways->compiled, direction, buffer, total, arena,
+                                    results, npackets, &used);
+    CHECK(examined == npackets && used == total);
+
+    for (size_t i = 0; i < npackets && i < examined; i++) {
+        struct xamine_item *compiled, *walked;
+
+        compiled = xamine_examine(ways->compiled, direction, buffer + offset, sizes[i]);
+        walked = xamine_examine(ways->walked, direction, buffer + offset, sizes[i]);
+        if (!same_tree(compiled, walked) || !same_tree(compiled, results[i])) {
+            fprintf(stderr, "%s %zu of a %s client (code %u, %zu bytes): results differ\n",
+                    direction == XAMINE_REQUEST ? "request" : "response", i,
+                    ways->is_le ? "little-endian" : "big-endian",
+                    buffer[offset], sizes[i]);
+            failures++;
+        }
+        if (compiled)
+            decoded++;
+        xamine_item_free(compiled);
+        xamine_item_free(walked);
+        offset += sizes[i];
+    }
+
+    xamine_arena_free(arena);
+    free(results);
+    return decoded;
+}
+
+static void
+check_ways(const struct ways *ways, size_t npackets, unsigned *seed)
+{
+    unsigned char *buffer = malloc(npackets * REQUEST_MAX);
+    size_t *sizes = malloc(npackets * sizeof(*sizes));
+    size_t offset = 0, decoded;
+
+    CHECK(buffer && sizes);
+    if (!buffer || !sizes) {
+        free(buffer);
+        free(sizes);
+        return;
+    }
+
+    for (size_t i = 0; i < npackets; i++) {
+        make_response(buffer + i * EVENT_SIZE, seed);
+        sizes[i] = EVENT_SIZE;
+    }
+    decoded = check_packets(ways, XAMINE_RESPONSE, buffer, sizes, npackets);
+    /* Not only packets which neither way can examine. */
+    CHECK(decoded > npackets / 4 && decoded < npackets);
+
+    for (size_t i = 0; i < npackets; i++) {
+        sizes[i] = make_request(buffer + offset, ways->is_le, seed);
+        offset += sizes[i];
+    }
+    decoded = check_packets(ways, XAMINE_REQUEST, buffer, sizes, npackets);
+    CHECK(decoded > npackets / 2 && decoded < npackets);
+
+    free(buffer);
+    free(sizes);
+}
+
+int
+main(int argc, char *argv[])
+{
+    static const enum xamine_conversation_flags orders[] = {
+        XAMINE_CONVERSATION_LSB_FIRST, XAMINE_CONVERSATION_MSB_FIRST
+    };
+    size_t npackets = argc > 1 ? strtoul(argv[1], NULL, 10) : 2000;
+    struct xamine_context *compiled, *walked;
+    unsigned seed = 1;
+    char *dir = protocol_write();
+
+    if (!dir) {
+        fprintf(stderr, "failed to write the protocol description\n");
+        return EXIT_FAILURE;
+    }
+
+    compiled = xamine_context_new(XAMINE_CONTEXT_NO_CACHE);
+    walked = xamine_context_new(XAMINE_CONTEXT_NO_CACHE | XAMINE_CONTEXT_NO_COMPILE);
+    CHECK(compiled && walked);
+    for (size_t i = 0; compiled && walked && i < sizeof(orders) / sizeof(*orders); i++) {
+        enum xamine_conversation_flags flags = XAMINE_CONVERSATION_NO_SETUP | orders[i];
+        struct xamine_conversation *a = xamine_conversation_new(compiled, flags);
+        struct xamine_conversation *b = xamine_conversation_new(walked, flags);
+        struct ways ways = { a, b, orders[i] == XAMINE_CONVERSATION_LSB_FIRST };
+
+        CHECK(a && b);
+        if (a && b)
+            check_ways(&ways, npackets, &seed);
+        xamine_conversation_unref(a);
+        xamine_conversation_unref(b);
+    }
+    xamine_context_unref(compiled);
+    xamine_context_unref(walked);
+
+    protocol_remove(dir);
+    if (failures)
+        fprintf(stderr, "%d checks failed\n", failures);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -16,9 +16,46 @@ repeat(char c, int i)
        putchar(c);
 }
 
+static void
+print_value(struct xamine_item *xamined)
+{
+    switch(xamined->definition->type) {
+    case XAMINE_BOOL:
+        printf("%s\n", xamined->u.bool_value ? "true" : "false");
+        break;
+
+    case XAMINE_CHAR:
+        printf("'%c'\n", xamined->u.char_value);
+        break;
+
+    case XAMINE_SIGNED:
+        printf("%ld\n", xamined->u.signed_value);
+        break;
+
+    case XAMINE_UNSIGNED:
+        printf("%lu\n", xamined->u.unsigned_value);
+        break;
+
+    /* TODO */
+    case XAMINE_STRUCT:
+        printf("<TODO STRUCT>\n");
+        break;
+
+    case XAMINE_UNION:
+        printf("<TODO UNION>\n");
+        break;
+
+    case XAMINE_TYPEDEF:
+        printf("<TODO TYPEDEF>\n");
+        break;
+    }
+}
+
 static void
 print_tree(struct xamine_item *xamined, int depth)
 {
+    struct xamine_item element;
+
     if (!xamined)
         return;
 
@@ -31,38 +68,18 @@ print_tree(struct xamine_item *xamined, int depth)
         repeat(' ', depth);
         printf("}\n");
     }
-    else {
-        switch(xamined->definition->type) {
-        case XAMINE_BOOL:
-            printf("%s\n", xamined->u.bool_value ? "true" : "false");
-            break;
-
-        case XAMINE_CHAR:
-            printf("'%c'\n", xamined->u.char_value);
-            break;
-
-        case XAMINE_SIGNED:
-            printf("%ld\n", xamined->u.signed_value);
-            break;
-
-        case XAMINE_UNSIGNED:
-            printf("%lu\n", xamined->u.unsigned_value);
-            break;
-
-        /* TODO */
-        case XAMINE_STRUCT:
-            printf("<TODO STRUCT>\n");
-            break;
-
-        case XAMINE_UNION:
-            printf("<TODO UNION>\n");
-            break;
-
-        case XAMINE_TYPEDEF:
-            printf("<TODO TYPEDEF>\n");
-            break;
+    else if (xamined->element_size) {
+        printf("{\n");
+        for (size_t i = 0; xamine_item_element(xamined, i, &element) == 0; i++) {
+            repeat(' ', depth + 4);
+            printf("%s [%zu] = ", element.definition->name, i);
+            print_value(&element);
         }
+        repeat(' ', depth);
+        printf("}\n");
     }
+    else
+        print_value(xamined);
 
     print_tree(xamined->next, depth);
 }
@@ -78,6 +95,7 @@ main(void)
     xcb_generic_event_t *event;
     struct xamine_context *ctx;
     struct xamine_conversation *conversation;
+    struct xamine_accessor *keycode;
 
     conn = xcb_connect(NULL, NULL);
     root = xcb_setup_roots_iterator(xcb_get_setup(conn)).data;
@@ -94,23 +112,25 @@ main(void)
 
     ctx = xamine_context_new(0);
     conversation = xamine_conversation_new(ctx, 0);
+    keycode = xamine_accessor_new(ctx, "KeyPress.detail");
 
     while ((event = xcb_wait_for_event(conn)) != NULL) {
         struct xamine_item *item = xamine_examine(conversation, XAMINE_RESPONSE, event, 32);
-        free(event);
+        long key;
+        int escape;
 
         print_tree(item, 0);
+        xamine_item_free(item);
 
         /* Exit on ESC. */
-        if (strcmp(item->definition->name, "KeyPress") == 0 &&
-            item->child->next->u.unsigned_value == 9) {
-            xamine_item_free(item);
+        escape = xamine_accessor_get(keycode, conversation, XAMINE_RESPONSE, event, 32, &key) == 0 &&
+                 key == 9;
+        free(event);
+        if (escape)
             break;
-        }
-
-        xamine_item_free(item);
     }
 
+    xamine_accessor_free(keycode);
     xamine_conversation_unref(conversation);
     xamine_context_unref(ctx);
     xcb_disconnect(conn);
@@ -0,0 +1,256 @@
+/*
+ * Test filters on packets of the description in protocol.h, with every way
+ * of loading a context: packet names and field comparisons combined with
+ * !, && and ||, parentheses around values and around conditions, the
+ * precedence of the arithmetic, fields of other packets and requests sent
+ * as big requests, and filters which are malformed or name unknown packets
+ * or fields.
+ *
+ * usage: filter
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "xamine.h"
+#include "protocol.h"
+
+static int failures;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+/* A filter, and whether it matches a PolyPoint, sent either way, and a
+ * KeyPress. */
+static const struct {
+    const char *filter;
+    bool poly_point;
+    bool key_press;
+} matches[] = {
+    { "PolyPoint", true, false },
+    { "KeyPress", false, true },
+    { "Expose", false, false },
+    { "!PolyPoint", false, true },
+    { "!!PolyPoint", true, false },
+    { "PolyPoint || KeyPress", true, true },
+    { "PolyPoint && KeyPress", false, false },
+    { "ShapeRectangles || ShapeNotify", false, false },
+    { "Expose || !KeyPress && PolyPoint", true, false },
+    { "(Expose || !KeyPress) && PolyPoint", true, false },
+    { "!(PolyPoint || Expose)", false, true },
+    { "PolyPoint.gc == 0x200002", true, false },
+    { "PolyPoint.gc != 0x200002", false, false },
+    { "PolyPoint.drawable < PolyPoint.gc", true, false },
+    { "PolyPoint.drawable <= 0x200001", true, false },
+    { "PolyPoint.drawable > 0x200001", false, false },
+    { "PolyPoint.gc >= 2097154", true, false },
+    { "PolyPoint.points[1].y == 4 && PolyPoint.points[0].x == 1", true, false },
+    { "PolyPoint.points[2].x == 0", false, false },
+    { "!(PolyPoint.points[2].x == 0)", true, true },
+    { "KeyPress.detail == 9", false, true },
+    { "KeyPress.detail == 9 || PolyPoint.gc == 0x200002", true, true },
+    { "!(KeyPress.detail == 9)", true, false },
+
+    /* A parenthesis starting a comparison, and one starting a group. */
+    { "(PolyPoint.gc + 1) == 0x200003", true, false },
+    { "(PolyPoint.gc) == 0x200002", true, false },
+    { "(PolyPoint.gc == 0x200002)", true, false },
+    { "(PolyPoint)", true, false },
+    { "((PolyPoint.gc == 0x200002) || (KeyPress))", true, true },
+    { "!((PolyPoint.gc - 2) << 1 == 0x400000)", false, true },
+
+    /* Precedence and associativity of the arithmetic. */
+    { "1 + 2 * 3 == 7", true, true },
+    { "(1 + 2) * 3 == 9", true, true },
+    { "10 - 4 - 3 == 3", true, true },
+    { "16 / 4 / 2 == 2", true, true },
+    { "1 << 2 + 1 == 8", true, true },
+    { "6 & 3 << 1 == 6", true, true },
+    { "PolyPoint.drawable & 0xff == 1", true, false },
+    { "1<<2 <= 4", true, true },
+    { "7 / 0 == 0", false, false },
+    { "!(7 / 0 == 0)", true, true },
+};
+
+/* Filters which do not compile. */
+static const char *const rejects[] = {
+    "",
+    "!",
+    "()",
+    "PolyPoint &&",
+    "&& PolyPoint",
+    "PolyPoint KeyPress",
+    "PolyPoint | KeyPress",
+    "(PolyPoint",
+    "PolyPoint)",
+    "(PolyPoint.gc == 1",
+    "(PolyPoint.gc + 1 == 1",
+    "NoSuchRequest",
+    "NoSuchRequest.gc == 1",
+    "PolyPoint.nosuch == 1",
+    "PolyPoint.points == 1",
+    "PolyPoint.gc",
+    "PolyPoint.gc ==",
+    "PolyPoint.gc === 1",
+    "PolyPoint.gc = 1",
+    "gc == 1",
+    "1 == 1 1",
+    "1 + == 1",
+    "PolyPoint.gc == 1 &&& KeyPress",
+};
+
+static void
+put16(unsigned char *p, uint16_t value)
+{
+    memcpy(p, &value, sizeof(value));
+}
+
+static void
+put32(unsigned char *p, uint32_t value)
+{
+    memcpy(p, &value, sizeof(value));
+}
+
+/* A PolyPoint of the points (1, -2) and (3, 4).  Returns its size. */
+static size_t
+make_poly_point(unsigned char *p, bool big)
+{
+    size_t header = big ? 8 : 4, size = header + 16;
+
+    memset(p, 0, size);
+    p[0] = 64;
+    put16(p + 2, big ? 0 : size / 4);
+    if (big)
+        put32(p + 4, size / 4);
+    put32(p + header, 0x200001);
+    put32(p + header + 4, 0x200002);
+    put16(p + header + 8, 1);
+    put16(p + header + 10, -2);
+    put16(p + header + 12, 3);
+    put16(p + header + 14, 4);
+    return size;
+}
+
+static void
+check_matches(struct xamine_context *ctx, const struct xamine_conversation *conversation)
+{
+    unsigned char poly_point[24], big_poly_point[24], key_press[32];
+    size_t size = make_poly_point(poly_point, false);
+    size_t big_size = make_poly_point(big_poly_point, true);
+
+    memset(key_press, 0, sizeof(key_press));
+    key_press[0] = 2;
+    key_press[1] = 9;
+
+    for (size_t i = 0; i < sizeof(matches) / sizeof(*matches); i++) {
+        struct xamine_filter *filter = xamine_filter_new(ctx, matches[i].filter);
+        bool poly_point_matched, big_matched, key_press_matched;
+
+        if (!filter) {
+            fprintf(stderr, "\"%s\" was rejected\n", matches[i].filter);
+            failures++;
+            continue;
+        }
+        poly_point_matched = xamine_filter_match(filter, conversation, XAMINE_REQUEST,
+                                                 poly_point, size);
+        big_matched = xamine_filter_match(filter, conversation, XAMINE_REQUEST,
+                                          big_poly_point, big_size);
+        key_press_matched = xamine_filter_match(filter, conversation, XAMINE_RESPONSE,
+                                                key_press, sizeof(key_press));
+        if (poly_point_matched != matches[i].poly_point ||
+            big_matched != matches[i].poly_point ||
+            key_press_matched != matches[i].key_press) {
+            fprintf(stderr, "\"%s\" matched PolyPoint %d, as a big request %d, KeyPress %d\n",
+                    matches[i].filter, poly_point_matched, big_matched, key_press_matched);
+            failures++;
+        }
+        xamine_filter_free(filter);
+    }
+}
+
+static void
+check_rejects(struct xamine_context *ctx)
+{
+    for (size_t i = 0; i < sizeof(rejects) / sizeof(*rejects); i++) {
+        struct xamine_filter *filter = xamine_filter_new(ctx, rejects[i]);
+
+        if (filter) {
+            fprintf(stderr, "\"%s\" was accepted\n", rejects[i]);
+            failures++;
+        }
+        xamine_filter_free(filter);
+    }
+}
+
+/* A conversation with a filter examines only the packets matching it. */
+static void
+check_conversation_filter(struct xamine_context *ctx,
+                          struct xamine_conversation *conversation)
+{
+    struct xamine_filter *filter = xamine_filter_new(ctx, "PolyPoint.points[1].y == 4");
+    unsigned char data[24];
+    size_t size = make_poly_point(data, true);
+    struct xamine_item *item;
+
+    CHECK(filter);
+    if (!filter)
+        return;
+    xamine_conversation_set_filter(conversation, filter);
+    item = xamine_examine(conversation, XAMINE_REQUEST, data, size);
+    CHECK(item);
+    xamine_item_free(item);
+    put16(data + 22, 5);
+    CHECK(!xamine_examine(conversation, XAMINE_REQUEST, data, size));
+    xamine_conversation_set_filter(conversation, NULL);
+    item = xamine_examine(conversation, XAMINE_REQUEST, data, size);
+    CHECK(item);
+    xamine_item_free(item);
+    xamine_filter_free(filter);
+}
+
+int
+main(void)
+{
+    /* The first default context writes the cache, and the second reads it. */
+    static const enum xamine_context_flags modes[] = {
+        XAMINE_CONTEXT_NO_CACHE,
+        XAMINE_CONTEXT_NO_CACHE | XAMINE_CONTEXT_NO_COMPILE,
+        XAMINE_CONTEXT_LAZY,
+        XAMINE_CONTEXT_NO_FLAGS,
+        XAMINE_CONTEXT_NO_FLAGS,
+    };
+    char *dir = protocol_write();
+
+    if (!dir) {
+        fprintf(stderr, "failed to write the protocol description\n");
+        return EXIT_FAILURE;
+    }
+
+    for (size_t i = 0; i < sizeof(modes) / sizeof(*modes); i++) {
+        struct xamine_context *ctx = xamine_context_new(modes[i]);
+        struct xamine_conversation *conversation = NULL;
+
+        if (ctx)
+            conversation = xamine_conversation_new(ctx, XAMINE_CONVERSATION_NO_SETUP);
+        CHECK(conversation);
+        if (conversation) {
+            check_matches(ctx, conversation);
+            check_rejects(ctx);
+            check_conversation_filter(ctx, conversation);
+        }
+        xamine_conversation_unref(conversation);
+        xamine_context_unref(ctx);
+    }
+
+    protocol_remove(dir);
+    if (failures)
+        fprintf(stderr, "%d checks failed\n", failures);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
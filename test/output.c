@@ -0,0 +1,308 @@
+/*
+ * Write packets of the description in protocol.h as JSON and CBOR, and
+ * compare the output with the bytes expected: negative values, strings
+ * which need escaping, lists of structs and of values, and packets which
+ * fail partway, which must leave the buffer as it was, and fields added in
+ * front of a packet's own.  Compiled contexts
+ * write from their programs and the others from items, so both ways are
+ * checked.
+ *
+ * usage: output
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "xamine.h"
+#include "protocol.h"
+
+static int failures;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+/* A packet, and what it is written as: JSON, and CBOR in hex. */
+struct expected {
+    const char *what;
+    enum xamine_direction direction;
+    unsigned char data[32];
+    size_t size;
+    const char *json;
+    const char *cbor;
+};
+
+/* The conversations are of little-endian clients. */
+static const struct expected packets[] = {
+    {
+        "KeyPress", XAMINE_RESPONSE,
+        { 2, 38, 1, 0, 0x10, 0, 0, 0, 0x01, 0, 0x20, 0, 0x02, 0, 0x20, 0,
+          0, 0, 0, 0, 0xfb, 0xff, 7, 0, 0xd4, 0xfe, 0, 0, 1, 1, 1, 0 }, 32,
+        "{\"packet\":\"KeyPress\",\"response_type\":2,\"detail\":38,\"sequence\":1,"
+        "\"time\":16,\"root\":2097153,\"event\":2097154,\"child\":0,"
+        "\"root_x\":-5,\"root_y\":7,\"event_x\":-300,\"event_y\":0,"
+        "\"state\":257,\"same_screen\":true}\n",
+        "ae"
+        "667061636b6574684b65795072657373"
+        "6d726573706f6e73655f7479706502"
+        "6664657461696c1826"
+        "6873657175656e636501"
+        "6474696d6510"
+        "64726f6f741a00200001"
+        "656576656e741a00200002"
+        "656368696c6400"
+        "66726f6f745f7824"
+        "66726f6f745f7907"
+        "676576656e745f7839012b"
+        "676576656e745f7900"
+        "657374617465190101"
+        "6b73616d655f73637265656ef5"
+    },
+    {
+        "InternAtom", XAMINE_REQUEST,
+        { 16, 0, 4, 0, 5, 0, 0, 0, 'a', '"', '\\', 0x01, 0xe9, 0, 0, 0 }, 16,
+        "{\"packet\":\"InternAtom\",\"major_opcode\":16,\"only_if_exists\":false,"
+        "\"length\":4,\"name_len\":5,\"name\":\"a\\\"\\\\\\u0001\xc3\xa9\"}\n",
+        "a6"
+        "667061636b65746a496e7465726e41746f6d"
+        "6c6d616a6f725f6f70636f646510"
+        "6e6f6e6c795f69665f657869737473f4"
+        "666c656e67746804"
+        "686e616d655f6c656e05"
+        "646e616d656661225c01c3a9"
+    },
+    {
+        "PolyPoint", XAMINE_REQUEST,
+        { 64, 1, 5, 0, 0x01, 0, 0x20, 0, 0x02, 0, 0x20, 0,
+          1, 0, 0xfe, 0xff, 3, 0, 4, 0 }, 20,
+        "{\"packet\":\"PolyPoint\",\"major_opcode\":64,\"coordinate_mode\":1,"
+        "\"length\":5,\"drawable\":2097153,\"gc\":2097154,"
+        "\"points\":[{\"x\":1,\"y\":-2},{\"x\":3,\"y\":4}]}\n",
+        "a7"
+        "667061636b657469506f6c79506f696e74"
+        "6c6d616a6f725f6f70636f64651840"
+        "6f636f6f7264696e6174655f6d6f646501"
+        "666c656e67746805"
+        "686472617761626c651a00200001"
+        "6267631a00200002"
+        "66706f696e747382a2617801617921a2617803617904"
+    },
+    {
+        "big PolyPoint", XAMINE_REQUEST,
+        { 64, 1, 0, 0, 6, 0, 0, 0, 0x01, 0, 0x20, 0, 0x02, 0, 0x20, 0,
+          1, 0, 0xfe, 0xff, 3, 0, 4, 0 }, 24,
+        "{\"packet\":\"PolyPoint\",\"major_opcode\":64,\"coordinate_mode\":1,"
+        "\"length\":0,\"big_length\":6,\"drawable\":2097153,\"gc\":2097154,"
+        "\"points\":[{\"x\":1,\"y\":-2},{\"x\":3,\"y\":4}]}\n",
+        "a8"
+        "667061636b657469506f6c79506f696e74"
+        "6c6d616a6f725f6f70636f64651840"
+        "6f636f6f7264696e6174655f6d6f646501"
+        "666c656e67746800"
+        "6a6269675f6c656e67746806"
+        "686472617761626c651a00200001"
+        "6267631a00200002"
+        "66706f696e747382a2617801617921a2617803617904"
+    },
+    {
+        "ChangeWindowAttributes", XAMINE_REQUEST,
+        { 2, 0, 5, 0, 0x01, 0, 0x20, 0, 3, 0, 0, 0,
+          0x01, 0, 0x40, 0, 0, 0, 0xff, 0 }, 20,
+        "{\"packet\":\"ChangeWindowAttributes\",\"major_opcode\":2,\"length\":5,"
+        "\"window\":2097153,\"value_mask\":3,\"value_list\":[4194305,16711680]}\n",
+        "a6"
+        "667061636b6574764368616e676557696e646f7741747472696275746573"
+        "6c6d616a6f725f6f70636f646502"
+        "666c656e67746805"
+        "6677696e646f771a00200001"
+        "6a76616c75655f6d61736b03"
+        "6a76616c75655f6c697374821a004000011a00ff0000"
+    },
+    {
+        "TrailingAlign", XAMINE_REQUEST,
+        { 120, 0, 3, 0, 3, 0, 0, 0, 'a', 'b', 'c', 0 }, 12,
+        "{\"packet\":\"TrailingAlign\",\"major_opcode\":120,\"length\":3,\"len\":3,"
+        "\"bytes\":[97,98,99]}\n",
+        "a5"
+        "667061636b65746d547261696c696e67416c69676e"
+        "6c6d616a6f725f6f70636f64651878"
+        "666c656e67746803"
+        "636c656e03"
+        "65627974657343616263"
+    },
+};
+
+static char *
+to_hex(const unsigned char *data, size_t size)
+{
+    static const char digits[] = "0123456789abcdef";
+    char *hex = malloc(2 * size + 1);
+
+    if (!hex)
+        return NULL;
+    for (size_t i = 0; i < size; i++) {
+        hex[2 * i] = digits[data[i] >> 4];
+        hex[2 * i + 1] = digits[data[i] & 0xf];
+    }
+    hex[2 * size] = '\0';
+    return hex;
+}
+
+static bool
+same_output(const struct xamine_buffer *buffer, enum xamine_format format,
+            const char *expected)
+{
+    char *got;
+    bool same;
+
+    if (format == XAMINE_FORMAT_JSON)
+        return buffer->size == strlen(expected) &&
+               memcmp(buffer->data, expected, buffer->size) == 0;
+    got = to_hex(buffer->data, buffer->size);
+    same = got && strcmp(got, expected) == 0;
+    free(got);
+    return same;
+}
+
+static void
+check_packet(const struct xamine_conversation *conversation,
+             const struct expected *packet, enum xamine_format format)
+{
+    const char *expected = format == XAMINE_FORMAT_JSON ? packet->json : packet->cbor;
+    struct xamine_buffer buffer = { 0 };
+    struct xamine_item *item;
+
+    if (xamine_write(conversation, packet->direction, packet->data, packet->size,
+                     format, &buffer) < 0 ||
+        !same_output(&buffer, format, expected)) {
+        fprintf(stderr, "%s written as %s is not as expected\n", packet->what,
+                format == XAMINE_FORMAT_JSON ? "JSON" : "CBOR");
+        failures++;
+    }
+
+    /* Writing the items gives the same. */
+    buffer.size = 0;
+    item = xamine_examine(conversation, packet->direction, packet->data, packet->size);
+    CHECK(item && xamine_write_item(item, format, &buffer) == 0 &&
+          same_output(&buffer, format, expected));
+    xamine_item_free(item);
+    free(buffer.data);
+}
+
+/* The InternAtom, with a number and a string which needs escaping first. */
+static void
+check_fields(const struct xamine_conversation *conversation, enum xamine_format format)
+{
+    static const struct xamine_field fields[] = {
+        { .name = "client", .number = 7 },
+        { .name = "direction", .text = "r\xe9q\"" },
+    };
+    static const char json[] =
+        "{\"client\":7,\"direction\":\"r\xc3\xa9q\\\"\",\"packet\":\"InternAtom\","
+        "\"major_opcode\":16,\"only_if_exists\":false,\"length\":4,\"name_len\":5,"
+        "\"name\":\"a\\\"\\\\\\u0001\xc3\xa9\"}\n";
+    static const char cbor[] =
+        "a8"
+        "66636c69656e7407"
+        "69646972656374696f6e6572c3a97122"
+        "667061636b65746a496e7465726e41746f6d"
+        "6c6d616a6f725f6f70636f646510"
+        "6e6f6e6c795f69665f657869737473f4"
+        "666c656e67746804"
+        "686e616d655f6c656e05"
+        "646e616d656661225c01c3a9";
+    const struct expected *packet = &packets[1];
+    struct xamine_buffer buffer = { 0 };
+
+    CHECK(xamine_write_fields(conversation, packet->direction, packet->data, packet->size,
+                              fields, sizeof(fields) / sizeof(*fields), format, &buffer) == 0 &&
+          same_output(&buffer, format, format == XAMINE_FORMAT_JSON ? json : cbor));
+    free(buffer.data);
+}
+
+/*
+ * An InternAtom whose name runs past its end fails after its header is
+ * written, which must be taken back out of the buffer.
+ */
+static void
+check_rollback(const struct xamine_conversation *conversation, enum xamine_format format)
+{
+    const struct expected *before = &packets[0];
+    unsigned char data[16];
+    struct xamine_buffer buffer = { 0 };
+    unsigned char *copy;
+    size_t size;
+
+    memcpy(data, packets[1].data, sizeof(data));
+    data[4] = 20;
+
+    CHECK(xamine_write(conversation, before->direction, before->data, before->size,
+                       format, &buffer) == 0);
+    size = buffer.size;
+    copy = malloc(size);
+    if (!copy) {
+        free(buffer.data);
+        return;
+    }
+    memcpy(copy, buffer.data, size);
+
+    CHECK(xamine_write(conversation, XAMINE_REQUEST, data, sizeof(data), format, &buffer) < 0);
+    CHECK(buffer.size == size && memcmp(buffer.data, copy, size) == 0);
+
+    /* An event cut short in the middle of a field. */
+    CHECK(xamine_write(conversation, XAMINE_RESPONSE, before->data, 23, format, &buffer) < 0);
+    CHECK(buffer.size == size && memcmp(buffer.data, copy, size) == 0);
+
+    /* And the buffer can still be written to. */
+    CHECK(xamine_write(conversation, XAMINE_REQUEST, packets[1].data, packets[1].size,
+                       format, &buffer) == 0 && buffer.size > size);
+    free(copy);
+    free(buffer.data);
+}
+
+int
+main(void)
+{
+    static const enum xamine_context_flags modes[] = {
+        XAMINE_CONTEXT_NO_CACHE,
+        XAMINE_CONTEXT_NO_CACHE | XAMINE_CONTEXT_NO_COMPILE,
+    };
+    static const enum xamine_format formats[] = { XAMINE_FORMAT_JSON, XAMINE_FORMAT_CBOR };
+    char *dir = protocol_write();
+
+    if (!dir) {
+        fprintf(stderr, "failed to write the protocol description\n");
+        return EXIT_FAILURE;
+    }
+
+    for (size_t i = 0; i < sizeof(modes) / sizeof(*modes); i++) {
+        struct xamine_context *ctx = xamine_context_new(modes[i]);
+        struct xamine_conversation *conversation;
+
+        CHECK(ctx);
+        if (!ctx)
+            continue;
+        conversation = xamine_conversation_new(ctx, XAMINE_CONVERSATION_NO_SETUP |
+                                                    XAMINE_CONVERSATION_LSB_FIRST);
+        CHECK(conversation);
+        for (size_t j = 0; conversation && j < sizeof(formats) / sizeof(*formats); j++) {
+            for (size_t k = 0; k < sizeof(packets) / sizeof(*packets); k++)
+                check_packet(conversation, &packets[k], formats[j]);
+            check_fields(conversation, formats[j]);
+            check_rollback(conversation, formats[j]);
+        }
+        xamine_conversation_unref(conversation);
+        xamine_context_unref(ctx);
+    }
+
+    protocol_remove(dir);
+    if (failures)
+        fprintf(stderr, "%d checks failed\n", failures);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,333 @@
+/*
+ * A small description of the core protocol and the SHAPE extension for the
+ * tests, so that they do not depend on the XML-XCB files installed.
+ * protocol_write writes it to a new temporary directory and points
+ * XAMINE_PATH at it, and XAMINE_CACHE at a cache file there.
+ */
+
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static const char protocol_xproto[] =
+    "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+    "<xcb header=\"xproto\">\n"
+    "  <xidtype name=\"WINDOW\" />\n"
+    "  <xidtype name=\"PIXMAP\" />\n"
+    "  <xidtype name=\"GCONTEXT\" />\n"
+    "  <xidtype name=\"ATOM\" />\n"
+    "  <xidunion name=\"DRAWABLE\">\n"
+    "    <type>WINDOW</type>\n"
+    "    <type>PIXMAP</type>\n"
+    "  </xidunion>\n"
+    "  <typedef oldname=\"CARD32\" newname=\"TIMESTAMP\" />\n"
+    "  <typedef oldname=\"CARD8\" newname=\"KEYCODE\" />\n"
+    "  <struct name=\"POINT\">\n"
+    "    <field type=\"INT16\" name=\"x\" />\n"
+    "    <field type=\"INT16\" name=\"y\" />\n"
+    "  </struct>\n"
+    "  <struct name=\"RECTANGLE\">\n"
+    "    <field type=\"INT16\" name=\"x\" />\n"
+    "    <field type=\"INT16\" name=\"y\" />\n"
+    "    <field type=\"CARD16\" name=\"width\" />\n"
+    "    <field type=\"CARD16\" name=\"height\" />\n"
+    "  </struct>\n"
+    "  <struct name=\"STR\">\n"
+    "    <field type=\"CARD8\" name=\"name_len\" />\n"
+    "    <list type=\"char\" name=\"name\">\n"
+    "      <fieldref>name_len</fieldref>\n"
+    "    </list>\n"
+    "  </struct>\n"
+    "  <event name=\"KeyPress\" number=\"2\">\n"
+    "    <field type=\"KEYCODE\" name=\"detail\" />\n"
+    "    <field type=\"TIMESTAMP\" name=\"time\" />\n"
+    "    <field type=\"WINDOW\" name=\"root\" />\n"
+    "    <field type=\"WINDOW\" name=\"event\" />\n"
+    "    <field type=\"WINDOW\" name=\"child\" />\n"
+    "    <field type=\"INT16\" name=\"root_x\" />\n"
+    "    <field type=\"INT16\" name=\"root_y\" />\n"
+    "    <field type=\"INT16\" name=\"event_x\" />\n"
+    "    <field type=\"INT16\" name=\"event_y\" />\n"
+    "    <field type=\"CARD16\" name=\"state\" />\n"
+    "    <field type=\"BOOL\" name=\"same_screen\" />\n"
+    "    <pad bytes=\"1\" />\n"
+    "  </event>\n"
+    "  <event name=\"Expose\" number=\"12\">\n"
+    "    <pad bytes=\"1\" />\n"
+    "    <field type=\"WINDOW\" name=\"window\" />\n"
+    "    <field type=\"CARD16\" name=\"x\" />\n"
+    "    <field type=\"CARD16\" name=\"y\" />\n"
+    "    <field type=\"CARD16\" name=\"width\" />\n"
+    "    <field type=\"CARD16\" name=\"height\" />\n"
+    "    <field type=\"CARD16\" name=\"count\" />\n"
+    "    <pad bytes=\"2\" />\n"
+    "  </event>\n"
+    "  <event name=\"GeGeneric\" number=\"35\" xge=\"true\">\n"
+    "    <pad bytes=\"22\" />\n"
+    "  </event>\n"
+    "  <error name=\"Value\" number=\"2\">\n"
+    "    <field type=\"CARD32\" name=\"bad_value\" />\n"
+    "    <field type=\"CARD16\" name=\"minor_opcode\" />\n"
+    "    <field type=\"CARD8\" name=\"major_opcode\" />\n"
+    "    <pad bytes=\"1\" />\n"
+    "  </error>\n"
+    "  <request name=\"ChangeWindowAttributes\" opcode=\"2\">\n"
+    "    <pad bytes=\"1\" />\n"
+    "    <field type=\"WINDOW\" name=\"window\" />\n"
+    "    <field type=\"CARD32\" name=\"value_mask\" />\n"
+    "    <switch name=\"value_list\">\n"
+    "      <fieldref>value_mask</fieldref>\n"
+    "      <bitcase>\n"
+    "        <enumref ref=\"CW\">BackPixmap</enumref>\n"
+    "        <field type=\"PIXMAP\" name=\"background_pixmap\" />\n"
+    "      </bitcase>\n"
+    "      <bitcase>\n"
+    "        <enumref ref=\"CW\">BackPixel</enumref>\n"
+    "        <field type=\"CARD32\" name=\"background_pixel\" />\n"
+    "      </bitcase>\n"
+    "    </switch>\n"
+    "  </request>\n"
+    "  <request name=\"MapWindow\" opcode=\"8\">\n"
+    "    <pad bytes=\"1\" />\n"
+    "    <field type=\"WINDOW\" name=\"window\" />\n"
+    "  </request>\n"
+    "  <request name=\"InternAtom\" opcode=\"16\">\n"
+    "    <field type=\"BOOL\" name=\"only_if_exists\" />\n"
+    "    <field type=\"CARD16\" name=\"name_len\" />\n"
+    "    <pad bytes=\"2\" />\n"
+    "    <list type=\"char\" name=\"name\">\n"
+    "      <fieldref>name_len</fieldref>\n"
+    "    </list>\n"
+    "    <reply>\n"
+    "      <pad bytes=\"1\" />\n"
+    "      <field type=\"ATOM\" name=\"atom\" />\n"
+    "    </reply>\n"
+    "  </request>\n"
+    "  <request name=\"GetInputFocus\" opcode=\"43\">\n"
+    "    <reply>\n"
+    "      <field type=\"BYTE\" name=\"revert_to\" />\n"
+    "      <field type=\"WINDOW\" name=\"focus\" />\n"
+    "    </reply>\n"
+    "  </request>\n"
+    "  <request name=\"PolyPoint\" opcode=\"64\">\n"
+    "    <field type=\"BYTE\" name=\"coordinate_mode\" />\n"
+    "    <field type=\"DRAWABLE\" name=\"drawable\" />\n"
+    "    <field type=\"GCONTEXT\" name=\"gc\" />\n"
+    "    <list type=\"POINT\" name=\"points\" />\n"
+    "  </request>\n"
+    "  <request name=\"QueryExtension\" opcode=\"98\">\n"
+    "    <pad bytes=\"1\" />\n"
+    "    <field type=\"CARD16\" name=\"name_len\" />\n"
+    "    <pad bytes=\"2\" />\n"
+    "    <list type=\"char\" name=\"name\">\n"
+    "      <fieldref>name_len</fieldref>\n"
+    "    </list>\n"
+    "    <reply>\n"
+    "      <pad bytes=\"1\" />\n"
+    "      <field type=\"BOOL\" name=\"present\" />\n"
+    "      <field type=\"CARD8\" name=\"major_opcode\" />\n"
+    "      <field type=\"CARD8\" name=\"first_event\" />\n"
+    "      <field type=\"CARD8\" name=\"first_error\" />\n"
+    "    </reply>\n"
+    "  </request>\n"
+    /* Not in the protocol: layouts xamine accepts only in some places, and
+     * fields whose offsets depend on the lists before them. */
+    "  <request name=\"TrailingAlign\" opcode=\"120\">\n"
+    "    <pad bytes=\"1\" />\n"
+    "    <field type=\"CARD16\" name=\"len\" />\n"
+    "    <pad bytes=\"2\" />\n"
+    "    <list type=\"CARD8\" name=\"bytes\">\n"
+    "      <fieldref>len</fieldref>\n"
+    "    </list>\n"
+    "    <pad align=\"4\" />\n"
+    "  </request>\n"
+    "  <request name=\"InnerAlign\" opcode=\"121\">\n"
+    "    <pad bytes=\"1\" />\n"
+    "    <field type=\"CARD16\" name=\"len\" />\n"
+    "    <pad bytes=\"2\" />\n"
+    "    <list type=\"CARD8\" name=\"bytes\">\n"
+    "      <fieldref>len</fieldref>\n"
+    "    </list>\n"
+    "    <pad align=\"4\" />\n"
+    "    <field type=\"CARD32\" name=\"after\" />\n"
+    "  </request>\n"
+    "  <request name=\"CaseSwitch\" opcode=\"122\">\n"
+    "    <pad bytes=\"1\" />\n"
+    "    <field type=\"CARD32\" name=\"kind\" />\n"
+    "    <switch name=\"data\">\n"
+    "      <fieldref>kind</fieldref>\n"
+    "      <case>\n"
+    "        <enumref ref=\"Kind\">Short</enumref>\n"
+    "        <field type=\"CARD16\" name=\"value\" />\n"
+    "      </case>\n"
+    "    </switch>\n"
+    "  </request>\n"
+    "  <request name=\"FieldsAfterLists\" opcode=\"123\">\n"
+    "    <pad bytes=\"1\" />\n"
+    "    <field type=\"CARD16\" name=\"points_len\" />\n"
+    "    <field type=\"CARD16\" name=\"names_len\" />\n"
+    "    <list type=\"POINT\" name=\"points\">\n"
+    "      <fieldref>points_len</fieldref>\n"
+    "    </list>\n"
+    "    <list type=\"STR\" name=\"names\">\n"
+    "      <fieldref>names_len</fieldref>\n"
+    "    </list>\n"
+    "    <field type=\"CARD32\" name=\"after\" />\n"
+    "    <field type=\"CARD8\" name=\"last\" />\n"
+    "  </request>\n"
+    /* A length too deep for the operand stack of a decode program, so the
+     * request is decoded by walking its definition. */
+    "  <request name=\"DeepLength\" opcode=\"124\">\n"
+    "    <pad bytes=\"1\" />\n"
+    "    <field type=\"CARD16\" name=\"len\" />\n"
+    "    <pad bytes=\"2\" />\n"
+    "    <list type=\"CARD8\" name=\"bytes\">\n"
+    "      <op op=\"+\"><value>0</value>\n"
+    "      <op op=\"+\"><value>0</value>\n"
+    "      <op op=\"+\"><value>0</value>\n"
+    "      <op op=\"+\"><value>0</value>\n"
+    "      <op op=\"+\"><value>0</value>\n"
+    "      <op op=\"+\"><value>0</value>\n"
+    "      <op op=\"+\"><value>0</value>\n"
+    "      <op op=\"+\"><value>0</value>\n"
+    "      <op op=\"+\"><value>0</value>\n"
+    "      <op op=\"+\"><value>0</value>\n"
+    "      <op op=\"+\"><value>0</value>\n"
+    "      <op op=\"+\"><value>0</value>\n"
+    "      <op op=\"+\"><value>0</value>\n"
+    "      <op op=\"+\"><value>0</value>\n"
+    "      <op op=\"+\"><value>0</value>\n"
+    "      <op op=\"+\"><value>0</value>\n"
+    "      <op op=\"+\"><value>0</value>\n"
+    "      <fieldref>len</fieldref>\n"
+    "      </op></op></op></op></op></op>\n"
+    "      </op></op></op></op></op></op>\n"
+    "      </op></op></op></op></op>\n"
+    "    </list>\n"
+    "  </request>\n"
+    "</xcb>\n";
+
+static const char protocol_shape[] =
+    "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+    "<xcb header=\"shape\" extension-xname=\"SHAPE\" extension-name=\"Shape\"\n"
+    "    major-version=\"1\" minor-version=\"1\">\n"
+    "  <import>xproto</import>\n"
+    "  <typedef oldname=\"CARD8\" newname=\"OP\" />\n"
+    "  <typedef oldname=\"CARD8\" newname=\"KIND\" />\n"
+    "  <event name=\"Notify\" number=\"0\">\n"
+    "    <field type=\"KIND\" name=\"shape_kind\" />\n"
+    "    <field type=\"xproto:WINDOW\" name=\"affected_window\" />\n"
+    "    <field type=\"INT16\" name=\"extents_x\" />\n"
+    "    <field type=\"INT16\" name=\"extents_y\" />\n"
+    "    <field type=\"CARD16\" name=\"extents_width\" />\n"
+    "    <field type=\"CARD16\" name=\"extents_height\" />\n"
+    "    <field type=\"TIMESTAMP\" name=\"server_time\" />\n"
+    "    <field type=\"BOOL\" name=\"shaped\" />\n"
+    "    <pad bytes=\"11\" />\n"
+    "  </event>\n"
+    "  <event name=\"Changed\" number=\"1\" xge=\"true\">\n"
+    "    <field type=\"xproto:WINDOW\" name=\"window\" />\n"
+    "    <field type=\"CARD16\" name=\"rectangles_len\" />\n"
+    "    <pad bytes=\"16\" />\n"
+    "    <list type=\"RECTANGLE\" name=\"rectangles\">\n"
+    "      <fieldref>rectangles_len</fieldref>\n"
+    "    </list>\n"
+    "  </event>\n"
+    "  <eventcopy name=\"Copied\" number=\"2\" ref=\"Changed\" />\n"
+    "  <request name=\"QueryVersion\" opcode=\"0\">\n"
+    "    <reply>\n"
+    "      <pad bytes=\"1\" />\n"
+    "      <field type=\"CARD16\" name=\"major_version\" />\n"
+    "      <field type=\"CARD16\" name=\"minor_version\" />\n"
+    "    </reply>\n"
+    "  </request>\n"
+    "  <request name=\"Rectangles\" opcode=\"1\">\n"
+    "    <field type=\"OP\" name=\"operation\" />\n"
+    "    <field type=\"KIND\" name=\"destination_kind\" />\n"
+    "    <field type=\"BYTE\" name=\"ordering\" />\n"
+    "    <pad bytes=\"1\" />\n"
+    "    <field type=\"WINDOW\" name=\"destination_window\" />\n"
+    "    <field type=\"INT16\" name=\"x_offset\" />\n"
+    "    <field type=\"INT16\" name=\"y_offset\" />\n"
+    "    <list type=\"RECTANGLE\" name=\"rectangles\" />\n"
+    "  </request>\n"
+    "</xcb>\n";
+
+static const char *const protocol_files[][2] = {
+    { "xproto.xml", protocol_xproto },
+    { "shape.xml", protocol_shape },
+};
+
+static char *
+protocol_path(const char *dir, const char *name)
+{
+    char *path = malloc(strlen(dir) + strlen(name) + 2);
+
+    if (path)
+        sprintf(path, "%s/%s", dir, name);
+    return path;
+}
+
+/* Remove the directory written by protocol_write, and free its name. */
+static void
+protocol_remove(char *dir)
+{
+    static const char *const names[] = { "xproto.xml", "shape.xml", "definitions.cache" };
+
+    if (!dir)
+        return;
+    for (size_t i = 0; i < sizeof(names) / sizeof(*names); i++) {
+        char *path = protocol_path(dir, names[i]);
+        if (path)
+            unlink(path);
+        free(path);
+    }
+    rmdir(dir);
+    free(dir);
+}
+
+/*
+ * Write the description to a new temporary directory, and use it for the
+ * contexts created from now on.  Returns the directory, or NULL on failure.
+ */
+static char *
+protocol_write(void)
+{
+    const char *tmp = getenv("TMPDIR");
+    char *dir, *cache;
+
+    dir = protocol_path(tmp && *tmp ? tmp : "/tmp", "xamine-test-XXXXXX");
+    if (!dir || !mkdtemp(dir)) {
+        free(dir);
+        return NULL;
+    }
+    for (size_t i = 0; i < sizeof(protocol_files) / sizeof(*protocol_files); i++) {
+        char *path = protocol_path(dir, protocol_files[i][0]);
+        FILE *file = path ? fopen(path, "w") : NULL;
+        bool ok = file && fputs(protocol_files[i][1], file) >= 0;
+
+        if (file && fclose(file) != 0)
+            ok = false;
+        free(path);
+        if (!ok) {
+            protocol_remove(dir);
+            return NULL;
+        }
+    }
+
+    cache = protocol_path(dir, "definitions.cache");
+    if (!cache || setenv("XAMINE_PATH", dir, 1) < 0 || setenv("XAMINE_CACHE", cache, 1) < 0) {
+        free(cache);
+        protocol_remove(dir);
+        return NULL;
+    }
+    free(cache);
+    return dir;
+}
+
+#endif /* PROTOCOL_H */
@@ -0,0 +1,339 @@
+/*
+ * Run xamine-proxy between a client and a fake server, both played by this
+ * test over local display sockets, and check that the bytes of both
+ * directions are passed on unchanged and that the proxy writes the packets
+ * with the client and the direction in front, as JSON and as CBOR.  The
+ * packets are of the description in protocol.h.  Skipped where the display
+ * sockets cannot be made.
+ *
+ * usage: proxy [XAMINE-PROXY]
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "protocol.h"
+
+#define X_SOCKET_DIR "/tmp/.X11-unix"
+
+static int failures;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+/* The client's setup and requests: MapWindow and GetInputFocus. */
+static const unsigned char client_bytes[] = {
+    'l', 0, 11, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    8, 0, 2, 0, 0x01, 0, 0x40, 0,
+    43, 0, 1, 0,
+};
+
+/* The server's setup, the reply to GetInputFocus and an Expose. */
+static const unsigned char server_bytes[8 + 32 + 32] = {
+    1, 0, 11, 0, 0, 0, 0, 0,
+    1, 1, 2, 0, 0, 0, 0, 0, 0x01, 0, 0x40, 0, [40] =
+    12, 0, 2, 0, 0x01, 0, 0x40, 0, 1, 0, 2, 0, 3, 0, 4, 0, 0, 0,
+};
+
+static const char expected_json[] =
+    "{\"client\":1,\"direction\":\"request\",\"packet\":\"MapWindow\","
+    "\"major_opcode\":8,\"length\":2,\"window\":4194305}\n"
+    "{\"client\":1,\"direction\":\"request\",\"packet\":\"GetInputFocus\","
+    "\"major_opcode\":43,\"length\":1}\n"
+    "{\"client\":1,\"direction\":\"response\",\"packet\":\"GetInputFocusReply\","
+    "\"response_type\":1,\"revert_to\":1,\"sequence\":2,\"length\":0,\"focus\":4194305}\n"
+    "{\"client\":1,\"direction\":\"response\",\"packet\":\"Expose\","
+    "\"response_type\":12,\"sequence\":2,\"window\":4194305,"
+    "\"x\":1,\"y\":2,\"width\":3,\"height\":4,\"count\":0}\n";
+
+/* The same in CBOR, in hex. */
+static const char expected_cbor[] =
+    "a6" "66636c69656e7401" "69646972656374696f6e6772657175657374"
+    "667061636b6574694d617057696e646f77" "6c6d616a6f725f6f70636f646508"
+    "666c656e67746802" "6677696e646f771a00400001"
+    "a5" "66636c69656e7401" "69646972656374696f6e6772657175657374"
+    "667061636b65746d476574496e707574466f637573" "6c6d616a6f725f6f70636f6465182b"
+    "666c656e67746801"
+    "a8" "66636c69656e7401" "69646972656374696f6e68726573706f6e7365"
+    "667061636b657472476574496e707574466f6375735265706c79"
+    "6d726573706f6e73655f7479706501" "697265766572745f746f01" "6873657175656e636502"
+    "666c656e67746800" "65666f6375731a00400001"
+    "ab" "66636c69656e7401" "69646972656374696f6e68726573706f6e7365"
+    "667061636b6574664578706f7365" "6d726573706f6e73655f747970650c"
+    "6873657175656e636502" "6677696e646f771a00400001" "617801" "617902"
+    "65776964746803" "6668656967687404" "65636f756e7400";
+
+static void
+socket_path(char *path, size_t size, unsigned display)
+{
+    snprintf(path, size, X_SOCKET_DIR "/X%u", display);
+}
+
+/* Find a display number whose socket is not there. */
+static unsigned
+free_display(unsigned from)
+{
+    char path[64];
+
+    for (;; from++) {
+        socket_path(path, sizeof(path), from);
+        if (access(path, F_OK) < 0 && errno == ENOENT)
+            return from;
+    }
+}
+
+static int
+listen_display(unsigned display)
+{
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+    int fd;
+
+    mkdir(X_SOCKET_DIR, 01777);
+    socket_path(address.sun_path, sizeof(address.sun_path), display);
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    if (bind(fd, (struct sockaddr *) &address, sizeof(address)) < 0 || listen(fd, 4) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Reads and writes give up after a while rather than hang the test. */
+static void
+set_timeout(int fd)
+{
+    struct timeval timeout = { 5, 0 };
+
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+/* Connect to the proxy once it listens, for up to 5 seconds. */
+static int
+connect_display(unsigned display, pid_t proxy)
+{
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+
+    socket_path(address.sun_path, sizeof(address.sun_path), display);
+    for (int i = 0; i < 500; i++) {
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+        if (fd < 0)
+            return -1;
+        if (connect(fd, (struct sockaddr *) &address, sizeof(address)) == 0) {
+            set_timeout(fd);
+            return fd;
+        }
+        close(fd);
+        if (waitpid(proxy, NULL, WNOHANG) != 0)
+            return -1;
+        usleep(10000);
+    }
+    return -1;
+}
+
+static bool
+send_all(int fd, const unsigned char *data, size_t size)
+{
+    while (size > 0) {
+        ssize_t n = send(fd, data, size, MSG_NOSIGNAL);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+static bool
+recv_all(int fd, unsigned char *data, size_t size)
+{
+    while (size > 0) {
+        ssize_t n = recv(fd, data, size, 0);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+/* Read a whole file into a string, or return NULL. */
+static char *
+read_file(const char *path, size_t *size)
+{
+    FILE *file = fopen(path, "rb");
+    char *data = NULL;
+    long length;
+
+    if (!file)
+        return NULL;
+    if (fseek(file, 0, SEEK_END) == 0 && (length = ftell(file)) >= 0 &&
+        fseek(file, 0, SEEK_SET) == 0 && (data = malloc(length + 1))) {
+        *size = fread(data, 1, length, file);
+        data[*size] = '\0';
+    }
+    fclose(file);
+    return data;
+}
+
+static bool
+same_output(const char *data, size_t size, bool cbor)
+{
+    static const char digits[] = "0123456789abcdef";
+    char *hex;
+    bool same;
+
+    if (!cbor)
+        return size == strlen(expected_json) && memcmp(data, expected_json, size) == 0;
+    hex = malloc(2 * size + 1);
+    if (!hex)
+        return false;
+    for (size_t i = 0; i < size; i++) {
+        hex[2 * i] = digits[(unsigned char) data[i] >> 4];
+        hex[2 * i + 1] = digits[data[i] & 0xf];
+    }
+    hex[2 * size] = '\0';
+    same = strcmp(hex, expected_cbor) == 0;
+    if (!same)
+        fprintf(stderr, "the proxy wrote, as CBOR:\n%s\n", hex);
+    free(hex);
+    return same;
+}
+
+/*
+ * Pass a client's traffic through the proxy, as the client and the server
+ * at once: they take turns, so neither waits for the other.
+ */
+static void
+run_client(int server_fd, unsigned display, pid_t proxy)
+{
+    unsigned char got[sizeof(client_bytes) + sizeof(server_bytes)];
+    int client = connect_display(display, proxy), server = -1;
+
+    CHECK(client >= 0);
+    if (client >= 0)
+        server = accept(server_fd, NULL, NULL);
+    CHECK(server >= 0);
+    if (server >= 0) {
+        set_timeout(server);
+        CHECK(send_all(client, client_bytes, 12) &&
+              recv_all(server, got, 12) && memcmp(got, client_bytes, 12) == 0);
+        CHECK(send_all(server, server_bytes, 8) &&
+              recv_all(client, got, 8) && memcmp(got, server_bytes, 8) == 0);
+        CHECK(send_all(client, client_bytes + 12, sizeof(client_bytes) - 12) &&
+              recv_all(server, got, sizeof(client_bytes) - 12) &&
+              memcmp(got, client_bytes + 12, sizeof(client_bytes) - 12) == 0);
+        CHECK(send_all(server, server_bytes + 8, sizeof(server_bytes) - 8) &&
+              recv_all(client, got, sizeof(server_bytes) - 8) &&
+              memcmp(got, server_bytes + 8, sizeof(server_bytes) - 8) == 0);
+
+        /* The client leaving closes the server's end, once the proxy has
+         * seen everything. */
+        close(client);
+        client = -1;
+        CHECK(recv(server, got, 1, 0) == 0);
+        close(server);
+    }
+    if (client >= 0)
+        close(client);
+}
+
+/* Returns false if the test cannot be run here. */
+static bool
+check_proxy(const char *path, const char *dir, bool cbor)
+{
+    unsigned server_display = free_display(100 + getpid() % 1000);
+    unsigned proxy_display = free_display(server_display + 1);
+    char *output = protocol_path(dir, "output");
+    char proxy_name[16], server_name[16], server_path[64];
+    int server_fd = listen_display(server_display), status;
+    char *data;
+    size_t size = 0;
+    pid_t pid;
+
+    if (!output || server_fd < 0) {
+        fprintf(stderr, "cannot listen on display :%u\n", server_display);
+        free(output);
+        return false;
+    }
+    snprintf(proxy_name, sizeof(proxy_name), ":%u", proxy_display);
+    snprintf(server_name, sizeof(server_name), ":%u", server_display);
+
+    pid = fork();
+    if (pid == 0) {
+        if (cbor)
+            execl(path, path, "-c", "-o", output, proxy_name, server_name, (char *) NULL);
+        else
+            execl(path, path, "-o", output, proxy_name, server_name, (char *) NULL);
+        fprintf(stderr, "cannot run %s: %s\n", path, strerror(errno));
+        _exit(127);
+    }
+    CHECK(pid > 0);
+    if (pid > 0) {
+        run_client(server_fd, proxy_display, pid);
+        kill(pid, SIGTERM);
+        CHECK(waitpid(pid, &status, 0) == pid && WIFEXITED(status) &&
+              WEXITSTATUS(status) == EXIT_SUCCESS);
+
+        data = read_file(output, &size);
+        if (!data || !same_output(data, size, cbor)) {
+            if (data && !cbor)
+                fprintf(stderr, "the proxy wrote, as JSON:\n%s", data);
+            failures++;
+        }
+        free(data);
+    }
+
+    close(server_fd);
+    socket_path(server_path, sizeof(server_path), server_display);
+    unlink(server_path);
+    unlink(output);
+    free(output);
+    return true;
+}
+
+int
+main(int argc, char *argv[])
+{
+    const char *path = argc > 1 ? argv[1] : "./xamine-proxy";
+    char *dir = protocol_write();
+
+    if (!dir) {
+        fprintf(stderr, "failed to write the protocol description\n");
+        return EXIT_FAILURE;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    if (!check_proxy(path, dir, false) || !check_proxy(path, dir, true)) {
+        protocol_remove(dir);
+        return 77;
+    }
+
+    protocol_remove(dir);
+    if (failures)
+        fprintf(stderr, "%d checks failed\n", failures);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
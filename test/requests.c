@@ -0,0 +1,276 @@
+/*
+ * Decode requests of the description in protocol.h with every way of
+ * loading a context: requests sent as big requests, through examining,
+ * cursors, accessors and filters, a switch of values, a length too deep to
+ * compile, the layouts that cannot be decoded, which leave their requests
+ * unknown, and requests of clients of either byte order.
+ *
+ * usage: requests
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "xamine.h"
+#include "protocol.h"
+
+static int failures;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+static void
+put16(unsigned char *p, uint16_t value)
+{
+    memcpy(p, &value, sizeof(value));
+}
+
+static void
+put32(unsigned char *p, uint32_t value)
+{
+    memcpy(p, &value, sizeof(value));
+}
+
+/* Find a field among the children of a packet. */
+static const struct xamine_item *
+find(const struct xamine_item *packet, const char *name)
+{
+    for (const struct xamine_item *item = packet ? packet->child : NULL; item; item = item->next)
+        if (item->name && strcmp(item->name, name) == 0)
+            return item;
+    return NULL;
+}
+
+static size_t
+count_children(const struct xamine_item *item)
+{
+    size_t count = 0;
+
+    for (item = item ? item->child : NULL; item; item = item->next)
+        count++;
+    return count;
+}
+
+static long
+field_value(const struct xamine_item *packet, const char *name)
+{
+    const struct xamine_item *item = find(packet, name);
+
+    return item ? (long) item->u.unsigned_value : -1;
+}
+
+/*
+ * A PolyPoint of the points (1, -2) and (3, 4), followed by 4 bytes which
+ * are not part of it.  A big request has the length 0 and the real length
+ * after it.  Returns the size of the request.
+ */
+static size_t
+make_poly_point(unsigned char *p, bool big)
+{
+    size_t header = big ? 8 : 4, size = header + 16;
+
+    memset(p, 0xee, size + 4);
+    p[0] = 64;
+    p[1] = 1;
+    put16(p + 2, big ? 0 : size / 4);
+    if (big)
+        put32(p + 4, size / 4);
+    put32(p + header, 0x200001);
+    put32(p + header + 4, 0x200002);
+    put16(p + header + 8, 1);
+    put16(p + header + 10, -2);
+    put16(p + header + 12, 3);
+    put16(p + header + 14, 4);
+    return size;
+}
+
+static void
+check_poly_point(struct xamine_context *ctx, const struct xamine_conversation *conversation,
+                 bool big)
+{
+    unsigned char data[32];
+    size_t size = make_poly_point(data, big);
+    struct xamine_item *packet = xamine_examine(conversation, XAMINE_REQUEST, data, size + 4);
+    const struct xamine_item *points = find(packet, "points");
+    struct xamine_accessor *gc = xamine_accessor_new(ctx, "PolyPoint.gc");
+    struct xamine_accessor *y = xamine_accessor_new(ctx, "PolyPoint.points[1].y");
+    struct xamine_filter *filter = xamine_filter_new(ctx, "PolyPoint && PolyPoint.gc == 0x200002");
+    struct xamine_cursor cursor, field;
+    long value;
+
+    CHECK(packet);
+    CHECK(field_value(packet, "coordinate_mode") == 1);
+    CHECK(field_value(packet, "length") == (big ? 0 : 5));
+    CHECK(big ? field_value(packet, "big_length") == 6 : !find(packet, "big_length"));
+    CHECK(field_value(packet, "drawable") == 0x200001);
+    CHECK(field_value(packet, "gc") == 0x200002);
+    CHECK(count_children(points) == 2);
+    xamine_item_free(packet);
+
+    CHECK(gc && xamine_accessor_get(gc, conversation, XAMINE_REQUEST, data, size, &value) == 0 &&
+          value == 0x200002);
+    CHECK(y && xamine_accessor_get(y, conversation, XAMINE_REQUEST, data, size, &value) == 0 &&
+          value == 4);
+    CHECK(filter && xamine_filter_match(filter, conversation, XAMINE_REQUEST, data, size));
+    CHECK(xamine_cursor_init(&cursor, conversation, XAMINE_REQUEST, data, size) == 0 &&
+          xamine_cursor_field(&cursor, "gc", &field) == 0 &&
+          xamine_cursor_value(&field, &value) == 0 && value == 0x200002);
+    xamine_accessor_free(gc);
+    xamine_accessor_free(y);
+    xamine_filter_free(filter);
+
+    /* Too short to hold the length of a big request. */
+    if (big)
+        CHECK(!xamine_examine(conversation, XAMINE_REQUEST, data, 6));
+}
+
+static void
+check_requests(struct xamine_context *ctx)
+{
+    struct xamine_conversation *conversation;
+    unsigned char data[32];
+    struct xamine_item *packet;
+    const struct xamine_item *item;
+    struct xamine_cursor cursor, field;
+    struct xamine_buffer buffer = { 0 };
+
+    conversation = xamine_conversation_new(ctx, XAMINE_CONVERSATION_NO_SETUP);
+    CHECK(conversation);
+    if (!conversation)
+        return;
+
+    check_poly_point(ctx, conversation, false);
+    check_poly_point(ctx, conversation, true);
+
+    /* A value for each of the two bits of the mask. */
+    memset(data, 0, sizeof(data));
+    data[0] = 2;
+    put16(data + 2, 5);
+    put32(data + 4, 0x200001);
+    put32(data + 8, 3);
+    put32(data + 12, 0x400001);
+    put32(data + 16, 0xff0000);
+    packet = xamine_examine(conversation, XAMINE_REQUEST, data, 20);
+    item = find(packet, "value_list");
+    CHECK(field_value(packet, "value_mask") == 3);
+    CHECK(item && item->count == 2 && item->element_size == 4 &&
+          ((const uint32_t *) item->u.array)[1] == 0xff0000);
+    xamine_item_free(packet);
+
+    /* Nothing follows the alignment pad at the end. */
+    memset(data, 0, sizeof(data));
+    data[0] = 120;
+    put16(data + 2, 3);
+    put16(data + 4, 3);
+    memcpy(data + 8, "abc", 3);
+    packet = xamine_examine(conversation, XAMINE_REQUEST, data, 12);
+    item = find(packet, "bytes");
+    CHECK(item && item->count == 3);
+    xamine_item_free(packet);
+
+    /* The same as a big request, whose count is a field further on. */
+    memset(data, 0, sizeof(data));
+    data[0] = 120;
+    put32(data + 4, 4);
+    put16(data + 8, 3);
+    memcpy(data + 12, "abc", 3);
+    packet = xamine_examine(conversation, XAMINE_REQUEST, data, 16);
+    item = find(packet, "bytes");
+    CHECK(item && item->count == 3);
+    xamine_item_free(packet);
+    CHECK(xamine_cursor_init(&cursor, conversation, XAMINE_REQUEST, data, 16) == 0 &&
+          xamine_cursor_field(&cursor, "bytes", &field) == 0 &&
+          xamine_cursor_count(&field) == 3);
+
+    /* A request with no decode program, which is walked instead. */
+    memset(data, 0, sizeof(data));
+    data[0] = 124;
+    put16(data + 2, 3);
+    put16(data + 4, 3);
+    memcpy(data + 8, "abc", 3);
+    packet = xamine_examine(conversation, XAMINE_REQUEST, data, 12);
+    item = find(packet, "bytes");
+    CHECK(item && item->count == 3);
+    xamine_item_free(packet);
+    CHECK(xamine_write(conversation, XAMINE_REQUEST, data, 12, XAMINE_FORMAT_JSON,
+                       &buffer) == 0 && buffer.size > 0);
+    free(buffer.data);
+
+    /* An alignment pad before other fields, and a switch of cases. */
+    data[0] = 121;
+    put16(data + 2, 4);
+    CHECK(!xamine_examine(conversation, XAMINE_REQUEST, data, 16));
+    data[0] = 122;
+    put16(data + 2, 3);
+    CHECK(!xamine_examine(conversation, XAMINE_REQUEST, data, 12));
+
+    xamine_conversation_unref(conversation);
+}
+
+/* Clients of either byte order, given without the connection setup. */
+static void
+check_byte_orders(struct xamine_context *ctx)
+{
+    static const enum xamine_conversation_flags orders[] = {
+        XAMINE_CONVERSATION_LSB_FIRST, XAMINE_CONVERSATION_MSB_FIRST
+    };
+
+    for (size_t i = 0; i < sizeof(orders) / sizeof(*orders); i++) {
+        bool is_le = orders[i] == XAMINE_CONVERSATION_LSB_FIRST;
+        unsigned char data[8] = { 8, 0, is_le ? 2 : 0, is_le ? 0 : 2 };
+        struct xamine_conversation *conversation;
+        struct xamine_item *packet;
+
+        for (int j = 0; j < 4; j++)
+            data[4 + (is_le ? j : 3 - j)] = 0x04030201 >> (8 * j);
+        conversation = xamine_conversation_new(ctx, XAMINE_CONVERSATION_NO_SETUP | orders[i]);
+        packet = xamine_examine(conversation, XAMINE_REQUEST, data, sizeof(data));
+        CHECK(field_value(packet, "window") == 0x04030201);
+        xamine_item_free(packet);
+        xamine_conversation_unref(conversation);
+    }
+    CHECK(!xamine_conversation_new(ctx, XAMINE_CONVERSATION_LSB_FIRST |
+                                        XAMINE_CONVERSATION_MSB_FIRST));
+}
+
+int
+main(void)
+{
+    /* The first default context writes the cache, and the second reads it. */
+    static const enum xamine_context_flags modes[] = {
+        XAMINE_CONTEXT_NO_CACHE,
+        XAMINE_CONTEXT_NO_CACHE | XAMINE_CONTEXT_NO_COMPILE,
+        XAMINE_CONTEXT_LAZY,
+        XAMINE_CONTEXT_NO_FLAGS,
+        XAMINE_CONTEXT_NO_FLAGS,
+    };
+    char *dir = protocol_write();
+
+    if (!dir) {
+        fprintf(stderr, "failed to write the protocol description\n");
+        return EXIT_FAILURE;
+    }
+
+    for (size_t i = 0; i < sizeof(modes) / sizeof(*modes); i++) {
+        struct xamine_context *ctx = xamine_context_new(modes[i]);
+
+        CHECK(ctx);
+        if (!ctx)
+            continue;
+        check_requests(ctx);
+        check_byte_orders(ctx);
+        xamine_context_unref(ctx);
+    }
+
+    protocol_remove(dir);
+    if (failures)
+        fprintf(stderr, "%d checks failed\n", failures);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
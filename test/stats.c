@@ -0,0 +1,255 @@
+/*
+ * Check the statistics of conversations on the description in protocol.h,
+ * examining and writing packets, compiled and walked: known packets,
+ * truncated ones, which fail, ones of unknown codes, ones the filter
+ * rejects, which count only as packets and bytes, and replies, which are
+ * known only for the requests fed before them.  Every counter of every
+ * code must be as expected, and the decode times must count the packets
+ * decoded or failed.
+ *
+ * usage: stats
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "xamine.h"
+#include "protocol.h"
+
+static int failures;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+/* How the packets are handled. */
+enum method {
+    EXAMINE,
+    WRITE
+};
+
+/* A packet, the direction it goes in, and whether it is examined. */
+struct packet {
+    enum xamine_direction direction;
+    unsigned char data[32];
+    size_t size;
+    int ret;
+};
+
+static void
+put16(unsigned char *p, uint16_t value)
+{
+    memcpy(p, &value, sizeof(value));
+}
+
+static void
+put32(unsigned char *p, uint32_t value)
+{
+    memcpy(p, &value, sizeof(value));
+}
+
+static int
+handle(struct xamine_conversation *conversation, enum method method,
+       enum xamine_direction direction, const void *data, size_t size)
+{
+    struct xamine_buffer buffer = { 0 };
+    struct xamine_item *item;
+    int ret;
+
+    if (method == WRITE) {
+        ret = xamine_write(conversation, direction, data, size, XAMINE_FORMAT_JSON, &buffer);
+        free(buffer.data);
+        return ret;
+    }
+    item = xamine_examine(conversation, direction, data, size);
+    xamine_item_free(item);
+    return item ? 0 : -1;
+}
+
+static void
+handle_fed(struct xamine_conversation *conversation, enum xamine_direction direction,
+           const void *data, size_t size, void *closure)
+{
+    handle(conversation, *(const enum method *) closure, direction, data, size);
+}
+
+/* InternAtom of a name of name_len bytes, of which the request holds "abc". */
+static struct packet
+intern_atom(uint16_t name_len)
+{
+    struct packet p = { XAMINE_REQUEST, { 16 }, 12, name_len <= 3 ? 0 : -1 };
+
+    put16(p.data + 2, 3);
+    put16(p.data + 4, name_len);
+    memcpy(p.data + 8, "abc", 3);
+    return p;
+}
+
+static struct packet
+response(unsigned char code, unsigned char detail, int ret)
+{
+    struct packet p = { XAMINE_RESPONSE, { code, detail }, 32, ret };
+
+    return p;
+}
+
+static void
+check_counts(const char *what, unsigned code, const struct xamine_stats_counts *counts,
+             uint64_t packets, uint64_t bytes, uint64_t failed, uint64_t unknown)
+{
+    if (counts->packets == packets && counts->bytes == bytes &&
+        counts->failures == failed && counts->unknown == unknown)
+        return;
+    fprintf(stderr, "%s %u: %llu packets, %llu bytes, %llu failures, %llu unknown; "
+            "expected %llu, %llu, %llu, %llu\n", what, code,
+            (unsigned long long) counts->packets, (unsigned long long) counts->bytes,
+            (unsigned long long) counts->failures, (unsigned long long) counts->unknown,
+            (unsigned long long) packets, (unsigned long long) bytes,
+            (unsigned long long) failed, (unsigned long long) unknown);
+    failures++;
+}
+
+static void
+check_stats(struct xamine_context *ctx, enum method method)
+{
+    struct xamine_filter *filter = xamine_filter_new(ctx, "!Expose");
+    struct xamine_conversation *conversation;
+    struct xamine_stats stats;
+    struct packet packets[11], *p = packets, reply;
+    uint64_t timed = 0;
+
+    conversation = xamine_conversation_new(ctx, XAMINE_CONVERSATION_NO_SETUP |
+                                                XAMINE_CONVERSATION_STATS);
+    CHECK(conversation && filter);
+    if (!conversation || !filter) {
+        xamine_conversation_unref(conversation);
+        xamine_filter_free(filter);
+        return;
+    }
+    xamine_conversation_set_filter(conversation, filter);
+
+    /* Known requests, one truncated, and one of an unknown opcode. */
+    *p++ = intern_atom(3);
+    *p++ = intern_atom(3);
+    *p++ = intern_atom(20);
+    *p = (struct packet) { XAMINE_REQUEST, { 200 }, 4, -1 };
+    put16(p++->data + 2, 1);
+
+    /* KeyPress, sent or not, Expose, which the filter rejects, and an
+     * event of an unknown code. */
+    *p++ = response(2, 9, 0);
+    *p++ = response(2 | 0x80, 9, 0);
+    *p++ = response(12, 0, -1);
+    *p++ = response(12, 0, -1);
+    *p++ = response(100, 0, -1);
+
+    /* A Value error, and an error of an unknown code. */
+    *p++ = response(0, 2, 0);
+    *p++ = response(0, 200, -1);
+
+    for (const struct packet *q = packets; q < p; q++)
+        CHECK(handle(conversation, method, q->direction, q->data, q->size) == q->ret);
+
+    /* A reply to a request fed to the conversation, and one to a request
+     * never sent. */
+    xamine_conversation_set_packet_func(conversation, handle_fed, &method);
+    reply = intern_atom(3);
+    CHECK(xamine_conversation_feed(conversation, XAMINE_REQUEST, reply.data, reply.size) == 0);
+    reply = response(1, 0, 0);
+    put16(reply.data + 2, 1);
+    put32(reply.data + 8, 39);
+    CHECK(xamine_conversation_feed(conversation, XAMINE_RESPONSE, reply.data, reply.size) == 0);
+    put16(reply.data + 2, 9);
+    CHECK(xamine_conversation_feed(conversation, XAMINE_RESPONSE, reply.data, reply.size) == 0);
+
+    CHECK(xamine_conversation_get_stats(conversation, &stats) == 0);
+    for (unsigned i = 0; i < 256; i++) {
+        switch (i) {
+        case 16:
+            check_counts("request", i, &stats.requests[i], 4, 48, 1, 0);
+            break;
+        case 200:
+            check_counts("request", i, &stats.requests[i], 1, 4, 0, 1);
+            break;
+        default:
+            check_counts("request", i, &stats.requests[i], 0, 0, 0, 0);
+            break;
+        }
+    }
+    for (unsigned i = 0; i < 128; i++) {
+        switch (i) {
+        case 2:
+            check_counts("event", i, &stats.events[i], 2, 64, 0, 0);
+            break;
+        case 12:
+            check_counts("event", i, &stats.events[i], 2, 64, 0, 0);
+            break;
+        case 100:
+            check_counts("event", i, &stats.events[i], 1, 32, 0, 1);
+            break;
+        default:
+            check_counts("event", i, &stats.events[i], 0, 0, 0, 0);
+            break;
+        }
+    }
+    for (unsigned i = 0; i < 256; i++) {
+        switch (i) {
+        case 2:
+            check_counts("error", i, &stats.errors[i], 1, 32, 0, 0);
+            break;
+        case 200:
+            check_counts("error", i, &stats.errors[i], 1, 32, 0, 1);
+            break;
+        default:
+            check_counts("error", i, &stats.errors[i], 0, 0, 0, 0);
+            break;
+        }
+    }
+    check_counts("replies", 1, &stats.replies, 2, 64, 0, 1);
+
+    /* The decoded and failed packets: four InternAtom, two KeyPress, a
+     * Value error and a reply. */
+    for (int i = 0; i < XAMINE_STATS_LATENCY_BUCKETS; i++)
+        timed += stats.latency[i];
+    CHECK(timed == 8);
+
+    xamine_conversation_unref(conversation);
+    xamine_filter_free(filter);
+}
+
+int
+main(void)
+{
+    static const enum xamine_context_flags modes[] = {
+        XAMINE_CONTEXT_NO_CACHE,
+        XAMINE_CONTEXT_NO_CACHE | XAMINE_CONTEXT_NO_COMPILE,
+    };
+    char *dir = protocol_write();
+
+    if (!dir) {
+        fprintf(stderr, "failed to write the protocol description\n");
+        return EXIT_FAILURE;
+    }
+
+    for (size_t i = 0; i < sizeof(modes) / sizeof(*modes); i++) {
+        struct xamine_context *ctx = xamine_context_new(modes[i]);
+
+        CHECK(ctx);
+        if (!ctx)
+            continue;
+        check_stats(ctx, EXAMINE);
+        check_stats(ctx, WRITE);
+        xamine_context_unref(ctx);
+    }
+
+    protocol_remove(dir);
+    if (failures)
+        fprintf(stderr, "%d checks failed\n", failures);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
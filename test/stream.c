@@ -0,0 +1,486 @@
+/*
+ * Feed conversations with both streams of a connection, split into chunks
+ * of one byte and of random sizes, from clients of each byte order, and
+ * check the packets passed to the packet function and what they are
+ * examined as.  The connection starts with the setup, sends a big request,
+ * looks up an extension with QueryExtension and uses it, gets its events,
+ * including those sent in GenericEvent by event type, gets replies
+ * after the sequence number has wrapped around, sends more requests than
+ * there are replies remembered for, and gets replies after later replies
+ * and after errors, whose requests they no longer answer.
+ *
+ * usage: stream
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "xamine.h"
+#include "protocol.h"
+
+/* Enough requests for the 16-bit sequence numbers to wrap around. */
+#define WRAP_REQUESTS 65546
+
+/* More requests waiting for replies than the conversation remembers. */
+#define PENDING_REPLIES 256
+#define OUTSTANDING_REQUESTS 300
+
+#define SHAPE_OPCODE 130
+#define SHAPE_EVENT 90
+#define SHAPE_ERROR 150
+
+#define GENERIC_EVENT 35
+
+struct expected {
+    enum xamine_direction direction;
+    size_t size;
+    const char *name;       /* NULL if it cannot be examined */
+};
+
+/* Packets fed in one go, in one direction. */
+struct step {
+    enum xamine_direction direction;
+    size_t start;
+};
+
+struct script {
+    bool is_le;
+    unsigned char *data[2];     /* By direction */
+    size_t size[2], alloc[2];
+    struct step *steps;
+    size_t nsteps, steps_alloc;
+    struct expected *expected;
+    size_t nexpected, expected_alloc;
+    unsigned char packet[64];   /* Being built */
+    size_t packet_size;
+};
+
+/* What the packet function saw. */
+struct log {
+    struct expected *packets;
+    size_t npackets, alloc;
+    bool failed;
+};
+
+static void *
+grow(void *array, size_t *alloc, size_t needed, size_t size)
+{
+    void *grown;
+
+    if (needed <= *alloc)
+        return array;
+    *alloc = *alloc ? 2 * *alloc : 64;
+    if (*alloc < needed)
+        *alloc = needed;
+    grown = realloc(array, *alloc * size);
+    if (!grown) {
+        fprintf(stderr, "out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    return grown;
+}
+
+static void
+put8(struct script *s, unsigned value)
+{
+    s->packet[s->packet_size++] = value;
+}
+
+static void
+put16(struct script *s, unsigned value)
+{
+    for (int i = 0; i < 2; i++)
+        s->packet[s->packet_size + (s->is_le ? i : 1 - i)] = value >> (8 * i);
+    s->packet_size += 2;
+}
+
+static void
+put32(struct script *s, unsigned long value)
+{
+    for (int i = 0; i < 4; i++)
+        s->packet[s->packet_size + (s->is_le ? i : 3 - i)] = value >> (8 * i);
+    s->packet_size += 4;
+}
+
+static void
+put_bytes(struct script *s, const void *bytes, size_t size)
+{
+    memcpy(s->packet + s->packet_size, bytes, size);
+    s->packet_size += size;
+}
+
+/* Pad the packet being built to its size, which must be a multiple of 4. */
+static void
+pad_to(struct script *s, size_t size)
+{
+    memset(s->packet + s->packet_size, 0, size - s->packet_size);
+    s->packet_size = size;
+}
+
+/*
+ * Add the packet built to its stream, expecting it to be passed on and
+ * examined as name.  The setups are not passed on.
+ */
+static void
+add(struct script *s, enum xamine_direction direction, bool is_setup, const char *name)
+{
+    if (s->nsteps == 0 || s->steps[s->nsteps - 1].direction != direction) {
+        s->steps = grow(s->steps, &s->steps_alloc, s->nsteps + 1, sizeof(*s->steps));
+        s->steps[s->nsteps++] = (struct step) { direction, s->size[direction] };
+    }
+    s->data[direction] = grow(s->data[direction], &s->alloc[direction],
+                              s->size[direction] + s->packet_size, 1);
+    memcpy(s->data[direction] + s->size[direction], s->packet, s->packet_size);
+    s->size[direction] += s->packet_size;
+    if (!is_setup) {
+        s->expected = grow(s->expected, &s->expected_alloc, s->nexpected + 1,
+                           sizeof(*s->expected));
+        s->expected[s->nexpected++] = (struct expected) { direction, s->packet_size, name };
+    }
+    s->packet_size = 0;
+}
+
+/* A response to request number sequence, with 32 bytes and extra words. */
+static void
+begin_response(struct script *s, unsigned code, unsigned detail, unsigned long sequence,
+               unsigned long extra)
+{
+    put8(s, code);
+    put8(s, detail);
+    put16(s, sequence & 0xffff);
+    if (code == 1 || code == GENERIC_EVENT)
+        put32(s, extra);
+}
+
+static void
+end_response(struct script *s, unsigned long extra)
+{
+    pad_to(s, 32 + 4 * extra);
+}
+
+static void
+put_intern_atom(struct script *s)
+{
+    put8(s, 16);
+    put8(s, 0);
+    put16(s, 4);
+    put16(s, 7);
+    put16(s, 0);
+    put_bytes(s, "WM_NAME", 7);
+    pad_to(s, 16);
+    add(s, XAMINE_REQUEST, false, "InternAtom");
+}
+
+static void
+build_script(struct script *s)
+{
+    static const char auth_name[] = "MIT-MAGIC-COOKIE-1";
+    unsigned long sequence = 0;
+
+    /* Connection setups: the client's with authorization, the server's
+     * with 8 bytes of its reply. */
+    put8(s, s->is_le ? 'l' : 'B');
+    put8(s, 0);
+    put16(s, 11);
+    put16(s, 0);
+    put16(s, sizeof(auth_name) - 1);
+    put16(s, 16);
+    put16(s, 0);
+    put_bytes(s, auth_name, sizeof(auth_name) - 1);
+    pad_to(s, 12 + 20);
+    memset(s->packet + s->packet_size, 0xaa, 16);
+    s->packet_size += 16;
+    add(s, XAMINE_REQUEST, true, NULL);
+    put8(s, 1);
+    put8(s, 0);
+    put16(s, 11);
+    put16(s, 0);
+    put16(s, 2);
+    pad_to(s, 16);
+    add(s, XAMINE_RESPONSE, true, NULL);
+
+    put8(s, 8);
+    put8(s, 0);
+    put16(s, 2);
+    put32(s, 0x200001);
+    add(s, XAMINE_REQUEST, false, "MapWindow");
+    sequence++;
+
+    put8(s, 98);
+    put8(s, 0);
+    put16(s, 4);
+    put16(s, 5);
+    put16(s, 0);
+    put_bytes(s, "SHAPE", 5);
+    pad_to(s, 16);
+    add(s, XAMINE_REQUEST, false, "QueryExtension");
+    sequence++;
+
+    /* A big request of three points. */
+    put8(s, 64);
+    put8(s, 0);
+    put16(s, 0);
+    put32(s, 7);
+    put32(s, 0x200001);
+    put32(s, 0x200002);
+    for (int i = 0; i < 6; i++)
+        put16(s, i);
+    add(s, XAMINE_REQUEST, false, "PolyPoint");
+    sequence++;
+
+    /* SHAPE is at the major opcode and event and error codes given. */
+    begin_response(s, 1, 0, 2, 0);
+    put8(s, 1);
+    put8(s, SHAPE_OPCODE);
+    put8(s, SHAPE_EVENT);
+    put8(s, SHAPE_ERROR);
+    end_response(s, 0);
+    add(s, XAMINE_RESPONSE, false, "QueryExtensionReply");
+    begin_response(s, SHAPE_EVENT, 0, 2, 0);
+    end_response(s, 0);
+    add(s, XAMINE_RESPONSE, false, "ShapeNotify");
+    begin_response(s, 2, 38, 3, 0);
+    end_response(s, 0);
+    add(s, XAMINE_RESPONSE, false, "KeyPress");
+    begin_response(s, 0, 2, 3, 0);
+    end_response(s, 0);
+    add(s, XAMINE_RESPONSE, false, "Value");
+
+    /* SHAPE's events sent in GenericEvent are told apart by event type,
+     * and do not take event codes; GenericEvent of other event types and
+     * extensions is examined as such. */
+    begin_response(s, GENERIC_EVENT, SHAPE_OPCODE, 3, 2);
+    put16(s, 1);
+    put32(s, 0x200001);
+    put16(s, 1);
+    pad_to(s, 32);
+    for (int i = 0; i < 4; i++)
+        put16(s, i + 1);
+    end_response(s, 2);
+    add(s, XAMINE_RESPONSE, false, "ShapeChanged");
+    begin_response(s, GENERIC_EVENT, SHAPE_OPCODE, 3, 0);
+    put16(s, 2);
+    end_response(s, 0);
+    add(s, XAMINE_RESPONSE, false, "ShapeCopied");
+    begin_response(s, GENERIC_EVENT, SHAPE_OPCODE, 3, 0);
+    put16(s, 7);
+    end_response(s, 0);
+    add(s, XAMINE_RESPONSE, false, "GeGeneric");
+    begin_response(s, GENERIC_EVENT, SHAPE_OPCODE + 1, 3, 0);
+    put16(s, 1);
+    end_response(s, 0);
+    add(s, XAMINE_RESPONSE, false, "GeGeneric");
+    for (int i = 1; i <= 2; i++) {
+        begin_response(s, SHAPE_EVENT + i, 0, 3, 0);
+        end_response(s, 0);
+        add(s, XAMINE_RESPONSE, false, NULL);
+    }
+
+    put8(s, SHAPE_OPCODE);
+    put8(s, 1);
+    put16(s, 6);
+    put8(s, 0);
+    put8(s, 0);
+    put8(s, 0);
+    put8(s, 0);
+    put32(s, 0x200001);
+    put16(s, 0);
+    put16(s, 0);
+    put16(s, 1);
+    put16(s, 2);
+    put16(s, 3);
+    put16(s, 4);
+    add(s, XAMINE_REQUEST, false, "ShapeRectangles");
+    sequence++;
+
+    for (unsigned long i = 0; i < WRAP_REQUESTS; i++) {
+        put8(s, 43);
+        put8(s, 0);
+        put16(s, 1);
+        add(s, XAMINE_REQUEST, false, "GetInputFocus");
+        sequence++;
+    }
+
+    put_intern_atom(s);
+    sequence++;
+    put8(s, 43);
+    put8(s, 0);
+    put16(s, 1);
+    add(s, XAMINE_REQUEST, false, "GetInputFocus");
+    sequence++;
+
+    /* Replies to the last two requests, one with extra data, and one to
+     * a request not sent yet. */
+    begin_response(s, 1, 0, sequence - 1, 0);
+    put32(s, 39);
+    end_response(s, 0);
+    add(s, XAMINE_RESPONSE, false, "InternAtomReply");
+    begin_response(s, 1, 2, sequence, 1);
+    put32(s, 0x200001);
+    end_response(s, 1);
+    add(s, XAMINE_RESPONSE, false, "GetInputFocusReply");
+    begin_response(s, 1, 0, sequence + 1, 0);
+    end_response(s, 0);
+    add(s, XAMINE_RESPONSE, false, NULL);
+    begin_response(s, 12, 0, sequence, 0);
+    end_response(s, 0);
+    add(s, XAMINE_RESPONSE, false, "Expose");
+
+    /* More requests waiting for replies than the ring of pending replies
+     * holds: the oldest have been overwritten when their replies come. */
+    for (unsigned long i = 0; i < OUTSTANDING_REQUESTS; i++) {
+        put_intern_atom(s);
+        sequence++;
+    }
+    for (unsigned long i = 0; i < OUTSTANDING_REQUESTS; i++) {
+        begin_response(s, 1, 0, sequence - OUTSTANDING_REQUESTS + 1 + i, 0);
+        end_response(s, 0);
+        add(s, XAMINE_RESPONSE, false,
+            OUTSTANDING_REQUESTS - i > PENDING_REPLIES ? NULL : "InternAtomReply");
+    }
+
+    /* A request may have more than one reply, but a reply retires the
+     * requests before its own. */
+    begin_response(s, 1, 0, sequence, 0);
+    end_response(s, 0);
+    add(s, XAMINE_RESPONSE, false, "InternAtomReply");
+    begin_response(s, 1, 0, sequence - 1, 0);
+    end_response(s, 0);
+    add(s, XAMINE_RESPONSE, false, NULL);
+
+    /* An error retires its own request too. */
+    put_intern_atom(s);
+    sequence++;
+    begin_response(s, 0, 2, sequence, 0);
+    end_response(s, 0);
+    add(s, XAMINE_RESPONSE, false, "Value");
+    begin_response(s, 1, 0, sequence, 0);
+    end_response(s, 0);
+    add(s, XAMINE_RESPONSE, false, NULL);
+}
+
+static void
+record(struct xamine_conversation *conversation, enum xamine_direction direction,
+       const void *data, size_t size, void *closure)
+{
+    struct log *log = closure;
+    struct xamine_item *item = xamine_examine(conversation, direction, data, size);
+    struct expected *packet;
+
+    log->packets = grow(log->packets, &log->alloc, log->npackets + 1, sizeof(*log->packets));
+    packet = &log->packets[log->npackets++];
+    packet->direction = direction;
+    packet->size = size;
+    packet->name = item && item->definition ? item->definition->name : NULL;
+    xamine_item_free(item);
+}
+
+/* Feed the script in chunks of at most max_chunk bytes, at random. */
+static int
+run(struct xamine_context *ctx, const struct script *s, size_t max_chunk, unsigned *seed)
+{
+    struct xamine_conversation *conversation;
+    struct log log = { 0 };
+    int failures = 0;
+
+    conversation = xamine_conversation_new(ctx, XAMINE_CONVERSATION_NO_FLAGS);
+    if (!conversation)
+        return 1;
+    xamine_conversation_set_packet_func(conversation, record, &log);
+
+    for (size_t i = 0; i < s->nsteps; i++) {
+        enum xamine_direction direction = s->steps[i].direction;
+        size_t offset = s->steps[i].start, end = s->size[direction];
+
+        for (size_t j = i + 1; j < s->nsteps; j++) {
+            if (s->steps[j].direction == direction) {
+                end = s->steps[j].start;
+                break;
+            }
+        }
+        while (offset < end) {
+            size_t chunk = max_chunk > 1 ? 1 + rand_r(seed) % max_chunk : 1;
+
+            if (chunk > end - offset)
+                chunk = end - offset;
+            if (xamine_conversation_feed(conversation, direction, s->data[direction] + offset,
+                                         chunk) < 0) {
+                fprintf(stderr, "failed to feed at %zu\n", offset);
+                failures++;
+                break;
+            }
+            offset += chunk;
+        }
+    }
+
+    if (log.npackets != s->nexpected) {
+        fprintf(stderr, "%s first, chunks up to %zu: %zu packets, expected %zu\n",
+                s->is_le ? "LSB" : "MSB", max_chunk, log.npackets, s->nexpected);
+        failures++;
+    }
+    for (size_t i = 0; i < log.npackets && i < s->nexpected; i++) {
+        const struct expected *got = &log.packets[i], *want = &s->expected[i];
+
+        if (got->direction == want->direction && got->size == want->size &&
+            (got->name && want->name ? strcmp(got->name, want->name) == 0
+                                     : got->name == want->name))
+            continue;
+        fprintf(stderr, "%s first, chunks up to %zu: packet %zu is %s %s of %zu bytes, "
+                "expected %s %s of %zu bytes\n",
+                s->is_le ? "LSB" : "MSB", max_chunk, i,
+                got->direction == XAMINE_REQUEST ? "request" : "response",
+                got->name ? got->name : "(unknown)", got->size,
+                want->direction == XAMINE_REQUEST ? "request" : "response",
+                want->name ? want->name : "(unknown)", want->size);
+        if (++failures > 10)
+            break;
+    }
+
+    free(log.packets);
+    xamine_conversation_unref(conversation);
+    return failures;
+}
+
+int
+main(void)
+{
+    static const enum xamine_context_flags modes[] = {
+        XAMINE_CONTEXT_NO_CACHE, XAMINE_CONTEXT_LAZY
+    };
+    static const size_t max_chunks[] = { 1, 13, 4096 };
+    char *dir = protocol_write();
+    unsigned seed = 1;
+    int failures = 0;
+
+    if (!dir) {
+        fprintf(stderr, "failed to write the protocol description\n");
+        return EXIT_FAILURE;
+    }
+
+    for (size_t m = 0; m < sizeof(modes) / sizeof(*modes); m++) {
+        struct xamine_context *ctx = xamine_context_new(modes[m]);
+
+        if (!ctx) {
+            fprintf(stderr, "failed to create context\n");
+            failures++;
+            continue;
+        }
+        for (int is_le = 0; is_le <= 1; is_le++) {
+            struct script s = { .is_le = is_le };
+
+            build_script(&s);
+            for (size_t i = 0; i < sizeof(max_chunks) / sizeof(*max_chunks); i++)
+                failures += run(ctx, &s, max_chunks[i], &seed);
+            free(s.data[XAMINE_REQUEST]);
+            free(s.data[XAMINE_RESPONSE]);
+            free(s.steps);
+            free(s.expected);
+        }
+        xamine_context_unref(ctx);
+    }
+
+    protocol_remove(dir);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,345 @@
+/*
+ * Share one context of the description in protocol.h among many threads,
+ * each creating conversations, feeding them a synthetic stream which
+ * queries an extension and gets one of its events, and examining its
+ * packets, while all of them also examine packets of one shared
+ * conversation and take and drop references to the context.  Every thread
+ * must get the results a single thread gets, and the statistics of the
+ * shared conversation, read while they run, must count every packet.
+ * Contexts which map the definition cache and lazy contexts, whose threads
+ * race to load the extension, are both shared.  Configure with
+ * --enable-thread-sanitizer to check for data races.
+ *
+ * usage: threads [THREADS [ROUNDS]]
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "xamine.h"
+#include "protocol.h"
+
+#define SHAPE_OPCODE 130
+#define SHAPE_EVENT 90
+#define SHAPE_ERROR 150
+
+/* The stream's replies and ShapeNotify come before the events of a round. */
+#define ROUND_REPLIES 2
+#define ROUND_EVENTS 4
+
+static const unsigned char event_codes[] = { 2, 3, 6, 12, 22, 28 };
+
+/* One round of the stream: requests, their replies and some events. */
+struct stream {
+    unsigned char *requests;
+    size_t request_size;
+    unsigned char *responses;
+    size_t response_size;
+};
+
+struct totals {
+    unsigned long packets;
+    unsigned long decoded;
+    unsigned long replies;          /* Decoded */
+    unsigned long extension_events; /* Decoded */
+    unsigned long checksum;
+};
+
+struct worker {
+    pthread_t thread;
+    unsigned seed;
+    unsigned rounds;
+    struct xamine_context *ctx;             /* The worker's own reference */
+    const struct xamine_conversation *shared;
+    const struct stream *stream;
+    const struct totals *expected;
+    int failures;
+};
+
+static void
+put16(unsigned char *p, uint16_t value)
+{
+    memcpy(p, &value, sizeof(value));
+}
+
+static unsigned long
+checksum(const struct xamine_item *item)
+{
+    unsigned long sum = 0;
+
+    /* The values of lists of numbers are summed, not their address. */
+    for (; item; item = item->next) {
+        unsigned long value = item->u.unsigned_value;
+
+        if (item->element_size)
+            value = 0;
+        for (size_t i = 0; i < item->count * item->element_size; i++)
+            value = value * 31 + ((const unsigned char *) item->u.array)[i];
+        sum = sum * 31 + item->offset + value + checksum(item->child);
+    }
+    return sum;
+}
+
+/*
+ * Sum the packets of all codes.  Unless the snapshot was taken meanwhile,
+ * the known packets each have a decode time counted.
+ */
+static uint64_t
+total_packets(const struct xamine_stats *stats, uint64_t *unknown, uint64_t *timed)
+{
+    uint64_t packets = stats->replies.packets;
+
+    *unknown = stats->replies.unknown;
+    for (int i = 0; i < 256; i++) {
+        packets += stats->requests[i].packets + stats->errors[i].packets;
+        *unknown += stats->requests[i].unknown + stats->errors[i].unknown;
+    }
+    for (int i = 0; i < 128; i++) {
+        packets += stats->events[i].packets;
+        *unknown += stats->events[i].unknown;
+    }
+    *timed = 0;
+    for (int i = 0; i < XAMINE_STATS_LATENCY_BUCKETS; i++)
+        *timed += stats->latency[i];
+    return packets;
+}
+
+static void
+count(struct xamine_conversation *conversation, enum xamine_direction direction,
+      const void *data, size_t size, void *closure)
+{
+    struct totals *totals = closure;
+    struct xamine_item *item = xamine_examine(conversation, direction, data, size);
+
+    totals->packets++;
+    if (item) {
+        totals->decoded++;
+        if (direction == XAMINE_RESPONSE && ((const unsigned char *) data)[0] == 1)
+            totals->replies++;
+        if (direction == XAMINE_RESPONSE && ((const unsigned char *) data)[0] == SHAPE_EVENT)
+            totals->extension_events++;
+        totals->checksum += checksum(item);
+    }
+    xamine_item_free(item);
+}
+
+/* Feed the stream in chunks of random sizes. */
+static void
+feed(struct xamine_conversation *conversation, enum xamine_direction direction,
+     const unsigned char *data, size_t size, unsigned *seed)
+{
+    while (size > 0) {
+        size_t chunk = 1 + rand_r(seed) % 64;
+
+        if (chunk > size)
+            chunk = size;
+        xamine_conversation_feed(conversation, direction, data, chunk);
+        data += chunk;
+        size -= chunk;
+    }
+}
+
+static void
+run_stream(struct xamine_context *ctx, const struct stream *stream, unsigned *seed,
+           struct totals *totals)
+{
+    struct xamine_conversation *conversation;
+
+    conversation = xamine_conversation_new(ctx, XAMINE_CONVERSATION_NO_SETUP);
+    xamine_conversation_set_packet_func(conversation, count, totals);
+    feed(conversation, XAMINE_REQUEST, stream->requests, stream->request_size, seed);
+    feed(conversation, XAMINE_RESPONSE, stream->responses, stream->response_size, seed);
+    xamine_conversation_unref(conversation);
+}
+
+static void *
+work(void *closure)
+{
+    struct worker *w = closure;
+    struct xamine_accessor *detail = xamine_accessor_new(w->ctx, "KeyPress.detail");
+    struct xamine_filter *filter;
+
+    filter = xamine_filter_new(w->ctx, "KeyPress || Expose || ShapeNotify");
+
+    for (unsigned round = 0; round < w->rounds; round++) {
+        struct xamine_context *ctx = xamine_context_ref(w->ctx);
+        struct totals totals = { 0 };
+        const unsigned char *event;
+        long value;
+
+        run_stream(ctx, w->stream, &w->seed, &totals);
+        if (memcmp(&totals, w->expected, sizeof(totals)) != 0)
+            w->failures++;
+
+        /* The shared conversation is only examined, never fed. */
+        event = w->stream->responses +
+                32 * (ROUND_REPLIES + 1 + rand_r(&w->seed) % ROUND_EVENTS);
+        if (detail && xamine_accessor_get(detail, w->shared, XAMINE_RESPONSE, event, 32, &value) == 0 &&
+            value != event[1])
+            w->failures++;
+        if (filter && xamine_filter_match(filter, w->shared, XAMINE_RESPONSE, event, 32) !=
+                      (event[0] == 2 || event[0] == 12))
+            w->failures++;
+        xamine_item_free(xamine_examine(w->shared, XAMINE_RESPONSE, event, 32));
+
+        xamine_context_unref(ctx);
+    }
+
+    xamine_filter_free(filter);
+    xamine_accessor_free(detail);
+    xamine_context_unref(w->ctx);
+    return NULL;
+}
+
+static void
+make_stream(struct stream *stream, unsigned *seed)
+{
+    unsigned char *p = stream->requests;
+
+    /* GetInputFocus and QueryExtension of SHAPE. */
+    memset(p, 0, stream->request_size);
+    p[0] = 43;
+    put16(p + 2, 1);
+    p[4] = 98;
+    put16(p + 6, 4);
+    put16(p + 8, 5);
+    memcpy(p + 12, "SHAPE", 5);
+
+    /* Their replies, then a ShapeNotify and events with the sequence
+     * number of the last request. */
+    p = stream->responses;
+    for (int i = 0; i <= ROUND_REPLIES + ROUND_EVENTS; i++, p += 32) {
+        for (int j = 0; j < 32; j++)
+            p[j] = rand_r(seed);
+        if (i < ROUND_REPLIES) {
+            p[0] = 1;
+            put16(p + 2, i + 1);
+            memset(p + 4, 0, 4);    /* Reply length */
+        }
+        else {
+            p[0] = i == ROUND_REPLIES ? SHAPE_EVENT
+                                      : event_codes[rand_r(seed) % sizeof(event_codes)];
+            put16(p + 2, ROUND_REPLIES);
+        }
+    }
+    p = stream->responses + 32;
+    p[8] = 1;
+    p[9] = SHAPE_OPCODE;
+    p[10] = SHAPE_EVENT;
+    p[11] = SHAPE_ERROR;
+}
+
+/*
+ * Run the workers on a context of the flags given.  The results of a
+ * single thread come from another context, so that the workers of a lazy
+ * context race to load the extension.  Returns the number of failures.
+ */
+static int
+run(enum xamine_context_flags flags, unsigned nthreads, unsigned rounds)
+{
+    unsigned char requests[20], responses[32 * (ROUND_REPLIES + 1 + ROUND_EVENTS)];
+    struct stream stream = { requests, sizeof(requests), responses, sizeof(responses) };
+    struct xamine_context *ctx;
+    struct xamine_conversation *shared;
+    struct totals expected = { 0 };
+    struct xamine_stats stats;
+    uint64_t packets, unknown, timed, last = 0;
+    struct worker *workers;
+    unsigned seed = 1;
+    int failures = 0;
+
+    make_stream(&stream, &seed);
+    ctx = xamine_context_new(flags);
+    if (!ctx) {
+        fprintf(stderr, "failed to create context\n");
+        return 1;
+    }
+    run_stream(ctx, &stream, &seed, &expected);
+    xamine_context_unref(ctx);
+    if (expected.replies != ROUND_REPLIES || expected.extension_events != 1) {
+        fprintf(stderr, "%lu of %d replies and %lu ShapeNotify decoded\n",
+                expected.replies, ROUND_REPLIES, expected.extension_events);
+        return 1;
+    }
+
+    ctx = xamine_context_new(flags);
+    shared = ctx ? xamine_conversation_new(ctx, XAMINE_CONVERSATION_NO_SETUP |
+                                                XAMINE_CONVERSATION_STATS) : NULL;
+    workers = calloc(nthreads, sizeof(*workers));
+    if (!shared || !workers) {
+        fprintf(stderr, "out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (unsigned i = 0; i < nthreads; i++) {
+        workers[i].seed = i + 1;
+        workers[i].rounds = rounds;
+        workers[i].ctx = xamine_context_ref(ctx);
+        workers[i].shared = shared;
+        workers[i].stream = &stream;
+        workers[i].expected = &expected;
+        if (pthread_create(&workers[i].thread, NULL, work, &workers[i]) != 0) {
+            fprintf(stderr, "failed to create thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    /* The shared conversation keeps the context alive for the workers. */
+    xamine_context_unref(ctx);
+
+    /* Counts only grow while the workers examine the shared conversation. */
+    for (int i = 0; i < 100; i++) {
+        xamine_conversation_get_stats(shared, &stats);
+        packets = total_packets(&stats, &unknown, &timed);
+        if (packets < last)
+            failures++;
+        last = packets;
+    }
+
+    for (unsigned i = 0; i < nthreads; i++) {
+        pthread_join(workers[i].thread, NULL);
+        failures += workers[i].failures;
+    }
+
+    /* Each worker examined one event of the shared conversation a round. */
+    if (xamine_conversation_get_stats(shared, &stats) != 0 ||
+        total_packets(&stats, &unknown, &timed) != (uint64_t) nthreads * rounds ||
+        timed != nthreads * rounds - unknown) {
+        fprintf(stderr, "statistics do not count every packet\n");
+        failures++;
+    }
+    xamine_conversation_unref(shared);
+    free(workers);
+
+    printf("%s, %u threads, %u rounds: %lu packets, %lu decoded, %d mismatched\n",
+           flags & XAMINE_CONTEXT_LAZY ? "lazy" : "cached", nthreads, rounds,
+           expected.packets, expected.decoded, failures);
+    return failures;
+}
+
+int
+main(int argc, char *argv[])
+{
+    /* The first context writes the cache, and the others map it. */
+    static const enum xamine_context_flags modes[] = {
+        XAMINE_CONTEXT_NO_FLAGS,
+        XAMINE_CONTEXT_LAZY,
+    };
+    unsigned nthreads = argc > 1 ? strtoul(argv[1], NULL, 10) : 8;
+    unsigned rounds = argc > 2 ? strtoul(argv[2], NULL, 10) : 200;
+    char *dir = protocol_write();
+    int failures = 0;
+
+    if (!dir) {
+        fprintf(stderr, "failed to write the protocol description\n");
+        return EXIT_FAILURE;
+    }
+
+    for (size_t i = 0; i < sizeof(modes) / sizeof(*modes); i++)
+        failures += run(modes[i], nthreads, rounds);
+
+    protocol_remove(dir);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
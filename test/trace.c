@@ -0,0 +1,197 @@
+/*
+ * Write a trace of pseudo-random records, read it back in order and by
+ * seeking to record numbers and times, and check that unfinished or
+ * truncated files are not read, and that a corrupt index is not followed.
+ *
+ * usage: trace [RECORDS]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "xamine.h"
+
+#define MAX_SIZE 100
+
+struct expected {
+    uint64_t time;
+    unsigned conversation;
+    enum xamine_direction direction;
+    unsigned char data[MAX_SIZE];
+    size_t size;
+};
+
+static int failures;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+static int
+same_record(const struct xamine_trace_record *record, const struct expected *e,
+            uint64_t number)
+{
+    return record->number == number &&
+           record->time == e->time &&
+           record->conversation == e->conversation &&
+           record->direction == e->direction &&
+           record->size == e->size &&
+           memcmp(record->data, e->data, e->size) == 0;
+}
+
+/* Copy the first size bytes of a file. */
+static int
+copy_file(const char *from, const char *to, long size)
+{
+    FILE *in = fopen(from, "rb"), *out = fopen(to, "wb");
+    int c;
+
+    if (!in || !out)
+        return -1;
+    while (size-- > 0 && (c = getc(in)) != EOF)
+        putc(c, out);
+    fclose(in);
+    return fclose(out);
+}
+
+int
+main(int argc, char *argv[])
+{
+    char path[] = "/tmp/xamine-trace-XXXXXX";
+    char *truncated;
+    size_t nrecords = argc > 1 ? strtoul(argv[1], NULL, 10) : 5000;
+    struct expected *expected;
+    struct xamine_trace_writer *writer;
+    struct xamine_trace *trace;
+    struct xamine_trace_record record;
+    uint64_t time = 0, number = 0;
+    long size;
+    FILE *file;
+    int fd;
+
+    fd = mkstemp(path);
+    if (fd < 0) {
+        perror("mkstemp");
+        return EXIT_FAILURE;
+    }
+    close(fd);
+    truncated = malloc(strlen(path) + 3);
+    sprintf(truncated, "%s.t", path);
+
+    expected = calloc(nrecords, sizeof(*expected));
+    if (!expected) {
+        fprintf(stderr, "out of memory\n");
+        return EXIT_FAILURE;
+    }
+
+    /* Times increase, and sometimes repeat. */
+    srand(1);
+    writer = xamine_trace_writer_new(path);
+    CHECK(writer != NULL);
+    if (!writer)
+        return EXIT_FAILURE;
+    for (size_t i = 0; i < nrecords; i++) {
+        struct expected *e = &expected[i];
+
+        time += rand() % 3;
+        e->time = time;
+        e->conversation = rand() % 16;
+        e->direction = rand() % 2 ? XAMINE_RESPONSE : XAMINE_REQUEST;
+        e->size = rand() % (MAX_SIZE + 1);
+        for (size_t j = 0; j < e->size; j++)
+            e->data[j] = rand();
+        CHECK(xamine_trace_write(writer, e->time, e->conversation, e->direction,
+                                 e->data, e->size) == 0);
+    }
+    CHECK(xamine_trace_write(writer, time + 1, 0, 2, NULL, 0) < 0);
+    if (time > 0)
+        CHECK(xamine_trace_write(writer, time - 1, 0, XAMINE_REQUEST, NULL, 0) < 0);
+
+    /* Not readable until the writer is done. */
+    CHECK(xamine_trace_open(path) == NULL);
+    CHECK(xamine_trace_writer_close(writer) == 0);
+
+    trace = xamine_trace_open(path);
+    CHECK(trace != NULL);
+    if (!trace)
+        return EXIT_FAILURE;
+    CHECK(xamine_trace_count(trace) == nrecords);
+
+    /* Read every record in order, in place. */
+    if (nrecords > 0 && xamine_trace_seek(trace, 0, &record) == 0) {
+        do {
+            CHECK(number < nrecords && same_record(&record, &expected[number], number));
+            CHECK((uintptr_t) record.data % 8 == 0);
+            number++;
+        } while (xamine_trace_next(trace, &record) == 0);
+    }
+    CHECK(number == nrecords);
+    CHECK(xamine_trace_seek(trace, nrecords, &record) < 0);
+
+    /* Seek to record numbers. */
+    for (int i = 0; i < 1000 && nrecords > 0; i++) {
+        number = rand() % nrecords;
+        CHECK(xamine_trace_seek(trace, number, &record) == 0 &&
+              same_record(&record, &expected[number], number));
+    }
+
+    /* Seek to times, including ones before and after all records. */
+    for (int i = 0; i < 1000; i++) {
+        uint64_t t = rand() % (time + 3);
+
+        for (number = 0; number < nrecords && expected[number].time < t; number++)
+            ;
+        if (number == nrecords)
+            CHECK(xamine_trace_seek_time(trace, t, &record) < 0);
+        else
+            CHECK(xamine_trace_seek_time(trace, t, &record) == 0 &&
+                  same_record(&record, &expected[number], number));
+    }
+    xamine_trace_close(trace);
+
+    /* A truncated file is not read. */
+    file = fopen(path, "rb");
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    fclose(file);
+    CHECK(copy_file(path, truncated, size - 8) == 0);
+    CHECK(xamine_trace_open(truncated) == NULL);
+
+    /* An index entry pointing past the records is not followed.  The
+     * index ends the file, and its last entry starts with the offset. */
+    if (nrecords > 0) {
+        uint64_t offset = (uint64_t) 1 << 40;
+
+        CHECK(copy_file(path, truncated, size) == 0);
+        file = fopen(truncated, "r+b");
+        CHECK(file && fseek(file, size - 16, SEEK_SET) == 0 &&
+              fwrite(&offset, sizeof(offset), 1, file) == 1);
+        if (file)
+            fclose(file);
+        trace = xamine_trace_open(truncated);
+        CHECK(trace != NULL);
+        if (trace) {
+            CHECK(xamine_trace_seek(trace, nrecords - 1, &record) < 0);
+            xamine_trace_close(trace);
+        }
+    }
+
+    unlink(truncated);
+    unlink(path);
+    free(truncated);
+    free(expected);
+
+    if (failures) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    printf("%zu records read back\n", nrecords);
+    return 0;
+}
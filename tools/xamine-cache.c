@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2004-2005 Josh Triplett
+ *
+ * This package is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ *
+ * This package is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ */
+
+/*
+ * Regenerate the definition cache from the XML-XCB descriptions on
+ * XAMINE_PATH.  With no argument the cache is written to the default
+ * location (XAMINE_CACHE, or libXamine/definitions.cache in the user's
+ * cache directory).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "xamine.h"
+
+int
+main(int argc, char *argv[])
+{
+    struct xamine_context *ctx;
+    const char *path = NULL;
+    int ret = EXIT_SUCCESS;
+
+    if (argc > 2) {
+        fprintf(stderr, "usage: %s [CACHE-FILE]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (argc == 2)
+        path = argv[1];
+
+    ctx = xamine_context_new(XAMINE_CONTEXT_NO_CACHE);
+    if (!ctx) {
+        fprintf(stderr, "%s: failed to load the protocol descriptions\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (xamine_context_write_cache(ctx, path) < 0) {
+        fprintf(stderr, "%s: failed to write the definition cache\n", argv[0]);
+        ret = EXIT_FAILURE;
+    }
+
+    xamine_context_unref(ctx);
+    return ret;
+}
@@ -0,0 +1,825 @@
+/*
+ * Copyright (C) 2004-2005 Josh Triplett
+ *
+ * This package is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ *
+ * This package is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ */
+
+/*
+ * An X11 proxy which decodes the traffic of its clients as it forwards it,
+ * like xtrace.  It listens on the socket of a display, connects each client
+ * to the real server, and writes every packet of both directions as JSON
+ * Lines or CBOR, with the number of the client and the direction added to
+ * the fields of the packet.  Packets which cannot be examined are left out.
+ *
+ * Forwarding never waits for decoding.  One epoll loop moves the bytes of
+ * all the connections, writing each chunk read straight to the other
+ * socket, and then queues a copy for a decoder thread, which feeds it to
+ * the client's conversation.  The queues hold a bounded number of bytes;
+ * when a client's queue is full, its chunk is dropped, and the client is
+ * no longer decoded, as its streams cannot be framed past the gap.
+ *
+ * The connection setup is forwarded unchanged, so clients need the real
+ * server's authorization, and a server without access control is simplest.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "xamine.h"
+
+#define CHUNK_SIZE (64 * 1024)
+#define FLUSH_SIZE (64 * 1024)
+#define DEFAULT_QUEUE_MB 16
+#define MAX_EVENTS 64
+#define X_SOCKET_DIR "/tmp/.X11-unix"
+#define X_TCP_PORT 6000
+
+struct proxy;
+
+/* The decoding side of a client, owned by its decoder thread. */
+struct session {
+    unsigned id;
+    struct decoder *decoder;
+    struct xamine_conversation *conversation;
+    bool broken[2];                 /* Indexed by enum xamine_direction */
+};
+
+/* A chunk of one direction of a session, or with no data, its end. */
+struct job {
+    struct job *next;
+    struct session *session;
+    enum xamine_direction direction;
+    size_t size;
+    unsigned char data[];
+};
+
+struct decoder {
+    struct proxy *proxy;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct job *first;
+    struct job **last;
+    size_t queued;                  /* Bytes of data in the queue */
+    bool done;
+    struct xamine_buffer output;    /* Only used by the thread */
+};
+
+/*
+ * One socket of a connection, with the bytes read from the other socket
+ * which it could not take yet.  Reading from the other socket waits until
+ * they are written, so there are never more than a chunk of them.
+ */
+struct endpoint {
+    struct connection *connection;
+    int fd;
+    uint32_t events;                /* Registered with epoll */
+    bool eof;
+    unsigned char *pending;
+    size_t pending_start;
+    size_t pending_end;
+};
+
+struct connection {
+    struct connection *prev;
+    struct connection *next;
+    unsigned id;
+    /* The client, which requests are read from, and the server. */
+    struct endpoint ends[2];        /* Indexed by enum xamine_direction */
+    bool connecting;                /* To the server */
+    bool closed;
+    struct session *session;        /* NULL once decoding stops */
+};
+
+struct proxy {
+    const char *name;
+    struct xamine_context *ctx;
+    enum xamine_format format;
+    int output_fd;
+    pthread_mutex_t output_lock;
+
+    struct decoder *decoders;
+    unsigned decoder_count;
+    size_t queue_limit;             /* Bytes per decoder */
+
+    int epoll_fd;
+    int listen_fd;
+    char socket_path[sizeof(((struct sockaddr_un *) NULL)->sun_path)];
+    struct sockaddr_storage server;
+    socklen_t server_size;
+
+    struct connection *connections;
+    struct connection *closed;      /* Freed after each batch of events */
+    unsigned next_id;
+    unsigned char chunk[CHUNK_SIZE];
+};
+
+static volatile sig_atomic_t stopping;
+
+static void
+stop(int signum)
+{
+    (void) signum;
+    stopping = 1;
+}
+
+/* Output */
+
+/*
+ * Write a packet found in a session's conversation, with the client and the
+ * direction added in front of its fields.
+ */
+static void
+write_packet(struct xamine_conversation *conversation, enum xamine_direction direction,
+             const void *data, size_t size, void *closure)
+{
+    static const char *const directions[] = { "request", "response" };
+    struct session *session = closure;
+    const struct xamine_field fields[] = {
+        { .name = "client", .number = session->id },
+        { .name = "direction", .text = directions[direction] },
+    };
+
+    xamine_write_fields(conversation, direction, data, size, fields,
+                        sizeof(fields) / sizeof(*fields),
+                        session->decoder->proxy->format, &session->decoder->output);
+}
+
+static void
+flush_output(struct proxy *proxy, struct xamine_buffer *buffer)
+{
+    if (buffer->size == 0)
+        return;
+    pthread_mutex_lock(&proxy->output_lock);
+    /* Output which cannot be written is dropped rather than kept growing. */
+    if (xamine_buffer_flush(buffer, proxy->output_fd) < 0)
+        buffer->size = 0;
+    pthread_mutex_unlock(&proxy->output_lock);
+}
+
+/* Decoding */
+
+static void
+run_job(struct job *job)
+{
+    static const char *const streams[] = { "requests", "responses" };
+    struct session *session = job->session;
+
+    if (job->size == 0) {
+        xamine_conversation_unref(session->conversation);
+        free(session);
+        return;
+    }
+    if (xamine_conversation_feed(session->conversation, job->direction,
+                                 job->data, job->size) < 0 &&
+        !session->broken[job->direction]) {
+        session->broken[job->direction] = true;
+        fprintf(stderr, "%s: client %u: cannot frame the %s, no longer decoding them\n",
+                session->decoder->proxy->name, session->id, streams[job->direction]);
+    }
+}
+
+static void *
+decode(void *closure)
+{
+    struct decoder *decoder = closure;
+
+    pthread_mutex_lock(&decoder->lock);
+    for (;;) {
+        struct job *job;
+        bool idle;
+
+        while (!decoder->first && !decoder->done)
+            pthread_cond_wait(&decoder->cond, &decoder->lock);
+        job = decoder->first;
+        if (!job)
+            break;
+        decoder->first = job->next;
+        if (!decoder->first)
+            decoder->last = &decoder->first;
+        decoder->queued -= job->size;
+        idle = !decoder->first;
+        pthread_mutex_unlock(&decoder->lock);
+
+        run_job(job);
+        free(job);
+        if (idle || decoder->output.size >= FLUSH_SIZE)
+            flush_output(decoder->proxy, &decoder->output);
+
+        pthread_mutex_lock(&decoder->lock);
+    }
+    pthread_mutex_unlock(&decoder->lock);
+
+    flush_output(decoder->proxy, &decoder->output);
+    return NULL;
+}
+
+/*
+ * Queue a chunk for the decoder, or the end of the session if size is 0.
+ * Chunks are refused when the queue is full; the end never is.
+ */
+static bool
+queue_job(struct decoder *decoder, struct session *session,
+          enum xamine_direction direction, const unsigned char *data, size_t size)
+{
+    struct job *job = malloc(sizeof(*job) + size);
+
+    if (!job)
+        return false;
+    job->next = NULL;
+    job->session = session;
+    job->direction = direction;
+    job->size = size;
+    if (size > 0)
+        memcpy(job->data, data, size);
+
+    pthread_mutex_lock(&decoder->lock);
+    if (size > 0 && decoder->queued + size > decoder->proxy->queue_limit) {
+        pthread_mutex_unlock(&decoder->lock);
+        free(job);
+        return false;
+    }
+    *decoder->last = job;
+    decoder->last = &job->next;
+    decoder->queued += size;
+    pthread_cond_signal(&decoder->cond);
+    pthread_mutex_unlock(&decoder->lock);
+    return true;
+}
+
+static void
+end_session(struct connection *connection)
+{
+    struct session *session = connection->session;
+
+    if (!session)
+        return;
+    connection->session = NULL;
+    /* Without memory for the end, the session is leaked rather than freed
+     * while its chunks may still be queued. */
+    queue_job(session->decoder, session, XAMINE_REQUEST, NULL, 0);
+}
+
+static void
+queue_chunk(struct proxy *proxy, struct connection *connection,
+            enum xamine_direction direction, const unsigned char *data, size_t size)
+{
+    struct session *session = connection->session;
+
+    if (!session || queue_job(session->decoder, session, direction, data, size))
+        return;
+    fprintf(stderr, "%s: client %u: decoding fell behind, no longer decoding it\n",
+            proxy->name, connection->id);
+    end_session(connection);
+}
+
+static int
+start_decoders(struct proxy *proxy)
+{
+    for (unsigned i = 0; i < proxy->decoder_count; i++) {
+        struct decoder *decoder = &proxy->decoders[i];
+
+        decoder->proxy = proxy;
+        decoder->last = &decoder->first;
+        pthread_mutex_init(&decoder->lock, NULL);
+        pthread_cond_init(&decoder->cond, NULL);
+        if (pthread_create(&decoder->thread, NULL, decode, decoder) != 0) {
+            proxy->decoder_count = i;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Let the decoders finish their queues, and wait for them. */
+static void
+stop_decoders(struct proxy *proxy)
+{
+    for (unsigned i = 0; i < proxy->decoder_count; i++) {
+        struct decoder *decoder = &proxy->decoders[i];
+
+        pthread_mutex_lock(&decoder->lock);
+        decoder->done = true;
+        pthread_cond_signal(&decoder->cond);
+        pthread_mutex_unlock(&decoder->lock);
+        pthread_join(decoder->thread, NULL);
+        pthread_mutex_destroy(&decoder->lock);
+        pthread_cond_destroy(&decoder->cond);
+        free(decoder->output.data);
+    }
+}
+
+/* Forwarding */
+
+static void
+close_connection(struct proxy *proxy, struct connection *connection)
+{
+    if (connection->closed)
+        return;
+    connection->closed = true;
+    end_session(connection);
+    for (int i = 0; i < 2; i++) {
+        close(connection->ends[i].fd);
+        free(connection->ends[i].pending);
+    }
+
+    if (connection->prev)
+        connection->prev->next = connection->next;
+    else
+        proxy->connections = connection->next;
+    if (connection->next)
+        connection->next->prev = connection->prev;
+
+    /* Later events of the batch may still point to it. */
+    connection->next = proxy->closed;
+    proxy->closed = connection;
+}
+
+/*
+ * Read from a socket only while the other can take what is read, and write
+ * to it only while bytes are waiting for it.
+ */
+static int
+update_events(struct proxy *proxy, struct connection *connection)
+{
+    for (int i = 0; i < 2; i++) {
+        struct endpoint *end = &connection->ends[i];
+        struct endpoint *other = &connection->ends[!i];
+        struct epoll_event event = { .data.ptr = end };
+
+        if (!end->eof && !connection->connecting && other->pending_start == other->pending_end)
+            event.events |= EPOLLIN;
+        if (end->pending_start < end->pending_end ||
+            (i == XAMINE_RESPONSE && connection->connecting))
+            event.events |= EPOLLOUT;
+        if (event.events == end->events)
+            continue;
+        if (epoll_ctl(proxy->epoll_fd, EPOLL_CTL_MOD, end->fd, &event) < 0)
+            return -1;
+        end->events = event.events;
+    }
+    return 0;
+}
+
+/* Whether a socket call failed only because it would have blocked. */
+static bool
+would_block(int error)
+{
+#if EAGAIN != EWOULDBLOCK
+    if (error == EWOULDBLOCK)
+        return true;
+#endif
+    return error == EAGAIN;
+}
+
+/* Write as much as the socket takes.  Returns the bytes written, or -1. */
+static ssize_t
+send_some(int fd, const unsigned char *data, size_t size)
+{
+    ssize_t n;
+
+    do
+        n = send(fd, data, size, MSG_NOSIGNAL);
+    while (n < 0 && errno == EINTR);
+    if (n < 0 && would_block(errno))
+        return 0;
+    return n;
+}
+
+static int
+forward(struct proxy *proxy, struct connection *connection, enum xamine_direction direction)
+{
+    struct endpoint *from = &connection->ends[direction];
+    struct endpoint *to = &connection->ends[!direction];
+    ssize_t n, sent;
+
+    n = recv(from->fd, proxy->chunk, sizeof(proxy->chunk), 0);
+    if (n < 0)
+        return would_block(errno) || errno == EINTR ? 0 : -1;
+    if (n == 0) {
+        from->eof = true;
+        return 0;
+    }
+
+    sent = send_some(to->fd, proxy->chunk, n);
+    if (sent < 0)
+        return -1;
+    if (sent < n) {
+        if (!to->pending && !(to->pending = malloc(CHUNK_SIZE)))
+            return -1;
+        memcpy(to->pending, proxy->chunk + sent, n - sent);
+        to->pending_start = 0;
+        to->pending_end = n - sent;
+    }
+
+    /* Only once the bytes are on their way. */
+    queue_chunk(proxy, connection, direction, proxy->chunk, n);
+    return 0;
+}
+
+static int
+flush_pending(struct connection *connection, struct endpoint *end)
+{
+    ssize_t sent;
+
+    if (end == &connection->ends[XAMINE_RESPONSE] && connection->connecting) {
+        int error = 0;
+        socklen_t size = sizeof(error);
+
+        if (getsockopt(end->fd, SOL_SOCKET, SO_ERROR, &error, &size) < 0 || error)
+            return -1;
+        connection->connecting = false;
+        return 0;
+    }
+
+    sent = send_some(end->fd, end->pending + end->pending_start,
+                     end->pending_end - end->pending_start);
+    if (sent < 0)
+        return -1;
+    end->pending_start += sent;
+    if (end->pending_start == end->pending_end)
+        end->pending_start = end->pending_end = 0;
+    return 0;
+}
+
+static void
+handle_event(struct proxy *proxy, struct endpoint *end, uint32_t events)
+{
+    struct connection *connection = end->connection;
+    enum xamine_direction direction = end == &connection->ends[XAMINE_REQUEST]
+                                      ? XAMINE_REQUEST : XAMINE_RESPONSE;
+    struct endpoint *other = &connection->ends[!direction];
+
+    if (connection->closed)
+        return;
+
+    if (events & EPOLLERR) {
+        close_connection(proxy, connection);
+        return;
+    }
+    if ((events & EPOLLOUT) && flush_pending(connection, end) < 0) {
+        if (connection->connecting)
+            fprintf(stderr, "%s: client %u: failed to connect to the server\n",
+                    proxy->name, connection->id);
+        close_connection(proxy, connection);
+        return;
+    }
+    if ((events & (EPOLLIN | EPOLLHUP)) && (end->events & EPOLLIN) &&
+        forward(proxy, connection, direction) < 0) {
+        close_connection(proxy, connection);
+        return;
+    }
+
+    /* Either side closing ends the connection, once the other side has
+     * been sent what was read before. */
+    if ((end->eof && other->pending_start == other->pending_end) ||
+        (other->eof && end->pending_start == end->pending_end) ||
+        update_events(proxy, connection) < 0)
+        close_connection(proxy, connection);
+}
+
+static int
+connect_server(struct proxy *proxy, struct connection *connection)
+{
+    int fd = socket(proxy->server.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+    connection->ends[XAMINE_RESPONSE].fd = fd;
+    if (fd < 0)
+        return -1;
+    if (proxy->server.ss_family != AF_UNIX) {
+        int one = 1;
+
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    if (connect(fd, (struct sockaddr *) &proxy->server, proxy->server_size) == 0)
+        return 0;
+    if (errno != EINPROGRESS)
+        return -1;
+    connection->connecting = true;
+    return 0;
+}
+
+static void
+accept_client(struct proxy *proxy, int fd)
+{
+    struct connection *connection = calloc(1, sizeof(*connection));
+    struct session *session = calloc(1, sizeof(*session));
+
+    if (!connection || !session)
+        goto fail;
+    connection->id = ++proxy->next_id;
+    connection->ends[XAMINE_REQUEST].fd = fd;
+    connection->ends[XAMINE_RESPONSE].fd = -1;
+    if (connect_server(proxy, connection) < 0) {
+        fprintf(stderr, "%s: client %u: failed to connect to the server: %s\n",
+                proxy->name, connection->id, strerror(errno));
+        goto fail;
+    }
+
+    for (int i = 0; i < 2; i++) {
+        struct epoll_event event = { 0, { .ptr = &connection->ends[i] } };
+
+        connection->ends[i].connection = connection;
+        if (epoll_ctl(proxy->epoll_fd, EPOLL_CTL_ADD, connection->ends[i].fd, &event) < 0)
+            goto fail;
+    }
+
+    /* Clients are spread over the decoders, each fed by only one. */
+    session->id = connection->id;
+    session->decoder = &proxy->decoders[connection->id % proxy->decoder_count];
+    session->conversation = xamine_conversation_new(proxy->ctx, XAMINE_CONVERSATION_NO_FLAGS);
+    if (session->conversation) {
+        xamine_conversation_set_packet_func(session->conversation, write_packet, session);
+        connection->session = session;
+    }
+    else
+        free(session);
+
+    connection->next = proxy->connections;
+    if (proxy->connections)
+        proxy->connections->prev = connection;
+    proxy->connections = connection;
+    if (update_events(proxy, connection) < 0)
+        close_connection(proxy, connection);
+    return;
+
+fail:
+    close(fd);
+    if (connection && connection->ends[XAMINE_RESPONSE].fd >= 0)
+        close(connection->ends[XAMINE_RESPONSE].fd);
+    free(session);
+    free(connection);
+}
+
+static void
+accept_clients(struct proxy *proxy)
+{
+    int fd;
+
+    while ((fd = accept4(proxy->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+        accept_client(proxy, fd);
+}
+
+static void
+run(struct proxy *proxy)
+{
+    struct epoll_event events[MAX_EVENTS];
+
+    while (!stopping) {
+        int n = epoll_wait(proxy->epoll_fd, events, MAX_EVENTS, -1);
+
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.ptr == proxy)
+                accept_clients(proxy);
+            else
+                handle_event(proxy, events[i].data.ptr, events[i].events);
+        }
+
+        while (proxy->closed) {
+            struct connection *connection = proxy->closed;
+
+            proxy->closed = connection->next;
+            free(connection);
+        }
+    }
+
+    while (proxy->connections)
+        close_connection(proxy, proxy->connections);
+    while (proxy->closed) {
+        struct connection *connection = proxy->closed;
+
+        proxy->closed = connection->next;
+        free(connection);
+    }
+}
+
+/* Displays */
+
+/*
+ * Split a display name, [HOST]:NUMBER[.SCREEN], into the host and the
+ * display number.  Returns -1 if it is not one.
+ */
+static int
+parse_display(const char *display, char *host, size_t host_size, unsigned *number)
+{
+    const char *colon = strrchr(display, ':');
+    char *end;
+
+    if (!colon || (size_t) (colon - display) >= host_size)
+        return -1;
+    memcpy(host, display, colon - display);
+    host[colon - display] = '\0';
+    *number = strtoul(colon + 1, &end, 10);
+    if (end == colon + 1 || (*end && *end != '.'))
+        return -1;
+    return 0;
+}
+
+static int
+resolve_server(struct proxy *proxy, const char *display)
+{
+    char host[256], port[16];
+    struct addrinfo hints = { .ai_socktype = SOCK_STREAM }, *result;
+    unsigned number;
+
+    if (parse_display(display, host, sizeof(host), &number) < 0)
+        return -1;
+
+    if (!host[0] || strcmp(host, "unix") == 0) {
+        struct sockaddr_un *address = (struct sockaddr_un *) &proxy->server;
+
+        address->sun_family = AF_UNIX;
+        snprintf(address->sun_path, sizeof(address->sun_path), X_SOCKET_DIR "/X%u", number);
+        proxy->server_size = sizeof(*address);
+        return 0;
+    }
+
+    snprintf(port, sizeof(port), "%u", X_TCP_PORT + number);
+    if (getaddrinfo(host, port, &hints, &result) != 0)
+        return -1;
+    memcpy(&proxy->server, result->ai_addr, result->ai_addrlen);
+    proxy->server_size = result->ai_addrlen;
+    freeaddrinfo(result);
+    return 0;
+}
+
+/* Listen on the socket of a local display, replacing a stale one. */
+static int
+listen_display(struct proxy *proxy, const char *display)
+{
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+    char host[256];
+    unsigned number;
+    int fd;
+
+    if (parse_display(display, host, sizeof(host), &number) < 0 || host[0])
+        return -1;
+    snprintf(address.sun_path, sizeof(address.sun_path), X_SOCKET_DIR "/X%u", number);
+    mkdir(X_SOCKET_DIR, 01777);
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    if (bind(fd, (struct sockaddr *) &address, sizeof(address)) < 0) {
+        int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        bool stale = errno == EADDRINUSE && probe >= 0 &&
+                     connect(probe, (struct sockaddr *) &address, sizeof(address)) < 0 &&
+                     errno == ECONNREFUSED;
+
+        if (probe >= 0)
+            close(probe);
+        if (!stale || unlink(address.sun_path) < 0 ||
+            bind(fd, (struct sockaddr *) &address, sizeof(address)) < 0) {
+            close(fd);
+            return -1;
+        }
+    }
+    if (listen(fd, SOMAXCONN) < 0) {
+        unlink(address.sun_path);
+        close(fd);
+        return -1;
+    }
+
+    proxy->listen_fd = fd;
+    memcpy(proxy->socket_path, address.sun_path, sizeof(address.sun_path));
+    return 0;
+}
+
+static void
+usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [-c] [-o FILE] [-q MEGABYTES] [-t THREADS] DISPLAY [SERVER-DISPLAY]\n"
+            "  -c            write CBOR instead of JSON Lines\n"
+            "  -o FILE       write to FILE instead of standard output\n"
+            "  -q MEGABYTES  queue up to MEGABYTES of data to decode (default %d)\n"
+            "  -t THREADS    decode on THREADS threads (default 1)\n"
+            "The server display defaults to $DISPLAY.\n",
+            name, DEFAULT_QUEUE_MB);
+}
+
+int
+main(int argc, char *argv[])
+{
+    static struct proxy proxy;
+    struct epoll_event event = { EPOLLIN, { .ptr = &proxy } };
+    struct sigaction action = { .sa_handler = stop };
+    sigset_t signals, old_signals;
+    unsigned long queue_mb = DEFAULT_QUEUE_MB;
+    const char *output = NULL, *server;
+    int opt, ret = EXIT_FAILURE;
+
+    proxy.name = argv[0];
+    proxy.format = XAMINE_FORMAT_JSON;
+    proxy.output_fd = STDOUT_FILENO;
+    proxy.decoder_count = 1;
+    proxy.listen_fd = -1;
+    pthread_mutex_init(&proxy.output_lock, NULL);
+
+    while ((opt = getopt(argc, argv, "co:q:t:")) != -1) {
+        switch (opt) {
+        case 'c':
+            proxy.format = XAMINE_FORMAT_CBOR;
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        case 'q':
+            queue_mb = strtoul(optarg, NULL, 10);
+            break;
+        case 't':
+            proxy.decoder_count = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    server = optind + 1 < argc ? argv[optind + 1] : getenv("DISPLAY");
+    if (optind >= argc || optind + 2 < argc || proxy.decoder_count == 0 || !server) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    proxy.queue_limit = queue_mb * 1024 * 1024 / proxy.decoder_count;
+
+    if (resolve_server(&proxy, server) < 0) {
+        fprintf(stderr, "%s: cannot find server display %s\n", argv[0], server);
+        return EXIT_FAILURE;
+    }
+    if (output) {
+        proxy.output_fd = open(output, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+        if (proxy.output_fd < 0) {
+            fprintf(stderr, "%s: cannot open %s: %s\n", argv[0], output, strerror(errno));
+            return EXIT_FAILURE;
+        }
+    }
+
+    proxy.ctx = xamine_context_new(XAMINE_CONTEXT_NO_FLAGS);
+    if (!proxy.ctx) {
+        fprintf(stderr, "%s: failed to load the protocol descriptions\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (listen_display(&proxy, argv[optind]) < 0) {
+        fprintf(stderr, "%s: cannot listen on display %s\n", argv[0], argv[optind]);
+        goto out;
+    }
+
+    proxy.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (proxy.epoll_fd < 0 ||
+        epoll_ctl(proxy.epoll_fd, EPOLL_CTL_ADD, proxy.listen_fd, &event) < 0) {
+        fprintf(stderr, "%s: %s\n", argv[0], strerror(errno));
+        goto out;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    /* Only the loop takes the signals, so that they interrupt epoll_wait. */
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, &old_signals);
+    proxy.decoders = calloc(proxy.decoder_count, sizeof(*proxy.decoders));
+    if (!proxy.decoders || start_decoders(&proxy) < 0) {
+        fprintf(stderr, "%s: failed to start the decoder threads\n", argv[0]);
+        goto out;
+    }
+    pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+
+    run(&proxy);
+    ret = EXIT_SUCCESS;
+
+out:
+    if (proxy.decoders)
+        stop_decoders(&proxy);
+    free(proxy.decoders);
+    if (proxy.listen_fd >= 0) {
+        unlink(proxy.socket_path);
+        close(proxy.listen_fd);
+    }
+    xamine_context_unref(proxy.ctx);
+    return ret;
+}